@@ -3265,7 +3265,7 @@ int mod_pff_entry_serlen(const struct mod_pff_entry * pffe)
 
 	if (!pffe) return 0;
 
-	ret = sizeof(address_t) + sizeof(qos_id_t) + sizeof(uint16_t)
+	ret = sizeof(address_t) + sizeof(qos_id_t) + 2 * sizeof(uint16_t)
 			+ sizeof(uint32_t);
 
         list_for_each_entry(pos, &(pffe->port_id_altlists), next) {
@@ -3285,6 +3285,7 @@ void serialize_mod_pff_entry(void **pptr, const struct mod_pff_entry *pffe)
 	serialize_obj(*pptr, address_t, pffe->fwd_info);
 	serialize_obj(*pptr, qos_id_t, pffe->qos_id);
 	serialize_obj(*pptr, uint32_t, pffe->cost);
+	serialize_obj(*pptr, uint16_t, pffe->wildcard_bits);
 
         list_for_each_entry(pos, &(pffe->port_id_altlists), next) {
                num_alts++;
@@ -3306,6 +3307,7 @@ int deserialize_mod_pff_entry(const void **pptr, struct mod_pff_entry *pffe)
 	deserialize_obj(*pptr, address_t, &pffe->fwd_info);
 	deserialize_obj(*pptr, qos_id_t, &pffe->qos_id);
 	deserialize_obj(*pptr, uint32_t, &pffe->cost);
+	deserialize_obj(*pptr, uint16_t, &pffe->wildcard_bits);
 	deserialize_obj(*pptr, uint16_t, &num_alts);
 
 	for(i = 0; i < num_alts; i++) {
@@ -659,6 +659,11 @@ struct mod_pff_entry {
         address_t        fwd_info; /* dest_addr, neighbor_addr, circuit-id */
         qos_id_t         qos_id;
         uint32_t	 cost;
+        /*
+         * Low order bits of fwd_info ignored when matching, so that the
+         * entry covers a whole address prefix. 0 for an exact match.
+         */
+        uint16_t         wildcard_bits;
 	struct list_head port_id_altlists;
         struct list_head next;
 };
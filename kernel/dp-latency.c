@@ -0,0 +1,204 @@
+/*
+ * Datapath per-stage latency histograms
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/mutex.h>
+#include <linux/percpu.h>
+#include <linux/ktime.h>
+#include <linux/log2.h>
+
+#define RINA_PREFIX "dp-latency"
+
+#include "logs.h"
+#include "debug.h"
+#include "utils.h"
+#include "dp-latency.h"
+
+/* The tracepoints are instantiated here, once for the whole core */
+#define CREATE_TRACE_POINTS
+#include "dp-trace.h"
+
+struct dp_lat_hist {
+        u64 buckets[DP_LAT_STAGES][DP_LAT_BUCKETS];
+};
+
+struct dp_lat {
+        struct dp_lat_hist __percpu * hist;
+        struct robject                robj;
+};
+
+struct static_key dp_lat_key = STATIC_KEY_INIT_FALSE;
+EXPORT_SYMBOL(dp_lat_key);
+
+static DEFINE_MUTEX(dp_lat_mutex);
+static bool dp_lat_enabled;
+
+static int dp_lat_param_set(const char * val, const struct kernel_param * kp)
+{
+        bool enable;
+        int  ret;
+
+        ret = strtobool(val, &enable);
+        if (ret)
+                return ret;
+
+        mutex_lock(&dp_lat_mutex);
+        if (enable && !dp_lat_enabled)
+                static_key_slow_inc(&dp_lat_key);
+        else if (!enable && dp_lat_enabled)
+                static_key_slow_dec(&dp_lat_key);
+        dp_lat_enabled = enable;
+        mutex_unlock(&dp_lat_mutex);
+
+        LOG_INFO("Datapath latency histograms %s",
+                 enable ? "enabled" : "disabled");
+
+        return 0;
+}
+
+static int dp_lat_param_get(char * buf, const struct kernel_param * kp)
+{ return sprintf(buf, "%d\n", dp_lat_enabled ? 1 : 0); }
+
+static const struct kernel_param_ops dp_lat_param_ops = {
+        .set = dp_lat_param_set,
+        .get = dp_lat_param_get,
+};
+
+module_param_cb(latency_hist, &dp_lat_param_ops, NULL, 0644);
+MODULE_PARM_DESC(latency_hist, "Enable datapath latency histograms");
+
+static ssize_t dp_lat_show(struct dp_lat *   lat,
+                           enum dp_lat_stage stage,
+                           char *            buf)
+{
+        u64     sum[DP_LAT_BUCKETS];
+        ssize_t len = 0;
+        int     cpu, i;
+
+        memset(sum, 0, sizeof(sum));
+        for_each_possible_cpu(cpu) {
+                struct dp_lat_hist * h = per_cpu_ptr(lat->hist, cpu);
+
+                for (i = 0; i < DP_LAT_BUCKETS; i++)
+                        sum[i] += h->buckets[stage][i];
+        }
+
+        /* One "<upper bound in us> <count>" line per bucket */
+        for (i = 0; i < DP_LAT_BUCKETS - 1; i++)
+                len += sprintf(buf + len, "%lu %llu\n",
+                               1UL << i, sum[i]);
+        len += sprintf(buf + len, "inf %llu\n", sum[DP_LAT_BUCKETS - 1]);
+
+        return len;
+}
+
+static ssize_t dp_lat_attr_show(struct robject *        robj,
+                                struct robj_attribute * attr,
+                                char *                  buf)
+{
+        struct dp_lat * lat;
+
+        lat = container_of(robj, struct dp_lat, robj);
+        if (!lat || !lat->hist)
+                return 0;
+
+        if (strcmp(robject_attr_name(attr), "tx_efcp") == 0)
+                return dp_lat_show(lat, DP_LAT_TX_EFCP, buf);
+        if (strcmp(robject_attr_name(attr), "tx_dtp") == 0)
+                return dp_lat_show(lat, DP_LAT_TX_DTP, buf);
+        if (strcmp(robject_attr_name(attr), "tx_rmt") == 0)
+                return dp_lat_show(lat, DP_LAT_TX_RMT, buf);
+        if (strcmp(robject_attr_name(attr), "tx_n1_port") == 0)
+                return dp_lat_show(lat, DP_LAT_TX_N1_PORT, buf);
+        if (strcmp(robject_attr_name(attr), "rx_dtp") == 0)
+                return dp_lat_show(lat, DP_LAT_RX_DTP, buf);
+        if (strcmp(robject_attr_name(attr), "rx_deliver") == 0)
+                return dp_lat_show(lat, DP_LAT_RX_DELIVER, buf);
+
+        return 0;
+}
+RINA_SYSFS_OPS(dp_lat);
+RINA_ATTRS(dp_lat, tx_efcp, tx_dtp, tx_rmt, tx_n1_port, rx_dtp, rx_deliver);
+RINA_KTYPE(dp_lat);
+
+struct dp_lat * dp_lat_create(struct robject * parent)
+{
+        struct dp_lat * tmp;
+
+        tmp = rkzalloc(sizeof(*tmp), GFP_KERNEL);
+        if (!tmp)
+                return NULL;
+
+        tmp->hist = alloc_percpu(struct dp_lat_hist);
+        if (!tmp->hist) {
+                rkfree(tmp);
+                return NULL;
+        }
+
+        if (robject_init_and_add(&tmp->robj, &dp_lat_rtype, parent,
+                                 "latency")) {
+                LOG_ERR("Failed to create latency sysfs entry");
+                free_percpu(tmp->hist);
+                rkfree(tmp);
+                return NULL;
+        }
+
+        return tmp;
+}
+EXPORT_SYMBOL(dp_lat_create);
+
+void dp_lat_destroy(struct dp_lat * lat)
+{
+        if (!lat)
+                return;
+
+        robject_del(&lat->robj);
+        free_percpu(lat->hist);
+        rkfree(lat);
+}
+EXPORT_SYMBOL(dp_lat_destroy);
+
+void __dp_lat_stamp(struct du * du)
+{
+        if (du && du->skb)
+                du->skb->tstamp = ktime_get();
+}
+EXPORT_SYMBOL(__dp_lat_stamp);
+
+void __dp_lat_record(struct dp_lat *   lat,
+                     enum dp_lat_stage stage,
+                     const struct du * du)
+{
+        s64          us;
+        unsigned int bucket;
+
+        /* DUs created inside the IPCP (e.g. control PDUs) carry no stamp */
+        if (!lat || !du || !du->skb || !ktime_to_ns(du->skb->tstamp))
+                return;
+
+        us = ktime_us_delta(ktime_get(), du->skb->tstamp);
+        if (us <= 0)
+                bucket = 0;
+        else
+                bucket = min_t(unsigned int, ilog2(us) + 1,
+                               DP_LAT_BUCKETS - 1);
+
+        this_cpu_inc(lat->hist->buckets[stage][bucket]);
+}
+EXPORT_SYMBOL(__dp_lat_record);
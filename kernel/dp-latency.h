@@ -0,0 +1,85 @@
+/*
+ * Datapath per-stage latency histograms
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef RINA_DP_LATENCY_H
+#define RINA_DP_LATENCY_H
+
+#include <linux/jump_label.h>
+
+#include "du.h"
+#include "rds/robjects.h"
+
+/*
+ * A DU is timestamped (in its skb) when it enters the IPCP, at
+ * kfa_flow_du_write() on the way down and at rmt_receive() on the way up.
+ * Each stage boundary then accounts the time elapsed since the entry point,
+ * so the difference between two consecutive histograms is the latency
+ * added by that stage. PDUs relayed by the RMT keep their reception stamp,
+ * so on relaying IPCPs the tx_rmt and tx_n1_port histograms include the
+ * forwarding delay.
+ *
+ * Disabled by default, toggle with the latency_hist module parameter. While
+ * disabled the hooks are a patched-out jump.
+ */
+
+enum dp_lat_stage {
+        DP_LAT_TX_EFCP = 0,
+        DP_LAT_TX_DTP,
+        DP_LAT_TX_RMT,
+        DP_LAT_TX_N1_PORT,
+        DP_LAT_RX_DTP,
+        DP_LAT_RX_DELIVER,
+        DP_LAT_STAGES
+};
+
+/* Bucket 0 is < 1us, bucket i is [2^(i-1), 2^i) us, last one is overflow */
+#define DP_LAT_BUCKETS 24
+
+struct dp_lat;
+
+extern struct static_key dp_lat_key;
+
+struct dp_lat * dp_lat_create(struct robject * parent);
+void            dp_lat_destroy(struct dp_lat * lat);
+
+void            __dp_lat_stamp(struct du * du);
+void            __dp_lat_record(struct dp_lat *   lat,
+                                enum dp_lat_stage stage,
+                                const struct du * du);
+
+static inline void dp_lat_stamp(struct du * du)
+{
+        if (static_key_false(&dp_lat_key))
+                __dp_lat_stamp(du);
+}
+
+/* LAT is only evaluated when the histograms are enabled */
+#define dp_lat_record(LAT, STAGE, DU)                                   \
+        do {                                                            \
+                if (static_key_false(&dp_lat_key))                      \
+                        __dp_lat_record(LAT, STAGE, DU);                \
+        } while (0)
+
+/* To be called before handing the DU over to a device */
+static inline void dp_lat_clear(struct du * du)
+{
+        if (static_key_false(&dp_lat_key) && du->skb)
+                du->skb->tstamp = ktime_set(0, 0);
+}
+
+#endif
@@ -0,0 +1,118 @@
+/*
+ * Datapath tracepoints
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * One tracepoint per stage boundary of the datapath, enable them with e.g.
+ *
+ *   echo 1 > /sys/kernel/debug/tracing/events/rina/enable
+ *
+ * While disabled each tracepoint costs a patched-out jump.
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM rina
+
+#if !defined(RINA_DP_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define RINA_DP_TRACE_H
+
+#include <linux/tracepoint.h>
+
+DECLARE_EVENT_CLASS(rina_du,
+
+	TP_PROTO(int id, ssize_t len),
+
+	TP_ARGS(id, len),
+
+	TP_STRUCT__entry(
+		__field(int,     id)
+		__field(ssize_t, len)
+	),
+
+	TP_fast_assign(
+		__entry->id  = id;
+		__entry->len = len;
+	),
+
+	TP_printk("id=%d len=%zd", __entry->id, __entry->len)
+);
+
+/* id is the port-id */
+DEFINE_EVENT(rina_du, kfa_flow_du_write,
+	TP_PROTO(int id, ssize_t len),
+	TP_ARGS(id, len));
+
+/* id is the cep-id */
+DEFINE_EVENT(rina_du, efcp_container_write,
+	TP_PROTO(int id, ssize_t len),
+	TP_ARGS(id, len));
+
+/* id is the source cep-id */
+DEFINE_EVENT(rina_du, dtp_write,
+	TP_PROTO(int id, ssize_t len),
+	TP_ARGS(id, len));
+
+/* id is the N-1 port-id */
+DEFINE_EVENT(rina_du, n1_port_write,
+	TP_PROTO(int id, ssize_t len),
+	TP_ARGS(id, len));
+
+/* id is the N-1 port-id the PDU came from */
+DEFINE_EVENT(rina_du, rmt_receive,
+	TP_PROTO(int id, ssize_t len),
+	TP_ARGS(id, len));
+
+/* id is the destination cep-id */
+DEFINE_EVENT(rina_du, dtp_receive,
+	TP_PROTO(int id, ssize_t len),
+	TP_ARGS(id, len));
+
+/* id is the port-id */
+DEFINE_EVENT(rina_du, kfa_du_post,
+	TP_PROTO(int id, ssize_t len),
+	TP_ARGS(id, len));
+
+TRACE_EVENT(rmt_send,
+
+	TP_PROTO(u32 dst, u32 qos_id, ssize_t len),
+
+	TP_ARGS(dst, qos_id, len),
+
+	TP_STRUCT__entry(
+		__field(u32,     dst)
+		__field(u32,     qos_id)
+		__field(ssize_t, len)
+	),
+
+	TP_fast_assign(
+		__entry->dst    = dst;
+		__entry->qos_id = qos_id;
+		__entry->len    = len;
+	),
+
+	TP_printk("dst=%u qos_id=%u len=%zd",
+		  __entry->dst, __entry->qos_id, __entry->len)
+);
+
+#endif /* RINA_DP_TRACE_H */
+
+/* This part must be outside the include guard */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE dp-trace
+#include <trace/define_trace.h>
@@ -36,6 +36,8 @@ struct dtcp_flowctrl_window_params {
 struct dtcp_flowctrl_rate_params {
         unsigned int sending_rate;
         unsigned int time_period;
+        /* Spread the PDUs evenly instead of sending a time frame at once */
+        bool pacing;
 };
 
 struct dtcp_flowctrl_params {
@@ -82,6 +84,23 @@ struct dtcp_ps {
         int (* no_rate_slow_down)(struct dtcp_ps * instance);
         int (* no_override_default_peak)(struct dtcp_ps * instance);
 
+        /*
+         * Congestion control hooks, sender side, all optional. They run
+         * under RCU without the sv lock held, and drive the sender through
+         * dtcp_cc_cwnd_set() and dtcp_cc_pacing_rate_set(). They need
+         * rtx control (for the ACKs) and window based flow control (for
+         * the congestion window to be enforced).
+         */
+        /* @acked PDUs cumulatively acked up to @seq, @rtt_us 0 if none */
+        void (* cc_on_ack)(struct dtcp_ps * instance,
+                           seq_num_t        seq,
+                           uint_t           acked,
+                           uint_t           rtt_us);
+        /* Retransmission timer expiry or NACK */
+        void (* cc_on_loss)(struct dtcp_ps * instance);
+        /* The peer echoed an ECN mark in an ACK (see ecn_echo) */
+        void (* cc_on_ecn)(struct dtcp_ps * instance, seq_num_t seq);
+
         /* Parametric policies. */
         bool flow_ctrl;
         struct dtcp_flowctrl_params flowctrl;
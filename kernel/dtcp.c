@@ -23,6 +23,7 @@
 #define RINA_PREFIX "dtcp"
 
 #include <linux/delay.h>
+#include <linux/percpu.h>
 
 #include "logs.h"
 #include "utils.h"
@@ -46,6 +47,7 @@ static struct policy_set_list policy_sets = {
 
 int dtcp_pdu_send(struct dtcp * dtcp, struct du * du)
 {
+        this_cpu_inc(dtcp->stats->ctrl_tx_pdus);
         return dtp_pdu_ctrl_send(dtcp->parent, du);
 }
 EXPORT_SYMBOL(dtcp_pdu_send);
@@ -119,6 +121,13 @@ static ssize_t dtcp_attr_show(struct robject *		     robj,
 	if (strcmp(robject_attr_name(attr), "rcv_rt_win_edge") == 0) {
 		return sprintf(buf, "%u\n", instance->sv->rcvr_rt_wind_edge);
 	}
+	/* Congestion control */
+	if (strcmp(robject_attr_name(attr), "snd_cwnd") == 0) {
+		return sprintf(buf, "%u\n", instance->sv->snd_cwnd);
+	}
+	if (strcmp(robject_attr_name(attr), "pacing_rate") == 0) {
+		return sprintf(buf, "%llu\n", instance->sv->pacing_rate);
+	}
 	/* Rate based */
 	if (strcmp(robject_attr_name(attr), "pdus_per_time_unit") == 0) {
 		return sprintf(buf, "%u\n", instance->sv->pdus_per_time_unit);
@@ -162,13 +171,29 @@ static ssize_t dtcp_attr_show(struct robject *		     robj,
 		return sprintf(buf, "%u\n",
 			rtxq_drop_pdus(instance->parent->rtxq));
 	}
+	if (strcmp(robject_attr_name(attr), "rtx_pdus") == 0) {
+		return sprintf(buf, "%lu\n",
+			pcpu_stats_get(instance->stats, struct dtcp_stats,
+				       rtx_pdus));
+	}
+	if (strcmp(robject_attr_name(attr), "ctrl_tx_pdus") == 0) {
+		return sprintf(buf, "%lu\n",
+			pcpu_stats_get(instance->stats, struct dtcp_stats,
+				       ctrl_tx_pdus));
+	}
+	if (strcmp(robject_attr_name(attr), "ctrl_rx_pdus") == 0) {
+		return sprintf(buf, "%lu\n",
+			pcpu_stats_get(instance->stats, struct dtcp_stats,
+				       ctrl_rx_pdus));
+	}
 	if (strcmp(robject_attr_name(attr), "ps_name") == 0) {
 		return sprintf(buf, "%s\n",instance->base.ps_factory->name);
 	}
 	return 0;
 }
 RINA_SYSFS_OPS(dtcp);
-RINA_ATTRS(dtcp, rtt, srtt, rttvar, ps_name);
+RINA_ATTRS(dtcp, rtt, srtt, rttvar, rtx_pdus, rtx_drop_pdus, ctrl_tx_pdus,
+	   ctrl_rx_pdus, ps_name);
 RINA_KTYPE(dtcp);
 
 static int push_pdus_rmt(struct dtcp * dtcp)
@@ -210,6 +235,14 @@ static int populate_ctrl_pci(struct pci *  pci,
         LWE = dtcp->parent->sv->rcv_left_window_edge;
         last_rcv_ctl_seq = dtcp->sv->last_rcv_ctl_seq;
 
+        /* Let the sender congestion control know about ECN marks */
+        if (dtcp->sv->ecn_echo && (pci_type(pci) == PDU_TYPE_ACK ||
+                                   pci_type(pci) == PDU_TYPE_ACK_AND_FC)) {
+                pci_flags_set(pci, pci_flags_get(pci) |
+                              PDU_FLAGS_EXPLICIT_CONGESTION);
+                dtcp->sv->ecn_echo = false;
+        }
+
         if (dtcp_flow_ctrl(dtcp->cfg)) {
                 if (dtcp_window_based_fctrl(dtcp->cfg)) {
                         snd_lft = dtcp->sv->snd_lft_win;
@@ -382,6 +415,8 @@ static int rcv_nack_ctl(struct dtcp * dtcp,
                 rtxq_nack(dtcp->parent->rtxq, seq_num, tr);
 		if (ps->rtt_estimator)
                 	ps->rtt_estimator(ps, pci_control_ack_seq_num(&du->pci));
+                if (ps->cc_on_loss)
+                        ps->cc_on_loss(ps);
         }
         rcu_read_unlock();
 
@@ -393,12 +428,49 @@ static int rcv_nack_ctl(struct dtcp * dtcp,
         return 0;
 }
 
+/*
+ * Feeds an ACK to the congestion control hooks, under RCU. Returns true
+ * if the congestion window may have opened.
+ */
+static bool cc_ack(struct dtcp *      dtcp,
+                   struct dtcp_ps *   ps,
+                   const struct pci * pci,
+                   uint_t             rtt_us)
+{
+        seq_num_t seq;
+        uint_t    acked;
+
+        if (!ps->cc_on_ack && !ps->cc_on_ecn)
+                return false;
+
+        seq   = pci_control_ack_seq_num(pci);
+        acked = 0;
+
+        spin_lock_bh(&dtcp->parent->sv_lock);
+        if (seq > dtcp->sv->snd_una) {
+                acked = seq - dtcp->sv->snd_una;
+                dtcp->sv->snd_una = seq;
+        }
+        spin_unlock_bh(&dtcp->parent->sv_lock);
+
+        if (ps->cc_on_ecn &&
+            (pci_flags_get(pci) & PDU_FLAGS_EXPLICIT_CONGESTION))
+                ps->cc_on_ecn(ps, seq);
+
+        if (ps->cc_on_ack && acked)
+                ps->cc_on_ack(ps, seq, acked, rtt_us);
+
+        return acked != 0;
+}
+
 static int rcv_ack(struct dtcp * dtcp,
                    struct du *   du)
 {
         struct dtcp_ps * ps;
         seq_num_t        seq;
         int              ret;
+        uint_t           rtt_us = 0;
+        bool             push;
 
         seq = pci_control_ack_seq_num(&du->pci);
 
@@ -407,9 +479,16 @@ static int rcv_ack(struct dtcp * dtcp,
                           struct dtcp_ps, base);
 	if (ps->rtx_ctrl && ps->rtt_estimator)
         	ps->rtt_estimator(ps, pci_control_ack_seq_num(&du->pci));
+        /* Sample before the ACK takes the PDU out of the rtx queue */
+        if (ps->cc_on_ack)
+                rtt_us = rtxq_entry_rtt_us(dtcp->parent->rtxq, seq);
 	ret = ps->sender_ack(ps, seq);
+        push = cc_ack(dtcp, ps, &du->pci, rtt_us);
         rcu_read_unlock();
 
+        if (push && dtcp->parent->cwq)
+                push_pdus_rmt(dtcp);
+
 
         LOG_DBG("DTCP received ACK (CPU: %d)", smp_processor_id());
         dump_we(dtcp, &du->pci);
@@ -463,6 +542,7 @@ static int rcv_ack_and_flow_ctl(struct dtcp * dtcp,
         seq_num_t        seq;
         uint_t		 rt;
         uint_t           tf;
+        uint_t           rtt_us = 0;
 
         seq = pci_control_ack_seq_num(&du->pci);
 
@@ -472,8 +552,11 @@ static int rcv_ack_and_flow_ctl(struct dtcp * dtcp,
         /* This updates sender LWE */
 	if (ps->rtx_ctrl && ps->rtt_estimator)
         	ps->rtt_estimator(ps, pci_control_ack_seq_num(&du->pci));
+        if (ps->cc_on_ack)
+                rtt_us = rtxq_entry_rtt_us(dtcp->parent->rtxq, seq);
         if (ps->sender_ack(ps, seq))
                 LOG_ERR("Could not update RTXQ and LWE");
+        cc_ack(dtcp, ps, &du->pci, rtt_us);
         rcu_read_unlock();
 
         spin_lock_bh(&dtcp->parent->sv_lock);
@@ -518,6 +601,7 @@ int dtcp_common_rcv_control(struct dtcp * dtcp, struct du * du)
         int              ret;
 
         atomic_inc(&dtcp->cpdus_in_transit);
+        this_cpu_inc(dtcp->stats->ctrl_rx_pdus);
 
         type = pci_type(&du->pci);
         if (!pdu_type_is_control(type)) {
@@ -854,6 +938,8 @@ int dtcp_select_policy_set(struct dtcp * dtcp,
 
         if (trans.state == PS_SEL_TRANS_PENDING) {
                 struct dtcp_ps *ps;
+                struct policy_parm * parm;
+                int bool_value;
 
                 /* Copy the connection parameters to the policy-set. From now
                  * on these connection parameters must be accessed by the DTCP
@@ -880,6 +966,15 @@ int dtcp_select_policy_set(struct dtcp * dtcp,
                                                 = dtcp_initial_credit(cfg);
                 ps->flowctrl.rate.sending_rate  = dtcp_sending_rate(cfg);
                 ps->flowctrl.rate.time_period   = dtcp_time_period(cfg);
+                ps->flowctrl.rate.pacing        = false;
+                parm = policy_param_find(cfg->dtcp_ps, "flowctrl.rate.pacing");
+                if (parm) {
+                        if (kstrtoint(policy_param_value(parm), 10,
+                                      &bool_value))
+                                LOG_WARN("Bogus flowctrl.rate.pacing value");
+                        else
+                                ps->flowctrl.rate.pacing = bool_value;
+                }
 
                 /* Fill in default policies. */
                 if (!ps->lost_control_pdu) {
@@ -1009,6 +1104,11 @@ int dtcp_set_policy_set_param(struct dtcp * dtcp,
                 } else if (strcmp(name, "flowctrl.rate.time_period") == 0) {
                         ret = kstrtouint(value, 10,
                                          &ps->flowctrl.rate.time_period);
+                } else if (strcmp(name, "flowctrl.rate.pacing") == 0) {
+                        ret = kstrtoint(value, 10, &bool_value);
+                        if (ret == 0) {
+                                ps->flowctrl.rate.pacing = bool_value;
+                        }
                 } else {
                         LOG_ERR("Unknown DTP parameter policy '%s'", name);
                 }
@@ -1030,6 +1130,7 @@ struct dtcp * dtcp_create(struct dtp *         dtp,
 {
         struct dtcp * tmp;
         string_t *    ps_name;
+        struct dtcp_ps * ps;
 
         if (!dtp) {
                 LOG_ERR("No DTP passed, bailing out");
@@ -1068,6 +1169,13 @@ struct dtcp * dtcp_create(struct dtp *         dtp,
                 return NULL;
         }
 
+        tmp->stats = alloc_percpu_gfp(struct dtcp_stats, GFP_ATOMIC);
+        if (!tmp->stats) {
+                LOG_ERR("Cannot create DTCP statistics");
+                dtcp_destroy(tmp);
+                return NULL;
+        }
+
         tmp->cfg  = dtcp_cfg;
         tmp->rmt  = rmt;
         atomic_set(&tmp->cpdus_in_transit, 0);
@@ -1089,6 +1197,18 @@ struct dtcp * dtcp_create(struct dtp *         dtp,
                 dtcp_destroy(tmp);
                 return NULL;
         }
+
+        /* Lets the policy fix up the state-vector, e.g. an initial cwnd */
+        rcu_read_lock();
+        ps = container_of(rcu_dereference(tmp->base.ps),
+                          struct dtcp_ps, base);
+        if (ps->flow_init && ps->flow_init(ps)) {
+                rcu_read_unlock();
+                LOG_ERR("DTCP PS %s could not init the flow", ps_name);
+                dtcp_destroy(tmp);
+                return NULL;
+        }
+        rcu_read_unlock();
         /* FIXME: fixups to the state-vector should be placed here */
 
         if (dtcp_flow_ctrl(dtcp_cfg)) {
@@ -1097,6 +1217,11 @@ struct dtcp * dtcp_create(struct dtp *         dtp,
 			RINA_DECLARE_AND_ADD_ATTRS(&tmp->robj, dtcp, sndr_credit, rcvr_credit,
 				snd_rt_win_edge, rcv_rt_win_edge);
 		}
+                if (dtcp_window_based_fctrl(dtcp_cfg) &&
+                    dtcp_rtx_ctrl(dtcp_cfg)) {
+			RINA_DECLARE_AND_ADD_ATTRS(&tmp->robj, dtcp, snd_cwnd,
+				pacing_rate);
+		}
                 if (dtcp_rate_based_fctrl(dtcp_cfg)) {
 			RINA_DECLARE_AND_ADD_ATTRS(&tmp->robj, dtcp, pdu_per_time_unit, time_unit,
 				sndr_rate, rcvr_rate, pdus_rcvd_in_time_unit, last_time);
@@ -1129,6 +1254,7 @@ int dtcp_destroy(struct dtcp * instance)
         }
 
         if (instance->sv)       rkfree(instance->sv);
+        if (instance->stats)    free_percpu(instance->stats);
         if (instance->cfg)      dtcp_config_destroy(instance->cfg);
         rina_component_fini(&instance->base);
 	robject_del(&instance->robj);
@@ -1162,6 +1288,14 @@ int dtcp_sv_update(struct dtcp * dtcp, struct pci * pci)
                           struct dtcp_ps, base);
         ASSERT(ps);
 
+        /* Echoed back in the next ACK, see populate_ctrl_pci() */
+        if (ps->cc_on_ecn &&
+            (pci_flags_get(pci) & PDU_FLAGS_EXPLICIT_CONGESTION)) {
+                spin_lock_bh(&dtcp->parent->sv_lock);
+                dtcp->sv->ecn_echo = true;
+                spin_unlock_bh(&dtcp->parent->sv_lock);
+        }
+
         flow_ctrl  = ps->flow_ctrl;
         win_based  = ps->flowctrl.window_based;
         rate_based = ps->flowctrl.rate_based;
@@ -1272,3 +1406,79 @@ bool dtcp_rate_exceeded(struct dtcp * dtcp, int send) {
 	return false;
 }
 EXPORT_SYMBOL(dtcp_rate_exceeded);
+
+/* Must be called with the sv lock taken */
+seq_num_t dtcp_snd_rt_wind_edge(struct dtcp * dtcp)
+{
+        seq_num_t edge;
+
+        edge = dtcp->sv->snd_rt_wind_edge;
+        if (dtcp->sv->snd_cwnd &&
+            dtcp->sv->snd_una + dtcp->sv->snd_cwnd < edge)
+                edge = dtcp->sv->snd_una + dtcp->sv->snd_cwnd;
+
+        return edge;
+}
+EXPORT_SYMBOL(dtcp_snd_rt_wind_edge);
+
+void dtcp_cc_cwnd_set(struct dtcp * dtcp, uint_t cwnd)
+{
+        spin_lock_bh(&dtcp->parent->sv_lock);
+        dtcp->sv->snd_cwnd = cwnd;
+        spin_unlock_bh(&dtcp->parent->sv_lock);
+}
+EXPORT_SYMBOL(dtcp_cc_cwnd_set);
+
+void dtcp_cc_pacing_rate_set(struct dtcp * dtcp, u64 rate)
+{
+        spin_lock_bh(&dtcp->parent->sv_lock);
+        dtcp->sv->pacing_rate = rate;
+        spin_unlock_bh(&dtcp->parent->sv_lock);
+}
+EXPORT_SYMBOL(dtcp_cc_pacing_rate_set);
+
+/* PDUs sent and not acked yet */
+uint_t dtcp_cc_inflight(struct dtcp * dtcp)
+{
+        seq_num_t sent, una;
+
+        spin_lock_bh(&dtcp->parent->sv_lock);
+        sent = dtcp->parent->sv->max_seq_nr_sent;
+        una  = dtcp->sv->snd_una;
+        spin_unlock_bh(&dtcp->parent->sv_lock);
+
+        return sent > una ? sent - una : 0;
+}
+EXPORT_SYMBOL(dtcp_cc_inflight);
+
+seq_num_t dtcp_cc_max_sent(struct dtcp * dtcp)
+{
+        seq_num_t sent;
+
+        spin_lock_bh(&dtcp->parent->sv_lock);
+        sent = dtcp->parent->sv->max_seq_nr_sent;
+        spin_unlock_bh(&dtcp->parent->sv_lock);
+
+        return sent;
+}
+EXPORT_SYMBOL(dtcp_cc_max_sent);
+
+uint_t dtcp_cc_mss(struct dtcp * dtcp)
+{ return dtcp->parent->sv->max_flow_pdu_size; }
+EXPORT_SYMBOL(dtcp_cc_mss);
+
+void dtcp_cc_loss(struct dtcp * dtcp)
+{
+        struct dtcp_ps * ps;
+
+        if (!dtcp)
+                return;
+
+        rcu_read_lock();
+        ps = container_of(rcu_dereference(dtcp->base.ps),
+                          struct dtcp_ps, base);
+        if (ps->cc_on_loss)
+                ps->cc_on_loss(ps);
+        rcu_read_unlock();
+}
+EXPORT_SYMBOL(dtcp_cc_loss);
@@ -79,6 +79,15 @@ int		dtcp_last_time_set(struct dtcp *dtcp,
 					   struct timespec *s);
 bool		dtcp_rate_exceeded(struct dtcp *dtcp, int send);
 
+/* Congestion control support, see the cc_* hooks in dtcp-ps.h */
+seq_num_t	dtcp_snd_rt_wind_edge(struct dtcp *dtcp);
+void		dtcp_cc_cwnd_set(struct dtcp *dtcp, uint_t cwnd);
+void		dtcp_cc_pacing_rate_set(struct dtcp *dtcp, u64 rate);
+uint_t		dtcp_cc_inflight(struct dtcp *dtcp);
+seq_num_t	dtcp_cc_max_sent(struct dtcp *dtcp);
+uint_t		dtcp_cc_mss(struct dtcp *dtcp);
+void		dtcp_cc_loss(struct dtcp *dtcp);
+
 /* end SDK */
 
 int		pdus_sent_in_t_unit_set(struct dtcp *dtcp, uint_t s);
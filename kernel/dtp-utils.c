@@ -22,6 +22,8 @@
  */
 
 #include <linux/list.h>
+#include <linux/percpu.h>
+#include <linux/log2.h>
 
 #define RINA_PREFIX "dt-utils"
 
@@ -42,58 +44,86 @@
 /* Maximum retransmission time is 60 seconds */
 #define MAX_RTX_WAIT_TIME msecs_to_jiffies(60000)
 
-struct cwq * cwq_create(void)
-{
-        struct cwq * tmp;
+/*
+ * The closed window queue is a fixed ring of PDU pointers sized from the
+ * flow control config, so queueing a PDU never allocates. Writers get
+ * backpressure (efcp_disable_write) well before the ring fills up, the
+ * slack absorbs the writers already past the window check.
+ */
+#define CWQ_MIN_SIZE  64
+#define CWQ_MAX_SIZE  (1 << 14)
+#define CWQ_SLACK     16
+/* PDUs moved out of the ring at once by cwq_deliver() */
+#define CWQ_BATCH     16
 
-        tmp = rkzalloc(sizeof(*tmp), GFP_KERNEL);
-        if (!tmp)
-                return NULL;
+static inline uint_t cwq_len(struct cwq * queue)
+{ return queue->tail - queue->head; }
 
-        tmp->q = rqueue_create();
-        if (!tmp->q) {
-                LOG_ERR("Failed to create closed window queue");
-                rkfree(tmp);
+static inline struct du * cwq_head(struct cwq * queue)
+{ return queue->ring[queue->head & queue->mask]; }
+
+static struct du * cwq_ring_pop(struct cwq * queue)
+{
+        struct du * du;
+
+        if (queue->head == queue->tail)
                 return NULL;
-        }
 
-        spin_lock_init(&tmp->lock);
+        du = queue->ring[queue->head & queue->mask];
+        queue->ring[queue->head & queue->mask] = NULL;
+        queue->head++;
 
-        return tmp;
+        return du;
 }
 
-struct cwq * cwq_create_ni(void)
+static struct cwq * cwq_create_gfp(uint_t max_len, gfp_t flags)
 {
         struct cwq * tmp;
+        uint_t       size;
 
-        tmp = rkzalloc(sizeof(*tmp), GFP_ATOMIC);
+        tmp = rkzalloc(sizeof(*tmp), flags);
         if (!tmp)
                 return NULL;
 
-        tmp->q = rqueue_create_ni();
-        if (!tmp->q) {
+        size = clamp_t(uint_t, max_len + CWQ_SLACK, CWQ_MIN_SIZE, CWQ_MAX_SIZE);
+        size = roundup_pow_of_two(size);
+        if (max_len + CWQ_SLACK > size)
+                LOG_WARN("Closed window queue capped to %u PDUs", size);
+
+        tmp->ring = rkzalloc(size * sizeof(*tmp->ring), flags);
+        if (!tmp->ring) {
                 LOG_ERR("Failed to create closed window queue");
                 rkfree(tmp);
                 return NULL;
         }
+        tmp->mask = size - 1;
+        tmp->head = 0;
+        tmp->tail = 0;
 
         spin_lock_init(&tmp->lock);
 
         return tmp;
 }
 
+struct cwq * cwq_create(uint_t max_len)
+{ return cwq_create_gfp(max_len, GFP_KERNEL); }
+
+struct cwq * cwq_create_ni(uint_t max_len)
+{ return cwq_create_gfp(max_len, GFP_ATOMIC); }
+
 int cwq_destroy(struct cwq * queue)
 {
+        struct du * du;
+
         if (!queue)
                 return -1;
 
-        ASSERT(queue->q);
+        ASSERT(queue->ring);
 
-        if (rqueue_destroy(queue->q, (void (*)(void *)) du_destroy)) {
-                LOG_ERR("Failed to destroy closed window queue");
-                return -1;
-        }
+        while ((du = cwq_ring_pop(queue)))
+                du_destroy(du);
 
+        rkfree(queue->ring);
         rkfree(queue);
 
         return 0;
@@ -105,12 +135,14 @@ int cwq_push(struct cwq * queue,
         LOG_DBG("Pushing in the Closed Window Queue");
 
         spin_lock_bh(&queue->lock);
-        if (rqueue_tail_push_ni(queue->q, du)) {
-                du_destroy(du);
+        if (cwq_len(queue) > queue->mask) {
                 spin_unlock_bh(&queue->lock);
-                LOG_ERR("Failed to add PDU");
+                du_destroy(du);
+                LOG_ERR("Closed window queue full, dropping PDU");
                 return -1;
         }
+        queue->ring[queue->tail & queue->mask] = du;
+        queue->tail++;
         spin_unlock_bh(&queue->lock);
 
         return 0;
@@ -125,7 +157,7 @@ struct du * cwq_pop(struct cwq * queue)
                 return NULL;
 
         spin_lock(&queue->lock);
-        tmp = (struct du *) rqueue_head_pop(queue->q);
+        tmp = cwq_ring_pop(queue);
         spin_unlock(&queue->lock);
 
         if (!tmp) {
@@ -144,7 +176,7 @@ bool cwq_is_empty(struct cwq * queue)
                 return false;
 
         spin_lock(&queue->lock);
-        ret = rqueue_is_empty(queue->q);
+        ret = (cwq_len(queue) == 0);
         spin_unlock(&queue->lock);
 
         return ret;
@@ -158,15 +190,8 @@ int cwq_flush(struct cwq * queue)
                 return -1;
 
         spin_lock(&queue->lock);
-        while (!rqueue_is_empty(queue->q)) {
-                tmp = (struct du *) rqueue_head_pop(queue->q);
-                if (!tmp) {
-                        spin_unlock(&queue->lock);
-                        LOG_ERR("Failed to retrieve PDU");
-                        return -1;
-                }
+        while ((tmp = cwq_ring_pop(queue)))
                 du_destroy(tmp);
-        }
         spin_unlock(&queue->lock);
 
         return 0;
@@ -181,7 +206,7 @@ ssize_t cwq_size(struct cwq * queue)
                 return -1;
 
         spin_lock_bh(&queue->lock);
-        tmp = rqueue_length(queue->q);
+        tmp = cwq_len(queue);
         spin_unlock_bh(&queue->lock);
 
         return tmp;
@@ -199,7 +224,7 @@ static void enable_write(struct cwq * cwq,
                 return;
 
         max_len = dtcp_max_closed_winq_length(cfg);
-        if (rqueue_length(cwq->q) < max_len)
+        if (cwq_len(cwq) < max_len)
                 efcp_enable_write(dtp->efcp);
 
         return;
@@ -215,10 +240,13 @@ static bool can_deliver(struct dtp * dtp, struct dtcp * dtcp)
         is_rb = dtcp_rate_based_fctrl(dtcp->cfg);
 
         if (is_wb)
-                w_ret = (dtp->sv->max_seq_nr_sent < dtcp->sv->snd_rt_wind_edge);
+                w_ret = (dtp->sv->max_seq_nr_sent <
+                         dtcp_snd_rt_wind_edge(dtcp)) &&
+                        !(dtcp->sv->pacing_rate && dtp_pace_closed(dtp));
 
 	if (is_rb)
-                r_ret = !dtcp_rate_exceeded(dtcp, 0);
+                r_ret = dtp->sv->rate_pacing ? !dtp_pace_closed(dtp) :
+                        !dtcp_rate_exceeded(dtcp, 0);
 
         LOG_DBG("Can cwq still deliver something, win: %d, rate: %d",
         	w_ret, r_ret);
@@ -236,15 +264,49 @@ static bool can_deliver(struct dtp * dtp, struct dtcp * dtcp)
         return to_ret;
 }
 
+/*
+ * PDUs at the head of the queue that can go now. With window based flow
+ * control alone, the right window edge is checked once for the whole
+ * batch. Rate based flow control and pacing charge every PDU, so they get
+ * one PDU at a time.
+ */
+static uint_t cwq_permitted(struct cwq * queue,
+                            struct dtp * dtp,
+                            struct dtcp * dtcp,
+                            bool         per_pdu)
+{
+        seq_num_t edge, sent;
+        uint_t    n, len;
+
+        if (!cwq_len(queue) || !can_deliver(dtp, dtcp))
+                return 0;
+
+        if (per_pdu)
+                return 1;
+
+        edge = dtcp_snd_rt_wind_edge(dtcp);
+        sent = dtp->sv->max_seq_nr_sent;
+        len  = min_t(uint_t, cwq_len(queue), CWQ_BATCH);
+        for (n = 0; n < len && sent < edge; n++)
+                sent = pci_sequence_number_get(
+                        &queue->ring[(queue->head + n) & queue->mask]->pci);
+
+        return n;
+}
+
 void cwq_deliver(struct cwq * queue,
                  struct dtp * dtp,
                  struct rmt * rmt)
 {
-        struct rtxq *           rtxq;
         struct dtcp *           dtcp;
-        struct du  *            tmp;
+        struct du *             batch[CWQ_BATCH];
+        struct du *             rtx[CWQ_BATCH];
+        struct du *             du;
         bool                    rtx_ctrl;
         bool                    flow_ctrl;
+        bool                    per_pdu;
+        bool                    stop = false;
+        uint_t                  n, i;
 
         bool			rate_ctrl = false;
         int 			sz = 0;
@@ -261,58 +323,77 @@ void cwq_deliver(struct cwq * queue,
         	rate_ctrl = dtcp_rate_based_fctrl(dtcp->cfg);
         }
 
-        spin_lock(&queue->lock);
-        while (!rqueue_is_empty(queue->q) && can_deliver(dtp, dtcp)) {
-                struct du *       du;
+        if (rtx_ctrl && !dtp->rtxq) {
+                LOG_ERR("Couldn't find the RTX queue");
+                return;
+        }
 
-                du = (struct du *) rqueue_head_pop(queue->q);
-                if (!du) {
-                        spin_unlock(&queue->lock);
-                        return;
-                }
-                if (rtx_ctrl) {
-                        rtxq = dtp->rtxq;
-                        if (!rtxq) {
-                                spin_unlock(&queue->lock);
-                                LOG_ERR("Couldn't find the RTX queue");
-                                return;
-                        }
-                        tmp = du_dup_ni(du);
-                        if (!tmp) {
-                                spin_unlock(&queue->lock);
-                                return;
+        spin_lock(&queue->lock);
+        per_pdu = rate_ctrl || dtp_pace_enabled(dtp);
+        while (!stop && (n = cwq_permitted(queue, dtp, dtcp, per_pdu))) {
+                /* The rtx copies first, nothing leaves the ring on failure */
+                for (i = 0; i < n; i++) {
+                        if (rtx_ctrl) {
+                                rtx[i] = du_dup_ni(queue->ring[(queue->head + i) &
+                                                               queue->mask]);
+                                if (!rtx[i])
+                                        break;
                         }
-                        rtxq_push_ni(rtxq, tmp);
+                        batch[i] = cwq_ring_pop(queue);
                 }
-                if(rate_ctrl) {
-                	sz = du_data_len(du);
-			sc = dtcp->sv->pdus_sent_in_time_unit;
+                n = i;
+                if (!n)
+                        break;
 
-			if(sz >= 0) {
-				if (sz + sc >= dtcp->sv->sndr_rate) {
-					dtcp->sv->pdus_sent_in_time_unit =
-						dtcp->sv->sndr_rate;
+                if (rtx_ctrl)
+                        rtxq_push_batch_ni(dtp->rtxq, rtx, n);
 
-					break;
-				} else {
-					dtcp->sv->pdus_sent_in_time_unit += sz;
-				}
-			}
+                if (dtp_pace_enabled(dtp)) {
+                        sz = 0;
+                        for (i = 0; i < n; i++)
+                                sz += du_data_len(batch[i]);
+                        spin_lock_bh(&dtp->sv_lock);
+                        dtp_pace_charge(dtp, dtcp, sz);
+                        spin_unlock_bh(&dtp->sv_lock);
                 }
-                dtp->sv->max_seq_nr_sent = pci_sequence_number_get(&du->pci);
 
-                dtp_pdu_send(dtp, rmt, du);
+                for (i = 0; i < n; i++) {
+                        du = batch[i];
+                        if(rate_ctrl && !dtp->sv->rate_pacing) {
+                                sz = du_data_len(du);
+                                sc = dtcp->sv->pdus_sent_in_time_unit;
+
+                                if(sz >= 0) {
+                                        if (sz + sc >= dtcp->sv->sndr_rate) {
+                                                dtcp->sv->pdus_sent_in_time_unit =
+                                                        dtcp->sv->sndr_rate;
+                                                stop = true;
+                                        } else {
+                                                dtcp->sv->pdus_sent_in_time_unit += sz;
+                                        }
+                                }
+                        }
+                        dtp->sv->max_seq_nr_sent =
+                                pci_sequence_number_get(&du->pci);
+
+                        dtp_pdu_send(dtp, rmt, du);
+                }
         }
 
         if (!can_deliver(dtp, dtcp)) {
         	if(dtcp_window_based_fctrl(dtcp->cfg)) {
 			dtp->sv->window_closed = true;
+			if (dtcp->sv->pacing_rate)
+				dtp_pace_arm(dtp);
         	}
 
                 if(dtcp_rate_based_fctrl(dtcp->cfg)) {
                 	LOG_DBG("rbfc Cannot deliver anymore, closing...");
                 	dtp->sv->rate_fulfiled = true;
-                	dtp_start_rate_timer(dtp, dtcp);
+                	if (dtp->sv->rate_pacing)
+                		dtp_pace_arm(dtp);
+                	else
+                		dtp_start_rate_timer(dtp, dtcp);
 
                 	// Cannot use anymore that port.
                 	//efcp_disable_write(dt_efcp(dtp));
@@ -343,27 +424,11 @@ void cwq_deliver(struct cwq * queue,
 /* NOTE: used only by dump_we */
 seq_num_t cwq_peek(struct cwq * queue)
 {
-        seq_num_t          ret;
-        struct du *        du;
+        seq_num_t          ret = 0;
 
         spin_lock_bh(&queue->lock);
-        if (rqueue_is_empty(queue->q)){
-                spin_unlock_bh(&queue->lock);
-                return 0;
-        }
-
-        du = (struct du *) rqueue_head_pop(queue->q);
-        if (!du) {
-                spin_unlock_bh(&queue->lock);
-                return -1;
-        }
-
-        ret = pci_sequence_number_get(&du->pci);
-        if (rqueue_head_push_ni(queue->q, du)) {
-                spin_unlock_bh(&queue->lock);
-                du_destroy(du);
-                return ret;
-        }
+        if (cwq_len(queue))
+                ret = pci_sequence_number_get(&cwq_head(queue)->pci);
         spin_unlock_bh(&queue->lock);
 
         return ret;
@@ -379,6 +444,7 @@ static struct rtxq_entry * rtxq_entry_create_gfp(struct du * du, gfp_t flag)
 
         tmp->du        = du;
         tmp->time_stamp = jiffies;
+        tmp->tx_time    = ktime_get();
         tmp->retries    = 0;
 
         INIT_LIST_HEAD(&tmp->next);
@@ -532,6 +598,8 @@ static int rtxqueue_entries_nack(struct rtxqueue * q,
 					 rmt,
 					 tmp))
                                 continue;
+                        if (dtcp)
+                                this_cpu_inc(dtcp->stats->rtx_pdus);
                 } else
                         return 0;
         }
@@ -539,6 +607,27 @@ static int rtxqueue_entries_nack(struct rtxqueue * q,
         return 0;
 }
 
+/* Karn: no samples from retransmitted PDUs, 0 if there is no sample */
+static uint_t rtxqueue_entry_rtt_us(struct rtxqueue * q, seq_num_t sn)
+{
+        struct rtxq_entry * cur;
+        seq_num_t           csn;
+
+        list_for_each_entry(cur, &q->head, next) {
+                csn = pci_sequence_number_get(&cur->du->pci);
+                if (csn > sn)
+                        return 0;
+                if (csn == sn) {
+                        if (cur->retries != 0)
+                                return 0;
+                        return (uint_t) max_t(s64, 1,
+                                ktime_us_delta(ktime_get(), cur->tx_time));
+                }
+        }
+
+        return 0;
+}
+
 unsigned long rtxqueue_entry_timestamp(struct rtxqueue * q, seq_num_t sn)
 {
         struct rtxq_entry * cur;
@@ -646,6 +735,7 @@ static int rtxqueue_rtx(struct rtxqueue * q,
         struct dtcp *	    dtcp;
         int sz;
         uint_t sc;
+        int rtx = 0;
 
         ASSERT(q);
         ASSERT(dt);
@@ -696,6 +786,9 @@ static int rtxqueue_rtx(struct rtxqueue * q,
                                          rmt,
                                          tmp))
                                 continue;
+                        rtx++;
+                        if (dtcp)
+                                this_cpu_inc(dtcp->stats->rtx_pdus);
                         LOG_DBG("Retransmitted PDU with seqN %u", seq);
                 } else {
                         LOG_DBG("RTX timer: from here PDUs still have time,"
@@ -706,7 +799,7 @@ static int rtxqueue_rtx(struct rtxqueue * q,
 
         LOG_DBG("RTXQ %pK has delivered until %u", q, seq);
 
-        return 0;
+        return rtx;
 }
 
 static bool rtxqueue_empty(struct rtxqueue * q)
@@ -726,6 +819,7 @@ static void rtx_timer_func(struct timer_list * tl)
         struct rtxq *        q;
         unsigned int         tr;
 	struct dtp *         dtp;
+        int                  rtx;
 
         LOG_DBG("RTX timer triggered...");
 
@@ -743,11 +837,12 @@ static void rtx_timer_func(struct timer_list * tl)
         tr = dtp->sv->tr;
 
         spin_lock(&q->lock);
-        if (rtxqueue_rtx(q->queue,
-                         tr,
-                         dtp,
-                         q->rmt,
-			 dtp->dtcp->cfg->rxctrl_cfg->data_retransmit_max))
+        rtx = rtxqueue_rtx(q->queue,
+                           tr,
+                           dtp,
+                           q->rmt,
+                           dtp->dtcp->cfg->rxctrl_cfg->data_retransmit_max);
+        if (rtx < 0)
                 LOG_ERR("RTX failed");
 
 #if RTIMER_ENABLED
@@ -758,6 +853,9 @@ static void rtx_timer_func(struct timer_list * tl)
 
         spin_unlock(&q->lock);
 
+        if (rtx > 0)
+                dtcp_cc_loss(dtp->dtcp);
+
         return;
 }
 
@@ -853,6 +951,21 @@ unsigned long rtxq_entry_timestamp(struct rtxq * q, seq_num_t sn)
 }
 EXPORT_SYMBOL(rtxq_entry_timestamp);
 
+uint_t rtxq_entry_rtt_us(struct rtxq * q, seq_num_t sn)
+{
+        uint_t rtt_us;
+
+        if (!q)
+                return 0;
+
+        spin_lock_bh(&q->lock);
+        rtt_us = rtxqueue_entry_rtt_us(q->queue, sn);
+        spin_unlock_bh(&q->lock);
+
+        return rtt_us;
+}
+EXPORT_SYMBOL(rtxq_entry_rtt_us);
+
 int rtxq_push_ni(struct rtxq * q,
                  struct du *  du)
 {
@@ -866,6 +979,28 @@ int rtxq_push_ni(struct rtxq * q,
         return 0;
 }
 
+/* Pushes @n PDUs sent back to back, restarting the timer only once */
+int rtxq_push_batch_ni(struct rtxq * q,
+                       struct du ** dus,
+                       uint_t       n)
+{
+        uint_t i;
+
+        spin_lock_bh(&q->lock);
+#if RTIMER_ENABLED
+        rtimer_start(&q->parent->timers.rtx, q->parent->sv->tr);
+#endif
+        for (i = 0; i < n; i++) {
+                if (rtxqueue_push_ni(q->queue, dus[i])) {
+                        LOG_ERR("Couldn't push to rtxq");
+                        du_destroy(dus[i]);
+                }
+        }
+        spin_unlock_bh(&q->lock);
+
+        return 0;
+}
+
 int rtxq_flush(struct rtxq * q)
 {
         if (!q || !q->queue)
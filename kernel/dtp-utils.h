@@ -28,8 +28,8 @@
 #include "du.h"
 #include "rmt.h"
 
-struct cwq *        cwq_create(void);
-struct cwq *        cwq_create_ni(void);
+struct cwq *        cwq_create(uint_t max_len);
+struct cwq *        cwq_create_ni(uint_t max_len);
 int                 cwq_destroy(struct cwq * q);
 
 bool                cwq_write_enable(struct cwq * queue);
@@ -59,11 +59,16 @@ int		    rtxq_size(struct rtxq * q);
 int		    rtxq_drop_pdus(struct rtxq * q);
 unsigned long       rtxq_entry_timestamp(struct rtxq * q,
                                          seq_num_t sn);
+uint_t              rtxq_entry_rtt_us(struct rtxq * q,
+                                      seq_num_t sn);
 int                 rtxq_entry_destroy(struct rtxq_entry * entry);
 int                 rtxq_push_sn(struct rtxq * q,
                                  seq_num_t sn);
 int                 rtxq_push_ni(struct rtxq * q,
                                  struct du *  du);
+int                 rtxq_push_batch_ni(struct rtxq * q,
+                                       struct du ** dus,
+                                       uint_t       n);
 int                 rtxq_ack(struct rtxq * q,
                              seq_num_t     seq_num,
                              timeout_t     tr);
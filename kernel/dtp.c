@@ -23,6 +23,7 @@
 
 #include <linux/random.h>
 #include <linux/version.h>
+#include <linux/percpu.h>
 
 #define RINA_PREFIX "dtp"
 
@@ -42,9 +43,13 @@
 #include "pci.h"
 #include "rds/robjects.h"
 #include "efcp-str.h"
+#include "dp-latency.h"
+#include "dp-trace.h"
 
 #define TO_POST_LENGTH 1000
 #define TO_SEND_LENGTH 16
+/* PDUs due this close to now are sent right away when pacing */
+#define DTP_PACE_SLACK_NS (20 * NSEC_PER_USEC)
 
 static struct policy_set_list policy_sets = {
         .head = LIST_HEAD_INIT(policy_sets.head)
@@ -55,18 +60,12 @@ static struct dtp_sv default_sv = {
         .max_seq_nr_sent               = 0,
         .seq_number_rollover_threshold = 0,
         .max_seq_nr_rcv                = 0,
-	.stats = {
-		.drop_pdus = 0,
-		.err_pdus = 0,
-		.tx_pdus = 0,
-		.tx_bytes = 0,
-		.rx_pdus = 0,
-		.rx_bytes = 0 },
         .rexmsn_ctrl                   = false,
         .rate_based                    = false,
         .window_based                  = false,
         .drf_required                  = true,
         .rate_fulfiled                 = false,
+        .rate_pacing                   = false,
         .max_flow_pdu_size    = UINT_MAX,
         .max_flow_sdu_size    = UINT_MAX,
         .MPL                  = 1000,
@@ -78,33 +77,29 @@ static struct dtp_sv default_sv = {
         .drf_flag             = true,
 };
 
-#define stats_get(name, sv, retval)				\
-        ASSERT(sv);						\
-        retval = sv->stats.name;				\
+#define stats_get(name, dtp)					\
+        pcpu_stats_get(dtp->stats, struct dtp_stats, name)
 
-#define stats_inc(name, sv)					\
-        ASSERT(sv);						\
-        sv->stats.name##_pdus++;				\
-        LOG_DBG("PDUs __STRINGIFY(name) %u",			\
-		sv->stats.name##_pdus);				\
+#define stats_inc(name, dtp)					\
+        this_cpu_inc(dtp->stats->name##_pdus);
 
-#define stats_inc_bytes(name, sv, bytes)			\
-        ASSERT(sv);						\
-        sv->stats.name##_pdus++;				\
-	sv->stats.name##_bytes += (unsigned long) bytes;	\
-        LOG_DBG("PDUs __STRINGIFY(name) %u (%u)",		\
-		sv->stats.name##_pdus,				\
-		sv->stats.name##_bytes);			\
+/* Accounts a drop, both in the total and in its reason */
+#define stats_drop(reason, dtp)					\
+        this_cpu_inc(dtp->stats->drop_pdus);			\
+        this_cpu_inc(dtp->stats->reason##_drop_pdus);
+
+#define stats_inc_bytes(name, dtp, bytes)			\
+        this_cpu_inc(dtp->stats->name##_pdus);			\
+        this_cpu_add(dtp->stats->name##_bytes, (unsigned long) bytes);
 
 static ssize_t dtp_attr_show(struct robject *		     robj,
                          	     struct robj_attribute * attr,
                                      char *		     buf)
 {
 	struct dtp * instance;
-	unsigned int stats_ret;
 
 	instance = container_of(robj, struct dtp, robj);
-	if (!instance || !instance->cfg || !instance->sv)
+	if (!instance || !instance->cfg || !instance->sv || !instance->stats)
 		return 0;
 
 	if (strcmp(robject_attr_name(attr), "init_a_timer") == 0) {
@@ -131,42 +126,22 @@ static ssize_t dtp_attr_show(struct robject *		     robj,
 		return sprintf(buf, "%d\n",
 			dtp_conf_seq_num_ro_th(instance->cfg));
 	}
-	if (strcmp(robject_attr_name(attr), "drop_pdus") == 0) {
-		spin_lock_bh(&instance->sv_lock);
-		stats_get(drop_pdus, instance->sv, stats_ret);
-		spin_unlock_bh(&instance->sv_lock);
-		return sprintf(buf, "%u\n", stats_ret);
-	}
-	if (strcmp(robject_attr_name(attr), "err_pdus") == 0) {
-		spin_lock_bh(&instance->sv_lock);
-		stats_get(err_pdus, instance->sv, stats_ret);
-		spin_unlock_bh(&instance->sv_lock);
-		return sprintf(buf, "%u\n", stats_ret);
-	}
-	if (strcmp(robject_attr_name(attr), "tx_pdus") == 0) {
-		spin_lock_bh(&instance->sv_lock);
-		stats_get(tx_pdus, instance->sv, stats_ret);
-		spin_unlock_bh(&instance->sv_lock);
-		return sprintf(buf, "%u\n", stats_ret);
-	}
-	if (strcmp(robject_attr_name(attr), "tx_bytes") == 0) {
-		spin_lock_bh(&instance->sv_lock);
-		stats_get(tx_bytes, instance->sv, stats_ret);
-		spin_unlock_bh(&instance->sv_lock);
-		return sprintf(buf, "%u\n", stats_ret);
-	}
-	if (strcmp(robject_attr_name(attr), "rx_pdus") == 0) {
-		spin_lock_bh(&instance->sv_lock);
-		stats_get(rx_pdus, instance->sv, stats_ret);
-		spin_unlock_bh(&instance->sv_lock);
-		return sprintf(buf, "%u\n", stats_ret);
-	}
-	if (strcmp(robject_attr_name(attr), "rx_bytes") == 0) {
-		spin_lock_bh(&instance->sv_lock);
-		stats_get(rx_bytes, instance->sv, stats_ret);
-		spin_unlock_bh(&instance->sv_lock);
-		return sprintf(buf, "%u\n", stats_ret);
-	}
+	if (strcmp(robject_attr_name(attr), "drop_pdus") == 0)
+		return sprintf(buf, "%lu\n", stats_get(drop_pdus, instance));
+	if (strcmp(robject_attr_name(attr), "dup_drop_pdus") == 0)
+		return sprintf(buf, "%lu\n", stats_get(dup_drop_pdus, instance));
+	if (strcmp(robject_attr_name(attr), "drf_drop_pdus") == 0)
+		return sprintf(buf, "%lu\n", stats_get(drf_drop_pdus, instance));
+	if (strcmp(robject_attr_name(attr), "err_pdus") == 0)
+		return sprintf(buf, "%lu\n", stats_get(err_pdus, instance));
+	if (strcmp(robject_attr_name(attr), "tx_pdus") == 0)
+		return sprintf(buf, "%lu\n", stats_get(tx_pdus, instance));
+	if (strcmp(robject_attr_name(attr), "tx_bytes") == 0)
+		return sprintf(buf, "%lu\n", stats_get(tx_bytes, instance));
+	if (strcmp(robject_attr_name(attr), "rx_pdus") == 0)
+		return sprintf(buf, "%lu\n", stats_get(rx_pdus, instance));
+	if (strcmp(robject_attr_name(attr), "rx_bytes") == 0)
+		return sprintf(buf, "%lu\n", stats_get(rx_bytes, instance));
 	if (strcmp(robject_attr_name(attr), "ps_name") == 0) {
 		return sprintf(buf, "%s\n", instance->base.ps_factory->name);
 	}
@@ -175,8 +150,8 @@ static ssize_t dtp_attr_show(struct robject *		     robj,
 RINA_SYSFS_OPS(dtp);
 RINA_ATTRS(dtp, init_a_timer, max_sdu_gap, partial_delivery,
 		    incomplete_delivery, in_order_delivery, seq_num_rollover_th,
-		    drop_pdus, err_pdus, tx_pdus, tx_bytes, rx_pdus, rx_bytes,
-		    ps_name);
+		    drop_pdus, dup_drop_pdus, drf_drop_pdus, err_pdus,
+		    tx_pdus, tx_bytes, rx_pdus, rx_bytes, ps_name);
 RINA_KTYPE(dtp);
 
 int dtp_initial_sequence_number(struct dtp * instance)
@@ -790,6 +765,99 @@ static void tf_rate_window(struct timer_list * tl)
         return;
 }
 
+/*
+ * Pacing: instead of letting a whole time frame worth of bytes go at once,
+ * every PDU pushes the departure time of the next one by its share of the
+ * time frame (len * time_unit / sndr_rate), or of the pacing rate set by
+ * the congestion control policy. The closed window queue is drained by an
+ * hrtimer armed at that time.
+ */
+
+bool dtp_pace_enabled(struct dtp * dtp)
+{
+        return (dtp->dtcp && dtp->dtcp->sv->pacing_rate) ||
+                (dtp->sv->rate_based && dtp->sv->rate_pacing);
+}
+
+bool dtp_pace_closed(struct dtp * dtp)
+{
+        return ktime_after(dtp->pace.next,
+                           ktime_add_ns(ktime_get(), DTP_PACE_SLACK_NS));
+}
+
+/* Must be called with sv lock taken */
+void dtp_pace_charge(struct dtp * dtp, struct dtcp * dtcp, int len)
+{
+        ktime_t now;
+        u64     gap;
+
+        if (len <= 0)
+                return;
+
+        if (dtcp->sv->pacing_rate)
+                gap = div64_u64((u64) len * NSEC_PER_SEC,
+                                dtcp->sv->pacing_rate);
+        else if (dtcp->sv->sndr_rate)
+                gap = div_u64((u64) len * dtcp->sv->time_unit * NSEC_PER_MSEC,
+                              dtcp->sv->sndr_rate);
+        else
+                return;
+
+        /* Idle flows do not bank credit, this would allow bursts again */
+        now = ktime_get();
+        if (ktime_before(dtp->pace.next, now))
+                dtp->pace.next = now;
+
+        dtp->pace.next = ktime_add_ns(dtp->pace.next, gap);
+}
+
+void dtp_pace_arm(struct dtp * dtp)
+{
+        ktime_t next;
+
+        /* Started under the lock, so it cannot race with dtp_destroy() */
+        spin_lock_bh(&dtp->sv_lock);
+        if (dtp->pace.dying) {
+                spin_unlock_bh(&dtp->sv_lock);
+                return;
+        }
+        next = dtp->pace.next;
+
+        LOG_DBG("rbfc Pacing timer start, %lld ns",
+                ktime_to_ns(ktime_sub(next, ktime_get())));
+
+        hrtimer_start(&dtp->pace.timer, next, HRTIMER_MODE_ABS);
+        spin_unlock_bh(&dtp->sv_lock);
+}
+
+/* Runs in softirq context, the next PDU may depart */
+static void dtp_pace_release(unsigned long arg)
+{
+        struct dtp * dtp;
+
+        dtp = (struct dtp *) arg;
+
+        spin_lock_bh(&dtp->sv_lock);
+        dtp->sv->rate_fulfiled = false;
+        spin_unlock_bh(&dtp->sv_lock);
+
+        if (!dtp->cwq)
+                return;
+
+        efcp_enable_write(dtp->efcp);
+        cwq_deliver(dtp->cwq, dtp, dtp->rmt);
+}
+
+static enum hrtimer_restart dtp_pace_timer(struct hrtimer * timer)
+{
+        struct dtp * dtp;
+
+        dtp = container_of(timer, struct dtp, pace.timer);
+        tasklet_schedule(&dtp->pace.tasklet);
+
+        return HRTIMER_NORESTART;
+}
+
 int dtp_sv_init(struct dtp * dtp,
                 bool         rexmsn_ctrl,
                 bool         window_based,
@@ -804,12 +872,6 @@ int dtp_sv_init(struct dtp * dtp,
         ASSERT(dtp);
         ASSERT(dtp->sv);
 
-	dtp->sv->stats.drop_pdus = 0;
-	dtp->sv->stats.err_pdus = 0;
-	dtp->sv->stats.tx_pdus = 0;
-	dtp->sv->stats.tx_bytes = 0;
-	dtp->sv->stats.rx_pdus = 0;
-	dtp->sv->stats.rx_bytes = 0;
         dtp->sv->rexmsn_ctrl  = rexmsn_ctrl;
         dtp->sv->window_based = window_based;
         dtp->sv->rate_based   = rate_based;
@@ -999,6 +1061,14 @@ struct dtp * dtp_create(struct efcp *       efcp,
 
         dtp->efcp = efcp;
 
+        /* Set up first, dtp_destroy() cancels it whatever the failure */
+        spin_lock_init(&dtp->sv_lock);
+        hrtimer_init(&dtp->pace.timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+        dtp->pace.timer.function = dtp_pace_timer;
+        tasklet_init(&dtp->pace.tasklet, dtp_pace_release, (unsigned long) dtp);
+        dtp->pace.next = ktime_get();
+        dtp->pace.dying = false;
+
 	if (robject_init_and_add(&dtp->robj,
 				 &dtp_rtype,
 				 parent,
@@ -1015,9 +1085,15 @@ struct dtp * dtp_create(struct efcp *       efcp,
                 return NULL;
         }
         *dtp->sv = default_sv;
-        /* FIXME: fixups to the state-vector should be placed here */
 
-        spin_lock_init(&dtp->sv_lock);
+        dtp->stats = alloc_percpu(struct dtp_stats);
+        if (!dtp->stats) {
+                LOG_ERR("Cannot create DTP statistics");
+
+                dtp_destroy(dtp);
+                return NULL;
+        }
+        /* FIXME: fixups to the state-vector should be placed here */
 
         dtp->cfg   = dtp_cfg;
         dtp->rmt  = rmt;
@@ -1079,6 +1155,17 @@ int dtp_destroy(struct dtp * instance)
         if (!instance)
                 return -1;
 
+        /*
+         * A running pace tasklet may re-arm the timer until it sees the
+         * dying flag, hence the second cancel once it is gone
+         */
+        spin_lock_bh(&instance->sv_lock);
+        instance->pace.dying = true;
+        spin_unlock_bh(&instance->sv_lock);
+        hrtimer_cancel(&instance->pace.timer);
+        tasklet_kill(&instance->pace.tasklet);
+        hrtimer_cancel(&instance->pace.timer);
+
 	spin_lock_bh(&instance->lock);
 
         if (instance->dtcp) {
@@ -1134,6 +1221,7 @@ int dtp_destroy(struct dtp * instance)
 
         if (instance->seqq) squeue_destroy(instance->seqq);
         if (instance->sv)   rkfree(instance->sv);
+        if (instance->stats) free_percpu(instance->stats);
         if (instance->cfg) dtp_config_destroy(instance->cfg);
         rina_component_fini(&instance->base);
 
@@ -1150,19 +1238,27 @@ static bool window_is_closed(struct dtp *    dtp,
                              seq_num_t       seq_num,
                              struct dtp_ps * ps)
 {
-        bool retval = false, w_ret = false, r_ret = false;
+        bool retval = false, w_ret = false, r_ret = false, paced = false;
 
         ASSERT(dtp);
         ASSERT(dtcp);
 
         spin_lock_bh(&dtp->sv_lock);
-        if (dtp->sv->window_based && seq_num > dtcp->sv->snd_rt_wind_edge) {
+        if (dtp->sv->window_based && seq_num > dtcp_snd_rt_wind_edge(dtcp)) {
         	dtp->sv->window_closed = true;
                 w_ret = true;
         }
 
+        /* Paced by the congestion control policy */
+        if (dtp->sv->window_based && !w_ret && dtcp->sv->pacing_rate &&
+            dtp_pace_closed(dtp)) {
+                w_ret = true;
+                paced = true;
+        }
+
         if (dtp->sv->rate_based) {
-        	if(dtcp_rate_exceeded(dtcp, 1)) {
+        	if (dtp->sv->rate_pacing ? dtp_pace_closed(dtp) :
+        	    dtcp_rate_exceeded(dtcp, 1)) {
         		dtp->sv->rate_fulfiled = true;
         		r_ret = true;
 		} else {
@@ -1175,8 +1271,15 @@ static bool window_is_closed(struct dtp *    dtp,
 
         spin_unlock_bh(&dtp->sv_lock);
 
-        if (r_ret)
-        	dtp_start_rate_timer(dtp, dtcp);
+        if (r_ret) {
+        	if (dtp->sv->rate_pacing)
+        		dtp_pace_arm(dtp);
+        	else
+        		dtp_start_rate_timer(dtp, dtcp);
+        }
+
+        if (paced)
+        	dtp_pace_arm(dtp);
 
         retval = (w_ret || r_ret);
 
@@ -1202,6 +1305,9 @@ int dtp_write(struct dtp * instance,
         efcp = instance->efcp;
         dtcp = instance->dtcp;
 
+        trace_dtp_write(efcp->connection->source_cep_id, du_len(du));
+        dp_lat_record(rmt_dp_lat(instance->rmt), DP_LAT_TX_DTP, du);
+
 #if DTP_INACTIVITY_TIMERS_ENABLE
         /* Stop SenderInactivityTimer */
         if (rtimer_stop(&instance->timers.sender_inactivity)) {
@@ -1285,7 +1391,13 @@ int dtp_write(struct dtp * instance,
 				rcu_read_unlock();
 				return 0;
 			}
-			if(instance->sv->rate_based) {
+			if (dtp_pace_enabled(instance)) {
+				spin_lock_bh(&instance->sv_lock);
+				dtp_pace_charge(instance, dtcp, sbytes);
+				spin_unlock_bh(&instance->sv_lock);
+			}
+			if(instance->sv->rate_based &&
+			   !instance->sv->rate_pacing) {
 				spin_lock_bh(&instance->sv_lock);
 				sc = dtcp->sv->pdus_sent_in_time_unit;
 				if(sbytes >= 0) {
@@ -1321,9 +1433,7 @@ int dtp_write(struct dtp * instance,
                 }
 
                 rcu_read_unlock();
-                spin_lock_bh(&instance->sv_lock);
-                stats_inc_bytes(tx, instance->sv, sbytes);
-		spin_unlock_bh(&instance->sv_lock);
+                stats_inc_bytes(tx, instance, sbytes);
 #if DTP_INACTIVITY_TIMERS_ENABLE
                 /* Start SenderInactivityTimer */
                 if (rtimer_restart(&instance->timers.sender_inactivity,
@@ -1340,9 +1450,7 @@ int dtp_write(struct dtp * instance,
                          instance->rmt,
                          du))
 		return -1;
-        spin_lock_bh(&instance->sv_lock);
-	stats_inc_bytes(tx, instance->sv, sbytes);
-	spin_unlock_bh(&instance->sv_lock);
+	stats_inc_bytes(tx, instance, sbytes);
 	return 0;
 
 pdu_err_exit:
@@ -1354,9 +1462,7 @@ pdu_stats_err_exit:
 stats_err_exit:
         rcu_read_unlock();
 stats_nounlock_err_exit:
-	spin_lock_bh(&instance->sv_lock);
-	stats_inc(err, instance->sv);
-	spin_unlock_bh(&instance->sv_lock);
+	stats_inc(err, instance);
 	return -1;
 }
 
@@ -1435,6 +1541,9 @@ int dtp_receive(struct dtp * instance,
         dtcp = instance->dtcp;
 	efcp = instance->efcp;
 
+        trace_dtp_receive(efcp->connection->destination_cep_id, du_len(du));
+        dp_lat_record(rmt_dp_lat(instance->rmt), DP_LAT_RX_DTP, du);
+
         spin_lock_bh(&instance->sv_lock);
         a           = instance->sv->A;
         r 	    = instance->sv->R;
@@ -1487,13 +1596,13 @@ int dtp_receive(struct dtp * instance,
                                 }
                         }
                         pdu_post(instance, du);
-			stats_inc_bytes(rx, instance->sv, sbytes);
+			stats_inc_bytes(rx, instance, sbytes);
                         LOG_DBG("Data run flag DRF");
                         return 0;
                 }
                 LOG_ERR("Expecting DRF but not present, dropping PDU %d...",
                         seq_num);
-		stats_inc(drop, instance->sv);
+		stats_drop(drf, instance);
 		spin_unlock_bh(&instance->sv_lock);
                 du_destroy(du);
                 return 0;
@@ -1510,7 +1619,7 @@ int dtp_receive(struct dtp * instance,
         	/* Duplicate PDU or flow control overrun */
         	LOG_ERR("Duplicate PDU or flow control overrun. SN: %u, LWE:%u",
         		 seq_num, LWE);
-                stats_inc(drop, instance->sv);
+                stats_drop(dup, instance);
                 spin_unlock_bh(&instance->sv_lock);
                 du_destroy(du);
 
@@ -1579,9 +1688,7 @@ int dtp_receive(struct dtp * instance,
                 if (pdu_post(instance, du))
                         return -1;
 
-                spin_lock_bh(&instance->sv_lock);
-		stats_inc_bytes(rx, instance->sv, sbytes);
-		spin_unlock_bh(&instance->sv_lock);
+		stats_inc_bytes(rx, instance, sbytes);
                 return 0;
 
         fail:
@@ -1633,9 +1740,7 @@ int dtp_receive(struct dtp * instance,
                 if (du) {
                 	sbytes = du_data_len(du);
                         pdu_post(instance, du);
-                        spin_lock_bh(&instance->sv_lock);
-			stats_inc_bytes(rx, instance->sv, sbytes);
-			spin_unlock_bh(&instance->sv_lock);
+			stats_inc_bytes(rx, instance, sbytes);
 		}
         }
 
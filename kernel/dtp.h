@@ -66,6 +66,12 @@ void         dtp_squeue_flush(struct dtp * dtp);
 // be processed.
 void         dtp_start_rate_timer(struct dtp * dtp, struct dtcp * dtcp);
 
+/* Rate pacing, see dtp.c */
+bool         dtp_pace_enabled(struct dtp * dtp);
+bool         dtp_pace_closed(struct dtp * dtp);
+void         dtp_pace_charge(struct dtp * dtp, struct dtcp * dtcp, int len);
+void         dtp_pace_arm(struct dtp * dtp);
+
 /* FIXME: temporal addition so that DTCP's sending ack can call this function
  * that was originally static */
 struct pci * process_A_expiration(struct dtp * dtp, struct dtcp * dtcp);
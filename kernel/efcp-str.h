@@ -22,6 +22,8 @@
 #define RINA_EFCP_STR_H
 
 #include <linux/list.h>
+#include <linux/hrtimer.h>
+#include <linux/interrupt.h>
 
 #include "common.h"
 #include "delim.h"
@@ -88,13 +90,18 @@ struct efcp {
 
 struct rtxq_entry {
         unsigned long    time_stamp;
+        ktime_t          tx_time; /* (Re)transmission time, for RTT samples */
         struct du *      du;
         int              retries;
         struct list_head next;
 };
 
+/* Ring of PDUs, the size is a power of 2, head and tail are free running */
 struct cwq {
-        struct rqueue * q;
+        struct du **    ring;
+        uint_t          mask;
+        uint_t          head;
+        uint_t          tail;
         spinlock_t      lock;
 };
 
@@ -125,14 +132,6 @@ struct dtp_sv {
 
         uint_t     seq_number_rollover_threshold;
 	/* FIXME: we need to control rollovers...*/
-	struct {
-		unsigned int drop_pdus;
-		unsigned int err_pdus;
-		unsigned int tx_pdus;
-		unsigned int tx_bytes;
-		unsigned int rx_pdus;
-		unsigned int rx_bytes;
-	} stats;
         seq_num_t  max_seq_nr_rcv;
         seq_num_t  seq_nr_to_send;
         seq_num_t  max_seq_nr_sent;
@@ -142,6 +141,20 @@ struct dtp_sv {
         bool       rate_based;
         bool       drf_required;
         bool       rate_fulfiled;
+        /* Rate-based flow control paces PDUs instead of using time frames */
+        bool       rate_pacing;
+};
+
+/* DTP counters, one block per CPU, see pcpu_stats_get() */
+struct dtp_stats {
+        unsigned long drop_pdus;     /* all the drops, whatever the reason */
+        unsigned long dup_drop_pdus; /* duplicated or flow control overrun */
+        unsigned long drf_drop_pdus; /* DRF expected but not present */
+        unsigned long err_pdus;
+        unsigned long tx_pdus;
+        unsigned long tx_bytes;
+        unsigned long rx_pdus;
+        unsigned long rx_bytes;
 };
 
 struct dtp {
@@ -157,6 +170,7 @@ struct dtp {
          */
         struct dtp_sv *           sv; /* The state-vector */
         spinlock_t          sv_lock; /* The state vector lock (DTP & DTCP) */
+        struct dtp_stats __percpu * stats;
 
         struct rina_component     base;
         struct dtp_config *       cfg;
@@ -171,6 +185,14 @@ struct dtp {
                 struct timer_list rate_window;
                 struct timer_list rtx;
         } timers;
+        struct {
+                struct hrtimer        timer;
+                struct tasklet_struct tasklet;
+                /* Earliest departure time of the next PDU, under sv_lock */
+                ktime_t               next;
+                /* Set under sv_lock by dtp_destroy(), the timer is not armed again */
+                bool                  dying;
+        } pace;
 	struct robject		  robj;
 
 	spinlock_t          lock;
@@ -282,6 +304,19 @@ struct dtcp_sv {
         uint_t       rtt;
         uint_t       srtt;
         uint_t       rttvar;
+
+        /* Congestion control, see the cc_* hooks of the DTCP PS */
+        seq_num_t    snd_una;     /* Highest cumulative ACK received */
+        uint_t       snd_cwnd;    /* In PDUs, 0 if not limited */
+        u64          pacing_rate; /* In bytes/s, 0 if not paced */
+        bool         ecn_echo;    /* Receiver: echo ECN on the next ACK */
+};
+
+/* DTCP counters, one block per CPU, see pcpu_stats_get() */
+struct dtcp_stats {
+        unsigned long ctrl_tx_pdus;
+        unsigned long ctrl_rx_pdus;
+        unsigned long rtx_pdus;     /* retransmitted data PDUs */
 };
 
 struct dtcp {
@@ -297,6 +332,7 @@ struct dtcp {
         struct rmt *           rmt;
 
         atomic_t               cpdus_in_transit;
+        struct dtcp_stats __percpu * stats;
 	struct robject         robj;
 };
 
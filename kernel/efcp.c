@@ -48,6 +48,8 @@
 #include "dtp-utils.h"
 #include "dtp-ps.h"
 #include "policies.h"
+#include "dp-latency.h"
+#include "dp-trace.h"
 
 static ssize_t efcp_attr_show(struct robject *		     robj,
                          	     struct robj_attribute * attr,
@@ -351,6 +353,9 @@ int efcp_container_write(struct efcp_container * container,
 
         du->cfg = container->config;
 
+        trace_efcp_container_write(cep_id, du_len(du));
+        dp_lat_record(rmt_dp_lat(container->rmt), DP_LAT_TX_EFCP, du);
+
         spin_lock_bh(&container->lock);
         efcp = efcp_imap_find(container->instances, cep_id);
         if (!efcp) {
@@ -652,7 +657,7 @@ cep_id_t efcp_connection_create(struct efcp_container * container,
 
         if (dtcp_window_based_fctrl(dtcp_cfg) ||
             dtcp_rate_based_fctrl(dtcp_cfg)) {
-                cwq = cwq_create();
+                cwq = cwq_create(dtcp_max_closed_winq_length(dtcp_cfg));
                 if (!cwq) {
                         LOG_ERR("Failed to create closed window queue");
                         efcp_destroy(efcp);
@@ -703,6 +708,13 @@ cep_id_t efcp_connection_create(struct efcp_container * container,
                 return cep_id_bad();
         }
 
+        if (dtcp && dtcp_rate_based_fctrl(dtcp_cfg)) {
+                rcu_read_lock();
+                efcp->dtp->sv->rate_pacing =
+                        dtcp_ps_get(dtcp)->flowctrl.rate.pacing;
+                rcu_read_unlock();
+        }
+
         /***/
 
         spin_lock_bh(&container->lock);
@@ -891,6 +903,9 @@ int efcp_enqueue(struct efcp * efcp,
         	return -1;
         }
 
+        dp_lat_record(rmt_dp_lat(efcp->container->rmt),
+                      DP_LAT_RX_DELIVER, du);
+
         /* Reassembly goes here */
         if (efcp->delim) {
 		delim_ps = container_of(rcu_dereference(efcp->delim->base.ps),
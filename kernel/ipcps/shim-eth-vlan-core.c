@@ -43,6 +43,9 @@
 
 #define RINA_PREFIX SHIM_NAME
 
+/* SDUs buffered on a flow while it is being allocated */
+#define SDU_QUEUE_MAX_SIZE 256
+
 #include "logs.h"
 #include "kipcm.h"
 #include "debug.h"
@@ -53,6 +56,7 @@
 #include "rinarp/rinarp.h"
 #include "rinarp/arp826-utils.h"
 #include "rds/robjects.h"
+#include "rds/rring.h"
 
 /* FIXME: To be solved properly */
 static struct workqueue_struct * rcv_wq;
@@ -95,7 +99,7 @@ struct shim_eth_flow {
         enum port_id_state     port_id_state;
 
         /* Used when flow is not allocated yet */
-        struct rfifo *         sdu_queue;
+        struct rring *         sdu_queue;
         struct ipcp_instance * user_ipcp;
 };
 
@@ -383,7 +387,7 @@ static int flow_destroy(struct ipcp_instance_data * data,
         if (flow->dest_pa) gpa_destroy(flow->dest_pa);
         if (flow->dest_ha) gha_destroy(flow->dest_ha);
         if (flow->sdu_queue)
-                rfifo_destroy(flow->sdu_queue, (void (*)(void *)) du_destroy);
+                rring_destroy(flow->sdu_queue, (void (*)(void *)) du_destroy);
         rkfree(flow);
 
         return 0;
@@ -495,10 +499,10 @@ static void rinarp_resolve_handler(void *             opaque,
 
                 ASSERT(flow->sdu_queue);
 
-                while (!rfifo_is_empty(flow->sdu_queue)) {
+                while (!rring_is_empty(flow->sdu_queue)) {
                         struct du * tmp = NULL;
 
-                        tmp = rfifo_pop(flow->sdu_queue);
+                        tmp = rring_pop(flow->sdu_queue);
                         ASSERT(tmp);
 
                         LOG_DBG("Got a new element from the fifo");
@@ -512,7 +516,7 @@ static void rinarp_resolve_handler(void *             opaque,
                         }
                 }
 
-                rfifo_destroy(flow->sdu_queue, (void (*)(void *)) du_destroy);
+                rring_destroy(flow->sdu_queue, (void (*)(void *)) du_destroy);
                 flow->sdu_queue = NULL;
 
                 if (kipcm_notify_flow_alloc_req_result(default_kipcm,
@@ -585,7 +589,8 @@ eth_vlan_flow_allocate_request(struct ipcp_instance_data * data,
                 list_add(&flow->list, &data->flows);
                 spin_unlock(&data->lock);
 
-                flow->sdu_queue = rfifo_create();
+                flow->sdu_queue = rring_create(SDU_QUEUE_MAX_SIZE,
+                                               RRING_MPSC);
                 if (!flow->sdu_queue) {
                         LOG_ERR("Couldn't create the sdu queue for a new flow");
                         unbind_and_destroy_flow(data, flow);
@@ -682,10 +687,10 @@ eth_vlan_flow_allocate_response(struct ipcp_instance_data * data,
 
                 ASSERT(flow->sdu_queue);
 
-                while (!rfifo_is_empty(flow->sdu_queue)) {
+                while (!rring_is_empty(flow->sdu_queue)) {
                         struct du * tmp = NULL;
 
-                        tmp = rfifo_pop(flow->sdu_queue);
+                        tmp = rring_pop(flow->sdu_queue);
                         ASSERT(tmp);
 
                         LOG_DBG("Got a new element from the fifo");
@@ -700,7 +705,7 @@ eth_vlan_flow_allocate_response(struct ipcp_instance_data * data,
                         }
                 }
 
-                rfifo_destroy(flow->sdu_queue, (void (*)(void *)) du_destroy);
+                rring_destroy(flow->sdu_queue, (void (*)(void *)) du_destroy);
                 flow->sdu_queue = NULL;
         } else {
                 spin_lock(&data->lock);
@@ -714,7 +719,7 @@ eth_vlan_flow_allocate_response(struct ipcp_instance_data * data,
                  *  the IPC manager deallocates the NULL state flow first.
                  */
                 ASSERT(flow->sdu_queue);
-                rfifo_destroy(flow->sdu_queue, (void (*)(void *)) du_destroy);
+                rring_destroy(flow->sdu_queue, (void (*)(void *)) du_destroy);
                 flow->sdu_queue = NULL;
         }
 
@@ -1296,7 +1301,8 @@ static int eth_vlan_recv_process_packet(struct sk_buff *    skb,
                 flow->port_id_state = PORT_STATE_PENDING;
                 flow->dest_ha       = ghaddr;
                 INIT_LIST_HEAD(&flow->list);
-                flow->sdu_queue = rfifo_create_ni();
+                flow->sdu_queue = rring_create_ni(SDU_QUEUE_MAX_SIZE,
+                                                  RRING_MPSC);
                 if (!flow->sdu_queue) {
                         LOG_ERR("Couldn't create the SDU queue "
                                 "for a new flow");
@@ -1307,13 +1313,13 @@ static int eth_vlan_recv_process_packet(struct sk_buff *    skb,
                 }
 
                 /* Store SDU in queue */
-                if (rfifo_push_ni(flow->sdu_queue, du)) {
+                if (rring_push(flow->sdu_queue, du)) {
                         LOG_ERR("Could not push a SDU into the flow queue");
                         du_destroy(du);
                         gha_destroy(ghaddr);
-                        rkfree (flow);
-                        rfifo_destroy(flow->sdu_queue,
+                        rring_destroy(flow->sdu_queue,
                                       (void (*)(void *)) du_destroy);
+                        rkfree(flow);
                         return -1;
                 }
 
@@ -1358,7 +1364,7 @@ static int eth_vlan_recv_process_packet(struct sk_buff *    skb,
                 } else if (flow->port_id_state == PORT_STATE_PENDING) {
                         LOG_DBG("Queueing frame");
 
-                        if (rfifo_push_ni(flow->sdu_queue, du)) {
+                        if (rring_push(flow->sdu_queue, du)) {
                                 LOG_ERR("Failed to write %zd bytes"
                                         "into the fifo",
                                         sizeof(struct sdu *));
@@ -1805,6 +1811,14 @@ static int eth_vlan_netdev_notify(struct notifier_block *nb,
 			ntfy_user_ipcp_on_if_state_change(pos, false);
 			break;
 
+		case NETDEV_CHANGE:
+			/* Carrier loss leaves the device up, report it too */
+			LOG_INFO("Device %s carrier is %s", dev->name,
+				 netif_carrier_ok(dev) ? "on" : "off");
+			ntfy_user_ipcp_on_if_state_change(pos,
+							  netif_carrier_ok(dev));
+			break;
+
 		default:
 			LOG_DBG("Ignoring event %lu on device %s",
 				event, dev->name);
@@ -0,0 +1,1708 @@
+/*
+ * Shim IPC Process for local loopback (in-memory pipe)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * All the shim-loopback instances assigned to the same DIF form a segment:
+ * a flow can be allocated from any application registered to one of them to
+ * any application registered to any of them (itself included). PDUs written
+ * on a flow go through the sender's pipe, which emulates a link with a
+ * configurable rate, delay, jitter, loss and queue size, and are delivered to
+ * the other end from softirq context, as a NIC driver would do.
+ *
+ * Configuration parameters (all optional, all unsigned integers):
+ *
+ *   delay-us      one-way delay                        (default 0)
+ *   jitter-us     uniform extra delay in [0, jitter]   (default 0, reorders)
+ *   loss-ppm      PDU loss probability, per million    (default 0)
+ *   rate-kbps     link rate                            (default 0, unlimited)
+ *   queue-size    max PDUs in flight on the pipe       (default 1024)
+ *   max-sdu-size  max SDU size accepted                (default 1500)
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/string.h>
+#include <linux/list.h>
+#include <linux/mutex.h>
+#include <linux/hrtimer.h>
+#include <linux/interrupt.h>
+#include <linux/ktime.h>
+#include <linux/random.h>
+#include <linux/skbuff.h>
+
+#define SHIM_NAME   "shim-loopback"
+#define RINA_PREFIX SHIM_NAME
+
+#include "logs.h"
+#include "kipcm.h"
+#include "debug.h"
+#include "utils.h"
+#include "du.h"
+#include "ipcp-utils.h"
+#include "ipcp-factories.h"
+#include "rds/robjects.h"
+
+/* FIXME: To be removed ABSOLUTELY */
+extern struct kipcm * default_kipcm;
+
+static struct workqueue_struct * loop_wq;
+
+static struct ipcp_factory_data {
+        struct list_head instances;
+} loop_data;
+
+/*
+ * The mutex serializes the control path (registrations, flow allocation and
+ * deallocation). The instances list is modified holding the mutex and the
+ * rwlock, so it can be browsed holding either: the datapath only takes the
+ * rwlock for reading. The flows and the pipe of each instance are protected
+ * by its own spinlock, so instances do not contend with each other.
+ */
+static DEFINE_MUTEX(loop_mutex);
+static DEFINE_RWLOCK(loop_lock);
+
+enum port_id_state {
+        PORT_STATE_NULL = 1,
+        PORT_STATE_PENDING,
+        PORT_STATE_ALLOCATED
+};
+
+/* Holds the information related to one flow */
+struct loop_flow {
+        struct list_head       list;
+
+        port_id_t              port_id;
+        enum port_id_state     port_id_state;
+        struct ipcp_instance * user_ipcp;
+
+        /* The other end of the flow */
+        ipc_process_id_t       peer_id;
+        port_id_t              peer_port_id;
+};
+
+/* An application (and its DAF) registered to the shim */
+struct loop_reg {
+        struct list_head list;
+        struct name *    app_name;
+        struct name *    daf_name;
+};
+
+/* A PDU travelling through a pipe */
+struct loop_pdu {
+        struct list_head list;
+        struct sk_buff * skb;
+        ipc_process_id_t dst_id;
+        port_id_t        dst_port_id;
+        ktime_t          due;
+};
+
+struct loop_params {
+        unsigned int delay_us;
+        unsigned int jitter_us;
+        unsigned int loss_ppm;
+        unsigned int rate_kbps;
+        unsigned int queue_size;
+        unsigned int max_sdu_size;
+};
+
+/* The emulated link, one per instance (its egress direction) */
+struct loop_pipe {
+        struct loop_params    params;
+
+        struct list_head      queue;      /* Sorted by due time */
+        unsigned int          queue_len;
+        ktime_t               link_free;  /* When the last PDU is on wire */
+        bool                  tx_busy;
+        bool                  stopping;
+
+        struct hrtimer        timer;
+        struct tasklet_struct tasklet;
+
+        uint64_t              tx_pdus;
+        uint64_t              delivered_pdus;
+        uint64_t              lost_pdus;
+        uint64_t              dropped_pdus;
+};
+
+/*
+ * Contains all the information associated to an instance of a
+ * shim loopback IPC Process
+ */
+struct ipcp_instance_data {
+        struct list_head   list;
+        ipc_process_id_t   id;
+
+        struct name *      name;
+        struct name *      dif_name;
+        struct flow_spec * fspec;
+
+        /* FIXME: Remove it as soon as the kipcm_kfa gets removed */
+        struct kfa *       kfa;
+
+        struct list_head   regs;
+
+        /* Protects flows and pipe */
+        spinlock_t         lock;
+        struct list_head   flows;
+
+        struct loop_pipe   pipe;
+};
+
+/* Passed to the workers of the control path */
+struct loop_work {
+        ipc_process_id_t src_id;
+        port_id_t        src_port_id;
+        ipc_process_id_t dst_id;
+        port_id_t        dst_port_id;
+        struct name *    source;
+        struct name *    dest;
+        bool             granted;
+};
+
+static ssize_t loop_ipcp_attr_show(struct robject *        robj,
+                                   struct robj_attribute * attr,
+                                   char *                  buf)
+{
+        struct ipcp_instance * instance;
+        struct loop_pipe *     pipe;
+
+        instance = container_of(robj, struct ipcp_instance, robj);
+        if (!instance || !instance->data)
+                return 0;
+
+        pipe = &instance->data->pipe;
+
+        if (strcmp(robject_attr_name(attr), "name") == 0)
+                return sprintf(buf, "%s\n",
+                               name_tostring(instance->data->name));
+        if (strcmp(robject_attr_name(attr), "dif") == 0)
+                return sprintf(buf, "%s\n",
+                               name_tostring(instance->data->dif_name));
+        if (strcmp(robject_attr_name(attr), "type") == 0)
+                return sprintf(buf, "shim-loopback\n");
+        if (strcmp(robject_attr_name(attr), "delay_us") == 0)
+                return sprintf(buf, "%u\n", pipe->params.delay_us);
+        if (strcmp(robject_attr_name(attr), "jitter_us") == 0)
+                return sprintf(buf, "%u\n", pipe->params.jitter_us);
+        if (strcmp(robject_attr_name(attr), "loss_ppm") == 0)
+                return sprintf(buf, "%u\n", pipe->params.loss_ppm);
+        if (strcmp(robject_attr_name(attr), "rate_kbps") == 0)
+                return sprintf(buf, "%u\n", pipe->params.rate_kbps);
+        if (strcmp(robject_attr_name(attr), "queue_size") == 0)
+                return sprintf(buf, "%u\n", pipe->params.queue_size);
+        if (strcmp(robject_attr_name(attr), "queue_len") == 0)
+                return sprintf(buf, "%u\n", pipe->queue_len);
+        if (strcmp(robject_attr_name(attr), "tx_pdus") == 0)
+                return sprintf(buf, "%llu\n", pipe->tx_pdus);
+        if (strcmp(robject_attr_name(attr), "delivered_pdus") == 0)
+                return sprintf(buf, "%llu\n", pipe->delivered_pdus);
+        if (strcmp(robject_attr_name(attr), "lost_pdus") == 0)
+                return sprintf(buf, "%llu\n", pipe->lost_pdus);
+        if (strcmp(robject_attr_name(attr), "dropped_pdus") == 0)
+                return sprintf(buf, "%llu\n", pipe->dropped_pdus);
+
+        return 0;
+}
+RINA_SYSFS_OPS(loop_ipcp);
+RINA_ATTRS(loop_ipcp, name, type, dif, delay_us, jitter_us, loss_ppm,
+           rate_kbps, queue_size, queue_len, tx_pdus, delivered_pdus,
+           lost_pdus, dropped_pdus);
+RINA_KTYPE(loop_ipcp);
+
+static struct ipcp_instance_data *
+find_instance(struct ipcp_factory_data * data,
+              ipc_process_id_t           id)
+{
+        struct ipcp_instance_data * pos;
+
+        ASSERT(data);
+
+        list_for_each_entry(pos, &(data->instances), list) {
+                if (pos->id == id)
+                        return pos;
+        }
+
+        return NULL;
+}
+
+/* Must be called with the lock of the instance held */
+static struct loop_flow * find_flow(struct ipcp_instance_data * data,
+                                    port_id_t                   id)
+{
+        struct loop_flow * flow;
+
+        ASSERT(data);
+
+        list_for_each_entry(flow, &data->flows, list) {
+                if (flow->port_id == id)
+                        return flow;
+        }
+
+        return NULL;
+}
+
+/* Must be called with loop_mutex held */
+static struct loop_reg * find_reg(struct ipcp_instance_data * data,
+                                  const struct name *         name)
+{
+        struct loop_reg * reg;
+
+        ASSERT(data);
+        ASSERT(name);
+
+        list_for_each_entry(reg, &data->regs, list) {
+                if (name_is_equal(reg->app_name, name))
+                        return reg;
+                if (reg->daf_name && name_is_equal(reg->daf_name, name))
+                        return reg;
+        }
+
+        return NULL;
+}
+
+/* Must be called with loop_mutex held */
+static struct ipcp_instance_data * find_peer(struct ipcp_instance_data * data,
+                                             const struct name *         dest)
+{
+        struct ipcp_instance_data * pos;
+
+        ASSERT(data);
+        ASSERT(data->dif_name);
+
+        list_for_each_entry(pos, &loop_data.instances, list) {
+                if (!pos->dif_name ||
+                    !name_is_equal(pos->dif_name, data->dif_name))
+                        continue;
+                if (find_reg(pos, dest))
+                        return pos;
+        }
+
+        return NULL;
+}
+
+static void loop_work_destroy(struct loop_work * work)
+{
+        ASSERT(work);
+
+        if (work->source) name_destroy(work->source);
+        if (work->dest)   name_destroy(work->dest);
+        rkfree(work);
+}
+
+static int loop_work_post(int (* worker)(void * data),
+                          struct loop_work * work)
+{
+        struct rwq_work_item * item;
+
+        item = rwq_work_create(worker, work);
+        if (!item) {
+                loop_work_destroy(work);
+                return -1;
+        }
+
+        if (rwq_work_post(loop_wq, item)) {
+                rwq_work_destroy(item);
+                loop_work_destroy(work);
+                return -1;
+        }
+
+        return 0;
+}
+
+static void flow_destroy(struct ipcp_instance_data * data,
+                         struct loop_flow *          flow)
+{
+        ASSERT(data);
+        ASSERT(flow);
+
+        spin_lock_bh(&data->lock);
+        if (!list_empty(&flow->list))
+                list_del(&flow->list);
+        spin_unlock_bh(&data->lock);
+
+        rkfree(flow);
+}
+
+static void unbind_and_destroy_flow(struct ipcp_instance_data * data,
+                                    struct loop_flow *          flow)
+{
+        ASSERT(data);
+        ASSERT(flow);
+
+        if (flow->user_ipcp) {
+                ASSERT(flow->user_ipcp->ops);
+                flow->user_ipcp->ops->
+                        flow_unbinding_ipcp(flow->user_ipcp->data,
+                                            flow->port_id);
+        }
+
+        flow_destroy(data, flow);
+}
+
+/*
+ * The pipe
+ */
+
+static void loop_enable_write(struct ipcp_instance_data * data)
+{
+        struct loop_flow *      flow;
+        struct ipcp_instance ** users;
+        port_id_t *             ports;
+        unsigned int            count, i;
+
+        /* enable_write() may write again on us, call it unlocked */
+        spin_lock(&data->lock);
+        count = 0;
+        list_for_each_entry(flow, &data->flows, list)
+                count++;
+        if (!count) {
+                spin_unlock(&data->lock);
+                return;
+        }
+        users = rkmalloc(count * (sizeof(*users) + sizeof(*ports)),
+                         GFP_ATOMIC);
+        if (!users) {
+                spin_unlock(&data->lock);
+                return;
+        }
+        ports = (port_id_t *) (users + count);
+        i     = 0;
+        list_for_each_entry(flow, &data->flows, list) {
+                if (!flow->user_ipcp ||
+                    flow->port_id_state != PORT_STATE_ALLOCATED)
+                        continue;
+                users[i] = flow->user_ipcp;
+                ports[i] = flow->port_id;
+                i++;
+        }
+        spin_unlock(&data->lock);
+
+        count = i;
+        for (i = 0; i < count; i++) {
+                if (users[i]->ops && users[i]->ops->enable_write)
+                        users[i]->ops->enable_write(users[i]->data, ports[i]);
+        }
+
+        rkfree(users);
+}
+
+/* Returns false if the PDU was dropped for lack of a flow at the other end */
+static bool loop_deliver(struct loop_pdu * pdu)
+{
+        struct ipcp_instance_data * dst;
+        struct loop_flow *          flow;
+        struct ipcp_instance *      user_ipcp = NULL;
+        port_id_t                   port_id = port_id_bad();
+        struct du *                 du;
+
+        read_lock(&loop_lock);
+        dst = find_instance(&loop_data, pdu->dst_id);
+        if (dst) {
+                spin_lock(&dst->lock);
+                flow = find_flow(dst, pdu->dst_port_id);
+                if (flow && flow->port_id_state == PORT_STATE_ALLOCATED) {
+                        user_ipcp = flow->user_ipcp;
+                        port_id   = flow->port_id;
+                }
+                spin_unlock(&dst->lock);
+        }
+        read_unlock(&loop_lock);
+
+        if (!user_ipcp) {
+                LOG_DBG("No flow at the other end, dropping PDU");
+                kfree_skb(pdu->skb);
+                return false;
+        }
+
+        du = du_create_from_skb(pdu->skb);
+        if (!du) {
+                LOG_ERR("Could not create DU from buffer");
+                kfree_skb(pdu->skb);
+                return true;
+        }
+
+        ASSERT(user_ipcp->ops);
+        ASSERT(user_ipcp->ops->du_enqueue);
+        if (user_ipcp->ops->du_enqueue(user_ipcp->data, port_id, du))
+                LOG_ERR("Couldn't enqueue DU to user IPCP");
+
+        return true;
+}
+
+/* Runs in softirq context, delivers all the PDUs whose time has come */
+static void loop_pipe_drain(unsigned long arg)
+{
+        struct ipcp_instance_data * data;
+        struct loop_pipe *          pipe;
+        struct loop_pdu *           pdu, * nxt;
+        struct list_head            due;
+        ktime_t                     now;
+        bool                        notify;
+        uint64_t                    delivered = 0, dropped = 0;
+
+        data = (struct ipcp_instance_data *) arg;
+        pipe = &data->pipe;
+        now  = ktime_get();
+
+        INIT_LIST_HEAD(&due);
+
+        spin_lock(&data->lock);
+        list_for_each_entry_safe(pdu, nxt, &pipe->queue, list) {
+                if (ktime_compare(pdu->due, now) > 0) {
+                        if (!pipe->stopping)
+                                hrtimer_start(&pipe->timer, pdu->due,
+                                              HRTIMER_MODE_ABS);
+                        break;
+                }
+                list_move_tail(&pdu->list, &due);
+                pipe->queue_len--;
+        }
+        notify = pipe->tx_busy && pipe->queue_len < pipe->params.queue_size;
+        if (notify)
+                pipe->tx_busy = false;
+        spin_unlock(&data->lock);
+
+        list_for_each_entry_safe(pdu, nxt, &due, list) {
+                list_del(&pdu->list);
+                if (loop_deliver(pdu))
+                        delivered++;
+                else
+                        dropped++;
+                rkfree(pdu);
+        }
+
+        spin_lock(&data->lock);
+        pipe->delivered_pdus += delivered;
+        pipe->dropped_pdus   += dropped;
+        spin_unlock(&data->lock);
+
+        if (notify)
+                loop_enable_write(data);
+}
+
+static enum hrtimer_restart loop_pipe_timer(struct hrtimer * timer)
+{
+        struct loop_pipe * pipe;
+
+        pipe = container_of(timer, struct loop_pipe, timer);
+        tasklet_schedule(&pipe->tasklet);
+
+        return HRTIMER_NORESTART;
+}
+
+static void loop_pipe_init(struct ipcp_instance_data * data)
+{
+        struct loop_pipe * pipe;
+
+        ASSERT(data);
+
+        pipe = &data->pipe;
+
+        pipe->params.delay_us     = 0;
+        pipe->params.jitter_us    = 0;
+        pipe->params.loss_ppm     = 0;
+        pipe->params.rate_kbps    = 0;
+        pipe->params.queue_size   = 1024;
+        pipe->params.max_sdu_size = 1500;
+
+        INIT_LIST_HEAD(&pipe->queue);
+        pipe->queue_len = 0;
+        pipe->link_free = ktime_set(0, 0);
+        pipe->tx_busy   = false;
+        pipe->stopping  = false;
+
+        hrtimer_init(&pipe->timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+        pipe->timer.function = loop_pipe_timer;
+        tasklet_init(&pipe->tasklet, loop_pipe_drain, (unsigned long) data);
+}
+
+static void loop_pipe_fini(struct ipcp_instance_data * data)
+{
+        struct loop_pipe * pipe;
+        struct loop_pdu *  pdu, * nxt;
+
+        ASSERT(data);
+
+        pipe = &data->pipe;
+
+        spin_lock_bh(&data->lock);
+        pipe->stopping = true;
+        spin_unlock_bh(&data->lock);
+
+        hrtimer_cancel(&pipe->timer);
+        tasklet_kill(&pipe->tasklet);
+
+        list_for_each_entry_safe(pdu, nxt, &pipe->queue, list) {
+                list_del(&pdu->list);
+                kfree_skb(pdu->skb);
+                rkfree(pdu);
+        }
+        pipe->queue_len = 0;
+}
+
+/* Must be called with the instance lock held, returns when the PDU is due */
+static ktime_t loop_pipe_schedule(struct loop_pipe * pipe,
+                                  size_t             len,
+                                  ktime_t            now)
+{
+        ktime_t start;
+        u32     extra;
+
+        start = now;
+        if (pipe->params.rate_kbps) {
+                if (ktime_compare(pipe->link_free, now) > 0)
+                        start = pipe->link_free;
+                /* bits / (kbits/s) = ms, hence the 10^6 for ns */
+                start = ktime_add_ns(start,
+                                     div_u64((u64) len * 8 * NSEC_PER_MSEC,
+                                             pipe->params.rate_kbps));
+                pipe->link_free = start;
+        }
+
+        extra = pipe->params.delay_us;
+        if (pipe->params.jitter_us)
+                extra += prandom_u32() % (pipe->params.jitter_us + 1);
+
+        return ktime_add_us(start, extra);
+}
+
+/*
+ * The IPCP operations
+ */
+
+static int loop_flow_arrived_worker(void * o);
+static int loop_flow_result_worker(void * o);
+static int loop_flow_deallocated_worker(void * o);
+
+static int loop_flow_allocate_request(struct ipcp_instance_data * data,
+                                      struct ipcp_instance *      user_ipcp,
+                                      const struct name *         source,
+                                      const struct name *         dest,
+                                      const struct flow_spec *    fspec,
+                                      port_id_t                   id)
+{
+        struct ipcp_instance_data * peer;
+        struct loop_flow *          flow;
+        struct loop_work *          work;
+
+        if (!data) {
+                LOG_ERR("Bogus data passed, bailing out");
+                return -1;
+        }
+        if (!source || !dest) {
+                LOG_ERR("Bogus application names passed, bailing out");
+                return -1;
+        }
+        if (!is_port_id_ok(id)) {
+                LOG_ERR("Invalid port ID passed, bailing out");
+                return -1;
+        }
+        if (!data->dif_name) {
+                LOG_ERR("IPC process not assigned to a DIF yet");
+                return -1;
+        }
+
+        work = rkzalloc(sizeof(*work), GFP_KERNEL);
+        if (!work)
+                return -1;
+
+        work->source = name_dup(source);
+        work->dest   = name_dup(dest);
+        if (!work->source || !work->dest) {
+                loop_work_destroy(work);
+                return -1;
+        }
+
+        flow = rkzalloc(sizeof(*flow), GFP_KERNEL);
+        if (!flow) {
+                loop_work_destroy(work);
+                return -1;
+        }
+
+        mutex_lock(&loop_mutex);
+
+        peer = find_peer(data, dest);
+        if (!peer) {
+                char * tmp = name_tostring(dest);
+
+                mutex_unlock(&loop_mutex);
+                LOG_ERR("Application %s is not registered in the DIF", tmp);
+                if (tmp) rkfree(tmp);
+                rkfree(flow);
+                loop_work_destroy(work);
+                return -1;
+        }
+
+        spin_lock_bh(&data->lock);
+        if (find_flow(data, id)) {
+                spin_unlock_bh(&data->lock);
+                mutex_unlock(&loop_mutex);
+                LOG_ERR("Flow for port-id %d already exists", id);
+                rkfree(flow);
+                loop_work_destroy(work);
+                return -1;
+        }
+
+        flow->port_id       = id;
+        flow->port_id_state = PORT_STATE_PENDING;
+        flow->user_ipcp     = user_ipcp;
+        flow->peer_id       = peer->id;
+        flow->peer_port_id  = port_id_bad();
+        INIT_LIST_HEAD(&flow->list);
+        list_add(&flow->list, &data->flows);
+        spin_unlock_bh(&data->lock);
+
+        mutex_unlock(&loop_mutex);
+
+        work->src_id      = data->id;
+        work->src_port_id = id;
+        work->dst_id      = peer->id;
+
+        if (loop_work_post(loop_flow_arrived_worker, work)) {
+                LOG_ERR("Could not post the flow arrival");
+                flow_destroy(data, flow);
+                return -1;
+        }
+
+        return 0;
+}
+
+/* Must be called with loop_mutex held */
+static void loop_flow_fail(struct ipcp_instance_data * data,
+                           port_id_t                   port_id)
+{
+        struct loop_flow * flow;
+
+        spin_lock_bh(&data->lock);
+        flow = find_flow(data, port_id);
+        spin_unlock_bh(&data->lock);
+        if (!flow)
+                return;
+
+        if (kipcm_notify_flow_alloc_req_result(default_kipcm, data->id,
+                                               port_id, 1))
+                LOG_ERR("Couldn't tell KIPCM the flow allocation failed");
+
+        kfa_port_id_release(data->kfa, port_id);
+        unbind_and_destroy_flow(data, flow);
+}
+
+/* On the destination, posted by the source on flow allocation request */
+static int loop_flow_arrived_worker(void * o)
+{
+        struct loop_work *          work;
+        struct ipcp_instance_data * src, * dst;
+        struct loop_reg *           reg;
+        struct loop_flow *          flow, * src_flow;
+        struct ipcp_instance *      user_ipcp, * ipcp;
+        port_id_t                   port_id;
+
+        work = (struct loop_work *) o;
+        ASSERT(work);
+
+        mutex_lock(&loop_mutex);
+
+        src = find_instance(&loop_data, work->src_id);
+        if (!src) {
+                LOG_DBG("Source shim is gone, ignoring flow arrival");
+                goto out;
+        }
+
+        dst = find_instance(&loop_data, work->dst_id);
+        reg = dst ? find_reg(dst, work->dest) : NULL;
+        if (!reg) {
+                LOG_ERR("Destination application unregistered meanwhile");
+                goto fail;
+        }
+
+        user_ipcp = kipcm_find_ipcp_by_name(default_kipcm, reg->app_name);
+        if (!user_ipcp)
+                user_ipcp = kfa_ipcp_instance(dst->kfa);
+        ipcp = kipcm_find_ipcp(default_kipcm, dst->id);
+        if (!user_ipcp || !ipcp) {
+                LOG_ERR("Could not find required ipcps");
+                goto fail;
+        }
+
+        flow = rkzalloc(sizeof(*flow), GFP_KERNEL);
+        if (!flow)
+                goto fail;
+
+        port_id = kfa_port_id_reserve(dst->kfa, dst->id);
+        if (!is_port_id_ok(port_id)) {
+                LOG_ERR("Could not reserve a port-id");
+                rkfree(flow);
+                goto fail;
+        }
+
+        if (!user_ipcp->ops->ipcp_name(user_ipcp->data)) {
+                LOG_DBG("This flow goes for an app");
+                if (kfa_flow_create(dst->kfa, port_id, ipcp, dst->id,
+                                    NULL, false)) {
+                        LOG_ERR("Could not create flow in KFA");
+                        kfa_port_id_release(dst->kfa, port_id);
+                        rkfree(flow);
+                        goto fail;
+                }
+        }
+
+        flow->port_id       = port_id;
+        flow->port_id_state = PORT_STATE_PENDING;
+        flow->user_ipcp     = user_ipcp;
+        flow->peer_id       = src->id;
+        flow->peer_port_id  = work->src_port_id;
+        INIT_LIST_HEAD(&flow->list);
+
+        spin_lock_bh(&dst->lock);
+        list_add(&flow->list, &dst->flows);
+        spin_unlock_bh(&dst->lock);
+
+        spin_lock_bh(&src->lock);
+        src_flow = find_flow(src, work->src_port_id);
+        if (src_flow)
+                src_flow->peer_port_id = port_id;
+        spin_unlock_bh(&src->lock);
+
+        if (kipcm_flow_arrived(default_kipcm,
+                               dst->id,
+                               port_id,
+                               dst->dif_name,
+                               work->dest,
+                               work->source,
+                               dst->fspec)) {
+                LOG_ERR("Couldn't tell the KIPCM about the flow");
+                kfa_port_id_release(dst->kfa, port_id);
+                flow_destroy(dst, flow);
+                goto fail;
+        }
+
+ out:
+        mutex_unlock(&loop_mutex);
+        loop_work_destroy(work);
+        return 0;
+
+ fail:
+        loop_flow_fail(src, work->src_port_id);
+        mutex_unlock(&loop_mutex);
+        loop_work_destroy(work);
+        return -1;
+}
+
+static int loop_flow_allocate_response(struct ipcp_instance_data * data,
+                                       struct ipcp_instance *      user_ipcp,
+                                       port_id_t                   port_id,
+                                       int                         result)
+{
+        struct loop_flow *     flow;
+        struct ipcp_instance * ipcp;
+        struct loop_work *     work;
+        bool                   granted;
+
+        if (!data) {
+                LOG_ERR("Bogus data passed, bailing out");
+                return -1;
+        }
+        if (!is_port_id_ok(port_id)) {
+                LOG_ERR("Invalid port ID passed, bailing out");
+                return -1;
+        }
+        if (!user_ipcp) {
+                LOG_ERR("Wrong user_ipcp passed, bailing out");
+                kfa_port_id_release(data->kfa, port_id);
+                return -1;
+        }
+
+        work = rkzalloc(sizeof(*work), GFP_KERNEL);
+        if (!work) {
+                kfa_port_id_release(data->kfa, port_id);
+                return -1;
+        }
+
+        mutex_lock(&loop_mutex);
+
+        spin_lock_bh(&data->lock);
+        flow = find_flow(data, port_id);
+        if (!flow || flow->port_id_state != PORT_STATE_PENDING) {
+                spin_unlock_bh(&data->lock);
+                mutex_unlock(&loop_mutex);
+                LOG_ERR("No pending flow for port-id %d", port_id);
+                kfa_port_id_release(data->kfa, port_id);
+                loop_work_destroy(work);
+                return -1;
+        }
+        work->src_id      = flow->peer_id;
+        work->src_port_id = flow->peer_port_id;
+        spin_unlock_bh(&data->lock);
+
+        granted = false;
+        if (!result) {
+                ipcp = kipcm_find_ipcp(default_kipcm, data->id);
+                if (!ipcp) {
+                        LOG_ERR("KIPCM could not retrieve this IPCP");
+                } else if (user_ipcp->ops->flow_binding_ipcp(user_ipcp->data,
+                                                             port_id,
+                                                             ipcp)) {
+                        LOG_ERR("Could not bind flow with user_ipcp");
+                } else {
+                        granted = true;
+                }
+        }
+        work->granted = granted;
+
+        if (granted) {
+                spin_lock_bh(&data->lock);
+                flow->port_id_state = PORT_STATE_ALLOCATED;
+                flow->user_ipcp     = user_ipcp;
+                spin_unlock_bh(&data->lock);
+        } else {
+                /*
+                 * Keep the flow in NULL state until the IPC Manager
+                 * deallocates it, as the other shims do
+                 */
+                spin_lock_bh(&data->lock);
+                flow->port_id_state = PORT_STATE_NULL;
+                flow->peer_port_id  = port_id_bad();
+                spin_unlock_bh(&data->lock);
+        }
+
+        /* The worker frees work, it must not be touched after this */
+        if (loop_work_post(loop_flow_result_worker, work)) {
+                LOG_ERR("Could not post the flow allocation result");
+                spin_lock_bh(&data->lock);
+                flow->port_id_state = PORT_STATE_NULL;
+                flow->peer_port_id  = port_id_bad();
+                spin_unlock_bh(&data->lock);
+                mutex_unlock(&loop_mutex);
+                kfa_port_id_release(data->kfa, port_id);
+                return -1;
+        }
+
+        mutex_unlock(&loop_mutex);
+
+        if (!result && !granted) {
+                kfa_port_id_release(data->kfa, port_id);
+                return -1;
+        }
+
+        return 0;
+}
+
+/* On the source, posted by the destination on flow allocation response */
+static int loop_flow_result_worker(void * o)
+{
+        struct loop_work *          work;
+        struct ipcp_instance_data * src;
+        struct loop_flow *          flow;
+        struct ipcp_instance *      ipcp;
+
+        work = (struct loop_work *) o;
+        ASSERT(work);
+
+        mutex_lock(&loop_mutex);
+
+        src = find_instance(&loop_data, work->src_id);
+        if (!src)
+                goto out;
+
+        spin_lock_bh(&src->lock);
+        flow = find_flow(src, work->src_port_id);
+        spin_unlock_bh(&src->lock);
+        if (!flow || flow->port_id_state != PORT_STATE_PENDING)
+                goto out;
+
+        if (!work->granted) {
+                loop_flow_fail(src, work->src_port_id);
+                goto out;
+        }
+
+        ipcp = kipcm_find_ipcp(default_kipcm, src->id);
+        if (!ipcp) {
+                LOG_ERR("KIPCM could not retrieve this IPCP");
+                loop_flow_fail(src, work->src_port_id);
+                goto out;
+        }
+
+        ASSERT(flow->user_ipcp);
+        ASSERT(flow->user_ipcp->ops);
+        ASSERT(flow->user_ipcp->ops->flow_binding_ipcp);
+        if (flow->user_ipcp->ops->flow_binding_ipcp(flow->user_ipcp->data,
+                                                    flow->port_id,
+                                                    ipcp)) {
+                LOG_ERR("Could not bind flow with user_ipcp");
+                loop_flow_fail(src, work->src_port_id);
+                goto out;
+        }
+
+        spin_lock_bh(&src->lock);
+        flow->port_id_state = PORT_STATE_ALLOCATED;
+        spin_unlock_bh(&src->lock);
+
+        if (kipcm_notify_flow_alloc_req_result(default_kipcm, src->id,
+                                               flow->port_id, 0)) {
+                LOG_ERR("Couldn't tell flow is allocated to KIPCM");
+                unbind_and_destroy_flow(src, flow);
+        }
+
+ out:
+        mutex_unlock(&loop_mutex);
+        loop_work_destroy(work);
+        return 0;
+}
+
+static int loop_flow_deallocate(struct ipcp_instance_data * data,
+                                port_id_t                   id)
+{
+        struct loop_flow * flow;
+        struct loop_work * work;
+
+        if (!data) {
+                LOG_ERR("Bogus data passed, bailing out");
+                return -1;
+        }
+        if (!is_port_id_ok(id)) {
+                LOG_ERR("Invalid port ID passed, bailing out");
+                return -1;
+        }
+
+        work = rkzalloc(sizeof(*work), GFP_KERNEL);
+        if (!work)
+                return -1;
+
+        mutex_lock(&loop_mutex);
+
+        spin_lock_bh(&data->lock);
+        flow = find_flow(data, id);
+        if (!flow) {
+                spin_unlock_bh(&data->lock);
+                mutex_unlock(&loop_mutex);
+                LOG_ERR("Flow does not exist, cannot remove");
+                loop_work_destroy(work);
+                return -1;
+        }
+        work->dst_id      = flow->peer_id;
+        work->dst_port_id = flow->peer_port_id;
+        spin_unlock_bh(&data->lock);
+
+        unbind_and_destroy_flow(data, flow);
+
+        mutex_unlock(&loop_mutex);
+
+        if (!is_port_id_ok(work->dst_port_id)) {
+                loop_work_destroy(work);
+                return 0;
+        }
+
+        return loop_work_post(loop_flow_deallocated_worker, work);
+}
+
+/* On the other end, posted on flow deallocation */
+static int loop_flow_deallocated_worker(void * o)
+{
+        struct loop_work *          work;
+        struct ipcp_instance_data * dst;
+        struct loop_flow *          flow = NULL;
+
+        work = (struct loop_work *) o;
+        ASSERT(work);
+
+        mutex_lock(&loop_mutex);
+
+        dst = find_instance(&loop_data, work->dst_id);
+        if (dst) {
+                spin_lock_bh(&dst->lock);
+                flow = find_flow(dst, work->dst_port_id);
+                spin_unlock_bh(&dst->lock);
+        }
+
+        if (flow) {
+                LOG_DBG("Notifying KIPCM about deallocate");
+                kipcm_notify_flow_dealloc(dst->id, 0, flow->port_id, 1);
+                kfa_port_id_release(dst->kfa, flow->port_id);
+                unbind_and_destroy_flow(dst, flow);
+        }
+
+        mutex_unlock(&loop_mutex);
+        loop_work_destroy(work);
+
+        return 0;
+}
+
+static int loop_unbind_user_ipcp(struct ipcp_instance_data * data,
+                                 port_id_t                   id)
+{
+        struct loop_flow * flow;
+
+        if (!data) {
+                LOG_ERR("Bogus data passed, bailing out");
+                return -1;
+        }
+
+        spin_lock_bh(&data->lock);
+        flow = find_flow(data, id);
+        if (!flow) {
+                spin_unlock_bh(&data->lock);
+                LOG_WARN("Could not find flow %d", id);
+                return -1;
+        }
+        flow->user_ipcp = NULL;
+        spin_unlock_bh(&data->lock);
+
+        return 0;
+}
+
+static int loop_application_register(struct ipcp_instance_data * data,
+                                     const struct name *         name,
+                                     const struct name *         daf_name)
+{
+        struct loop_reg * reg;
+
+        if (!data) {
+                LOG_ERR("Bogus data passed, bailing out");
+                return -1;
+        }
+        if (!name) {
+                LOG_ERR("Invalid name passed, bailing out");
+                return -1;
+        }
+
+        reg = rkzalloc(sizeof(*reg), GFP_KERNEL);
+        if (!reg)
+                return -1;
+
+        reg->app_name = name_dup(name);
+        if (!reg->app_name) {
+                rkfree(reg);
+                return -1;
+        }
+        if (daf_name) {
+                reg->daf_name = name_dup(daf_name);
+                if (!reg->daf_name) {
+                        name_destroy(reg->app_name);
+                        rkfree(reg);
+                        return -1;
+                }
+        }
+        INIT_LIST_HEAD(&reg->list);
+
+        mutex_lock(&loop_mutex);
+        if (find_reg(data, name)) {
+                char * tmp = name_tostring(name);
+
+                mutex_unlock(&loop_mutex);
+                LOG_ERR("Application %s is already registered", tmp);
+                if (tmp) rkfree(tmp);
+                if (reg->daf_name) name_destroy(reg->daf_name);
+                name_destroy(reg->app_name);
+                rkfree(reg);
+                return -1;
+        }
+        list_add(&reg->list, &data->regs);
+        mutex_unlock(&loop_mutex);
+
+        return 0;
+}
+
+static void reg_destroy(struct loop_reg * reg)
+{
+        ASSERT(reg);
+
+        list_del(&reg->list);
+        if (reg->daf_name) name_destroy(reg->daf_name);
+        name_destroy(reg->app_name);
+        rkfree(reg);
+}
+
+static int loop_application_unregister(struct ipcp_instance_data * data,
+                                       const struct name *         name)
+{
+        struct loop_reg * reg;
+
+        if (!data) {
+                LOG_ERR("Bogus data passed, bailing out");
+                return -1;
+        }
+        if (!name) {
+                LOG_ERR("Invalid name passed, bailing out");
+                return -1;
+        }
+
+        mutex_lock(&loop_mutex);
+        list_for_each_entry(reg, &data->regs, list) {
+                if (name_is_equal(reg->app_name, name)) {
+                        reg_destroy(reg);
+                        mutex_unlock(&loop_mutex);
+                        return 0;
+                }
+        }
+        mutex_unlock(&loop_mutex);
+
+        LOG_ERR("Application is not registered");
+
+        return -1;
+}
+
+static int loop_configure(struct ipcp_instance_data * data,
+                          const struct dif_config *   config)
+{
+        struct loop_params   params;
+        struct ipcp_config * tmp;
+        unsigned int *       value;
+
+        ASSERT(data);
+        ASSERT(config);
+
+        spin_lock_bh(&data->lock);
+        params = data->pipe.params;
+        spin_unlock_bh(&data->lock);
+
+        list_for_each_entry(tmp, &(config->ipcp_config_entries), next) {
+                const struct ipcp_config_entry * entry = tmp->entry;
+
+                if (!strcmp(entry->name, "delay-us"))
+                        value = &params.delay_us;
+                else if (!strcmp(entry->name, "jitter-us"))
+                        value = &params.jitter_us;
+                else if (!strcmp(entry->name, "loss-ppm"))
+                        value = &params.loss_ppm;
+                else if (!strcmp(entry->name, "rate-kbps"))
+                        value = &params.rate_kbps;
+                else if (!strcmp(entry->name, "queue-size"))
+                        value = &params.queue_size;
+                else if (!strcmp(entry->name, "max-sdu-size"))
+                        value = &params.max_sdu_size;
+                else {
+                        LOG_DBG("Unknown config param for loopback shim, "
+                                "ignoring");
+                        continue;
+                }
+
+                ASSERT(entry->value);
+                if (kstrtouint(entry->value, 10, value)) {
+                        LOG_ERR("Bad value '%s' for parameter %s",
+                                entry->value, entry->name);
+                        return -1;
+                }
+        }
+
+        if (!params.queue_size || !params.max_sdu_size ||
+            params.loss_ppm > 1000000) {
+                LOG_ERR("Bad loopback shim configuration");
+                return -1;
+        }
+
+        spin_lock_bh(&data->lock);
+        data->pipe.params          = params;
+        data->fspec->max_sdu_size  = params.max_sdu_size;
+        data->fspec->delay         = params.delay_us / 1000;
+        data->fspec->jitter        = params.jitter_us / 1000;
+        data->fspec->average_bandwidth = params.rate_kbps * 1000;
+        spin_unlock_bh(&data->lock);
+
+        LOG_DBG("Loopback pipe: delay %uus, jitter %uus, loss %uppm, "
+                "rate %ukbps, queue %u",
+                params.delay_us, params.jitter_us, params.loss_ppm,
+                params.rate_kbps, params.queue_size);
+
+        return 0;
+}
+
+static int loop_assign_to_dif(struct ipcp_instance_data * data,
+                              const struct name *         dif_name,
+                              const string_t *            type,
+                              struct dif_config *         config)
+{
+        if (!data) {
+                LOG_ERR("Bogus data passed, bailing out");
+                return -1;
+        }
+        if (!config) {
+                LOG_ERR("Bogus dif_information passed, bailing out");
+                return -1;
+        }
+
+        if (data->dif_name) {
+                ASSERT(data->dif_name->process_name);
+
+                LOG_ERR("IPCP already assigned to DIF %s, "
+                        "can be assigned only once",
+                        data->dif_name->process_name);
+                return -1;
+        }
+
+        if (loop_configure(data, config))
+                return -1;
+
+        mutex_lock(&loop_mutex);
+        data->dif_name = name_dup(dif_name);
+        mutex_unlock(&loop_mutex);
+        if (!data->dif_name) {
+                LOG_ERR("Error duplicating name, bailing out");
+                return -1;
+        }
+
+        LOG_DBG("Configured shim loopback IPC Process");
+
+        return 0;
+}
+
+static int loop_update_dif_config(struct ipcp_instance_data * data,
+                                  const struct dif_config *   new_config)
+{
+        if (!data) {
+                LOG_ERR("Bogus data passed, bailing out");
+                return -1;
+        }
+        if (!new_config) {
+                LOG_ERR("Bogus configuration passed, bailing out");
+                return -1;
+        }
+
+        return loop_configure(data, new_config);
+}
+
+/* Takes the ownership of the passed DU */
+static int loop_du_write(struct ipcp_instance_data * data,
+                         port_id_t                   id,
+                         struct du *                 du,
+                         bool                        blocking)
+{
+        struct loop_pipe * pipe;
+        struct loop_flow * flow;
+        struct loop_pdu *  pdu, * pos;
+        struct sk_buff *   skb;
+        ssize_t            length;
+        ktime_t            now;
+
+        if (unlikely(!data)) {
+                LOG_ERR("Bogus data passed, bailing out");
+                return -1;
+        }
+
+        pipe   = &data->pipe;
+        length = du_len(du);
+
+        if (unlikely(length > pipe->params.max_sdu_size)) {
+                LOG_ERR("SDU too large (%zd), dropping", length);
+                du_destroy(du);
+                return -1;
+        }
+
+        pdu = rkmalloc(sizeof(*pdu), GFP_ATOMIC);
+        if (!pdu) {
+                du_destroy(du);
+                return -1;
+        }
+
+        spin_lock_bh(&data->lock);
+        flow = find_flow(data, id);
+        if (!flow || flow->port_id_state != PORT_STATE_ALLOCATED ||
+            pipe->stopping) {
+                spin_unlock_bh(&data->lock);
+                LOG_ERR("Flow is not in the right state to call this");
+                rkfree(pdu);
+                du_destroy(du);
+                return -1;
+        }
+        if (pipe->queue_len >= pipe->params.queue_size) {
+                pipe->tx_busy = true;
+                spin_unlock_bh(&data->lock);
+                rkfree(pdu);
+                return -EAGAIN;
+        }
+        pdu->dst_id      = flow->peer_id;
+        pdu->dst_port_id = flow->peer_port_id;
+        pipe->tx_pdus++;
+        if (pipe->params.loss_ppm &&
+            prandom_u32() % 1000000 < pipe->params.loss_ppm) {
+                pipe->lost_pdus++;
+                spin_unlock_bh(&data->lock);
+                rkfree(pdu);
+                du_destroy(du);
+                return 0;
+        }
+        /* Reserve the slot, concurrent writers see the queue as full */
+        pipe->queue_len++;
+        spin_unlock_bh(&data->lock);
+
+        /*
+         * The receiver gets a private copy of the PDU, the sender may still
+         * be holding the original for retransmission
+         */
+        skb = du_detach_skb(du);
+        du_destroy(du);
+        skb = skb_share_check(skb, GFP_ATOMIC);
+        if (skb)
+                skb = skb_unshare(skb, GFP_ATOMIC);
+        if (!skb) {
+                LOG_ERR("Could not copy the PDU");
+                spin_lock_bh(&data->lock);
+                if (!pipe->stopping)
+                        pipe->queue_len--;
+                spin_unlock_bh(&data->lock);
+                rkfree(pdu);
+                return -1;
+        }
+        pdu->skb = skb;
+        INIT_LIST_HEAD(&pdu->list);
+
+        now = ktime_get();
+
+        /*
+         * The pipe may have been stopped while copying: check it again in
+         * the same critical section that queues the PDU and arms the timer
+         */
+        spin_lock_bh(&data->lock);
+        if (pipe->stopping) {
+                spin_unlock_bh(&data->lock);
+                LOG_DBG("Pipe stopped meanwhile, dropping PDU");
+                kfree_skb(skb);
+                rkfree(pdu);
+                return -1;
+        }
+        pdu->due = loop_pipe_schedule(pipe, length, now);
+
+        /* Without jitter PDUs are always appended */
+        list_for_each_entry_reverse(pos, &pipe->queue, list) {
+                if (ktime_compare(pos->due, pdu->due) <= 0)
+                        break;
+        }
+        list_add(&pdu->list, &pos->list);
+
+        if (pipe->queue.next == &pdu->list) {
+                if (ktime_compare(pdu->due, now) <= 0)
+                        tasklet_schedule(&pipe->tasklet);
+                else
+                        hrtimer_start(&pipe->timer, pdu->due,
+                                      HRTIMER_MODE_ABS);
+        }
+        spin_unlock_bh(&data->lock);
+
+        return 0;
+}
+
+static const struct name * loop_ipcp_name(struct ipcp_instance_data * data)
+{
+        ASSERT(data);
+        ASSERT(name_is_ok(data->name));
+
+        return data->name;
+}
+
+static const struct name * loop_dif_name(struct ipcp_instance_data * data)
+{
+        if (!data) {
+                LOG_ERR("Bogus data passed, bailing out");
+                return NULL;
+        }
+
+        return data->dif_name;
+}
+
+static size_t loop_max_sdu_size(struct ipcp_instance_data * data)
+{
+        if (!data) {
+                LOG_ERR("Bogus data passed, bailing out");
+                return 0;
+        }
+
+        return data->pipe.params.max_sdu_size;
+}
+
+static ipc_process_id_t loop_ipcp_id(struct ipcp_instance_data * data)
+{
+        ASSERT(data);
+        return data->id;
+}
+
+static int loop_query_rib(struct ipcp_instance_data * data,
+                          struct list_head *          entries,
+                          const string_t *            object_class,
+                          const string_t *            object_name,
+                          uint64_t                    object_instance,
+                          uint32_t                    scope,
+                          const string_t *            filter)
+{
+        LOG_MISSING;
+        return -1;
+}
+
+static struct ipcp_instance_ops loop_instance_ops = {
+        .flow_allocate_request     = loop_flow_allocate_request,
+        .flow_allocate_response    = loop_flow_allocate_response,
+        .flow_deallocate           = loop_flow_deallocate,
+        .flow_prebind              = NULL,
+        .flow_binding_ipcp         = NULL,
+        .flow_unbinding_ipcp       = NULL,
+        .flow_unbinding_user_ipcp  = loop_unbind_user_ipcp,
+        .nm1_flow_state_change     = NULL,
+
+        .application_register      = loop_application_register,
+        .application_unregister    = loop_application_unregister,
+
+        .assign_to_dif             = loop_assign_to_dif,
+        .update_dif_config         = loop_update_dif_config,
+
+        .connection_create         = NULL,
+        .connection_update         = NULL,
+        .connection_destroy        = NULL,
+        .connection_create_arrived = NULL,
+        .connection_modify         = NULL,
+
+        .du_enqueue                = NULL,
+        .du_write                  = loop_du_write,
+
+        .mgmt_du_write             = NULL,
+        .mgmt_du_post              = NULL,
+
+        .pff_add                   = NULL,
+        .pff_remove                = NULL,
+        .pff_dump                  = NULL,
+        .pff_flush                 = NULL,
+        .pff_modify                = NULL,
+
+        .query_rib                 = loop_query_rib,
+
+        .ipcp_name                 = loop_ipcp_name,
+        .dif_name                  = loop_dif_name,
+        .ipcp_id                   = loop_ipcp_id,
+
+        .set_policy_set_param      = NULL,
+        .select_policy_set         = NULL,
+        .update_crypto_state       = NULL,
+        .address_change            = NULL,
+        .max_sdu_size              = loop_max_sdu_size
+};
+
+static int loop_init(struct ipcp_factory_data * data)
+{
+        ASSERT(data == &loop_data);
+
+        bzero(data, sizeof(*data));
+        INIT_LIST_HEAD(&(data->instances));
+
+        LOG_INFO("%s initialized", SHIM_NAME);
+
+        return 0;
+}
+
+static int loop_fini(struct ipcp_factory_data * data)
+{
+        ASSERT(data == &loop_data);
+
+        ASSERT(list_empty(&(data->instances)));
+
+        return 0;
+}
+
+static void inst_cleanup(struct ipcp_instance * inst)
+{
+        ASSERT(inst);
+
+        if (inst->data) {
+                if (inst->data->fspec)
+                        rkfree(inst->data->fspec);
+                if (inst->data->name)
+                        name_destroy(inst->data->name);
+
+                rkfree(inst->data);
+        }
+
+        rkfree(inst);
+}
+
+static struct ipcp_instance * loop_create(struct ipcp_factory_data * data,
+                                          const struct name *        name,
+                                          ipc_process_id_t           id,
+                                          uint_t                     us_nl_port)
+{
+        struct ipcp_instance * inst;
+
+        ASSERT(data);
+        ASSERT(name);
+
+        /* Check if there already is an instance with that id */
+        if (find_instance(data, id)) {
+                LOG_ERR("There's a shim instance with id %d already", id);
+                return NULL;
+        }
+
+        inst = rkzalloc(sizeof(*inst), GFP_KERNEL);
+        if (!inst)
+                return NULL;
+
+        inst->ops = &loop_instance_ops;
+
+        if (robject_rset_init_and_add(&inst->robj,
+                                      &loop_ipcp_rtype,
+                                      kipcm_rset(default_kipcm),
+                                      "%u",
+                                      id)) {
+                rkfree(inst);
+                return NULL;
+        }
+
+        inst->data = rkzalloc(sizeof(struct ipcp_instance_data), GFP_KERNEL);
+        if (!inst->data) {
+                robject_del(&inst->robj);
+                inst_cleanup(inst);
+                return NULL;
+        }
+
+        inst->data->id = id;
+        spin_lock_init(&inst->data->lock);
+
+        inst->data->name = name_dup(name);
+        if (!inst->data->name) {
+                LOG_ERR("Failed creation of ipc name");
+                robject_del(&inst->robj);
+                inst_cleanup(inst);
+                return NULL;
+        }
+
+        inst->data->fspec = rkzalloc(sizeof(*inst->data->fspec), GFP_KERNEL);
+        if (!inst->data->fspec) {
+                LOG_ERR("Instance creation failed");
+                robject_del(&inst->robj);
+                inst_cleanup(inst);
+                return NULL;
+        }
+
+        loop_pipe_init(inst->data);
+
+        inst->data->fspec->average_bandwidth           = 0;
+        inst->data->fspec->average_sdu_bandwidth       = 0;
+        inst->data->fspec->delay                       = 0;
+        inst->data->fspec->jitter                      = 0;
+        inst->data->fspec->max_allowable_gap           = -1;
+        inst->data->fspec->max_sdu_size                =
+                inst->data->pipe.params.max_sdu_size;
+        inst->data->fspec->ordered_delivery            = 0;
+        inst->data->fspec->partial_delivery            = 1;
+        inst->data->fspec->peak_bandwidth_duration     = 0;
+        inst->data->fspec->peak_sdu_bandwidth_duration = 0;
+        inst->data->fspec->undetected_bit_error_rate   = 0;
+
+        /* FIXME: Remove as soon as the kipcm_kfa gets removed*/
+        inst->data->kfa = kipcm_kfa(default_kipcm);
+        ASSERT(inst->data->kfa);
+
+        INIT_LIST_HEAD(&(inst->data->regs));
+        INIT_LIST_HEAD(&(inst->data->flows));
+        INIT_LIST_HEAD(&(inst->data->list));
+
+        mutex_lock(&loop_mutex);
+        write_lock_bh(&loop_lock);
+        list_add(&(inst->data->list), &(data->instances));
+        write_unlock_bh(&loop_lock);
+        mutex_unlock(&loop_mutex);
+
+        return inst;
+}
+
+static int loop_destroy(struct ipcp_factory_data * data,
+                        struct ipcp_instance *     instance)
+{
+        struct ipcp_instance_data * pos;
+        struct loop_flow *          flow, * nflow;
+        struct loop_reg *           reg, * nreg;
+
+        ASSERT(data);
+        ASSERT(instance);
+
+        mutex_lock(&loop_mutex);
+
+        pos = find_instance(data, instance->data->id);
+        if (!pos) {
+                mutex_unlock(&loop_mutex);
+                LOG_DBG("Didn't find instance, returning error");
+                return -1;
+        }
+
+        /* Unbind from the instances set, PDUs in flight will be dropped */
+        write_lock_bh(&loop_lock);
+        list_del(&pos->list);
+        write_unlock_bh(&loop_lock);
+
+        list_for_each_entry_safe(flow, nflow, &pos->flows, list)
+                unbind_and_destroy_flow(pos, flow);
+
+        list_for_each_entry_safe(reg, nreg, &pos->regs, list)
+                reg_destroy(reg);
+
+        mutex_unlock(&loop_mutex);
+
+        loop_pipe_fini(pos);
+
+        if (pos->dif_name)
+                name_destroy(pos->dif_name);
+
+        robject_del(&instance->robj);
+        inst_cleanup(instance);
+
+        LOG_DBG("Loopback instance destroyed, returning");
+
+        return 0;
+}
+
+static struct ipcp_factory_ops loop_ops = {
+        .init      = loop_init,
+        .fini      = loop_fini,
+        .create    = loop_create,
+        .destroy   = loop_destroy,
+};
+
+static struct ipcp_factory * shim_loopback = NULL;
+
+static int __init mod_init(void)
+{
+        loop_wq = rwq_create(SHIM_NAME);
+        if (!loop_wq) {
+                LOG_CRIT("Cannot create a workqueue for shim %s", SHIM_NAME);
+                return -1;
+        }
+
+        shim_loopback = kipcm_ipcp_factory_register(default_kipcm,
+                                                    SHIM_NAME,
+                                                    &loop_data,
+                                                    &loop_ops);
+        if (!shim_loopback) {
+                rwq_destroy(loop_wq);
+                return -1;
+        }
+
+        return 0;
+}
+
+static void __exit mod_exit(void)
+{
+        ASSERT(shim_loopback);
+
+        rwq_flush(loop_wq);
+        rwq_destroy(loop_wq);
+
+        kipcm_ipcp_factory_unregister(default_kipcm, shim_loopback);
+
+        LOG_INFO("IRATI shim loopback module removed");
+}
+
+module_init(mod_init);
+module_exit(mod_exit);
+
+MODULE_DESCRIPTION("RINA Shim IPC Process for local loopback");
+
+MODULE_LICENSE("GPL");
@@ -49,10 +49,12 @@
 #include "ipcp-utils.h"
 #include "ipcp-factories.h"
 #include "rds/robjects.h"
+#include "rds/rring.h"
 
 #define CUBE_UNRELIABLE 0
 #define CUBE_RELIABLE   1
 #define SEND_WQ_MAX_SIZE 1000
+#define SDU_QUEUE_MAX_SIZE 256
 
 static struct workqueue_struct * rcv_wq;
 static struct workqueue_struct * snd_wq;
@@ -128,7 +130,7 @@ struct shim_tcp_udp_flow {
         struct socket *        sock;
         union address          addr;
 
-        struct rfifo *         sdu_queue;
+        struct rring *         sdu_queue;
 
         int                    bytes_left;
         int                    lbuf;
@@ -580,7 +582,7 @@ static int flow_destroy(struct ipcp_instance_data * data,
 
         /* FIXME: Check for leaks */
         if (flow->sdu_queue)
-                rfifo_destroy(flow->sdu_queue, (void (*)(void *)) du_destroy);
+                rring_destroy(flow->sdu_queue, (void (*)(void *)) du_destroy);
         rkfree(flow);
 
         return 0;
@@ -811,7 +813,7 @@ tcp_udp_flow_allocate_request(struct ipcp_instance_data * data,
                 }
 
                 if (flow->sdu_queue)
-                        if (!rfifo_is_empty(flow->sdu_queue)) {
+                        if (!rring_is_empty(flow->sdu_queue)) {
                                 LOG_ERR("We are going to leak ...");
                         }
                 flow->sdu_queue = NULL;
@@ -901,10 +903,10 @@ tcp_udp_flow_allocate_response(struct ipcp_instance_data * data,
                 LOG_DBG("Moving SDUs from sdu-queue to user-IPCP");
 
                 ASSERT(flow->sdu_queue);
-                while (!rfifo_is_empty(flow->sdu_queue)) {
+                while (!rring_is_empty(flow->sdu_queue)) {
                         struct du * tmp = NULL;
 
-                        tmp = rfifo_pop(flow->sdu_queue);
+                        tmp = rring_pop(flow->sdu_queue);
                         ASSERT(tmp);
 
                         LOG_DBG("Got a new element from the fifo, "
@@ -925,7 +927,7 @@ tcp_udp_flow_allocate_response(struct ipcp_instance_data * data,
                         }
                 }
 
-                rfifo_destroy(flow->sdu_queue, (void (*)(void *)) du_destroy);
+                rring_destroy(flow->sdu_queue, (void (*)(void *)) du_destroy);
                 flow->sdu_queue = NULL;
 
         } else {
@@ -956,7 +958,7 @@ tcp_udp_flow_allocate_response(struct ipcp_instance_data * data,
                  */
                 /* FIXME: This is true for UDP. For TCP too? */
                 ASSERT(flow->sdu_queue);
-                rfifo_destroy(flow->sdu_queue, (void (*)(void *)) du_destroy);
+                rring_destroy(flow->sdu_queue, (void (*)(void *)) du_destroy);
                 flow->sdu_queue = NULL;
         }
 
@@ -1183,7 +1185,8 @@ static int udp_process_msg(struct ipcp_instance_data * data,
                         }
                 }
 
-                flow->sdu_queue = rfifo_create();
+                flow->sdu_queue = rring_create(SDU_QUEUE_MAX_SIZE,
+                                               RRING_MPSC);
                 if (!flow->sdu_queue) {
                         flow->port_id_state = PORT_STATE_NULL;
 
@@ -1201,7 +1204,7 @@ static int udp_process_msg(struct ipcp_instance_data * data,
                 /* Store SDU in queue */
 
                 LOG_DBG("Queueing frame in SDU queue");
-                if (rfifo_push(flow->sdu_queue, du)) {
+                if (rring_push(flow->sdu_queue, du)) {
                         flow->port_id_state = PORT_STATE_NULL;
 
                         LOG_ERR("Could not write %zd bytes into the fifo",
@@ -1272,7 +1275,7 @@ static int udp_process_msg(struct ipcp_instance_data * data,
                         LOG_DBG("Port is PENDING, "
                                 "queueing frame in SDU queue");
 
-                        if (rfifo_push(flow->sdu_queue, du)) {
+                        if (rring_push(flow->sdu_queue, du)) {
                                 spin_unlock_bh(&data->lock);
 
                                 LOG_ERR("Failed to write %zd bytes"
@@ -1379,7 +1382,7 @@ static int tcp_recv_new_message(struct ipcp_instance_data * data,
                         LOG_DBG("Port is PENDING, "
                                 "queueing frame in SDU queue");
 
-                        if (rfifo_push_ni(flow->sdu_queue, du)) {
+                        if (rring_push(flow->sdu_queue, du)) {
                                 spin_unlock_bh(&data->lock);
 
                                 LOG_ERR("Failed to write %zd bytes"
@@ -1449,7 +1452,7 @@ static int tcp_recv_partial_message(struct ipcp_instance_data * data,
                         LOG_DBG("Port is PENDING, "
                                 "queueing frame in SDU queue");
 
-                        if (rfifo_push_ni(flow->sdu_queue, du)) {
+                        if (rring_push(flow->sdu_queue, du)) {
                                 spin_unlock_bh(&data->lock);
 
                                 LOG_ERR("Failed to write %zd bytes"
@@ -1629,7 +1632,8 @@ static int tcp_process(struct ipcp_instance_data * data, struct socket * sock)
                         }
                 }
 
-                flow->sdu_queue = rfifo_create_ni();
+                flow->sdu_queue = rring_create_ni(SDU_QUEUE_MAX_SIZE,
+                                                  RRING_MPSC);
                 if (!flow->sdu_queue) {
                         LOG_ERR("Couldn't create the sdu queue "
                                 "for a new flow");
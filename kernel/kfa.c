@@ -35,6 +35,8 @@
 #include "pidm.h"
 #include "kfa.h"
 #include "kfa-utils.h"
+#include "dp-latency.h"
+#include "dp-trace.h"
 
 #define RINA_IP_FLOW_ENT_NAME "RINA_IP"
 
@@ -443,6 +445,9 @@ int kfa_flow_du_write(struct kfa  *kfa,
 	LOG_DBG("Trying to write SDU of length %zd to port-id %d",
 		length, id);
 
+	trace_kfa_flow_du_write(id, length);
+	dp_lat_stamp(du);
+
 	spin_lock_bh(&kfa->lock);
 
 	flow = kfa_pmap_find(kfa->flows, id);
@@ -1019,6 +1024,7 @@ static int kfa_du_post(struct ipcp_instance_data *data,
 	}
 
 	LOG_DBG("Posting DU to port-id %d ", id);
+	trace_kfa_du_post(id, du_len(du));
 
 	spin_lock_bh(&instance->lock);
 	flow = kfa_pmap_find(instance->flows, id);
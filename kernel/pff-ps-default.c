@@ -39,6 +39,11 @@
 /* FIXME: This representation is crappy and MUST be changed */
 struct pft_port_entry {
         port_id_t        port_id;
+        /* Port in use, one of the alternates while port_id is down */
+        port_id_t        nhop;
+        /* Precomputed alternates (e.g. LFAs), in order of preference */
+        port_id_t *      alts;
+        size_t           alts_n;
         struct list_head next;
 };
 
@@ -60,6 +65,9 @@ static struct pft_port_entry * pft_pe_create_gfp(gfp_t     flags,
                 return NULL;
 
         tmp->port_id = port_id;
+        tmp->nhop    = port_id;
+        tmp->alts    = NULL;
+        tmp->alts_n  = 0;
         INIT_LIST_HEAD(&tmp->next);
 
         return tmp;
@@ -89,6 +97,8 @@ static void pft_pe_destroy(struct pft_port_entry * pe)
         ASSERT(pft_pe_is_ok(pe));
 
         list_del(&pe->next);
+        if (pe->alts)
+                rkfree(pe->alts);
         rkfree(pe);
 }
 
@@ -134,10 +144,20 @@ static ssize_t pft_entry_attr_show(struct robject *        robj,
 			sprintf(buf + offset -1, "\n");
 		return offset;
 	}
+	if (strcmp(robject_attr_name(attr), "nhops") == 0) {
+		int offset = 0;
+		struct pft_port_entry * pos;
+        	list_for_each_entry(pos, &entry->ports, next) {
+			offset += sprintf(buf + offset, "%u ", pos->nhop);
+        	}
+		if (offset > 1)
+			sprintf(buf + offset -1, "\n");
+		return offset;
+	}
 	return 0;
 }
 RINA_SYSFS_OPS(pft_entry);
-RINA_ATTRS(pft_entry, dest_addr, qos_id, ports);
+RINA_ATTRS(pft_entry, dest_addr, qos_id, ports, nhops);
 RINA_KTYPE(pft_entry);
 
 static struct pft_entry * pfte_create_gfp(gfp_t     flags,
@@ -200,9 +220,86 @@ static int pff_sysfs_worker(void * o)
 struct pff_ps_priv {
         spinlock_t       lock;
         struct list_head entries;
+        /* Holds the N-1 ports that are down */
+        struct list_head ports_down;
         struct workqueue_struct * sysfs_wq;
 };
 
+static bool priv_is_ok(struct pff_ps_priv * priv)
+{ return priv != NULL; }
+
+static bool pft_is_port_down(struct pff_ps_priv * priv,
+                             port_id_t            port_id)
+{
+        struct pft_port_entry * pos;
+
+        list_for_each_entry(pos, &priv->ports_down, next) {
+                if (pft_pe_port(pos) == port_id)
+                        return true;
+        }
+
+        return false;
+}
+
+/* Whether some entry forwards, or may fail over, on the port */
+static bool pft_is_port_used(struct pff_ps_priv * priv,
+                             port_id_t            port_id)
+{
+        struct pft_entry *      pos;
+        struct pft_port_entry * pe;
+        size_t                  i;
+
+        list_for_each_entry(pos, &priv->entries, next) {
+                list_for_each_entry(pe, &pos->ports, next) {
+                        if (pe->port_id == port_id)
+                                return true;
+                        for (i = 0; i < pe->alts_n; i++) {
+                                if (pe->alts[i] == port_id)
+                                        return true;
+                        }
+                }
+        }
+
+        return false;
+}
+
+/*
+ * A port only needs to be remembered as down while the table refers to it,
+ * otherwise every N-1 flow ever deallocated would stay in the list. Called
+ * whenever entries go away, so that ports unbound meanwhile are dropped once
+ * the routing daemon has routed around them.
+ */
+static void __pff_ports_down_trim(struct pff_ps_priv * priv)
+{
+        struct pft_port_entry * pe, * next;
+
+        list_for_each_entry_safe(pe, next, &priv->ports_down, next) {
+                if (!pft_is_port_used(priv, pft_pe_port(pe)))
+                        pft_pe_destroy(pe);
+        }
+}
+
+/*
+ * Picks the port to forward on: the primary if it is up, otherwise the
+ * first alternate that is. With nothing up the primary is kept, the RMT
+ * will drop on it until the routing daemon installs something better.
+ */
+static port_id_t pft_pe_nhop_select(struct pff_ps_priv *    priv,
+                                    struct pft_port_entry * pe)
+{
+        size_t i;
+
+        if (!pft_is_port_down(priv, pe->port_id))
+                return pe->port_id;
+
+        for (i = 0; i < pe->alts_n; i++) {
+                if (!pft_is_port_down(priv, pe->alts[i]))
+                        return pe->alts[i];
+        }
+
+        return pe->port_id;
+}
+
 static void pfte_destroy(struct pft_entry * entry, struct pff_ps_priv * priv)
 {
         struct pft_port_entry * pos, * next;
@@ -242,22 +339,43 @@ static struct pft_port_entry * pfte_port_find(struct pft_entry * entry,
         return NULL;
 }
 
-static int pfte_port_add(struct pft_entry * entry,
-                         port_id_t          id)
+static int pfte_port_add(struct pff_ps_priv *     priv,
+                         struct pft_entry *       entry,
+                         struct port_id_altlist * alts)
 {
         struct pft_port_entry * pe;
+        port_id_t *             tmp;
+        size_t                  n;
 
         ASSERT(pfte_is_ok(entry));
+        ASSERT(alts && alts->num_ports > 0);
 
-        pe = pfte_port_find(entry, id);
-        if (pe)
-                return 0;
+        n   = alts->num_ports - 1;
+        tmp = NULL;
+        if (n > 0) {
+                tmp = rkmalloc(n * sizeof(*tmp), GFP_ATOMIC);
+                if (!tmp)
+                        return -1;
+                memcpy(tmp, alts->ports + 1, n * sizeof(*tmp));
+        }
 
-        pe = pft_pe_create_ni(id);
-        if (!pe)
-                return -1;
+        pe = pfte_port_find(entry, alts->ports[0]);
+        if (!pe) {
+                pe = pft_pe_create_ni(alts->ports[0]);
+                if (!pe) {
+                        if (tmp)
+                                rkfree(tmp);
+                        return -1;
+                }
+                list_add(&pe->next, &entry->ports);
+        }
 
-        list_add(&pe->next, &entry->ports);
+        /* A re-add refreshes the alternates computed by the daemon */
+        if (pe->alts)
+                rkfree(pe->alts);
+        pe->alts   = tmp;
+        pe->alts_n = n;
+        pe->nhop   = pft_pe_nhop_select(priv, pe);
 
         return 0;
 }
@@ -279,6 +397,22 @@ static void pfte_port_remove(struct pft_entry * entry,
 
 }
 
+/* Whether a port entry before pe already forwards on the same port */
+static bool pfte_nhop_seen(struct pft_entry *      entry,
+                           struct pft_port_entry * pe)
+{
+        struct pft_port_entry * pos;
+
+        list_for_each_entry(pos, &entry->ports, next) {
+                if (pos == pe)
+                        return false;
+                if (pos->nhop == pe->nhop)
+                        return true;
+        }
+
+        return false;
+}
+
 static int pfte_ports_copy(struct pft_entry * entry,
                            port_id_t **       port_ids,
                            size_t *           entries)
@@ -289,9 +423,17 @@ static int pfte_ports_copy(struct pft_entry * entry,
 
         ASSERT(pfte_is_ok(entry));
 
+        /*
+         * NOTE: Several primaries may have failed over to the same
+         * alternate, the RMT sends a copy per port so duplicates are
+         * left out. They are counted out before sizing the array: the
+         * RMT hands back the same array and count on the next PDU, and
+         * the count is also what tells us its size
+         */
         count = 0;
         list_for_each_entry(pos, &entry->ports, next) {
-                count++;
+                if (!pfte_nhop_seen(entry, pos))
+                        count++;
         }
 
         ASSERT(entries);
@@ -313,15 +455,13 @@ static int pfte_ports_copy(struct pft_entry * entry,
         /* Get the first port, and so on, fill in the port_ids */
         i = 0;
         list_for_each_entry(pos, &entry->ports, next) {
-                (*port_ids)[i++] = pft_pe_port(pos);
+                if (!pfte_nhop_seen(entry, pos))
+                        (*port_ids)[i++] = pos->nhop;
         }
 
         return 0;
 }
 
-static bool priv_is_ok(struct pff_ps_priv * priv)
-{ return priv != NULL; }
-
 static struct pft_entry * pft_find(struct pff_ps_priv * priv,
                                    address_t            destination,
                                    qos_id_t             qos_id)
@@ -374,8 +514,11 @@ static int __pff_add(struct pff_ps *        ps,
 			continue;
 		}
 
-		/* Just add the first alternative and ignore the others. */
-		if (pfte_port_add(tmp, alts->ports[0])) {
+		/*
+		 * The first alternative is the primary, the others are kept
+		 * to fail over to when it goes down.
+		 */
+		if (pfte_port_add(priv, tmp, alts)) {
 			pfte_destroy(tmp, priv);
 			return -1;
 		}
@@ -454,7 +597,7 @@ int default_remove(struct pff_ps *        ps,
 			continue;
 		}
 
-		/* Just remove the first alternative and ignore the others. */
+		/* Entries are keyed by the primary, the first alternative */
                 pfte_port_remove(tmp, alts->ports[0]);
 	}
 
@@ -463,6 +606,8 @@ int default_remove(struct pff_ps *        ps,
                 pfte_destroy(tmp, priv);
         }
 
+        __pff_ports_down_trim(priv);
+
         spin_unlock_bh(&priv->lock);
 
         return 0;
@@ -506,6 +651,71 @@ int default_flush(struct pff_ps * ps)
         spin_lock_bh(&priv->lock);
 
         __pff_flush(priv);
+        __pff_ports_down_trim(priv);
+
+        spin_unlock_bh(&priv->lock);
+
+        return 0;
+}
+
+/*
+ * Fails over (or back) in place, without waiting for the routing daemon
+ * to recompute. Only the port entries the change matters to are touched:
+ * those forwarding on the port that went down, or on an alternate when a
+ * port comes back up. A port the table does not refer to (e.g. an N-1 flow
+ * for management only being unbound) is not remembered as down.
+ */
+int default_port_state_change(struct pff_ps * ps,
+                              port_id_t       port_id,
+                              bool            up)
+{
+        struct pff_ps_priv *    priv;
+        struct pft_entry *      pos;
+        struct pft_port_entry * pe, * next;
+
+        priv = (struct pff_ps_priv *) ps->priv;
+        if (!priv_is_ok(priv))
+                return -1;
+
+        if (!is_port_id_ok(port_id)) {
+                LOG_ERR("Bogus port-id, cannot change its state");
+                return -1;
+        }
+
+        spin_lock_bh(&priv->lock);
+
+        if (up) {
+                list_for_each_entry_safe(pe, next, &priv->ports_down, next) {
+                        if (pft_pe_port(pe) == port_id)
+                                pft_pe_destroy(pe);
+                }
+        } else if (!pft_is_port_down(priv, port_id) &&
+                   pft_is_port_used(priv, port_id)) {
+                pe = pft_pe_create_ni(port_id);
+                if (!pe) {
+                        spin_unlock_bh(&priv->lock);
+                        return -1;
+                }
+                list_add(&pe->next, &priv->ports_down);
+        }
+
+        list_for_each_entry(pos, &priv->entries, next) {
+                list_for_each_entry(pe, &pos->ports, next) {
+                        port_id_t nhop;
+
+                        if (up ? pe->nhop == pe->port_id :
+                                 pe->nhop != port_id)
+                                continue;
+
+                        nhop = pft_pe_nhop_select(priv, pe);
+                        if (nhop == pe->nhop)
+                                continue;
+
+                        LOG_DBG("Destination %u: port-id %d -> %d",
+                                pos->destination, pe->nhop, nhop);
+                        pe->nhop = nhop;
+                }
+        }
 
         spin_unlock_bh(&priv->lock);
 
@@ -539,6 +749,8 @@ int default_modify(struct pff_ps *    ps,
         	__pff_add(ps, priv, entry);
         }
 
+        __pff_ports_down_trim(priv);
+
         spin_unlock_bh(&priv->lock);
 
         return 0;
@@ -611,6 +823,8 @@ static int pfte_port_id_altlists_copy(struct pft_entry * entry,
 		struct port_id_altlist * alt;
 		int cnt = 1;
 
+		cnt += pos->alts_n;
+
 		alt = rkmalloc(sizeof(*alt), GFP_ATOMIC);
 		if (!alt) {
 			return -1;
@@ -618,10 +832,14 @@ static int pfte_port_id_altlists_copy(struct pft_entry * entry,
 
 		alt->ports = rkmalloc(cnt * sizeof(*(alt->ports)), GFP_ATOMIC);
 		if (!alt->ports) {
+			rkfree(alt);
 			return -1;
 		}
 
 		alt->ports[0] = pft_pe_port(pos);
+		if (pos->alts_n)
+			memcpy(alt->ports + 1, pos->alts,
+			       pos->alts_n * sizeof(*(alt->ports)));
 		alt->num_ports = cnt;
 
 		list_add_tail(&alt->next, port_id_altlists);
@@ -651,6 +869,7 @@ int default_dump(struct pff_ps *    ps,
 
                 entry->fwd_info = pos->destination;
                 entry->qos_id = pos->qos_id;
+                entry->wildcard_bits = 0;
 		INIT_LIST_HEAD(&entry->port_id_altlists);
                 if (pfte_port_id_altlists_copy(pos, &entry->port_id_altlists)) {
                         rkfree(entry);
@@ -712,6 +931,7 @@ pff_ps_default_create(struct rina_component * component)
         spin_lock_init(&priv->lock);
 
         INIT_LIST_HEAD(&priv->entries);
+        INIT_LIST_HEAD(&priv->ports_down);
 
         ipcp = pff_ipcp_get(pff);
         ipc_process_id = ipcp->ops->ipcp_id(ipcp->data);
@@ -731,7 +951,7 @@ pff_ps_default_create(struct rina_component * component)
 
         ps->pff_add = default_add;
         ps->pff_remove = default_remove;
-	ps->pff_port_state_change = NULL;
+	ps->pff_port_state_change = default_port_state_change;
         ps->pff_is_empty = default_is_empty;
         ps->pff_flush = default_flush;
         ps->pff_nhop = default_nhop;
@@ -747,7 +967,8 @@ void pff_ps_default_destroy(struct ps_base * bps)
         struct pff_ps * ps = container_of(bps, struct pff_ps, base);
 
         if (bps) {
-                struct pff_ps_priv * priv;
+                struct pff_ps_priv *    priv;
+                struct pft_port_entry * pe, * next;
 
                 priv = (struct pff_ps_priv *) ps->priv;
                 if(!priv_is_ok(priv)) {
@@ -758,6 +979,10 @@ void pff_ps_default_destroy(struct ps_base * bps)
 
                 __pff_flush(priv);
 
+                list_for_each_entry_safe(pe, next, &priv->ports_down, next) {
+                        pft_pe_destroy(pe);
+                }
+
                 spin_unlock_bh(&priv->lock);
 
                 flush_workqueue(priv->sysfs_wq);
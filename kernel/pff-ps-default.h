@@ -30,6 +30,9 @@ int              default_add(struct pff_ps *        ps,
                              struct mod_pff_entry * entry);
 int              default_remove(struct pff_ps *        ps,
                                 struct mod_pff_entry * entry);
+int              default_port_state_change(struct pff_ps * ps,
+                                           port_id_t       port_id,
+                                           bool            up);
 bool             default_is_empty(struct pff_ps * ps);
 int              default_flush(struct pff_ps * ps);
 int              default_nhop(struct pff_ps * ps,
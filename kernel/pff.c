@@ -38,6 +38,7 @@ struct pff {
         struct rina_component base;
         struct rset * rset;
         struct ipcp_instance * ipcp;
+        struct rmt * rmt;
 };
 
 /*
@@ -70,7 +71,8 @@ static bool __pff_is_ok(struct pff * instance)
 { return instance ? true : false; }
 
 static struct pff * pff_create_gfp(struct robject * parent,
-				   struct ipcp_instance * ipcp, gfp_t flags)
+				   struct ipcp_instance * ipcp,
+				   struct rmt * rmt, gfp_t flags)
 {
         struct pff * tmp;
 
@@ -89,6 +91,7 @@ static struct pff * pff_create_gfp(struct robject * parent,
 	}
 
 	tmp->ipcp = ipcp;
+	tmp->rmt  = rmt;
 
         /* Try to select the default policy-set. */
         if (pff_select_policy_set(tmp, "", RINA_PS_DEFAULT_NAME)) {
@@ -106,8 +109,9 @@ struct pff * pff_create_ni(void)
 #endif
 
 struct pff * pff_create(struct robject * parent,
-			struct ipcp_instance * ipcp)
-{ return pff_create_gfp(parent, ipcp, GFP_KERNEL); }
+			struct ipcp_instance * ipcp,
+			struct rmt * rmt)
+{ return pff_create_gfp(parent, ipcp, rmt, GFP_KERNEL); }
 
 int pff_destroy(struct pff * instance)
 {
@@ -438,6 +442,12 @@ struct ipcp_instance * pff_ipcp_get(struct pff * pff)
 }
 EXPORT_SYMBOL(pff_ipcp_get);
 
+struct rmt * pff_rmt_get(struct pff * pff)
+{
+	return pff->rmt;
+}
+EXPORT_SYMBOL(pff_rmt_get);
+
 struct pff * pff_from_component(struct rina_component * component)
 { return container_of(component, struct pff, base); }
 EXPORT_SYMBOL(pff_from_component);
@@ -29,9 +29,11 @@
 
 struct pff;
 struct pci;
+struct rmt;
 
 struct pff *    pff_create(struct robject * parent,
-			   struct ipcp_instance * ipcp);
+			   struct ipcp_instance * ipcp,
+			   struct rmt * rmt);
 int             pff_destroy(struct pff * instance);
 
 bool            pff_is_ok(struct pff * instance);
@@ -73,5 +75,6 @@ struct pff_ps * pff_ps_get(struct pff * pff);
 struct rset *   pff_rset(struct pff * pff);
 struct pff *    pff_from_component(struct rina_component * component);
 struct ipcp_instance * pff_ipcp_get(struct pff * pff);
+struct rmt *    pff_rmt_get(struct pff * pff);
 
 #endif
@@ -39,6 +39,9 @@ extern bool regression_tests_rmem(void);
 #ifdef CONFIG_RINA_RINGQ_REGRESSION_TESTS
 extern bool regression_tests_ringq(void);
 #endif
+#ifdef CONFIG_RINA_RRING_REGRESSION_TESTS
+extern bool regression_tests_rring(void);
+#endif
 
 bool regression_tests_rds(void)
 {
@@ -62,6 +65,10 @@ bool regression_tests_rds(void)
         if (!regression_tests_ringq())
                 return false;
 #endif
+#ifdef CONFIG_RINA_RRING_REGRESSION_TESTS
+        if (!regression_tests_rring())
+                return false;
+#endif
 
         return true;
 }
@@ -33,6 +33,7 @@
 #include "rwq.h"
 #include "rstr.h"
 #include "ringq.h"
+#include "rring.h"
 
 bool regression_tests_rds(void);
 
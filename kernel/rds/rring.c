@@ -0,0 +1,480 @@
+/*
+ * RINA Rings (bounded, allocation-free FIFOs)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <linux/export.h>
+#include <linux/types.h>
+#include <linux/log2.h>
+#include <linux/spinlock.h>
+#include <linux/cache.h>
+#include <linux/atomic.h>
+#include <linux/compiler.h>
+
+#define RINA_PREFIX "rring"
+
+#include "logs.h"
+#include "debug.h"
+#include "rmem.h"
+#include "rring.h"
+
+/*
+ * head and tail are free running counters, masked on access. The producer
+ * publishes the slot with a release on tail, the consumer frees it with a
+ * release on head; each side acquires the other's counter.
+ */
+struct rring {
+        void **         slots;
+        unsigned int    mask;
+        enum rring_type type;
+        spinlock_t      plock;    /* Serializes producers on MPSC rings */
+        atomic_long_t   drops;
+
+        unsigned int    head ____cacheline_aligned_in_smp; /* Consumer */
+        unsigned int    tail ____cacheline_aligned_in_smp; /* Producer */
+};
+
+static struct rring * rring_create_gfp(gfp_t           flags,
+                                       unsigned int    size,
+                                       enum rring_type type)
+{
+        struct rring * r;
+
+        if (!size || size > RRING_MAX_SIZE) {
+                LOG_ERR("Bogus ring size %u", size);
+                return NULL;
+        }
+
+        r = rkzalloc(sizeof(*r), flags);
+        if (!r)
+                return NULL;
+
+        size     = roundup_pow_of_two(size);
+        r->slots = rkzalloc(size * sizeof(*r->slots), flags);
+        if (!r->slots) {
+                rkfree(r);
+                return NULL;
+        }
+
+        r->mask = size - 1;
+        r->type = type;
+        r->head = 0;
+        r->tail = 0;
+        spin_lock_init(&r->plock);
+        atomic_long_set(&r->drops, 0);
+
+        return r;
+}
+
+struct rring * rring_create(unsigned int size, enum rring_type type)
+{ return rring_create_gfp(GFP_KERNEL, size, type); }
+EXPORT_SYMBOL(rring_create);
+
+struct rring * rring_create_ni(unsigned int size, enum rring_type type)
+{ return rring_create_gfp(GFP_ATOMIC, size, type); }
+EXPORT_SYMBOL(rring_create_ni);
+
+int rring_resize_ni(struct rring * r, unsigned int size)
+{
+        void **      slots;
+        unsigned int len;
+        unsigned int i;
+
+        if (!r) {
+                LOG_ERR("Can't resize a NULL ring");
+                return -1;
+        }
+        if (!size || size > RRING_MAX_SIZE) {
+                LOG_ERR("Bogus ring size %u", size);
+                return -1;
+        }
+
+        size = roundup_pow_of_two(size);
+        len  = r->tail - r->head;
+        if (size < len)
+                return -1;
+        if (size == r->mask + 1)
+                return 0;
+
+        slots = rkzalloc(size * sizeof(*slots), GFP_ATOMIC);
+        if (!slots)
+                return -1;
+
+        for (i = 0; i < len; i++)
+                slots[i] = r->slots[(r->head + i) & r->mask];
+
+        rkfree(r->slots);
+        r->slots = slots;
+        r->mask  = size - 1;
+        r->head  = 0;
+        r->tail  = len;
+
+        return 0;
+}
+EXPORT_SYMBOL(rring_resize_ni);
+
+int rring_destroy(struct rring * r,
+                  void        (* dtor)(void * e))
+{
+        void * e;
+
+        if (!r) {
+                LOG_ERR("Bogus input parameters, can't destroy NULL");
+                return -1;
+        }
+
+        while (!rring_is_empty(r)) {
+                e = rring_pop(r);
+                if (dtor && e)
+                        dtor(e);
+        }
+
+        rkfree(r->slots);
+        rkfree(r);
+
+        return 0;
+}
+EXPORT_SYMBOL(rring_destroy);
+
+static int __rring_push(struct rring * r, void * e)
+{
+        unsigned int tail = r->tail;
+
+        if (tail - smp_load_acquire(&r->head) > r->mask) {
+                atomic_long_inc(&r->drops);
+                return -1;
+        }
+
+        r->slots[tail & r->mask] = e;
+        smp_store_release(&r->tail, tail + 1);
+
+        return 0;
+}
+
+int rring_push(struct rring * r, void * e)
+{
+        unsigned long flags;
+        int           ret;
+
+        if (unlikely(!r)) {
+                LOG_ERR("Can't push into a NULL ring");
+                return -1;
+        }
+
+        if (r->type == RRING_SPSC)
+                return __rring_push(r, e);
+
+        spin_lock_irqsave(&r->plock, flags);
+        ret = __rring_push(r, e);
+        spin_unlock_irqrestore(&r->plock, flags);
+
+        return ret;
+}
+EXPORT_SYMBOL(rring_push);
+
+void * rring_pop(struct rring * r)
+{
+        unsigned int head;
+        void *       e;
+
+        if (unlikely(!r)) {
+                LOG_ERR("Can't pop from a NULL ring");
+                return NULL;
+        }
+
+        head = r->head;
+        if (head == smp_load_acquire(&r->tail))
+                return NULL;
+
+        e = r->slots[head & r->mask];
+        smp_store_release(&r->head, head + 1);
+
+        return e;
+}
+EXPORT_SYMBOL(rring_pop);
+
+void * rring_peek(struct rring * r)
+{
+        unsigned int head;
+
+        if (unlikely(!r)) {
+                LOG_ERR("Can't peek a NULL ring");
+                return NULL;
+        }
+
+        head = r->head;
+        if (head == smp_load_acquire(&r->tail))
+                return NULL;
+
+        return r->slots[head & r->mask];
+}
+EXPORT_SYMBOL(rring_peek);
+
+bool rring_is_empty(struct rring * r)
+{
+        if (!r) {
+                LOG_ERR("Can't check the emptiness of a NULL ring");
+                return false;
+        }
+
+        return READ_ONCE(r->head) == READ_ONCE(r->tail);
+}
+EXPORT_SYMBOL(rring_is_empty);
+
+bool rring_is_full(struct rring * r)
+{
+        if (!r) {
+                LOG_ERR("Can't check the fullness of a NULL ring");
+                return false;
+        }
+
+        return READ_ONCE(r->tail) - READ_ONCE(r->head) > r->mask;
+}
+EXPORT_SYMBOL(rring_is_full);
+
+ssize_t rring_length(struct rring * r)
+{
+        if (!r)
+                return -1;
+
+        return READ_ONCE(r->tail) - READ_ONCE(r->head);
+}
+EXPORT_SYMBOL(rring_length);
+
+ssize_t rring_capacity(struct rring * r)
+{
+        if (!r)
+                return -1;
+
+        return r->mask + 1;
+}
+EXPORT_SYMBOL(rring_capacity);
+
+unsigned long rring_drops(struct rring * r)
+{
+        if (!r)
+                return 0;
+
+        return atomic_long_read(&r->drops);
+}
+EXPORT_SYMBOL(rring_drops);
+
+#ifdef CONFIG_RINA_RRING_REGRESSION_TESTS
+#include <linux/ktime.h>
+
+#include "rfifo.h"
+
+static bool regression_test_rring_bounds(enum rring_type type)
+{
+        struct rring * r;
+        unsigned long  i;
+
+        r = rring_create(5, type);
+        if (!r) {
+                LOG_ERR("Failed to create ring");
+                return false;
+        }
+
+        if (rring_capacity(r) != 8) {
+                LOG_ERR("Capacity %zd, expected 8", rring_capacity(r));
+                goto fail;
+        }
+
+        for (i = 1; i <= 8; i++) {
+                if (rring_push(r, (void *) i)) {
+                        LOG_ERR("Could not push element %lu", i);
+                        goto fail;
+                }
+        }
+
+        if (!rring_is_full(r) || !rring_push(r, (void *) 9UL)) {
+                LOG_ERR("Pushed into a full ring");
+                goto fail;
+        }
+        if (rring_drops(r) != 1) {
+                LOG_ERR("Drop not accounted");
+                goto fail;
+        }
+
+        for (i = 1; i <= 8; i++) {
+                if (rring_pop(r) != (void *) i) {
+                        LOG_ERR("Element %lu popped out of order", i);
+                        goto fail;
+                }
+        }
+
+        if (!rring_is_empty(r) || rring_pop(r)) {
+                LOG_ERR("Ring should be empty");
+                goto fail;
+        }
+
+        rring_destroy(r, NULL);
+        return true;
+
+ fail:
+        rring_destroy(r, NULL);
+        return false;
+}
+
+static bool regression_test_rring_wrap(void)
+{
+        struct rring * r;
+        unsigned long  pushed = 0, popped = 0;
+        int            round;
+
+        r = rring_create(4, RRING_SPSC);
+        if (!r) {
+                LOG_ERR("Failed to create ring");
+                return false;
+        }
+
+        /* Move head and tail well past the capacity, unevenly */
+        for (round = 0; round < 1000; round++) {
+                while (!rring_is_full(r))
+                        rring_push(r, (void *) ++pushed);
+                while (rring_length(r) > round % 3)
+                        if (rring_pop(r) != (void *) ++popped) {
+                                LOG_ERR("Out of order after %lu pops",
+                                        popped);
+                                rring_destroy(r, NULL);
+                                return false;
+                        }
+        }
+
+        if (rring_drops(r)) {
+                LOG_ERR("Unexpected drops");
+                rring_destroy(r, NULL);
+                return false;
+        }
+
+        rring_destroy(r, NULL);
+        return true;
+}
+
+static bool regression_test_rring_resize(void)
+{
+        struct rring * r;
+        unsigned long  i;
+
+        r = rring_create(4, RRING_SPSC);
+        if (!r) {
+                LOG_ERR("Failed to create ring");
+                return false;
+        }
+
+        /* Wrap the indexes so the live elements straddle the slot array */
+        for (i = 1; i <= 3; i++)
+                rring_push(r, (void *) i);
+        rring_pop(r);
+        rring_pop(r);
+        for (i = 4; i <= 6; i++)
+                rring_push(r, (void *) i);
+
+        if (!rring_resize_ni(r, 2)) {
+                LOG_ERR("Shrunk below the queued elements");
+                goto fail;
+        }
+        if (rring_resize_ni(r, 16) || rring_capacity(r) != 16) {
+                LOG_ERR("Could not grow the ring");
+                goto fail;
+        }
+        for (i = 7; i <= 16; i++)
+                rring_push(r, (void *) i);
+        if (rring_drops(r)) {
+                LOG_ERR("Unexpected drops after growing");
+                goto fail;
+        }
+
+        for (i = 3; i <= 16; i++) {
+                if (rring_pop(r) != (void *) i) {
+                        LOG_ERR("Element %lu lost in the resize", i);
+                        goto fail;
+                }
+        }
+
+        rring_destroy(r, NULL);
+        return true;
+
+ fail:
+        rring_destroy(r, NULL);
+        return false;
+}
+
+#define RRING_PERF_OPS 100000
+
+static void regression_test_rring_perf(void)
+{
+        struct rring * r;
+        struct rfifo * f;
+        ktime_t        start;
+        s64            ring_ns, fifo_ns;
+        unsigned long  i;
+
+        r = rring_create(1024, RRING_SPSC);
+        f = rfifo_create();
+        if (!r || !f) {
+                if (r) rring_destroy(r, NULL);
+                if (f) rfifo_destroy(f, NULL);
+                return;
+        }
+
+        start = ktime_get();
+        for (i = 1; i <= RRING_PERF_OPS; i++) {
+                rring_push(r, (void *) i);
+                rring_pop(r);
+        }
+        ring_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+        start = ktime_get();
+        for (i = 1; i <= RRING_PERF_OPS; i++) {
+                rfifo_push_ni(f, (void *) i);
+                rfifo_pop(f);
+        }
+        fifo_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+        LOG_INFO("push+pop: rring %lld ns/op, rfifo %lld ns/op",
+                 ring_ns / RRING_PERF_OPS, fifo_ns / RRING_PERF_OPS);
+
+        rring_destroy(r, NULL);
+        rfifo_destroy(f, NULL);
+}
+
+bool regression_tests_rring(void)
+{
+        if (!regression_test_rring_bounds(RRING_SPSC)) {
+                LOG_ERR("RRING SPSC bounds test failed");
+                return false;
+        }
+        if (!regression_test_rring_bounds(RRING_MPSC)) {
+                LOG_ERR("RRING MPSC bounds test failed");
+                return false;
+        }
+        if (!regression_test_rring_wrap()) {
+                LOG_ERR("RRING wrap-around test failed");
+                return false;
+        }
+        if (!regression_test_rring_resize()) {
+                LOG_ERR("RRING resize test failed");
+                return false;
+        }
+
+        regression_test_rring_perf();
+
+        LOG_INFO("RRING regression tests passed");
+
+        return true;
+}
+#endif
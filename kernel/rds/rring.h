@@ -0,0 +1,71 @@
+/*
+ * RINA Rings (bounded, allocation-free FIFOs)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef RINA_RRING_H
+#define RINA_RRING_H
+
+#include <linux/types.h>
+
+/*
+ * A ring of pointers with a fixed, power of two, capacity: nothing gets
+ * allocated or freed on push/pop. Pushing on a full ring fails (the caller
+ * keeps the ownership of the element) and is accounted as a drop.
+ *
+ * RRING_SPSC rings do not lock at all: there must be at most one producer
+ * and one consumer at a time (e.g. both serialized by an outer lock).
+ * RRING_MPSC rings serialize the producers internally, the consumer must
+ * still be unique.
+ */
+enum rring_type {
+        RRING_SPSC = 0,
+        RRING_MPSC
+};
+
+struct rring;
+
+/* The largest ring we accept, 2^20 slots */
+#define RRING_MAX_SIZE (1U << 20)
+
+/* size is rounded up to the next power of two */
+struct rring * rring_create(unsigned int size, enum rring_type type);
+struct rring * rring_create_ni(unsigned int size, enum rring_type type);
+
+/*
+ * Changes the capacity (rounded up to the next power of two) keeping the
+ * elements, fails if they do not fit. Nothing may push or pop meanwhile.
+ */
+int            rring_resize_ni(struct rring * r, unsigned int size);
+
+/* NOTE: dtor has the ownership of freeing the passed element */
+int            rring_destroy(struct rring * r,
+                             void        (* dtor)(void * e));
+
+/*
+ * NOTE: NULL entries can be pushed, but then rring_pop() returning NULL
+ *       does not mean empty: check with rring_is_empty()
+ */
+int            rring_push(struct rring * r, void * e);
+void *         rring_pop(struct rring * r);
+void *         rring_peek(struct rring * r);
+bool           rring_is_empty(struct rring * r);
+bool           rring_is_full(struct rring * r);
+ssize_t        rring_length(struct rring * r);
+ssize_t        rring_capacity(struct rring * r);
+unsigned long  rring_drops(struct rring * r);
+
+#endif
@@ -18,8 +18,16 @@
  * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
  */
 
+#include <linux/module.h>
 #include <linux/list.h>
 #include <linux/netdevice.h>
+#include <linux/hashtable.h>
+#include <linux/jhash.h>
+#include <linux/jiffies.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/proc_fs.h>
+#include <linux/seq_file.h>
 
 /* FIXME: The following dependencies have to be removed */
 #define RINA_PREFIX "arp826-arm"
@@ -35,11 +43,25 @@
 #include "arp826-rxtx.h"
 #include "arp826-arm.h"
 
+static unsigned int retry_ms = 1000;
+module_param(retry_ms, uint, 0644);
+MODULE_PARM_DESC(retry_ms,
+                 "Time (ms) resolutions of a GPA wait for the reply to the "
+                 "request already sent, instead of sending another one");
+
+static unsigned int negative_ms = 5000;
+module_param(negative_ms, uint, 0644);
+MODULE_PARM_DESC(negative_ms,
+                 "Time (ms) a GPA left unanswered after retry_ms is reported "
+                 "as unresolvable: a new request is sent for it only "
+                 "retry_ms + negative_ms after the previous one");
+
 struct resolution {
         struct resolve_data * data;
 
         arp826_notify_t       notify;
         void *                opaque;
+        ktime_t               started;
 
         struct list_head      next;
 };
@@ -47,6 +69,94 @@ struct resolution {
 static DEFINE_SPINLOCK(resolutions_lock);
 static struct list_head resolutions_ongoing;
 
+/*
+ * Outstanding requests, indexed by (dev, ptype, tpa). An entry younger than
+ * retry_ms means a request is on the wire (new resolutions piggyback on it),
+ * an entry older than that but younger than retry_ms + negative_ms means
+ * nobody answered (negative cache hit). Entries are dropped on reply, so
+ * the request for an unanswered GPA is only sent again after
+ * retry_ms + negative_ms.
+ */
+#define PENDINGS_HASH_BITS 6
+
+struct pending {
+        struct net_device * dev;
+        uint16_t            ptype;
+        struct gpa *        tpa;
+        unsigned long       sent;
+        struct hlist_node   node;
+};
+
+static DEFINE_HASHTABLE(pendings, PENDINGS_HASH_BITS);
+
+/* All protected by resolutions_lock */
+static struct {
+        u64 requests;
+        u64 coalesced;
+        u64 negative;
+        u64 resolved;
+        u64 latency_sum;        /* usecs */
+        u64 latency_min;
+        u64 latency_max;
+} arm_stats;
+
+static u32 pending_hash(struct net_device * dev,
+                        uint16_t            ptype,
+                        const struct gpa *  tpa)
+{
+        return jhash(gpa_address_value(tpa), gpa_address_length(tpa),
+                     hash_ptr(dev, 32) ^ ptype);
+}
+
+static void pending_destroy(struct pending * p)
+{
+        hash_del(&p->node);
+        gpa_destroy(p->tpa);
+        rkfree(p);
+}
+
+static bool pending_is_expired(const struct pending * p)
+{
+        return time_after_eq(jiffies,
+                             p->sent + msecs_to_jiffies(retry_ms +
+                                                        negative_ms));
+}
+
+/* Must be called with resolutions_lock held, prunes stale entries too */
+static struct pending * pending_find(struct net_device * dev,
+                                     uint16_t            ptype,
+                                     const struct gpa *  tpa)
+{
+        struct pending *    pos;
+        struct hlist_node * tmp;
+        struct pending *    found = NULL;
+
+        hash_for_each_possible_safe(pendings, pos, tmp, node,
+                                    pending_hash(dev, ptype, tpa)) {
+                if (pos->dev == dev && pos->ptype == ptype &&
+                    gpa_is_equal(pos->tpa, tpa)) {
+                        found = pos;
+                        continue;
+                }
+                if (pending_is_expired(pos))
+                        pending_destroy(pos);
+        }
+
+        return found;
+}
+
+static void stats_latency_add(ktime_t started)
+{
+        u64 us = ktime_to_us(ktime_sub(ktime_get(), started));
+
+        arm_stats.resolved++;
+        arm_stats.latency_sum += us;
+        if (arm_stats.resolved == 1 || us < arm_stats.latency_min)
+                arm_stats.latency_min = us;
+        if (us > arm_stats.latency_max)
+                arm_stats.latency_max = us;
+}
+
 struct resolve_data {
         struct net_device * dev;
         uint16_t            ptype;
@@ -145,6 +255,7 @@ static int resolver(void * o)
 {
         struct resolve_data * tmp;
         struct resolution *   pos, * nxt;
+        struct pending *      pos_pending;
 
         LOG_DBG("In the resolver, looking for handler");
 
@@ -161,6 +272,10 @@ static int resolver(void * o)
 
         spin_lock(&resolutions_lock);
 
+        pos_pending = pending_find(tmp->dev, tmp->ptype, tmp->spa);
+        if (pos_pending)
+                pending_destroy(pos_pending);
+
         LOG_DBG("Gonna browse the list of resolutions now");
 
         list_for_each_entry_safe(pos, nxt, &resolutions_ongoing, next) {
@@ -169,6 +284,7 @@ static int resolver(void * o)
                         LOG_DBG("Found an equal resolution");
 
                         ASSERT(pos->notify);
+                        stats_latency_add(pos->started);
                         spin_unlock(&resolutions_lock);
 
                         LOG_DBG("Calling the notifier hook");
@@ -240,6 +356,9 @@ int arp826_resolve_gpa(struct net_device * dev,
                        void *              opaque)
 {
         struct resolution * resolution;
+        struct pending *    pending;
+        struct pending *    fresh;
+        bool                send;
 
         struct gpa * tmp_spa;
         struct gpa * tmp_tpa;
@@ -262,19 +381,31 @@ int arp826_resolve_gpa(struct net_device * dev,
                 return -1;
         }
 
+        fresh = rkzalloc(sizeof(*fresh), GFP_KERNEL);
+        if (!fresh)
+                return -1;
+        fresh->tpa = gpa_dup(tpa);
+        if (!fresh->tpa) {
+                rkfree(fresh);
+                return -1;
+        }
+        fresh->dev   = dev;
+        fresh->ptype = ptype;
+        INIT_HLIST_NODE(&fresh->node);
+
         tmp_spa = gpa_dup(spa);
         if (!tmp_spa)
-                return -1;
+                goto free_fresh;
         tmp_tpa = gpa_dup(tpa);
         if (!tmp_tpa) {
                 gpa_destroy(tmp_spa);
-                return -1;
+                goto free_fresh;
         }
         tmp_sha = gha_dup(sha);
         if (!tmp_sha) {
                 gpa_destroy(tmp_spa);
                 gpa_destroy(tmp_tpa);
-                return -1;
+                goto free_fresh;
         }
 
         resolution = rkzalloc(sizeof(*resolution), GFP_KERNEL);
@@ -282,7 +413,7 @@ int arp826_resolve_gpa(struct net_device * dev,
                 gpa_destroy(tmp_spa);
                 gpa_destroy(tmp_tpa);
                 gha_destroy(tmp_sha);
-                return -1;
+                goto free_fresh;
         }
 
         resolution->data = resolve_data_create(dev, ptype,
@@ -293,21 +424,63 @@ int arp826_resolve_gpa(struct net_device * dev,
                 gpa_destroy(tmp_tpa);
                 gha_destroy(tmp_sha);
                 rkfree(resolution);
-                return -1;
+                goto free_fresh;
         }
 
-        resolution->notify = notify;
-        resolution->opaque = opaque;
+        resolution->notify  = notify;
+        resolution->opaque  = opaque;
+        resolution->started = ktime_get();
         INIT_LIST_HEAD(&resolution->next);
 
-        LOG_DBG("Adding new resolution to the ongoing list");
         spin_lock(&resolutions_lock);
+
+        send    = true;
+        pending = pending_find(dev, ptype, tpa);
+        if (!pending) {
+                fresh->sent = jiffies;
+                hash_add(pendings, &fresh->node,
+                         pending_hash(dev, ptype, tpa));
+                pending = fresh;
+                fresh   = NULL;
+        } else if (time_before(jiffies,
+                               pending->sent + msecs_to_jiffies(retry_ms))) {
+                LOG_DBG("Request already outstanding, piggybacking on it");
+                arm_stats.coalesced++;
+                send = false;
+        } else if (!pending_is_expired(pending)) {
+                LOG_DBG("GPA recently found unresolvable, not asking again");
+                arm_stats.negative++;
+                spin_unlock(&resolutions_lock);
+
+                resolve_data_destroy(resolution->data);
+                rkfree(resolution);
+                goto free_fresh;
+        } else {
+                pending->sent = jiffies;
+        }
+
+        LOG_DBG("Adding new resolution to the ongoing list");
         list_add(&resolution->next, &resolutions_ongoing);
+        if (send)
+                arm_stats.requests++;
+
         spin_unlock(&resolutions_lock);
 
-        if (arp_send_request(dev, ptype, spa, sha, tpa)) {
+        if (fresh) {
+                gpa_destroy(fresh->tpa);
+                rkfree(fresh);
+        }
+
+        if (send && arp_send_request(dev, ptype, spa, sha, tpa)) {
                 LOG_ERR("Cannot send request, cannot resolve GPA");
 
+                spin_lock(&resolutions_lock);
+                list_del(&resolution->next);
+                pending = pending_find(dev, ptype, tpa);
+                if (pending)
+                        pending_destroy(pending);
+                spin_unlock(&resolutions_lock);
+
                 resolve_data_destroy(resolution->data);
                 rkfree(resolution);
 
@@ -315,9 +488,44 @@ int arp826_resolve_gpa(struct net_device * dev,
         }
 
         return 0;
+
+ free_fresh:
+        gpa_destroy(fresh->tpa);
+        rkfree(fresh);
+        return -1;
 }
 EXPORT_SYMBOL(arp826_resolve_gpa);
 
+static int arm_stats_show(struct seq_file * m, void * v)
+{
+        u64 resolved;
+        u64 avg;
+
+        spin_lock(&resolutions_lock);
+        resolved = arm_stats.resolved;
+        avg      = resolved ? div64_u64(arm_stats.latency_sum, resolved) : 0;
+        seq_printf(m, "requests:  %llu\n", arm_stats.requests);
+        seq_printf(m, "coalesced: %llu\n", arm_stats.coalesced);
+        seq_printf(m, "negative:  %llu\n", arm_stats.negative);
+        seq_printf(m, "resolved:  %llu\n", resolved);
+        seq_printf(m, "latency:   min %llu avg %llu max %llu us\n",
+                   arm_stats.latency_min, avg, arm_stats.latency_max);
+        spin_unlock(&resolutions_lock);
+
+        return 0;
+}
+
+static int arm_stats_open(struct inode * inode, struct file * file)
+{ return single_open(file, arm_stats_show, NULL); }
+
+static const struct file_operations arm_stats_fops = {
+        .owner   = THIS_MODULE,
+        .open    = arm_stats_open,
+        .read    = seq_read,
+        .llseek  = seq_lseek,
+        .release = single_release,
+};
+
 int arm_init(void)
 {
         arm_wq = rwq_create("arp826-wq");
@@ -326,6 +534,11 @@ int arm_init(void)
 
         spin_lock_init(&resolutions_lock);
         INIT_LIST_HEAD(&resolutions_ongoing);
+        hash_init(pendings);
+        memset(&arm_stats, 0, sizeof(arm_stats));
+
+        if (!proc_create("arp826-stats", 0444, NULL, &arm_stats_fops))
+                LOG_WARN("Cannot create the ARM statistics proc entry");
 
         LOG_INFO("ARM initialized successfully");
 
@@ -335,13 +548,21 @@ int arm_init(void)
 int arm_fini(void)
 {
         struct resolution * pos, * nxt;
+        struct pending *    p;
+        struct hlist_node * tmp;
+        int                 bkt;
         int                 ret;
 
+        remove_proc_entry("arp826-stats", NULL);
+
         list_for_each_entry_safe(pos, nxt, &resolutions_ongoing, next) {
                 resolve_data_destroy(pos->data);
                 rkfree(pos);
         }
 
+        hash_for_each_safe(pendings, bkt, tmp, p, node)
+                pending_destroy(p);
+
         ret = rwq_destroy(arm_wq);
 
         LOG_INFO("ARM finalized successfully");
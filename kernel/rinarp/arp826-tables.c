@@ -19,14 +19,15 @@
  */
 
 /*
- * NOTE: This cache implementation is far far far away to be a performance-wise
- *       one. Its scope is to server the upper-layers, nothing else. If we will
- *       have the time, a performance-wise implementation will obsolete this
- *       one completely.
+ * NOTE: Entries are kept in a list (for browsing and disposal) and indexed
+ *       by two hash tables, one keyed by GPA and one keyed by GHA, so that
+ *       lookups do not degrade with the size of the L2 domain.
  */
 
 #include <linux/types.h>
 #include <linux/netdevice.h>
+#include <linux/hashtable.h>
+#include <linux/jhash.h>
 
 /* FIXME: The following dependencies have to be removed */
 #define RINA_PREFIX "arp826-tables"
@@ -43,10 +44,12 @@
 #include "arp826-tables.h"
 
 struct table_entry {
-        struct gpa *     pa; /* Protocol address */
-        struct gha *     ha; /* Hardware address */
+        struct gpa *      pa; /* Protocol address */
+        struct gha *      ha; /* Hardware address */
 
-        struct list_head next;
+        struct list_head  next;
+        struct hlist_node pa_node;
+        struct hlist_node ha_node;
 };
 
 static void tble_fini(struct table_entry * entry)
@@ -95,6 +98,8 @@ static int tble_init(struct table_entry * entry,
         entry->ha = ha;
 
         INIT_LIST_HEAD(&entry->next);
+        INIT_HLIST_NODE(&entry->pa_node);
+        INIT_HLIST_NODE(&entry->ha_node);
 
         return 0;
 }
@@ -183,12 +188,57 @@ const struct gha * tble_ha(const struct table_entry * entry)
         return entry->ha;
 }
 
+#define TBL_HASH_BITS 8
+
 struct table {
         size_t           hal;     /* Hardware address length */
         spinlock_t       lock;
         struct list_head entries;
+
+        DECLARE_HASHTABLE(by_pa, TBL_HASH_BITS);
+        DECLARE_HASHTABLE(by_ha, TBL_HASH_BITS);
 };
 
+static u32 tbl_pa_hash(const struct gpa * pa)
+{
+        return jhash(gpa_address_value(pa), gpa_address_length(pa), 0);
+}
+
+static u32 tbl_ha_hash(const struct gha * ha)
+{
+        return jhash(gha_address(ha), gha_address_length(ha), 0);
+}
+
+/* Must be called with the table lock held */
+static struct table_entry * __tbl_find_by_gpa(struct table *     instance,
+                                              const struct gpa * pa)
+{
+        struct table_entry * pos;
+
+        hash_for_each_possible(instance->by_pa, pos, pa_node,
+                               tbl_pa_hash(pa)) {
+                if (gpa_is_equal(pos->pa, pa))
+                        return pos;
+        }
+
+        return NULL;
+}
+
+/* Must be called with the table lock held */
+static struct table_entry * __tbl_find_by_gha(struct table *     instance,
+                                              const struct gha * ha)
+{
+        struct table_entry * pos;
+
+        hash_for_each_possible(instance->by_ha, pos, ha_node,
+                               tbl_ha_hash(ha)) {
+                if (gha_is_equal(pos->ha, ha))
+                        return pos;
+        }
+
+        return NULL;
+}
+
 static struct table * tbl_create_gfp(gfp_t  flags,
                                      size_t ha_length)
 {
@@ -209,6 +259,8 @@ static struct table * tbl_create_gfp(gfp_t  flags,
 
         instance->hal = ha_length;
         INIT_LIST_HEAD(&instance->entries);
+        hash_init(instance->by_pa);
+        hash_init(instance->by_ha);
         spin_lock_init(&instance->lock);
 
         LOG_DBG("Table instance created successfully");
@@ -257,20 +309,27 @@ int tbl_update_by_gpa(struct table *     instance,
                 return -1;
         }
 
+        ha = gha_dup_gfp(flags, ha);
+        if (!ha)
+                return -1;
+
         spin_lock(&instance->lock);
 
-        list_for_each_entry(pos, &instance->entries, next) {
-                if (gpa_is_equal(pos->pa, pa)) {
-                        gha_destroy(pos->ha);
-                        pos->ha = gha_dup_gfp(flags, ha);
-                        spin_unlock(&instance->lock);
-                        return 0;
-                }
+        pos = __tbl_find_by_gpa(instance, pa);
+        if (!pos) {
+                spin_unlock(&instance->lock);
+                gha_destroy(ha);
+                return -1;
         }
 
+        hash_del(&pos->ha_node);
+        gha_destroy(pos->ha);
+        pos->ha = ha;
+        hash_add(instance->by_ha, &pos->ha_node, tbl_ha_hash(pos->ha));
+
         spin_unlock(&instance->lock);
 
-        return -1;
+        return 0;
 }
 
 struct table_entry * tbl_find(struct table *     instance,
@@ -294,17 +353,13 @@ struct table_entry * tbl_find(struct table *     instance,
 
         spin_lock(&instance->lock);
 
-        list_for_each_entry(pos, &instance->entries, next) {
-                if (gpa_is_equal(pos->pa, pa) &&
-                    gha_is_equal(pos->ha, ha)) {
-                        spin_unlock(&instance->lock);
-                        return pos;
-                }
-        }
+        pos = __tbl_find_by_gpa(instance, pa);
+        if (pos && !gha_is_equal(pos->ha, ha))
+                pos = NULL;
 
         spin_unlock(&instance->lock);
 
-        return NULL;
+        return pos;
 }
 
 struct table_entry * tbl_find_by_gha(struct table *     instance,
@@ -322,17 +377,10 @@ struct table_entry * tbl_find_by_gha(struct table *     instance,
         }
 
         spin_lock(&instance->lock);
-
-        list_for_each_entry(pos, &instance->entries, next) {
-                if (gha_is_equal(pos->ha, address)) {
-                        spin_unlock(&instance->lock);
-                        return pos;
-                }
-        }
-
+        pos = __tbl_find_by_gha(instance, address);
         spin_unlock(&instance->lock);
 
-        return NULL;
+        return pos;
 }
 
 struct table_entry * tbl_find_by_gpa(struct table *     instance,
@@ -349,25 +397,14 @@ struct table_entry * tbl_find_by_gpa(struct table *     instance,
                 return NULL;
         }
 
-        LOG_DBG("Looking for the following address in table");
-        gpa_dump(address);
-
-        LOG_DBG("Showing addresses in table in the meanwhile");
-
         spin_lock(&instance->lock);
-        list_for_each_entry(pos, &instance->entries, next) {
-                gpa_dump(pos->pa);
-                if (gpa_is_equal(pos->pa, address)) {
-                        LOG_DBG("That's the address I need");
-                        spin_unlock(&instance->lock);
-                        return pos;
-                }
-        }
+        pos = __tbl_find_by_gpa(instance, address);
         spin_unlock(&instance->lock);
 
-        LOG_DBG("Got no matching address");
+        if (!pos)
+                LOG_DBG("Got no matching address");
 
-        return NULL;
+        return pos;
 }
 
 int tbl_add(struct table *       instance,
@@ -388,33 +425,29 @@ int tbl_add(struct table *       instance,
 
         spin_lock(&instance->lock);
 
-        list_for_each_entry(pos, &instance->entries, next) {
-                if (tble_is_equal(pos, entry)) {
-                        LOG_WARN("We already have an equal entry ...");
-                        spin_unlock(&instance->lock);
-                        return 0;
-                }
-
-                /* FIXME: What about the other conditions ??? */
-                if (gha_is_equal(tble_ha(pos), tble_ha(entry))) {
-                        /* FIXME: What should we do here? */
-
-                        /* Remember to: spin_unlock(&instance->lock); */
-                }
+        /* The new entry replaces the one with the same GPA, if any, so
+         * that a GPA is never hashed twice */
+        pos = __tbl_find_by_gpa(instance, tble_pa(entry));
+        if (pos) {
+                if (gha_is_equal(tble_ha(pos), tble_ha(entry)))
+                        LOG_DBG("We already have an equal entry ...");
+                else
+                        LOG_WARN("Replacing the GHA of a GPA in the cache");
 
-                if (gpa_is_equal(tble_pa(pos), tble_pa(entry))) {
-                        LOG_WARN("We already have the same GPA in the cache");
-
-                        /* FIXME: What should we do here? */
-
-                        /* Remember to: spin_unlock(&instance->lock); */
-                }
+                list_del(&pos->next);
+                hash_del(&pos->pa_node);
+                hash_del(&pos->ha_node);
         }
 
         list_add(&entry->next, &instance->entries);
+        hash_add(instance->by_pa, &entry->pa_node, tbl_pa_hash(entry->pa));
+        hash_add(instance->by_ha, &entry->ha_node, tbl_ha_hash(entry->ha));
 
         spin_unlock(&instance->lock);
 
+        if (pos)
+                tble_destroy(pos);
+
         LOG_DBG("Entry %pK added successfully to the table", entry);
 
         return 0;
@@ -423,7 +456,7 @@ int tbl_add(struct table *       instance,
 int tbl_remove(struct table *             instance,
                const struct table_entry * entry)
 {
-        struct table_entry * pos, * q;
+        struct table_entry * pos;
 
         if (!instance) {
                 LOG_ERR("Bogus instance, cannot remove entry from table");
@@ -436,9 +469,12 @@ int tbl_remove(struct table *             instance,
 
         spin_lock(&instance->lock);
 
-        list_for_each_entry_safe(pos, q, &instance->entries, next) {
+        hash_for_each_possible(instance->by_pa, pos, pa_node,
+                               tbl_pa_hash(entry->pa)) {
                 if (pos == entry) {
                         list_del(&pos->next);
+                        hash_del(&pos->pa_node);
+                        hash_del(&pos->ha_node);
                         spin_unlock(&instance->lock);
                         return 0;
                 }
@@ -449,7 +485,8 @@ int tbl_remove(struct table *             instance,
         return -1;
 }
 
-static DEFINE_SPINLOCK(tables_lock);
+/* Lookups are far more frequent than (de)registrations, hence the rwlock */
+static DEFINE_RWLOCK(tables_lock);
 static struct tmap * tables = NULL;
 
 struct table * tbls_find(struct net_device * device, uint16_t ptype)
@@ -459,17 +496,11 @@ struct table * tbls_find(struct net_device * device, uint16_t ptype)
         if (!device)
                 return NULL;
 
-        spin_lock_bh(&tables_lock);
-
+        read_lock_bh(&tables_lock);
         e = tmap_entry_find(tables, device, ptype);
-        if (!e) {
-                spin_unlock_bh(&tables_lock);
-                return NULL;
-        }
-
-        spin_unlock_bh(&tables_lock);
+        read_unlock_bh(&tables_lock);
 
-        return tmap_entry_value(e);
+        return e ? tmap_entry_value(e) : NULL;
 }
 
 static struct table * tbls_create_gfp(gfp_t               flags,
@@ -494,15 +525,15 @@ static struct table * tbls_create_gfp(gfp_t               flags,
 
         LOG_DBG("Now adding the new table to the tables map");
 
-        spin_lock_bh(&tables_lock);
+        write_lock_bh(&tables_lock);
         if (tmap_entry_add_ni(tables, device, ptype, cl)) {
-                spin_unlock_bh(&tables_lock);
+                write_unlock_bh(&tables_lock);
 
                 tbl_destroy(cl);
 
                 return NULL;
         }
-        spin_unlock_bh(&tables_lock);
+        write_unlock_bh(&tables_lock);
 
         LOG_DBG("Table for created successfully "
                 "(device = %pK, ptype = 0x%04X, hwlen = %zd)",
@@ -526,18 +557,18 @@ int tbls_destroy(struct net_device * device, uint16_t ptype)
         struct tmap_entry * e;
         struct table *      cl;
 
-        spin_lock(&tables_lock);
+        write_lock_bh(&tables_lock);
 
         e = tmap_entry_find(tables, device, ptype);
         if (!e) {
                 LOG_DBG("Table for ptype 0x%04X is missing, cannot destroy",
                          ptype);
-                spin_unlock(&tables_lock);
+                write_unlock_bh(&tables_lock);
                 return -1;
         }
         tmap_entry_remove(e);
 
-        spin_unlock(&tables_lock); /* No need to hold the lock anymore */
+        write_unlock_bh(&tables_lock); /* No need to hold the lock anymore */
 
         cl = tmap_entry_value(e);
 
@@ -562,7 +593,7 @@ int tbls_init(void)
         if (!tables)
                 return -1;
 
-        spin_lock_init(&tables_lock);
+        rwlock_init(&tables_lock);
 
         LOG_INFO("ARP826 tables initialized successfully");
 
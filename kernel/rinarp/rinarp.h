@@ -40,6 +40,7 @@ typedef void (* rinarp_notification_t)(void *             opaque,
                                        const struct gpa * tpa,
                                        const struct gha * tha);
 
+/* Fails early if tpa went unanswered recently (negative cache) */
 int                    rinarp_resolve_gpa(struct rinarp_handle * handle,
                                           const struct gpa *     tpa,
                                           rinarp_notification_t  notify,
@@ -25,6 +25,8 @@
 #include <linux/module.h>
 #include <linux/string.h>
 #include <linux/hashtable.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
 
 #define RINA_PREFIX "rmt-ps-default"
 
@@ -36,18 +38,52 @@
 #include "policies.h"
 #include "rmt-ps-default.h"
 #include "rds/robjects.h"
+#include "rds/rring.h"
 
 #define DEFAULT_Q_MAX 1000
+/* Initial size of the management ring, it grows on demand */
+#define MGT_Q_INIT_SIZE 64
+#define DEFAULT_Q_TARGET_US 5000
+#define DEFAULT_Q_MIN_BYTES (16 * 1024)
+#define DEFAULT_Q_MAX_BYTES (4 * 1024 * 1024)
+/* Shortest drain rate sampling interval of the byte queue limits */
+#define BQL_INTERVAL_US 10000
 #define rmap_hash(T, K) hash_min(K, HASH_BITS(T))
 
+enum rmt_q_mode {
+	RMT_Q_MODE_PDUS = 0,
+	RMT_Q_MODE_BYTES
+};
+
+/*
+ * The data ring is sized after q_max and grown when q_max is raised later on.
+ * The management ring is not bounded by q_max: it doubles whenever it fills
+ * up, so management PDUs are only dropped if that allocation fails. Both are
+ * resized in the enqueue path, with the N-1 port lock held as for every other
+ * ring access. In bytes mode q_max still caps the number of PDUs, but the
+ * data queue is limited by n1_port->qlimit bytes.
+ * That limit follows the drain rate observed by the dequeue policy, so that
+ * the queue holds about q_target_us worth of traffic (see bql_update()).
+ */
 struct rmt_queue {
-	struct rfifo *dt_queue;
-	struct rfifo *mgt_queue;
+	struct rring *dt_queue;
+	struct rring *mgt_queue;
 	port_id_t    pid;
+	unsigned int dt_bytes;
+
+	/* Current drain rate sampling interval */
+	ktime_t	     ival_start;
+	unsigned int ival_bytes;
+	bool	     ival_idle;  /* dt_queue ran empty */
+	bool	     ival_drops; /* dt_queue hit the limit */
 };
 
 struct rmt_ps_default_data {
 	unsigned int q_max;
+	enum rmt_q_mode q_mode;
+	unsigned int q_target_us;
+	unsigned int q_min_bytes;
+	unsigned int q_max_bytes;
 	struct robject robj;
 };
 
@@ -64,13 +100,28 @@ static ssize_t rmt_ps_attr_show(struct robject *        robj,
 	if (strcmp(robject_attr_name(attr), "q_max") == 0) {
 		return sprintf(buf, "%u\n", data->q_max);
 	}
+	if (strcmp(robject_attr_name(attr), "q_mode") == 0) {
+		return sprintf(buf, "%s\n",
+			       data->q_mode == RMT_Q_MODE_BYTES ?
+			       "bytes" : "pdus");
+	}
+	if (strcmp(robject_attr_name(attr), "q_target_us") == 0) {
+		return sprintf(buf, "%u\n", data->q_target_us);
+	}
+	if (strcmp(robject_attr_name(attr), "q_min_bytes") == 0) {
+		return sprintf(buf, "%u\n", data->q_min_bytes);
+	}
+	if (strcmp(robject_attr_name(attr), "q_max_bytes") == 0) {
+		return sprintf(buf, "%u\n", data->q_max_bytes);
+	}
 	return 0;
 }
 RINA_SYSFS_OPS(rmt_ps);
-RINA_ATTRS(rmt_ps, q_max);
+RINA_ATTRS(rmt_ps, q_max, q_mode, q_target_us, q_min_bytes, q_max_bytes);
 RINA_KTYPE(rmt_ps);
 
-static struct rmt_queue *rmt_queue_create(port_id_t port)
+static struct rmt_queue *rmt_queue_create(port_id_t port,
+					  unsigned int q_max)
 {
 	struct rmt_queue *tmp;
 
@@ -78,20 +129,23 @@ static struct rmt_queue *rmt_queue_create(port_id_t port)
 	if (!tmp)
 		return NULL;
 
-	tmp->dt_queue = rfifo_create_ni();
+	/* Both only touched with the N-1 port lock held */
+	tmp->dt_queue = rring_create_ni(q_max, RRING_SPSC);
 	if (!tmp->dt_queue) {
 		rkfree(tmp);
 		return NULL;
 	}
 
-	tmp->mgt_queue = rfifo_create_ni();
+	tmp->mgt_queue = rring_create_ni(MGT_Q_INIT_SIZE, RRING_SPSC);
 	if (!tmp->mgt_queue) {
-		rfifo_destroy(tmp->dt_queue, (void (*)(void *)) du_destroy);
+		rring_destroy(tmp->dt_queue, (void (*)(void *)) du_destroy);
 		rkfree(tmp);
 		return NULL;
 	}
 
 	tmp->pid = port;
+	tmp->ival_start = ktime_get();
+	tmp->ival_idle = true;
 
 	return tmp;
 }
@@ -104,10 +158,10 @@ static int rmt_queue_destroy(struct rmt_queue *q)
 	}
 
 	if (q->dt_queue)
-		rfifo_destroy(q->dt_queue, (void (*)(void *)) du_destroy);
+		rring_destroy(q->dt_queue, (void (*)(void *)) du_destroy);
 
 	if (q->mgt_queue)
-		rfifo_destroy(q->mgt_queue, (void (*)(void *)) du_destroy);
+		rring_destroy(q->mgt_queue, (void (*)(void *)) du_destroy);
 
 	rkfree(q);
 
@@ -127,7 +181,7 @@ void * default_rmt_q_create_policy(struct rmt_ps      *ps,
 
 	data = ps->priv;
 
-	queue = rmt_queue_create(n1_port->port_id);
+	queue = rmt_queue_create(n1_port->port_id, data->q_max);
 	if (!queue) {
 		LOG_ERR("Could not create queue for n1_port %u",
 			n1_port->port_id);
@@ -165,6 +219,48 @@ int default_rmt_q_destroy_policy(struct rmt_ps      *ps,
 }
 EXPORT_SYMBOL(default_rmt_q_destroy_policy);
 
+/*
+ * Byte queue limits: once per sampling interval the bytes drained from the
+ * data queue give the rate of the N-1 port, and the limit moves towards the
+ * bytes that rate drains in q_target_us. The rate is only trusted when the
+ * queue stayed backlogged for the whole interval, otherwise it is just a
+ * lower bound. A queue that dropped and then ran empty starved the port,
+ * so its limit is doubled.
+ *
+ * Must be called with the n1_port lock held
+ */
+static void bql_update(struct rmt_ps_default_data *data,
+		       struct rmt_n1_port *n1_port,
+		       struct rmt_queue *q)
+{
+	ktime_t now = ktime_get();
+	s64 elapsed_us;
+	u64 est;
+	u64 limit;
+
+	elapsed_us = ktime_us_delta(now, q->ival_start);
+	if (elapsed_us < BQL_INTERVAL_US)
+		return;
+
+	est = div64_u64((u64) q->ival_bytes * data->q_target_us, elapsed_us);
+	limit = n1_port->qlimit;
+
+	if (!q->ival_idle)
+		limit = (3 * limit + est) / 4;
+	else if (q->ival_drops)
+		limit *= 2;
+	else
+		limit = max(limit, est);
+
+	n1_port->qlimit = clamp_t(u64, limit,
+				  data->q_min_bytes, data->q_max_bytes);
+
+	q->ival_start = now;
+	q->ival_bytes = 0;
+	q->ival_idle = rring_is_empty(q->dt_queue);
+	q->ival_drops = false;
+}
+
 int default_rmt_enqueue_policy(struct rmt_ps *      ps,
 			       struct rmt_n1_port * n1_port,
 			       struct du *          du,
@@ -173,6 +269,7 @@ int default_rmt_enqueue_policy(struct rmt_ps *      ps,
 	struct rmt_queue *q;
 	struct rmt_ps_default_data *data = ps->priv;
 	pdu_type_t pdu_type;
+	ssize_t len;
 
 	if (!ps || !n1_port || !du) {
 		LOG_ERR("Wrong input parameters");
@@ -187,25 +284,59 @@ int default_rmt_enqueue_policy(struct rmt_ps *      ps,
 		return RMT_PS_ENQ_ERR;
 	}
 
+	len = du_len(du);
 	pdu_type = pci_type(&du->pci);
 	if (pdu_type == PDU_TYPE_MGMT) {
-		if (!must_enqueue && rfifo_is_empty(q->mgt_queue)){
+		if (!must_enqueue && rring_is_empty(q->mgt_queue)){
 			return RMT_PS_ENQ_SEND;
 		}
 
-		rfifo_push_ni(q->mgt_queue, du);
+		if (rring_is_full(q->mgt_queue) &&
+		    rring_capacity(q->mgt_queue) < RRING_MAX_SIZE)
+			rring_resize_ni(q->mgt_queue,
+					2 * rring_capacity(q->mgt_queue));
+
+		if (rring_push(q->mgt_queue, du)) {
+			du_destroy(du);
+			return RMT_PS_ENQ_DROP;
+		}
+		n1_port->qbytes += len;
 		return RMT_PS_ENQ_SCHED;
 	}
 
-	if (!must_enqueue && rfifo_is_empty(q->dt_queue))
-		return RMT_PS_ENQ_SEND;
+	if (rring_is_empty(q->dt_queue)) {
+		q->ival_idle = true;
+		if (!must_enqueue)
+			return RMT_PS_ENQ_SEND;
+	}
+
+	if (data->q_mode == RMT_Q_MODE_BYTES) {
+		if (!n1_port->qlimit)
+			n1_port->qlimit = data->q_min_bytes;
+
+		/* One PDU is always let in, whatever its size */
+		if (q->dt_bytes && q->dt_bytes + len > n1_port->qlimit) {
+			q->ival_drops = true;
+			du_destroy(du);
+			return RMT_PS_ENQ_DROP;
+		}
+	} else
+		n1_port->qlimit = 0;
+
+	/* q_max was raised after the ring was created */
+	if (rring_capacity(q->dt_queue) < data->q_max)
+		rring_resize_ni(q->dt_queue, data->q_max);
 
-	if (rfifo_length(q->dt_queue) >= data->q_max) {
+	if (rring_length(q->dt_queue) >= data->q_max ||
+	    rring_push(q->dt_queue, du)) {
+		q->ival_drops = true;
 		du_destroy(du);
 		return RMT_PS_ENQ_DROP;
 	}
 
-	rfifo_push_ni(q->dt_queue, du);
+	q->dt_bytes += len;
+	n1_port->qbytes += len;
+
 	return RMT_PS_ENQ_SCHED;
 }
 EXPORT_SYMBOL(default_rmt_enqueue_policy);
@@ -214,7 +345,9 @@ struct du *default_rmt_dequeue_policy(struct rmt_ps	  *ps,
 				      struct rmt_n1_port *n1_port)
 {
 	struct rmt_queue *q;
+	struct rmt_ps_default_data *data;
 	struct du *ret_du;
+	ssize_t len;
 
 	if (!ps || !n1_port) {
 		LOG_ERR("Wrong input parameters");
@@ -228,10 +361,25 @@ struct du *default_rmt_dequeue_policy(struct rmt_ps	  *ps,
 		return NULL;
 	}
 
-	if (!rfifo_is_empty(q->mgt_queue))
-		ret_du = rfifo_pop(q->mgt_queue);
-	else
-		ret_du = rfifo_pop(q->dt_queue);
+	if (!rring_is_empty(q->mgt_queue)) {
+		ret_du = rring_pop(q->mgt_queue);
+		if (ret_du)
+			n1_port->qbytes -= du_len(ret_du);
+	} else {
+		ret_du = rring_pop(q->dt_queue);
+		if (ret_du) {
+			len = du_len(ret_du);
+			q->dt_bytes -= len;
+			q->ival_bytes += len;
+			n1_port->qbytes -= len;
+			if (rring_is_empty(q->dt_queue))
+				q->ival_idle = true;
+
+			data = ps->priv;
+			if (data->q_mode == RMT_Q_MODE_BYTES)
+				bql_update(data, n1_port, q);
+		}
+	}
 
 	if (!ret_du) {
 		LOG_ERR("Could not dequeue scheduled pdu");
@@ -249,6 +397,7 @@ static int rmt_ps_default_set_policy_set_param(struct ps_base *bps,
 	struct rmt_ps *ps = container_of(bps, struct rmt_ps, base);
 	struct rmt_ps_default_data *data = ps->priv;
 	int bool_value;
+	unsigned int uval;
 	int ret;
 
 	(void) ps;
@@ -265,13 +414,107 @@ static int rmt_ps_default_set_policy_set_param(struct ps_base *bps,
 
 	if (strcmp(name, "q_max") == 0) {
 		ret = kstrtoint(value, 10, &bool_value);
-		if (!ret)
+		if (!ret && bool_value > 0 &&
+		    (unsigned int) bool_value <= RRING_MAX_SIZE)
 			data->q_max = bool_value;
+		else
+			LOG_ERR("Invalid q_max '%s'", value);
+	}
+
+	if (strcmp(name, "q_mode") == 0) {
+		if (strcmp(value, "bytes") == 0)
+			data->q_mode = RMT_Q_MODE_BYTES;
+		else if (strcmp(value, "pdus") == 0)
+			data->q_mode = RMT_Q_MODE_PDUS;
+		else
+			LOG_ERR("Unknown queue mode '%s'", value);
+	}
+
+	if (strcmp(name, "q_target_us") == 0) {
+		ret = kstrtouint(value, 10, &uval);
+		if (!ret && uval)
+			data->q_target_us = uval;
+	}
+
+	if (strcmp(name, "q_min_bytes") == 0) {
+		ret = kstrtouint(value, 10, &uval);
+		if (!ret && uval && uval <= data->q_max_bytes)
+			data->q_min_bytes = uval;
+		else
+			LOG_ERR("Invalid q_min_bytes '%s' (q_max_bytes %u)",
+				value, data->q_max_bytes);
+	}
+
+	if (strcmp(name, "q_max_bytes") == 0) {
+		ret = kstrtouint(value, 10, &uval);
+		if (!ret && uval >= data->q_min_bytes)
+			data->q_max_bytes = uval;
+		else
+			LOG_ERR("Invalid q_max_bytes '%s' (q_min_bytes %u)",
+				value, data->q_min_bytes);
 	}
 
 	return 0;
 }
 
+static void rmt_ps_default_load_param(struct rmt_ps *ps,
+				      const struct rmt_config *rmt_cfg,
+				      const char *name)
+{
+	struct policy_parm *parm;
+
+	parm = policy_param_find(rmt_cfg->policy_set, name);
+	if (!parm)
+		return;
+
+	rmt_ps_default_set_policy_set_param(&ps->base,
+					    policy_param_name(parm),
+					    policy_param_value(parm));
+}
+
+static unsigned int rmt_ps_default_load_bytes(const struct rmt_config *rmt_cfg,
+					      const char *name,
+					      unsigned int def)
+{
+	struct policy_parm *parm;
+	unsigned int uval;
+
+	parm = policy_param_find(rmt_cfg->policy_set, name);
+	if (!parm)
+		return def;
+
+	if (kstrtouint(policy_param_value(parm), 10, &uval) || !uval) {
+		LOG_ERR("Invalid %s '%s'", name, policy_param_value(parm));
+		return def;
+	}
+
+	return uval;
+}
+
+/*
+ * The byte limits are only checked against each other once both are read,
+ * otherwise a valid pair could be refused because of the default in place
+ * for the one loaded last.
+ */
+static void rmt_ps_default_load_bql(struct rmt_ps_default_data *data,
+				    const struct rmt_config *rmt_cfg)
+{
+	unsigned int min, max;
+
+	min = rmt_ps_default_load_bytes(rmt_cfg, "q_min_bytes",
+					data->q_min_bytes);
+	max = rmt_ps_default_load_bytes(rmt_cfg, "q_max_bytes",
+					data->q_max_bytes);
+	if (min > max) {
+		LOG_WARN("q_min_bytes %u above q_max_bytes %u, using defaults",
+			 min, max);
+		return;
+	}
+
+	data->q_min_bytes = min;
+	data->q_max_bytes = max;
+}
+
 struct ps_base *rmt_ps_default_create(struct rina_component *component)
 {
 	struct rmt *rmt;
@@ -304,6 +547,11 @@ struct ps_base *rmt_ps_default_create(struct rina_component *component)
 	ps->dm = rmt;
 	ps->priv = data;
 
+	data->q_mode = RMT_Q_MODE_PDUS;
+	data->q_target_us = DEFAULT_Q_TARGET_US;
+	data->q_min_bytes = DEFAULT_Q_MIN_BYTES;
+	data->q_max_bytes = DEFAULT_Q_MAX_BYTES;
+
 	rmt_cfg = rmt_config_get(rmt);
 	if (rmt_cfg) {
 		/* RMT config is available at assign-to-dif time, but
@@ -319,6 +567,14 @@ struct ps_base *rmt_ps_default_create(struct rina_component *component)
 						    policy_param_name(parm),
 						    policy_param_value(parm));
         }
+	if (!data->q_max)
+		data->q_max = DEFAULT_Q_MAX;
+
+	if (rmt_cfg) {
+		rmt_ps_default_load_param(ps, rmt_cfg, "q_mode");
+		rmt_ps_default_load_param(ps, rmt_cfg, "q_target_us");
+		rmt_ps_default_load_bql(data, rmt_cfg);
+	}
 
 	ps->rmt_dequeue_policy = default_rmt_dequeue_policy;
 	ps->rmt_enqueue_policy = default_rmt_enqueue_policy;
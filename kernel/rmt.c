@@ -31,6 +31,8 @@
 #include <linux/string.h>
 /* FIXME: to be re-removed after removing tasklets */
 #include <linux/interrupt.h>
+#include <linux/percpu.h>
+#include <linux/ktime.h>
 
 #define RINA_PREFIX "rmt"
 
@@ -48,6 +50,8 @@
 #include "ipcp-utils.h"
 #include "du.h"
 #include "rmt-ps-default.h"
+#include "dp-latency.h"
+#include "dp-trace.h"
 
 #define rmap_hash(T, K) hash_min(K, HASH_BITS(T))
 #define MAX_PDUS_SENT_PER_CYCLE 10
@@ -81,17 +85,26 @@ struct rmt {
 	struct pff_cache cache;
 	struct rmt_config *rmt_cfg;
 	struct sdup *sdup;
+	struct dp_lat *lat;
 	struct robject robj;
 };
 
-#define stats_get(name, n1_port, retval)				\
-        spin_lock_bh(&n1_port->lock);					\
-        retval = n1_port->stats.name;					\
-        spin_unlock_bh(&n1_port->lock);
+#define stats_get(name, n1_port)					\
+	pcpu_stats_get(n1_port->stats, struct n1_port_stats, name)
 
 #define stats_inc(name, n1_port, bytes)					\
-        n1_port->stats.name##_pdus++;					\
-	n1_port->stats.name##_bytes += (unsigned int) bytes;		\
+	this_cpu_inc(n1_port->stats->name##_pdus);			\
+	this_cpu_add(n1_port->stats->name##_bytes, (unsigned long) bytes);
+
+#define stats_drop(name, n1_port)					\
+	this_cpu_inc(n1_port->stats->name)
+
+/* Must be called with the n1_port lock held */
+static inline void n1_port_plen_inc(struct rmt_n1_port *n1_port)
+{
+	if (++n1_port->plen > n1_port->plen_hwm)
+		n1_port->plen_hwm = n1_port->plen;
+}
 
 static ssize_t rmt_attr_show(struct robject *        robj,
                              struct robj_attribute * attr,
@@ -114,7 +127,7 @@ static ssize_t rmt_n1_port_attr_show(struct robject *        robj,
                                      char *                  buf)
 {
 	struct rmt_n1_port * n1_port;
-	unsigned int stats_ret;
+	unsigned int plen;
 	bool wbusy;
 	enum flow_state state;
 
@@ -123,33 +136,43 @@ static ssize_t rmt_n1_port_attr_show(struct robject *        robj,
 		return 0;
 
 	if (strcmp(robject_attr_name(attr), "queued_pdus") == 0) {
-		stats_get(plen, n1_port, stats_ret);
-		return sprintf(buf, "%u\n", stats_ret);
-	}
-	if (strcmp(robject_attr_name(attr), "drop_pdus") == 0) {
-		stats_get(drop_pdus, n1_port, stats_ret);
-		return sprintf(buf, "%u\n", stats_ret);
-	}
-	if (strcmp(robject_attr_name(attr), "err_pdus") == 0) {
-		stats_get(err_pdus, n1_port, stats_ret);
-		return sprintf(buf, "%u\n", stats_ret);
-	}
-	if (strcmp(robject_attr_name(attr), "tx_pdus") == 0) {
-		stats_get(tx_pdus, n1_port, stats_ret);
-		return sprintf(buf, "%u\n", stats_ret);
-	}
-	if (strcmp(robject_attr_name(attr), "rx_pdus") == 0) {
-		stats_get(rx_pdus, n1_port, stats_ret);
-		return sprintf(buf, "%u\n", stats_ret);
+		spin_lock_bh(&n1_port->lock);
+		plen = n1_port->plen;
+		spin_unlock_bh(&n1_port->lock);
+		return sprintf(buf, "%u\n", plen);
 	}
-	if (strcmp(robject_attr_name(attr), "tx_bytes") == 0) {
-		stats_get(tx_bytes, n1_port, stats_ret);
-		return sprintf(buf, "%u\n", stats_ret);
+	if (strcmp(robject_attr_name(attr), "queued_pdus_hwm") == 0) {
+		spin_lock_bh(&n1_port->lock);
+		plen = n1_port->plen_hwm;
+		spin_unlock_bh(&n1_port->lock);
+		return sprintf(buf, "%u\n", plen);
 	}
-	if (strcmp(robject_attr_name(attr), "rx_bytes") == 0) {
-		stats_get(rx_bytes, n1_port, stats_ret);
-		return sprintf(buf, "%u\n", stats_ret);
+	if (strcmp(robject_attr_name(attr), "queued_bytes") == 0) {
+		spin_lock_bh(&n1_port->lock);
+		plen = n1_port->qbytes;
+		spin_unlock_bh(&n1_port->lock);
+		return sprintf(buf, "%u\n", plen);
 	}
+	if (strcmp(robject_attr_name(attr), "queue_limit_bytes") == 0) {
+		spin_lock_bh(&n1_port->lock);
+		plen = n1_port->qlimit;
+		spin_unlock_bh(&n1_port->lock);
+		return sprintf(buf, "%u\n", plen);
+	}
+	if (strcmp(robject_attr_name(attr), "drop_pdus") == 0)
+		return sprintf(buf, "%lu\n", stats_get(drop_pdus, n1_port));
+	if (strcmp(robject_attr_name(attr), "err_pdus") == 0)
+		return sprintf(buf, "%lu\n", stats_get(err_pdus, n1_port));
+	if (strcmp(robject_attr_name(attr), "rx_err_pdus") == 0)
+		return sprintf(buf, "%lu\n", stats_get(rx_err_pdus, n1_port));
+	if (strcmp(robject_attr_name(attr), "tx_pdus") == 0)
+		return sprintf(buf, "%lu\n", stats_get(tx_pdus, n1_port));
+	if (strcmp(robject_attr_name(attr), "rx_pdus") == 0)
+		return sprintf(buf, "%lu\n", stats_get(rx_pdus, n1_port));
+	if (strcmp(robject_attr_name(attr), "tx_bytes") == 0)
+		return sprintf(buf, "%lu\n", stats_get(tx_bytes, n1_port));
+	if (strcmp(robject_attr_name(attr), "rx_bytes") == 0)
+		return sprintf(buf, "%lu\n", stats_get(rx_bytes, n1_port));
 	if (strcmp(robject_attr_name(attr), "wbusy") == 0) {
 		spin_lock_bh(&n1_port->lock);
 		wbusy = n1_port->wbusy;
@@ -168,7 +191,8 @@ RINA_SYSFS_OPS(rmt);
 RINA_ATTRS(rmt, ps_name);
 RINA_KTYPE(rmt);
 RINA_SYSFS_OPS(rmt_n1_port);
-RINA_ATTRS(rmt_n1_port, queued_pdus, drop_pdus, err_pdus, tx_pdus,
+RINA_ATTRS(rmt_n1_port, queued_pdus, queued_pdus_hwm, queued_bytes,
+	   queue_limit_bytes, drop_pdus, err_pdus, rx_err_pdus, tx_pdus,
 	   tx_bytes, rx_pdus, rx_bytes, wbusy, state);
 RINA_KTYPE(rmt_n1_port);
 
@@ -183,6 +207,12 @@ static struct rmt_n1_port *n1_port_create(port_id_t id,
 	if (!tmp)
 		return NULL;
 
+	tmp->stats = alloc_percpu_gfp(struct n1_port_stats, GFP_ATOMIC);
+	if (!tmp->stats) {
+		rkfree(tmp);
+		return NULL;
+	}
+
 	robject_init(&tmp->robj, &rmt_n1_port_rtype);
 	INIT_HLIST_NODE(&tmp->hlist);
 
@@ -192,13 +222,10 @@ static struct rmt_n1_port *n1_port_create(port_id_t id,
 
 	atomic_set(&tmp->refs_c, 0);
 	tmp->wbusy = false;
-	tmp->stats.plen = 0;
-	tmp->stats.drop_pdus = 0;
-	tmp->stats.err_pdus = 0;
-	tmp->stats.tx_pdus = 0;
-	tmp->stats.tx_bytes = 0;
-	tmp->stats.rx_pdus = 0;
-	tmp->stats.rx_bytes = 0;
+	tmp->plen = 0;
+	tmp->plen_hwm = 0;
+	tmp->qbytes = 0;
+	tmp->qlimit = 0;
 	tmp->sdup_port = 0;
 	spin_lock_init(&tmp->lock);
 
@@ -242,6 +269,7 @@ static int n1_port_destroy(struct rmt_n1_port *n1p)
 	if (n1p->wbusy)
 		LOG_WARN("Deleting n1_port with bussy writer... there may be something wrong...");
 
+	free_percpu(n1p->stats);
 	rkfree(n1p);
 
 	return 0;
@@ -597,6 +625,8 @@ int rmt_destroy(struct rmt *instance)
 		pff_destroy(instance->pff);
 	if (instance->rmt_cfg)
 		rmt_config_free(instance->rmt_cfg);
+	if (instance->lat)
+		dp_lat_destroy(instance->lat);
 
 	robject_del(&instance->robj);
 
@@ -629,6 +659,10 @@ struct robject * rmt_robject(struct rmt * instance)
 }
 EXPORT_SYMBOL(rmt_robject);
 
+struct dp_lat *rmt_dp_lat(struct rmt *instance)
+{ return instance ? instance->lat : NULL; }
+EXPORT_SYMBOL(rmt_dp_lat);
+
 struct rmt_config *rmt_config_get(struct rmt *instance)
 {
 	if (!instance) {
@@ -683,6 +717,9 @@ static int n1_port_write_du(struct rmt *rmt,
 	ssize_t bytes = du_len(du);
 
 	LOG_DBG("Gonna send SDU to port-id %d", n1_port->port_id);
+	trace_n1_port_write(n1_port->port_id, bytes);
+	dp_lat_record(rmt->lat, DP_LAT_TX_N1_PORT, du);
+	dp_lat_clear(du);
 	ret = n1_port->n1_ipcp->ops->du_write(n1_port->n1_ipcp->data,
 					      n1_port->port_id,
 					      du, false);
@@ -695,11 +732,11 @@ static int n1_port_write_du(struct rmt *rmt,
 			LOG_ERR("Already a pending SDU present for port %d",
 					n1_port->port_id);
 			du_destroy(n1_port->pending_du);
-			n1_port->stats.plen--;
+			n1_port->plen--;
 		}
 
 		n1_port->pending_du = du;
-		n1_port->stats.plen++;
+		n1_port_plen_inc(n1_port);
 
 		if (n1_port->state == N1_PORT_STATE_DO_NOT_DISABLE) {
 			n1_port->state = N1_PORT_STATE_ENABLED;
@@ -781,7 +818,7 @@ static void send_worker(unsigned long o)
 		}
 
 		if (n1_port->state == N1_PORT_STATE_DISABLED	||
-		    !n1_port->stats.plen) {
+		    !n1_port->plen) {
 			spin_unlock(&n1_port->lock);
 			spin_lock(&rmt->n1_ports->lock);
 			LOG_DBG("Port state is DISABLED or no PDUs to send");
@@ -804,22 +841,22 @@ static void send_worker(unsigned long o)
 		/* Try to send PDUs on that port-id here */
 
 		while ((pdus_sent < MAX_PDUS_SENT_PER_CYCLE) &&
-			n1_port->stats.plen) {
+			n1_port->plen) {
 			du = NULL;
 			pendu = NULL;
 			if (n1_port->pending_du) {
 				pendu = n1_port->pending_du;
 				n1_port->pending_du = NULL;
-				n1_port->stats.plen--;
+				n1_port->plen--;
 			} else {
 				du = ps->rmt_dequeue_policy(ps, n1_port);
 				if (!du) {
-					if (n1_port->stats.plen)
+					if (n1_port->plen)
 						LOG_ERR("rmt_dequeue_policy returned no pdu but plen is %u",
-								n1_port->stats.plen);
+								n1_port->plen);
 					break;
 				}
-				n1_port->stats.plen--;
+				n1_port->plen--;
 			}
 
 			spin_unlock(&n1_port->lock);
@@ -838,7 +875,7 @@ static void send_worker(unsigned long o)
 
 		if ((n1_port->state == N1_PORT_STATE_ENABLED ||
 		    n1_port->state == N1_PORT_STATE_DO_NOT_DISABLE) &&
-		    n1_port->stats.plen)
+		    n1_port->plen)
 			reschedule++;
 
 		n1_port->wbusy = false;
@@ -863,6 +900,36 @@ static void send_worker(unsigned long o)
 	}
 }
 
+void rmt_n1_port_drop_queued(struct rmt_n1_port *n1_port)
+{
+	ASSERT(n1_port->plen);
+
+	n1_port->plen--;
+	stats_drop(drop_pdus, n1_port);
+}
+EXPORT_SYMBOL(rmt_n1_port_drop_queued);
+
+int rmt_n1port_backlog(struct rmt *instance,
+		       port_id_t id)
+{
+	struct rmt_n1_port *n1_port;
+	int backlog;
+
+	if (!instance)
+		return -1;
+
+	n1_port = n1pmap_find(instance, id);
+	if (!n1_port)
+		return -1;
+
+	/* Just a hint, no need to take the port lock to read it */
+	backlog = READ_ONCE(n1_port->plen);
+	n1pmap_release(instance, n1_port);
+
+	return backlog;
+}
+EXPORT_SYMBOL(rmt_n1port_backlog);
+
 int rmt_send_port_id(struct rmt *instance,
 		     port_id_t id,
 		     struct du * du)
@@ -894,7 +961,7 @@ int rmt_send_port_id(struct rmt *instance,
 	n1_port_lock(n1_port);
 
 	must_enqueue = false;
-	if (n1_port->stats.plen 				||
+	if (n1_port->plen 				||
 		n1_port->wbusy 					||
 		n1_port->state == N1_PORT_STATE_DISABLED) {
 		must_enqueue = true;
@@ -904,17 +971,17 @@ int rmt_send_port_id(struct rmt *instance,
 	rcu_read_unlock();
 	switch (ret) {
 	case RMT_PS_ENQ_SCHED:
-		n1_port->stats.plen++;
+		n1_port_plen_inc(n1_port);
 		tasklet_hi_schedule(&instance->egress_tasklet);
 		ret = 0;
 		break;
 	case RMT_PS_ENQ_DROP:
-		n1_port->stats.drop_pdus++;
+		stats_drop(drop_pdus, n1_port);
 		LOG_DBG("PDU dropped while enqueing");
 		ret = 0;
 		break;
 	case RMT_PS_ENQ_ERR:
-		n1_port->stats.err_pdus++;
+		stats_drop(err_pdus, n1_port);
 		LOG_DBG("Some error occurred while enqueuing PDU");
 		ret = 0;
 		break;
@@ -922,7 +989,7 @@ int rmt_send_port_id(struct rmt *instance,
 		if (must_enqueue) {
 			/* Wrong behaviour of the policy */
 			du_destroy(du);
-			n1_port->stats.err_pdus++;
+			stats_drop(err_pdus, n1_port);
 			LOG_DBG("Policy should have enqueue, returned SEND");
 			ret = -1;
 			break;
@@ -964,6 +1031,10 @@ int rmt_send(struct rmt *instance,
 		return -1;
 	}
 
+	trace_rmt_send(pci_destination(&du->pci), pci_qos_id(&du->pci),
+		       du_len(du));
+	dp_lat_record(instance->lat, DP_LAT_TX_RMT, du);
+
 	if (pff_nhop(instance->pff, &du->pci,
 		     &(instance->cache.pids),
 		     &(instance->cache.count))) {
@@ -1039,7 +1110,7 @@ int rmt_enable_port_id(struct rmt *instance,
 	LOG_DBG("Changed state to ENABLED");
 
 exit:
-	if (n1_port->stats.plen)
+	if (n1_port->plen)
 		tasklet_hi_schedule(&instance->egress_tasklet);
 
 	n1_port_unlock_release(n1_port);
@@ -1083,7 +1154,7 @@ int rmt_disable_port_id(struct rmt *instance,
 
 	if (n1_port->state == N1_PORT_STATE_DO_NOT_DISABLE) {
 		n1_port->state = N1_PORT_STATE_ENABLED;
-		if (n1_port->stats.plen)
+		if (n1_port->plen)
 			tasklet_hi_schedule(&instance->egress_tasklet);
 		goto exit;
 	}
@@ -1169,6 +1240,10 @@ int rmt_n1port_bind(struct rmt *instance,
 		return -1;
 	}
 
+	/* Port-ids get reused, forget any down state from a previous flow */
+	if (instance->pff)
+		pff_port_state_change(instance->pff, id, true);
+
 	return 0;
 }
 EXPORT_SYMBOL(rmt_n1port_bind);
@@ -1177,6 +1252,7 @@ int rmt_n1port_unbind(struct rmt *instance,
 		      port_id_t id)
 {
 	struct rmt_n1_port *n1_port;
+	ktime_t start;
 
 	if (!instance) {
 		LOG_ERR("Bogus instance passed");
@@ -1206,6 +1282,20 @@ int rmt_n1port_unbind(struct rmt *instance,
 	 * not wrong since once in N1_PORT_STATE_DEALLOCATED no other action
 	 * will be performed on the n1_port but this action should be atomic */
 	n1pmap_release(instance, n1_port);
+
+	/*
+	 * The N-1 flow is gone (e.g. deallocated on keepalive timeout), let
+	 * the PFF fail over to its alternates right away instead of waiting
+	 * for the routing daemon to recompute the table. The time it takes
+	 * is logged, tests/failover-loopback.sh checks it.
+	 */
+	if (instance->pff) {
+		start = ktime_get();
+		pff_port_state_change(instance->pff, id, false);
+		LOG_INFO("N-1 port %d unbound, PFF failover took %lld ns", id,
+			 ktime_to_ns(ktime_sub(ktime_get(), start)));
+	}
+
 	return 0;
 }
 EXPORT_SYMBOL(rmt_n1port_unbind);
@@ -1298,6 +1388,9 @@ int rmt_receive(struct rmt *rmt,
 	bytes = du_len(du);
 	du->cfg = rmt->efcpc->config;
 
+	trace_rmt_receive(from, bytes);
+	dp_lat_stamp(du);
+
 	n1_port = n1pmap_find(rmt, from);
 	if (!n1_port) {
 		LOG_ERR("Could not retrieve N-1 port for the received PDU...");
@@ -1308,6 +1401,7 @@ int rmt_receive(struct rmt *rmt,
 
 	/* SDU Protection */
 	if (sdup_unprotect_pdu(n1_port->sdup_port, du)) {
+		stats_drop(rx_err_pdus, n1_port);
                 LOG_ERR("Failed to unprotect PDU");
                 du_destroy(du);
                 return -1;
@@ -1315,6 +1409,7 @@ int rmt_receive(struct rmt *rmt,
 
 	/* This one updates the pci->sdup_header and pdu->skb->data pointers */
 	if (sdup_get_lifetime_limit(n1_port->sdup_port, du)) {
+		stats_drop(rx_err_pdus, n1_port);
                 LOG_ERR("Failed to get PDU's TTL");
                 du_destroy(du);
                 return -1;
@@ -1418,12 +1513,18 @@ struct rmt *rmt_create(struct kfa *kfa,
                 return NULL;
 	}
 
-	tmp->pff = pff_create(&tmp->robj, tmp->parent);
+	tmp->pff = pff_create(&tmp->robj, tmp->parent, tmp);
 	if (!tmp->pff) {
 		rmt_destroy(tmp);
 		return NULL;
 	}
 
+	tmp->lat = dp_lat_create(&tmp->robj);
+	if (!tmp->lat) {
+		rmt_destroy(tmp);
+		return NULL;
+	}
+
 	tmp->n1_ports = n1pmap_create(&tmp->robj);
 	if (!tmp->n1_ports) {
 		LOG_ERR("Failed to create N-1 ports map");
@@ -64,14 +64,15 @@ enum flow_state {
 	N1_PORT_STATE_DEALLOCATED,
 };
 
+/* One block per CPU, see pcpu_stats_get() */
 struct n1_port_stats {
-	unsigned int plen; /* port len, all pdus enqueued in PS queue/s */
-	unsigned int drop_pdus;
-	unsigned int err_pdus;
-	unsigned int tx_pdus;
-	unsigned int tx_bytes;
-	unsigned int rx_pdus;
-	unsigned int rx_bytes;
+	unsigned long drop_pdus;   /* dropped by the enqueue policy */
+	unsigned long err_pdus;    /* enqueue policy errors */
+	unsigned long rx_err_pdus; /* failed SDU unprotection on reception */
+	unsigned long tx_pdus;
+	unsigned long tx_bytes;
+	unsigned long rx_pdus;
+	unsigned long rx_bytes;
 };
 
 struct rmt_n1_port {
@@ -83,7 +84,11 @@ struct rmt_n1_port {
 	atomic_t		refs_c;
 	struct du		*pending_du;
 	struct sdup_port 	*sdup_port;
-	struct n1_port_stats	stats;
+	unsigned int		plen; /* all pdus enqueued in PS queue/s */
+	unsigned int		plen_hwm; /* highest plen seen */
+	unsigned int		qbytes; /* bytes in PS queue/s, kept by the PS */
+	unsigned int		qlimit; /* PS byte limit, 0 if none */
+	struct n1_port_stats __percpu *stats;
 	bool			wbusy;
 	void 			*rmt_ps_queues;
 	struct robject		robj;
@@ -139,4 +144,19 @@ int		   rmt_address_remove(struct rmt *instance,
 				      address_t address);
 struct rmt	  *rmt_from_component(struct rina_component *component);
 struct robject    *rmt_robject(struct rmt * instance);
+struct dp_lat     *rmt_dp_lat(struct rmt * instance);
+
+/*
+ * For policies dropping a PDU they had already enqueued (e.g. AQM at
+ * dequeue time), to be called with the n1_port lock held
+ */
+void		   rmt_n1_port_drop_queued(struct rmt_n1_port *n1_port);
+
+/*
+ * PDUs waiting in the PS queues of an N-1 port, -1 if the port is not bound.
+ * Meant as load feedback for the forwarding policies, must not be called
+ * with an n1_port lock held
+ */
+int		   rmt_n1port_backlog(struct rmt *instance,
+				      port_id_t id);
 #endif
@@ -25,6 +25,7 @@
 
 /* For RWQ */
 #include <linux/workqueue.h>
+#include <linux/percpu.h>
 
 #define RINA_PREFIX "utils"
 
@@ -37,6 +38,21 @@
 bool is_value_in_range(int value, int min_value, int max_value)
 { return ((value >= min_value || value <= max_value) ? true : false); }
 
+unsigned long pcpu_stats_sum(const void __percpu * stats, size_t offset)
+{
+        unsigned long sum = 0;
+        int           cpu;
+
+        if (!stats)
+                return 0;
+
+        for_each_possible_cpu(cpu)
+                sum += *(const unsigned long *)
+                        ((const char *) per_cpu_ptr(stats, cpu) + offset);
+
+        return sum;
+}
+
 char * strdup_from_user(const char __user * src)
 {
         size_t size;
@@ -23,6 +23,14 @@
 
 bool    is_value_in_range(int value, int min_value, int max_value);
 
+/*
+ * Per-CPU statistics: blocks of unsigned long counters, bumped with
+ * this_cpu_inc/this_cpu_add and only added up when read
+ */
+unsigned long pcpu_stats_sum(const void __percpu * stats, size_t offset);
+#define pcpu_stats_get(STATS, TYPE, FIELD)                              \
+        pcpu_stats_sum(STATS, offsetof(TYPE, FIELD))
+
 /* Syscalls */
 char *  strdup_from_user(const char __user * src);
 
@@ -31,6 +31,9 @@
 #include "vmpi.h"
 
 
+static unsigned int queue_pairs = 1;
+module_param(queue_pairs, uint, 0444);
+MODULE_PARM_DESC(queue_pairs, "Number of RX/TX virtqueue pairs to use");
 
 struct vmpi_impl_queue {
         struct virtqueue *vq;
@@ -46,28 +49,40 @@ struct vmpi_impl_queue {
 
 struct vmpi_impl_info {
         struct virtio_device *vdev;
+        /* Arrays of num_queues send and receive queues. */
         struct vmpi_impl_queue *sq;
         struct vmpi_impl_queue *rq;
+        unsigned int num_queues;
         void *private;
 };
 
+/* Virtqueues are laid out as RX/TX pairs, like in virtio-net. */
+#define vq2qp(vq)       ((vq)->index / 2)
+
 vmpi_info_t *
 vmpi_info_from_vmpi_impl_info(vmpi_impl_info_t *vi)
 {
         return vi->private;
 }
 
+unsigned int
+vmpi_impl_num_queues(vmpi_impl_info_t *vi)
+{
+        return vi->num_queues;
+}
+
 static void
 virtio_mpi_xmit_callback(struct virtqueue *vq)
 {
         struct vmpi_impl_info *vi = vq->vdev->priv;
+        unsigned int qp = vq2qp(vq);
 
         /*
          * Callback is NULL in the interval between vmpi-guest deregistering
          * callbacks and the virtiqueue being removed by this driver.
          */
-        if (likely(vi->sq->cb)) {
-                vi->sq->cb(vi);
+        if (likely(vi->sq[qp].cb)) {
+                vi->sq[qp].cb(vi, qp);
         }
 }
 
@@ -75,22 +90,23 @@ static void
 virtio_mpi_recv_callback(struct virtqueue *vq)
 {
         struct vmpi_impl_info *vi = vq->vdev->priv;
+        unsigned int qp = vq2qp(vq);
 
         /*
          * Callback is NULL in the interval between vmpi-guest deregistering
          * callbacks and the virtiqueue being removed by this driver.
          */
-        if (likely(vi->rq->cb)) {
-                vi->rq->cb(vi);
+        if (likely(vi->rq[qp].cb)) {
+                vi->rq[qp].cb(vi, qp);
         }
 }
 
 /* To be called under lock. */
 int
-vmpi_impl_write_buf(struct vmpi_impl_info *vi, struct vmpi_buf *vb,
-                    unsigned int channel)
+vmpi_impl_write_buf(struct vmpi_impl_info *vi, unsigned int qp,
+                    struct vmpi_buf *vb, unsigned int channel)
 {
-        struct vmpi_impl_queue *q = vi->sq;
+        struct vmpi_impl_queue *q = vi->sq + qp;
         ssize_t ret;
 
 #ifdef VMPI_BUF_CAN_PUSH
@@ -110,23 +126,31 @@ vmpi_impl_write_buf(struct vmpi_impl_info *vi, struct vmpi_buf *vb,
         return ret;
 }
 
+/* With the event index negotiated, the host is only notified when it
+ * asked for it, i.e. when it is not already draining the queue. */
+void
+vmpi_impl_txkick(struct vmpi_impl_info *vi, unsigned int qp)
+{
+        virtqueue_kick(vi->sq[qp].vq);
+}
+
 void
-vmpi_impl_txkick(struct vmpi_impl_info *vi)
+vmpi_impl_rxkick(struct vmpi_impl_info *vi, unsigned int qp)
 {
-        virtqueue_kick(vi->sq->vq);
+        virtqueue_kick(vi->rq[qp].vq);
 }
 
 bool
-vmpi_impl_tx_should_stop(struct vmpi_impl_info *vi)
+vmpi_impl_tx_should_stop(struct vmpi_impl_info *vi, unsigned int qp)
 {
-        return vi->sq->vq->num_free < 4;
+        return vi->sq[qp].vq->num_free < 4;
 }
 
 struct vmpi_buf *
-vmpi_impl_get_written_buffer(struct vmpi_impl_info *vi)
+vmpi_impl_get_written_buffer(struct vmpi_impl_info *vi, unsigned int qp)
 {
         unsigned int len;
-        struct vmpi_buf *vb = virtqueue_get_buf(vi->sq->vq, &len);
+        struct vmpi_buf *vb = virtqueue_get_buf(vi->sq[qp].vq, &len);
 
         return vb;
 }
@@ -166,12 +190,14 @@ add_rx_buf(struct vmpi_impl_queue *q)
         return err;
 }
 
-/* To be called under lock. */
+/* To be called under lock. The consumed receive buffer is replaced
+ * right away, but the host is only notified by vmpi_impl_rxkick(). */
 struct vmpi_buf *
-vmpi_impl_read_buffer(struct vmpi_impl_info *vi, unsigned *channel)
+vmpi_impl_read_buffer(struct vmpi_impl_info *vi, unsigned int qp,
+                      unsigned *channel)
 {
         unsigned int len;
-        struct vmpi_impl_queue *q = vi->rq;
+        struct vmpi_impl_queue *q = vi->rq + qp;
         struct vmpi_buf *vb = virtqueue_get_buf(q->vq, &len);
         struct vmpi_hdr *hdr;
 
@@ -190,29 +216,28 @@ vmpi_impl_read_buffer(struct vmpi_impl_info *vi, unsigned *channel)
         *channel = hdr->channel;
 
         add_rx_buf(q);
-        virtqueue_kick(q->vq);
 
         return vb;
 }
 
 bool
-vmpi_impl_send_cb(struct vmpi_impl_info *vi, int enable)
+vmpi_impl_send_cb(struct vmpi_impl_info *vi, unsigned int qp, int enable)
 {
         if (enable) {
-                return virtqueue_enable_cb_delayed(vi->sq->vq);
+                return virtqueue_enable_cb_delayed(vi->sq[qp].vq);
         }
-        virtqueue_disable_cb(vi->sq->vq);
+        virtqueue_disable_cb(vi->sq[qp].vq);
 
         return true;
 }
 
 bool
-vmpi_impl_receive_cb(struct vmpi_impl_info *vi, int enable)
+vmpi_impl_receive_cb(struct vmpi_impl_info *vi, unsigned int qp, int enable)
 {
         if (enable) {
-                return virtqueue_enable_cb(vi->rq->vq);
+                return virtqueue_enable_cb(vi->rq[qp].vq);
         }
-        virtqueue_disable_cb(vi->rq->vq);
+        virtqueue_disable_cb(vi->rq[qp].vq);
 
         return true;
 }
@@ -222,15 +247,23 @@ vmpi_impl_callbacks_register(struct vmpi_impl_info *vi,
                              vmpi_impl_callback_t xmit,
                              vmpi_impl_callback_t recv)
 {
-        vi->sq->cb = xmit;
-        vi->rq->cb = recv;
+        unsigned int i;
+
+        for (i = 0; i < vi->num_queues; i++) {
+                vi->sq[i].cb = xmit;
+                vi->rq[i].cb = recv;
+        }
 }
 
 void
 vmpi_impl_callbacks_unregister(struct vmpi_impl_info *vi)
 {
-        vi->sq->cb = NULL;
-        vi->rq->cb = NULL;
+        unsigned int i;
+
+        for (i = 0; i < vi->num_queues; i++) {
+                vi->sq[i].cb = NULL;
+                vi->rq[i].cb = NULL;
+        }
 }
 
 static int
@@ -241,12 +274,12 @@ virtio_mpi_find_vqs(struct vmpi_impl_info *vi)
         int ret = -ENOMEM;
         int total_vqs;
         const char **names;
+        unsigned int i;
 
         /* We expect 1 RX virtqueue followed by 1 TX virtqueue, followed by
-         * possible N-1 RX/TX queue pairs used in multiqueue mode, followed by
-         * possible control vq.
+         * possible N-1 RX/TX queue pairs used in multiqueue mode.
          */
-        total_vqs = 2;
+        total_vqs = 2 * vi->num_queues;
 
         /* Allocate space for find_vqs parameters */
         vqs = kzalloc(total_vqs * sizeof(*vqs), GFP_KERNEL);
@@ -260,20 +293,24 @@ virtio_mpi_find_vqs(struct vmpi_impl_info *vi)
                 goto err_names;
 
         /* Allocate/initialize parameters for send/receive virtqueues */
-        callbacks[0] = virtio_mpi_recv_callback;
-        callbacks[1] = virtio_mpi_xmit_callback;
-        sprintf(vi->rq->name, "input.%d", 0);
-        sprintf(vi->sq->name, "output.%d", 0);
-        names[0] = vi->rq->name;
-        names[1] = vi->sq->name;
+        for (i = 0; i < vi->num_queues; i++) {
+                callbacks[2 * i] = virtio_mpi_recv_callback;
+                callbacks[2 * i + 1] = virtio_mpi_xmit_callback;
+                sprintf(vi->rq[i].name, "input.%u", i);
+                sprintf(vi->sq[i].name, "output.%u", i);
+                names[2 * i] = vi->rq[i].name;
+                names[2 * i + 1] = vi->sq[i].name;
+        }
 
         ret = vi->vdev->config->find_vqs(vi->vdev, total_vqs, vqs, callbacks,
                                          names);
         if (ret)
                 goto err_find;
 
-        vi->rq->vq = vqs[0];
-        vi->sq->vq = vqs[1];
+        for (i = 0; i < vi->num_queues; i++) {
+                vi->rq[i].vq = vqs[2 * i];
+                vi->sq[i].vq = vqs[2 * i + 1];
+        }
 
         kfree(names);
         kfree(callbacks);
@@ -303,16 +340,20 @@ virtio_mpi_config_changed(struct virtio_device *vdev)
 static int
 virtio_mpi_alloc_queues(struct vmpi_impl_info *vi)
 {
-        vi->sq = kzalloc((sizeof(*vi->sq)) * 1, GFP_KERNEL);
+        unsigned int i;
+
+        vi->sq = kzalloc(sizeof(*vi->sq) * vi->num_queues, GFP_KERNEL);
         if (!vi->sq)
                 goto err_sq;
 
-        vi->rq = kzalloc(sizeof(*vi->rq) * 1, GFP_KERNEL);
+        vi->rq = kzalloc(sizeof(*vi->rq) * vi->num_queues, GFP_KERNEL);
         if (!vi->rq)
                 goto err_rq;
 
-        sg_init_table(vi->rq->sg, ARRAY_SIZE(vi->rq->sg));
-        sg_init_table(vi->sq->sg, ARRAY_SIZE(vi->sq->sg));
+        for (i = 0; i < vi->num_queues; i++) {
+                sg_init_table(vi->rq[i].sg, ARRAY_SIZE(vi->rq[i].sg));
+                sg_init_table(vi->sq[i].sg, ARRAY_SIZE(vi->sq[i].sg));
+        }
 
         return 0;
 
@@ -334,30 +375,28 @@ vmpi_impl_free_unused_bufs(struct vmpi_impl_info *vi)
 {
         struct vmpi_buf *vb;
         struct virtqueue *vq;
-        int cnt;
+        unsigned int i;
 
-        cnt = 0;
-        vq = vi->sq->vq;
-        while ((vb = virtqueue_detach_unused_buf(vq)) != NULL) {
-                vmpi_buf_free(vb);
-                cnt++;
-        }
+        for (i = 0; i < vi->num_queues; i++) {
+                vq = vi->sq[i].vq;
+                while ((vb = virtqueue_detach_unused_buf(vq)) != NULL) {
+                        vmpi_buf_free(vb);
+                }
 
-        cnt = 0;
-        vq = vi->rq->vq;
-        while ((vb = virtqueue_detach_unused_buf(vq)) != NULL) {
-                vmpi_buf_free(vb);
-                cnt++;
-                //--vi->rq[0].num;
+                vq = vi->rq[i].vq;
+                while ((vb = virtqueue_detach_unused_buf(vq)) != NULL) {
+                        vmpi_buf_free(vb);
+                }
         }
-        //BUG_ON(vi->rq[0].num != 0);
 }
 
 static int
-init_vqs(struct vmpi_impl_info *vi)
+init_vqs_n(struct vmpi_impl_info *vi, unsigned int num_queues)
 {
         int ret;
 
+        vi->num_queues = num_queues;
+
         /* Allocate send & receive queues */
         ret = virtio_mpi_alloc_queues(vi);
         if (ret)
@@ -375,6 +414,25 @@ init_vqs(struct vmpi_impl_info *vi)
         return ret;
 }
 
+static int
+init_vqs(struct vmpi_impl_info *vi)
+{
+        unsigned int n = clamp_t(unsigned int, queue_pairs, 1,
+                                 VMPI_QUEUE_PAIRS_MAX);
+        int ret;
+
+        ret = init_vqs_n(vi, n);
+        if (ret && n > 1) {
+                /* The device does not expose that many virtqueues:
+                 * fall back to a single queue pair. */
+                printk("virtio-mpi: %u queue pairs not available, "
+                       "using 1\n", n);
+                ret = init_vqs_n(vi, 1);
+        }
+
+        return ret;
+}
+
 static void
 virtio_mpi_del_vqs(struct vmpi_impl_info *vi)
 {
@@ -427,6 +485,7 @@ virtio_mpi_probe(struct virtio_device *vdev)
         int err;
         struct vmpi_impl_info *vi;
         unsigned int i;
+        unsigned int q;
 
         err = -ENOMEM;
 
@@ -438,7 +497,8 @@ virtio_mpi_probe(struct virtio_device *vdev)
         vi->vdev = vdev;
         vdev->priv = vi;
 
-        /* Use single tx/rx queue pair as default */
+        /* Use single tx/rx queue pair as default, unless more queue
+         * pairs are requested with the queue_pairs parameter. */
 
         /* Allocate/initialize the rx/tx queues, and invoke find_vqs */
         err = init_vqs(vi);
@@ -455,16 +515,19 @@ virtio_mpi_probe(struct virtio_device *vdev)
 
         /* Setup some receive buffers. */
         i = 0;
-        do {
-                err = add_rx_buf(vi->rq);
-                if (err) {
-                        goto setup_rxbufs;
-                }
-                i++;
-        } while (vi->rq->vq->num_free);
-        virtqueue_kick(vi->rq->vq);
+        for (q = 0; q < vi->num_queues; q++) {
+                do {
+                        err = add_rx_buf(vi->rq + q);
+                        if (err) {
+                                goto setup_rxbufs;
+                        }
+                        i++;
+                } while (vi->rq[q].vq->num_free);
+                virtqueue_kick(vi->rq[q].vq);
+        }
 
-        printk("virtio_mpi_probe completed (%d rx bufs added)\n", i);
+        printk("virtio_mpi_probe completed (%u queue pairs, %d rx bufs "
+               "added)\n", vi->num_queues, i);
 
         return 0;
 
@@ -26,17 +26,21 @@
 typedef struct vmpi_impl_info vmpi_impl_info_t;
 typedef struct vmpi_info vmpi_info_t;
 
-typedef void (*vmpi_impl_callback_t)(vmpi_impl_info_t *);
-
-int vmpi_impl_write_buf(vmpi_impl_info_t *vi, struct vmpi_buf *buf,
-                        unsigned int channel);
-void vmpi_impl_txkick(vmpi_impl_info_t *vi);
-bool vmpi_impl_tx_should_stop(vmpi_impl_info_t *vi);
-struct vmpi_buf *vmpi_impl_get_written_buffer(vmpi_impl_info_t *vi);
-struct vmpi_buf *vmpi_impl_read_buffer(vmpi_impl_info_t *vi,
+/* Callbacks are invoked with the index of the queue pair. */
+typedef void (*vmpi_impl_callback_t)(vmpi_impl_info_t *, unsigned int);
+
+unsigned int vmpi_impl_num_queues(vmpi_impl_info_t *vi);
+int vmpi_impl_write_buf(vmpi_impl_info_t *vi, unsigned int q,
+                        struct vmpi_buf *buf, unsigned int channel);
+void vmpi_impl_txkick(vmpi_impl_info_t *vi, unsigned int q);
+void vmpi_impl_rxkick(vmpi_impl_info_t *vi, unsigned int q);
+bool vmpi_impl_tx_should_stop(vmpi_impl_info_t *vi, unsigned int q);
+struct vmpi_buf *vmpi_impl_get_written_buffer(vmpi_impl_info_t *vi,
+                                              unsigned int q);
+struct vmpi_buf *vmpi_impl_read_buffer(vmpi_impl_info_t *vi, unsigned int q,
                                        unsigned int *channel);
-bool vmpi_impl_send_cb(vmpi_impl_info_t *vi, int enable);
-bool vmpi_impl_receive_cb(vmpi_impl_info_t *vi, int enable);
+bool vmpi_impl_send_cb(vmpi_impl_info_t *vi, unsigned int q, int enable);
+bool vmpi_impl_receive_cb(vmpi_impl_info_t *vi, unsigned int q, int enable);
 void vmpi_impl_callbacks_register(vmpi_impl_info_t *vi,
                                   vmpi_impl_callback_t xmit,
                                   vmpi_impl_callback_t recv);
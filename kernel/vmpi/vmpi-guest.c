@@ -33,12 +33,24 @@
 
 #define VMPI_GUEST_BUDGET  64
 
-struct vmpi_info {
-        vmpi_impl_info_t *vi;
+/* Per queue pair state: each queue pair has its own lock and receive
+ * worker, so that channels mapped on different queue pairs do not
+ * contend with each other. */
+struct vmpi_queue {
+        struct vmpi_info *mpi;
+        unsigned int idx;
 
         spinlock_t write_lock;
         struct work_struct recv_worker;
         struct mutex recv_worker_lock;
+};
+
+struct vmpi_info {
+        vmpi_impl_info_t *vi;
+
+        struct vmpi_queue queues[VMPI_QUEUE_PAIRS_MAX];
+        unsigned int num_queues;
+        spinlock_t cb_lock;
 
         vmpi_read_cb_t read_cb;
         vmpi_write_restart_cb_t write_restart_cb;
@@ -59,9 +71,7 @@ vmpi_guest_register_cbs(struct vmpi_ops *ops, vmpi_read_cb_t rcb,
                 return -EINVAL;
         }
 
-        /* We could use a separate lock for this, but we'll just
-         * reuse the write lock. */
-        spin_lock_bh(&mpi->write_lock);
+        spin_lock_bh(&mpi->cb_lock);
         if (mpi->read_cb) {
                 ret = -EBUSY;
 
@@ -70,7 +80,7 @@ vmpi_guest_register_cbs(struct vmpi_ops *ops, vmpi_read_cb_t rcb,
                 mpi->write_restart_cb = wcb;
                 mpi->cb_data = opaque;
         }
-        spin_unlock_bh(&mpi->write_lock);
+        spin_unlock_bh(&mpi->cb_lock);
 
         return ret;
 }
@@ -80,23 +90,26 @@ vmpi_guest_unregister_cbs(struct vmpi_ops *ops)
 {
         struct vmpi_info *mpi = ops->priv;
 
-        spin_lock_bh(&mpi->write_lock);
+        spin_lock_bh(&mpi->cb_lock);
         mpi->read_cb = NULL;
         mpi->write_restart_cb = NULL;
         mpi->cb_data = NULL;
-        spin_unlock_bh(&mpi->write_lock);
+        spin_unlock_bh(&mpi->cb_lock);
 
         return 0;
 }
 
+/* To be called under the queue write lock. */
 static void
-vmpi_clean_tx(struct vmpi_info *mpi)
+vmpi_clean_tx(struct vmpi_queue *q)
 {
+        struct vmpi_info *mpi = q->mpi;
         struct vmpi_buf *buf;
 
-        vmpi_impl_send_cb(mpi->vi, 0);
+        vmpi_impl_send_cb(mpi->vi, q->idx, 0);
 
-        while ((buf = vmpi_impl_get_written_buffer(mpi->vi)) != NULL) {
+        while ((buf = vmpi_impl_get_written_buffer(mpi->vi, q->idx))
+                                                        != NULL) {
                 IFV(printk("xmit done %p\n", buf));
                 vmpi_buf_free(buf);
                 mpi->stats.txres++;
@@ -105,54 +118,56 @@ vmpi_clean_tx(struct vmpi_info *mpi)
 
 static ssize_t
 vmpi_guest_write(struct vmpi_ops *ops, unsigned int channel,
-           struct vmpi_buf *vb)
-
+                 struct vmpi_buf *vb)
 {
         struct vmpi_info *mpi = ops->priv;
         vmpi_impl_info_t *vi = mpi->vi;
         size_t len = vmpi_buf_len(vb);
+        struct vmpi_queue *q;
         ssize_t ret = 0;
 
         if (!vi)
                 return -EBADFD;
 
-        spin_lock_bh(&mpi->write_lock);
+        q = mpi->queues + vmpi_channel_to_queue(channel, mpi->num_queues);
+
+        spin_lock_bh(&q->write_lock);
 
-        vmpi_clean_tx(mpi);
+        vmpi_clean_tx(q);
 
-        if (vmpi_impl_tx_should_stop(vi)) {
+        if (vmpi_impl_tx_should_stop(vi, q->idx)) {
                 /* We have to stop, let's enable notifications and
                  * doublecheck. */
-                if (vmpi_impl_send_cb(vi, 1)) {
-                        spin_unlock_bh(&mpi->write_lock);
+                if (vmpi_impl_send_cb(vi, q->idx, 1)) {
+                        spin_unlock_bh(&q->write_lock);
                         return -EAGAIN;
                 }
 
                 /* Wow, that's uncommon, we may go ahead. */
-                vmpi_clean_tx(mpi);
-                if (vmpi_impl_tx_should_stop(vi)) {
+                vmpi_clean_tx(q);
+                if (vmpi_impl_tx_should_stop(vi, q->idx)) {
                         /* No, false alarm. */
-                        spin_unlock_bh(&mpi->write_lock);
+                        spin_unlock_bh(&q->write_lock);
                         return -EAGAIN;
                 }
-                vmpi_impl_send_cb(vi, 0);
+                vmpi_impl_send_cb(vi, q->idx, 0);
         }
 
-        ret = vmpi_impl_write_buf(vi, vb, channel);
+        ret = vmpi_impl_write_buf(vi, q->idx, vb, channel);
         if (likely(ret == 0)) {
                 ret = len;
                 mpi->stats.txreq++;
         }
 
-        vmpi_impl_txkick(vi);
+        vmpi_impl_txkick(vi, q->idx);
 
-        spin_unlock_bh(&mpi->write_lock);
+        spin_unlock_bh(&q->write_lock);
 
         return ret;
 }
 
 static void
-xmit_callback(vmpi_impl_info_t *vi)
+xmit_callback(vmpi_impl_info_t *vi, unsigned int qidx)
 {
         struct vmpi_info *mpi = vmpi_info_from_vmpi_impl_info(vi);
 
@@ -168,20 +183,22 @@ xmit_callback(vmpi_impl_info_t *vi)
 static void
 recv_worker_function(struct work_struct *work)
 {
-        struct vmpi_info *mpi =
-                container_of(work, struct vmpi_info, recv_worker);
+        struct vmpi_queue *q =
+                container_of(work, struct vmpi_queue, recv_worker);
+        struct vmpi_info *mpi = q->mpi;
         struct vmpi_impl_info *vi = mpi->vi;
         unsigned int budget = VMPI_GUEST_BUDGET;
         struct vmpi_buf *vb;
         unsigned int channel;
 
-        mutex_lock(&mpi->recv_worker_lock);
+        mutex_lock(&q->recv_worker_lock);
  again:
-        while (budget && (vb = vmpi_impl_read_buffer(vi, &channel)) != NULL) {
+        while (budget &&
+               (vb = vmpi_impl_read_buffer(vi, q->idx, &channel)) != NULL) {
                 IFV(printk("received %d bytes\n", (int)vmpi_buf_len(vb)));
 
                 /* XXX don't drop the lock here */
-                mutex_unlock(&mpi->recv_worker_lock);
+                mutex_unlock(&q->recv_worker_lock);
 
                 if (unlikely(!mpi->read_cb)) {
                         vmpi_buf_free(vb);
@@ -189,31 +206,36 @@ recv_worker_function(struct work_struct *work)
                         mpi->read_cb(mpi->cb_data, channel, vb);
                 }
 
-                mutex_lock(&mpi->recv_worker_lock);
+                mutex_lock(&q->recv_worker_lock);
 
                 mpi->stats.rxres++;
                 budget--;
         }
 
+        /* Give back all the refilled receive buffers at once. */
+        if (budget != VMPI_GUEST_BUDGET) {
+                vmpi_impl_rxkick(vi, q->idx);
+        }
+
         if (!budget) {
-                schedule_work(&mpi->recv_worker); /* HZ/20 */
-        } else if (!vmpi_impl_receive_cb(vi, 1)) {
-                vmpi_impl_receive_cb(vi, 0);
+                schedule_work(&q->recv_worker); /* HZ/20 */
+        } else if (!vmpi_impl_receive_cb(vi, q->idx, 1)) {
+                vmpi_impl_receive_cb(vi, q->idx, 0);
                 goto again;
         }
 
-        mutex_unlock(&mpi->recv_worker_lock);
+        mutex_unlock(&q->recv_worker_lock);
 }
 
 static void
-recv_callback(vmpi_impl_info_t *vi)
+recv_callback(vmpi_impl_info_t *vi, unsigned int qidx)
 {
         struct vmpi_info *mpi = vmpi_info_from_vmpi_impl_info(vi);
 
         mpi->stats.rxint++;
 
-        vmpi_impl_receive_cb(vi, 0);
-        schedule_work(&mpi->recv_worker);
+        vmpi_impl_receive_cb(vi, qidx, 0);
+        schedule_work(&mpi->queues[qidx].recv_worker);
 }
 
 struct vmpi_info *
@@ -221,6 +243,7 @@ vmpi_init(vmpi_impl_info_t *vi, int *ret)
 {
         struct vmpi_info *mpi;
         struct vmpi_ops ops;
+        unsigned int i;
 
         *ret = -ENOMEM;
 
@@ -240,10 +263,19 @@ vmpi_init(vmpi_impl_info_t *vi, int *ret)
         vmpi_stats_init(&mpi->stats);
 
         mpi->vi = vi;
-
-        spin_lock_init(&mpi->write_lock);
-        INIT_WORK(&mpi->recv_worker, recv_worker_function);
-        mutex_init(&mpi->recv_worker_lock);
+        mpi->num_queues = min_t(unsigned int, vmpi_impl_num_queues(vi),
+                                VMPI_QUEUE_PAIRS_MAX);
+
+        spin_lock_init(&mpi->cb_lock);
+        for (i = 0; i < mpi->num_queues; i++) {
+                struct vmpi_queue *q = mpi->queues + i;
+
+                q->mpi = mpi;
+                q->idx = i;
+                spin_lock_init(&q->write_lock);
+                INIT_WORK(&q->recv_worker, recv_worker_function);
+                mutex_init(&q->recv_worker_lock);
+        }
 
         vmpi_impl_callbacks_register(mpi->vi, xmit_callback, recv_callback);
 
@@ -263,6 +295,8 @@ vmpi_init(vmpi_impl_info_t *vi, int *ret)
 void
 vmpi_fini(struct vmpi_info *mpi)
 {
+        unsigned int i;
+
         vmpi_provider_unregister(VMPI_PROVIDER_GUEST, mpi->id);
 
         if (mpi == NULL) {
@@ -280,7 +314,9 @@ vmpi_fini(struct vmpi_info *mpi)
          * Cancel and flush any pending receive work, so that we
          * can free the RX resources.
          */
-        cancel_work_sync(&mpi->recv_worker);
+        for (i = 0; i < mpi->num_queues; i++) {
+                cancel_work_sync(&mpi->queues[i].recv_worker);
+        }
 
         vmpi_stats_fini(&mpi->stats);
         kfree(mpi);
@@ -43,20 +43,38 @@
  * Using this limit prevents one virtqueue from starving others. */
 #define VHOST_MPI_WEIGHT 0x80000
 
+/* Max number of guest RX descriptors used by a single buffer. */
+#define VHOST_MPI_RX_QUOTA 1
+
+/* Used descriptors are published (and the guest possibly notified, as
+ * allowed by the event index) in batches of at most VMPI_BATCH. */
 enum {
-        VHOST_MPI_FEATURES = VHOST_FEATURES | (1ULL << VIRTIO_F_VERSION_1),
+        VHOST_MPI_FEATURES = VHOST_FEATURES | (1ULL << VIRTIO_F_VERSION_1) |
+                             (1ULL << VIRTIO_RING_F_EVENT_IDX),
 };
 
+/* Virtqueues are laid out as RX/TX pairs, like in virtio-net:
+ * the queue pair q uses virtqueues 2q (RX) and 2q + 1 (TX). */
 enum {
         VHOST_MPI_VQ_RX = 0,
         VHOST_MPI_VQ_TX = 1,
-        VHOST_MPI_VQ_MAX = 2,
+        VHOST_MPI_VQ_PER_PAIR = 2,
+        VHOST_MPI_VQ_MAX = VHOST_MPI_VQ_PER_PAIR * VMPI_QUEUE_PAIRS_MAX,
 };
 
+#define VHOST_MPI_VQ_IS_TX(idx) (((idx) % VHOST_MPI_VQ_PER_PAIR) == \
+                                 VHOST_MPI_VQ_TX)
+
 extern unsigned int vmpi_max_channels;
 
 struct vmpi_impl_queue {
         struct vhost_virtqueue vq;
+
+        /* Only used by RX virtqueues: buffers waiting to be
+         * pushed to the guest. */
+        struct list_head write;
+        unsigned int write_len;
+        spinlock_t write_lock;
 #ifndef VMPI_BUF_CAN_PUSH
         struct vmpi_hdr hdrs[VMPI_RING_SIZE];
         unsigned int hdr_head;
@@ -69,15 +87,15 @@ struct vmpi_impl_info {
         struct vmpi_impl_queue vqs[VHOST_MPI_VQ_MAX];
         struct vhost_poll poll[VHOST_MPI_VQ_MAX];
 
+        /* Number of queue pairs used to spread channels, i.e. the
+         * highest queue pair started by userspace (plus one). */
+        unsigned int num_queues;
+
         struct file *file;
         wait_queue_head_t wqh_poll;
 
         struct vmpi_info *mpi;
 
-        struct list_head write;
-        unsigned int write_len;
-        spinlock_t write_lock;
-
         vmpi_read_cb_t read_cb;
         vmpi_write_restart_cb_t write_restart_cb;
         void *cb_data;
@@ -85,20 +103,37 @@ struct vmpi_impl_info {
         struct vmpi_stats stats;
 };
 
+static void
+vmpi_impl_lock_vqs(struct vmpi_impl_info *vi)
+{
+        int i;
+
+        for (i = 0; i < VHOST_MPI_VQ_MAX; i++) {
+                mutex_lock_nested(&vi->vqs[i].vq.mutex, i);
+        }
+}
+
+static void
+vmpi_impl_unlock_vqs(struct vmpi_impl_info *vi)
+{
+        int i;
+
+        for (i = VHOST_MPI_VQ_MAX - 1; i >= 0; i--) {
+                mutex_unlock(&vi->vqs[i].vq.mutex);
+        }
+}
+
 int
 vmpi_impl_register_cbs(vmpi_impl_info_t *vi, vmpi_read_cb_t rcb,
                        vmpi_write_restart_cb_t wcb, void *opaque)
 {
-        struct vhost_virtqueue *txvq = &vi->vqs[VHOST_MPI_VQ_TX].vq;
-        struct vhost_virtqueue *rxvq = &vi->vqs[VHOST_MPI_VQ_RX].vq;
         int ret = 0;
 
         if (!rcb || !wcb) {
                 return -EINVAL;
         }
 
-        mutex_lock(&txvq->mutex);
-        mutex_lock(&rxvq->mutex);
+        vmpi_impl_lock_vqs(vi);
 
         if (vi->read_cb) {
                 ret = -EBUSY;
@@ -108,8 +143,7 @@ vmpi_impl_register_cbs(vmpi_impl_info_t *vi, vmpi_read_cb_t rcb,
                 vi->cb_data = opaque;
         }
 
-        mutex_unlock(&txvq->mutex);
-        mutex_unlock(&rxvq->mutex);
+        vmpi_impl_unlock_vqs(vi);
 
         return ret;
 }
@@ -117,22 +151,26 @@ vmpi_impl_register_cbs(vmpi_impl_info_t *vi, vmpi_read_cb_t rcb,
 int
 vmpi_impl_unregister_cbs(vmpi_impl_info_t *vi)
 {
-        struct vhost_virtqueue *txvq = &vi->vqs[VHOST_MPI_VQ_TX].vq;
-        struct vhost_virtqueue *rxvq = &vi->vqs[VHOST_MPI_VQ_RX].vq;
-
-        mutex_lock(&txvq->mutex);
-        mutex_lock(&rxvq->mutex);
+        vmpi_impl_lock_vqs(vi);
 
         vi->read_cb = NULL;
         vi->write_restart_cb = NULL;
         vi->cb_data = NULL;
 
-        mutex_unlock(&txvq->mutex);
-        mutex_unlock(&rxvq->mutex);
+        vmpi_impl_unlock_vqs(vi);
 
         return 0;
 }
 
+static inline struct vmpi_impl_queue *
+vmpi_impl_channel_to_rxq(struct vmpi_impl_info *vi, unsigned int channel)
+{
+        unsigned int q = vmpi_channel_to_queue(channel,
+                                               READ_ONCE(vi->num_queues));
+
+        return &vi->vqs[q * VHOST_MPI_VQ_PER_PAIR + VHOST_MPI_VQ_RX];
+}
+
 static void
 vhost_mpi_vq_reset(struct vmpi_impl_info *vi)
 {
@@ -141,12 +179,12 @@ vhost_mpi_vq_reset(struct vmpi_impl_info *vi)
 /* Expects to be always run from workqueue - which acts as
  * read-size critical section for our kind of RCU. */
 static void
-handle_guest_tx(struct vmpi_impl_info *vi)
+handle_guest_tx(struct vmpi_impl_info *vi, struct vmpi_impl_queue *nvq)
 {
-        struct vmpi_impl_queue *nvq = &vi->vqs[VHOST_MPI_VQ_TX];
         struct vhost_virtqueue *vq = &nvq->vq;
         unsigned out, in;
         int head;
+        unsigned int nheads = 0;
         size_t len, total_len = 0;
         void *opaque;
         struct vmpi_buf *vb = NULL;
@@ -212,13 +250,24 @@ handle_guest_tx(struct vmpi_impl_info *vi)
                         vi->stats.rxres++;
                 }
 
-                vhost_add_used_and_signal(&vi->dev, vq, head, 0);
+                /* Used descriptors are returned in batches, so that
+                 * the guest is interrupted at most once per batch. */
+                vq->heads[nheads].id = cpu_to_vhost32(vq, head);
+                vq->heads[nheads].len = 0;
+                if (++nheads == VMPI_BATCH) {
+                        vhost_add_used_and_signal_n(&vi->dev, vq, vq->heads,
+                                                    nheads);
+                        nheads = 0;
+                }
                 total_len += len;
                 if (unlikely(total_len >= VHOST_MPI_WEIGHT)) {
                         vhost_poll_queue(&vq->poll);
                         break;
                 }
         }
+        if (nheads) {
+                vhost_add_used_and_signal_n(&vi->dev, vq, vq->heads, nheads);
+        }
  out:
         mutex_unlock(&vq->mutex);
 }
@@ -233,14 +282,12 @@ int
 vmpi_impl_write_buf(struct vmpi_impl_info *vi, struct vmpi_buf *vb,
                     unsigned int channel)
 {
-#ifndef VMPI_BUF_CAN_PUSH
-        struct vmpi_impl_queue *nvq = &vi->vqs[VHOST_MPI_VQ_RX];
-#endif
+        struct vmpi_impl_queue *nvq = vmpi_impl_channel_to_rxq(vi, channel);
 	struct vmpi_buf_node *vbn;
 
-        spin_lock_bh(&vi->write_lock);
-        if (vi->write_len >= WR_Q_MAXLEN) {
-                spin_unlock_bh(&vi->write_lock);
+        spin_lock_bh(&nvq->write_lock);
+        if (nvq->write_len >= WR_Q_MAXLEN) {
+                spin_unlock_bh(&nvq->write_lock);
                 return -EAGAIN;
         }
 #ifdef VMPI_BUF_CAN_PUSH
@@ -252,42 +299,49 @@ vmpi_impl_write_buf(struct vmpi_impl_info *vi, struct vmpi_buf *vb,
 #endif
 	vbn = vmpi_buf_node_alloc(vb, GFP_ATOMIC);
 	if (!vbn) {
-                spin_unlock_bh(&vi->write_lock);
+                spin_unlock_bh(&nvq->write_lock);
                 return -EAGAIN;
 	}
-        list_add_tail(&vbn->node, &vi->write);
-        vi->write_len++;
+        list_add_tail(&vbn->node, &nvq->write);
+        nvq->write_len++;
         vi->stats.txreq++;
-        spin_unlock_bh(&vi->write_lock);
+        spin_unlock_bh(&nvq->write_lock);
 
         return 0;
 }
 
+/* Only the worker of the RX queue serving @channel is scheduled, and
+ * scheduling it again while it is already queued is a no-op, so that
+ * back-to-back writes cost one kick. Userspace pollers are woken up
+ * as well. */
 int
-vmpi_impl_txkick(struct vmpi_impl_info *vi)
+vmpi_impl_txkick(struct vmpi_impl_info *vi, unsigned int channel)
 {
+        struct vmpi_impl_queue *nvq = vmpi_impl_channel_to_rxq(vi, channel);
+
+        vhost_poll_queue(vi->poll + (nvq - vi->vqs));
         wake_up_interruptible_poll(&vi->wqh_poll, POLLIN |
                                    POLLRDNORM | POLLRDBAND);
 
         return 0;
-
 }
 
 static int
-peek_head_len(struct vmpi_impl_info *vi)
+peek_head_len(struct vmpi_impl_queue *nvq)
 {
         int ret = 0;
 	struct vmpi_buf_node * vbn;
 
-        spin_lock_bh(&vi->write_lock);
-        if (vi->write_len) {
-                vbn = list_first_entry(&vi->write, struct vmpi_buf_node, node);
+        spin_lock_bh(&nvq->write_lock);
+        if (nvq->write_len) {
+                vbn = list_first_entry(&nvq->write, struct vmpi_buf_node,
+                                       node);
                 ret = vmpi_buf_len(vbn->vb);
 #ifndef VMPI_BUF_CAN_PUSH
                 ret += sizeof(struct vmpi_hdr);
 #endif /* ! VMPI_BUF_CAN_PUSH */
         }
-        spin_unlock_bh(&vi->write_lock);
+        spin_unlock_bh(&nvq->write_lock);
 
         return ret;
 }
@@ -372,13 +426,14 @@ err:
 /* Expects to be always run from workqueue - which acts as
  * read-size critical section for our kind of RCU. */
 static void
-handle_guest_rx(struct vmpi_impl_info *vi)
+handle_guest_rx(struct vmpi_impl_info *vi, struct vmpi_impl_queue *nvq)
 {
-        struct vmpi_impl_queue *nvq = &vi->vqs[VHOST_MPI_VQ_RX];
         struct vhost_virtqueue *vq = &nvq->vq;
         unsigned uninitialized_var(in), log;
         struct vhost_log *vq_log;
         size_t total_len = 0;
+        unsigned int nheads = 0;
+        unsigned int done = 0;
         s16 headcount;
         size_t len;
         void *opaque;
@@ -397,15 +452,43 @@ handle_guest_rx(struct vmpi_impl_info *vi)
 
         vi->stats.txint++;
 
-        while ((len = peek_head_len(vi))) {
+        while ((len = peek_head_len(nvq))) {
                 IFV(printk("peek %d bytes from write queue\n", (int)len));
-                headcount = get_rx_bufs(vq, vq->heads, len,
-                                        &in, vq_log, &log, 1);
+                /* vq->heads has UIO_MAXIOV entries: publish the pending
+                 * heads first if the ones of this buffer may not fit. */
+                if (nheads + VHOST_MPI_RX_QUOTA > UIO_MAXIOV) {
+                        vhost_add_used_and_signal_n(&vi->dev, vq, vq->heads,
+                                                    nheads);
+                        nheads = 0;
+                }
+                headcount = get_rx_bufs(vq, vq->heads + nheads, len,
+                                        &in, vq_log, &log,
+                                        VHOST_MPI_RX_QUOTA);
                 /* On error, stop handling until the next kick. */
                 if (unlikely(headcount < 0)) {
                         printk("get_rx_bufs() failed --> %d\n", headcount);
                         break;
                 }
+                /* On overrun the buffer does not fit in the guest
+                 * descriptors, which have been given back: drop it. */
+                if (unlikely(headcount > UIO_MAXIOV)) {
+                        printk("dropping %d bytes buffer, guest RX "
+                               "descriptors too small\n", (int)len);
+                        spin_lock_bh(&nvq->write_lock);
+                        vbn = list_first_entry(&nvq->write,
+                                               struct vmpi_buf_node, node);
+                        list_del(&vbn->node);
+                        nvq->write_len--;
+#ifndef VMPI_BUF_CAN_PUSH
+                        nvq->hdr_head = (nvq->hdr_head + 1) &
+                                        VMPI_RING_SIZE_MASK;
+#endif /* ! VMPI_BUF_CAN_PUSH */
+                        spin_unlock_bh(&nvq->write_lock);
+                        vmpi_buf_free(vbn->vb);
+                        vmpi_buf_node_free(vbn);
+                        done++;
+                        continue;
+                }
                 /* OK, now we need to know about added descriptors. */
                 if (!headcount) {
                         if (unlikely(vhost_enable_notify(&vi->dev, vq))) {
@@ -422,34 +505,37 @@ handle_guest_rx(struct vmpi_impl_info *vi)
 
                 iov = vq->iov;
 
-                spin_lock_bh(&vi->write_lock);
-                vbn = list_first_entry(&vi->write, struct vmpi_buf_node, node);
+                spin_lock_bh(&nvq->write_lock);
+                vbn = list_first_entry(&nvq->write, struct vmpi_buf_node,
+                                       node);
                 vb = vbn->vb;
                 list_del(&vbn->node);
 		vmpi_buf_node_free(vbn);
-                vi->write_len--;
+                nvq->write_len--;
 #ifndef VMPI_BUF_CAN_PUSH
                 iovec_from_buf(&iov, &in, nvq->hdrs + nvq->hdr_head,
                                sizeof(struct vmpi_hdr));
                 nvq->hdr_head = (nvq->hdr_head + 1) & VMPI_RING_SIZE_MASK;
                 len -= sizeof(struct vmpi_hdr);
 #endif /* ! VMPI_BUF_CAN_PUSH */
-                spin_unlock_bh(&vi->write_lock);
+                spin_unlock_bh(&nvq->write_lock);
 
                 len = iovec_from_buf(&iov, &in, vmpi_buf_data(vb), len);
                 vmpi_buf_free(vb);
-
-                /* More room to write. */
-                if (likely(vi->write_restart_cb)) {
-                        vi->write_restart_cb(vi->cb_data);
-                }
+                done++;
 
                 IFV(printk("pushed %d bytes and %d in descs in the RX ring\n",
                            (int)len, in));
                 vi->stats.txres++;
 
-                vhost_add_used_and_signal_n(&vi->dev, vq, vq->heads,
-                                            headcount);
+                /* Publish the used descriptors (and possibly interrupt
+                 * the guest) once per batch. */
+                nheads += headcount;
+                if (nheads >= VMPI_BATCH) {
+                        vhost_add_used_and_signal_n(&vi->dev, vq, vq->heads,
+                                                    nheads);
+                        nheads = 0;
+                }
                 if (unlikely(vq_log))
                         vhost_log_write(vq, vq_log, log, len);
                 total_len += len;
@@ -458,6 +544,14 @@ handle_guest_rx(struct vmpi_impl_info *vi)
                         break;
                 }
         }
+        if (nheads) {
+                vhost_add_used_and_signal_n(&vi->dev, vq, vq->heads, nheads);
+        }
+
+        /* More room to write. */
+        if (done && likely(vi->write_restart_cb)) {
+                vi->write_restart_cb(vi->cb_data);
+        }
  out:
         mutex_unlock(&vq->mutex);
 }
@@ -470,7 +564,7 @@ handle_tx_kick(struct vhost_work *work)
         struct vmpi_impl_info *vi = container_of(vq->dev,
                                                  struct vmpi_impl_info, dev);
 
-        handle_guest_tx(vi);
+        handle_guest_tx(vi, container_of(vq, struct vmpi_impl_queue, vq));
 }
 
 static void
@@ -481,23 +575,27 @@ handle_rx_kick(struct vhost_work *work)
         struct vmpi_impl_info *vi = container_of(vq->dev,
                                                  struct vmpi_impl_info, dev);
 
-        handle_guest_rx(vi);
+        handle_guest_rx(vi, container_of(vq, struct vmpi_impl_queue, vq));
 }
 
 static void
 handle_tx_mpi(struct vhost_work *work)
 {
-        struct vmpi_impl_info *vi = container_of(work, struct vmpi_impl_info,
-                                                 poll[VHOST_MPI_VQ_TX].work);
-        handle_guest_tx(vi);
+        struct vhost_poll *poll = container_of(work, struct vhost_poll, work);
+        struct vmpi_impl_info *vi = container_of(poll->dev,
+                                                 struct vmpi_impl_info, dev);
+
+        handle_guest_tx(vi, vi->vqs + (poll - vi->poll));
 }
 
 static void
 handle_rx_mpi(struct vhost_work *work)
 {
-        struct vmpi_impl_info *vi = container_of(work, struct vmpi_impl_info,
-                                                 poll[VHOST_MPI_VQ_RX].work);
-        handle_guest_rx(vi);
+        struct vhost_poll *poll = container_of(work, struct vhost_poll, work);
+        struct vmpi_impl_info *vi = container_of(poll->dev,
+                                                 struct vmpi_impl_info, dev);
+
+        handle_guest_rx(vi, vi->vqs + (poll - vi->poll));
 }
 
 static int
@@ -507,6 +605,7 @@ vhost_mpi_open(struct inode *inode, struct file *f)
         struct vhost_dev *dev;
         struct vhost_virtqueue **vqs;
         int r;
+        int i;
 
         vi = kzalloc(sizeof *vi, GFP_KERNEL | __GFP_NOWARN | __GFP_REPEAT);
         if (!vi) {
@@ -522,17 +621,27 @@ vhost_mpi_open(struct inode *inode, struct file *f)
         }
 
         dev = &vi->dev;
-        vqs[VHOST_MPI_VQ_TX] = &vi->vqs[VHOST_MPI_VQ_TX].vq;
-        vqs[VHOST_MPI_VQ_RX] = &vi->vqs[VHOST_MPI_VQ_RX].vq;
-        vi->vqs[VHOST_MPI_VQ_TX].vq.handle_kick = handle_tx_kick;
-        vi->vqs[VHOST_MPI_VQ_RX].vq.handle_kick = handle_rx_kick;
+        for (i = 0; i < VHOST_MPI_VQ_MAX; i++) {
+                vqs[i] = &vi->vqs[i].vq;
+                vi->vqs[i].vq.handle_kick = VHOST_MPI_VQ_IS_TX(i) ?
+                                            handle_tx_kick : handle_rx_kick;
+                INIT_LIST_HEAD(&vi->vqs[i].write);
+                vi->vqs[i].write_len = 0;
+                spin_lock_init(&vi->vqs[i].write_lock);
+        }
+        vi->num_queues = 1;
 
         vhost_dev_init(dev, vqs, VHOST_MPI_VQ_MAX);
 
-        vhost_poll_init(vi->poll + VHOST_MPI_VQ_TX,
-                        handle_tx_mpi, POLLOUT, dev);
-        vhost_poll_init(vi->poll + VHOST_MPI_VQ_RX,
-                        handle_rx_mpi, POLLIN, dev);
+        for (i = 0; i < VHOST_MPI_VQ_MAX; i++) {
+                if (VHOST_MPI_VQ_IS_TX(i)) {
+                        vhost_poll_init(vi->poll + i, handle_tx_mpi,
+                                        POLLOUT, dev);
+                } else {
+                        vhost_poll_init(vi->poll + i, handle_rx_mpi,
+                                        POLLIN, dev);
+                }
+        }
 
         f->private_data = vi;
         vi->file = f;
@@ -543,9 +652,6 @@ vhost_mpi_open(struct inode *inode, struct file *f)
         if (vi->mpi == NULL) {
                 goto buf_alloc_fail;
         }
-        INIT_LIST_HEAD(&vi->write);
-        vi->write_len = 0;
-        spin_lock_init(&vi->write_lock);
 
         vmpi_stats_init(&vi->stats);
 
@@ -597,8 +703,11 @@ vhost_mpi_stop_vq(struct vmpi_impl_info *vi, struct vhost_virtqueue *vq)
 static void
 vhost_mpi_stop(struct vmpi_impl_info *vi)
 {
-        vhost_mpi_stop_vq(vi, &vi->vqs[VHOST_MPI_VQ_TX].vq);
-        vhost_mpi_stop_vq(vi, &vi->vqs[VHOST_MPI_VQ_RX].vq);
+        int i;
+
+        for (i = 0; i < VHOST_MPI_VQ_MAX; i++) {
+                vhost_mpi_stop_vq(vi, &vi->vqs[i].vq);
+        }
 }
 
 static void
@@ -611,8 +720,11 @@ vhost_mpi_flush_vq(struct vmpi_impl_info *vi, int index)
 static void
 vhost_mpi_flush(struct vmpi_impl_info *vi)
 {
-        vhost_mpi_flush_vq(vi, VHOST_MPI_VQ_TX);
-        vhost_mpi_flush_vq(vi, VHOST_MPI_VQ_RX);
+        int i;
+
+        for (i = 0; i < VHOST_MPI_VQ_MAX; i++) {
+                vhost_mpi_flush_vq(vi, i);
+        }
 }
 
 static int
@@ -689,6 +801,13 @@ vhost_mpi_startstop(struct vmpi_impl_info *vi, unsigned index, unsigned enable)
                         goto err_used;
         }
 
+        /* Channels are spread over all the queue pairs that have been
+         * started at least once, so that the guest and the host agree on
+         * the mapping without further negotiation. */
+        if (enable && index / VHOST_MPI_VQ_PER_PAIR >= vi->num_queues) {
+                WRITE_ONCE(vi->num_queues, index / VHOST_MPI_VQ_PER_PAIR + 1);
+        }
+
         mutex_unlock(&vq->mutex);
 
         if (oldfile) {
@@ -727,6 +846,7 @@ vhost_mpi_reset_owner(struct vmpi_impl_info *vi)
         vhost_mpi_flush(vi);
         vhost_dev_reset_owner(&vi->dev, memory);
         vhost_mpi_vq_reset(vi);
+        WRITE_ONCE(vi->num_queues, 1);
  done:
         mutex_unlock(&vi->dev.mutex);
         return err;
@@ -836,6 +956,7 @@ vhost_mpi_poll(struct file *file, poll_table *wait)
 {
         struct vmpi_impl_info *vi = file->private_data;
         unsigned int mask = 0;
+        int i;
 
         if (!vi)
                 return POLLERR;
@@ -846,10 +967,13 @@ vhost_mpi_poll(struct file *file, poll_table *wait)
          * Are there host resources for the guest to receive
          * (e.g. pending rx packets) ?
          */
-        spin_lock_bh(&vi->write_lock);
-        if (vi->write_len > 0)
-                mask |= POLLIN | POLLRDNORM;
-        spin_unlock_bh(&vi->write_lock);
+        for (i = VHOST_MPI_VQ_RX; i < VHOST_MPI_VQ_MAX;
+                                i += VHOST_MPI_VQ_PER_PAIR) {
+                if (READ_ONCE(vi->vqs[i].write_len) > 0) {
+                        mask |= POLLIN | POLLRDNORM;
+                        break;
+                }
+        }
 
         /*
          * Are there host resources for the guest to send ?
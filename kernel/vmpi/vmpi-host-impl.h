@@ -41,7 +41,7 @@ typedef struct vmpi_info vmpi_info_t;
 
 int vmpi_impl_write_buf(struct vmpi_impl_info *vi, struct vmpi_buf *vb,
                         unsigned int channel);
-int vmpi_impl_txkick(vmpi_impl_info_t *vi);
+int vmpi_impl_txkick(vmpi_impl_info_t *vi, unsigned int channel);
 int vmpi_impl_register_cbs(vmpi_impl_info_t *vi, vmpi_read_cb_t rcb,
                            vmpi_write_restart_cb_t wcb, void* opaque);
 int vmpi_impl_unregister_cbs(vmpi_impl_info_t *vi);
@@ -69,7 +69,7 @@ vmpi_host_write(struct vmpi_ops *ops, unsigned int channel,
                 ret = len;
         }
 
-        vmpi_impl_txkick(mpi->vi);
+        vmpi_impl_txkick(mpi->vi, channel);
 
         return ret;
 }
@@ -25,6 +25,10 @@
 #include <linux/moduleparam.h>
 #include <linux/uio.h>
 #include <linux/slab.h>
+#include <linux/proc_fs.h>
+#include <linux/seq_file.h>
+#include <linux/ktime.h>
+#include <linux/mutex.h>
 
 #include "vmpi.h"
 #include "vmpi-bufs.h"
@@ -41,6 +45,18 @@ module_param(write_channel, uint, 0644);
 static unsigned int read_channel = 0;
 module_param(read_channel, uint, 0644);
 
+/* Send received buffers back on the channel they came from. */
+static bool echo = false;
+module_param(echo, bool, 0644);
+
+/* Parameters of the benchmark run by writing to /proc/vmpi-test-bench,
+ * whose report is then read from the same file. */
+static unsigned int bench_count = 1000000;
+module_param(bench_count, uint, 0644);
+
+static unsigned int bench_len = 64;
+module_param(bench_len, uint, 0644);
+
 struct test_queue {
         struct list_head        entries;
         unsigned int            len;
@@ -129,6 +145,13 @@ test_read_callback(void *opaque, unsigned int channel,
                 channel = 0;
         }
 
+        if (echo) {
+                if (vt->vmpi_ops.write(&vt->vmpi_ops, channel, vb) < 0) {
+                        vmpi_buf_free(vb);
+                }
+                return;
+        }
+
         queue = &vt->readqueues[channel];
         spin_lock(&queue->lock);
         if (likely(queue->len < 512)) {
@@ -311,6 +334,220 @@ static const struct file_operations vmpi_test_fops = {
         .llseek         = noop_llseek,
 };
 
+/*
+ * Throughput and latency benchmark: bench_count buffers of bench_len
+ * bytes are written on write_channel, each one carrying its
+ * transmission timestamp. If the peer runs vmpi-test with
+ * echo=1 (and the device open), the buffers come back and the round trip
+ * time is measured.
+ */
+struct vmpi_test_bench {
+        struct vmpi_ops vmpi_ops;
+        wait_queue_head_t wqh;
+        atomic_t restart;
+        spinlock_t lock;
+        u64 received;
+        u64 rtt_min;
+        u64 rtt_max;
+        u64 rtt_sum;
+};
+
+static void
+bench_write_restart_callback(void *opaque)
+{
+        struct vmpi_test_bench *b = opaque;
+
+        atomic_set(&b->restart, 1);
+        wake_up_interruptible(&b->wqh);
+}
+
+static void
+bench_read_callback(void *opaque, unsigned int channel,
+                    struct vmpi_buf *vb)
+{
+        struct vmpi_test_bench *b = opaque;
+        u64 now = ktime_get_ns();
+        u64 stamp;
+        u64 rtt;
+
+        if (likely(vmpi_buf_len(vb) >= sizeof(stamp))) {
+                memcpy(&stamp, vmpi_buf_data(vb), sizeof(stamp));
+                rtt = now - stamp;
+
+                spin_lock_bh(&b->lock);
+                if (!b->received || rtt < b->rtt_min) {
+                        b->rtt_min = rtt;
+                }
+                if (rtt > b->rtt_max) {
+                        b->rtt_max = rtt;
+                }
+                b->rtt_sum += rtt;
+                b->received++;
+                spin_unlock_bh(&b->lock);
+        }
+        vmpi_buf_free(vb);
+
+        wake_up_interruptible(&b->wqh);
+}
+
+/* Report of the last benchmark run, protected by bench_lock, which also
+ * serializes the runs. */
+static DEFINE_MUTEX(bench_lock);
+static char bench_report[512];
+
+/* To be called with bench_lock held. */
+static int
+vmpi_test_bench_run(void)
+{
+        unsigned int count = bench_count;
+        size_t len = max_t(size_t, bench_len, sizeof(u64));
+        struct vmpi_test_bench *b;
+        struct vmpi_buf *vb;
+        size_t n = 0;
+        u64 sent = 0;
+        u64 start;
+        u64 elapsed;
+        u64 stamp;
+        u64 mppsk;
+        int ret;
+
+        b = kzalloc(sizeof(*b), GFP_KERNEL);
+        if (!b) {
+                return -ENOMEM;
+        }
+        init_waitqueue_head(&b->wqh);
+        spin_lock_init(&b->lock);
+        atomic_set(&b->restart, 0);
+
+        ret = vmpi_provider_find_instance(VMPI_PROVIDER_AUTO, vmpi_id,
+                                          &b->vmpi_ops);
+        if (ret) {
+                scnprintf(bench_report, sizeof(bench_report),
+                          "VMPI instance %u not found\n", vmpi_id);
+                goto out;
+        }
+
+        ret = b->vmpi_ops.register_cbs(&b->vmpi_ops, bench_read_callback,
+                                       bench_write_restart_callback, b);
+        if (ret) {
+                scnprintf(bench_report, sizeof(bench_report),
+                          "register_cbs failed [%d]\n", ret);
+                goto out;
+        }
+
+        start = ktime_get_ns();
+        while (sent < count) {
+                vb = vmpi_buf_alloc(len, 0, GFP_KERNEL);
+                if (!vb) {
+                        ret = -ENOMEM;
+                        break;
+                }
+
+                for (;;) {
+                        stamp = ktime_get_ns();
+                        memcpy(vmpi_buf_data(vb), &stamp, sizeof(stamp));
+                        atomic_set(&b->restart, 0);
+                        ret = b->vmpi_ops.write(&b->vmpi_ops, write_channel,
+                                                vb);
+                        if (ret != -EAGAIN) {
+                                break;
+                        }
+                        /* No room to write, wait for the peer to drain. */
+                        if (wait_event_interruptible_timeout(b->wqh,
+                                        atomic_read(&b->restart), HZ) < 0) {
+                                ret = -ERESTARTSYS;
+                                break;
+                        }
+                }
+                if (ret < 0) {
+                        vmpi_buf_free(vb);
+                        break;
+                }
+                sent++;
+        }
+        elapsed = max_t(u64, ktime_get_ns() - start, 1);
+
+        /* Give the echoes some time to come back. */
+        wait_event_interruptible_timeout(b->wqh,
+                                         READ_ONCE(b->received) >= sent, HZ);
+
+        b->vmpi_ops.unregister_cbs(&b->vmpi_ops);
+
+        mppsk = div64_u64(sent * 1000000ULL, elapsed);
+        n += scnprintf(bench_report + n, sizeof(bench_report) - n,
+                       "sent: %llu buffers of %zu bytes\n", sent, len);
+        if (ret < 0) {
+                n += scnprintf(bench_report + n, sizeof(bench_report) - n,
+                               "stopped early [%d]\n", ret);
+        }
+        n += scnprintf(bench_report + n, sizeof(bench_report) - n,
+                       "elapsed: %llu ns\n", elapsed);
+        n += scnprintf(bench_report + n, sizeof(bench_report) - n,
+                       "rate: %llu.%03llu Mpps\n", mppsk / 1000,
+                       mppsk % 1000);
+        n += scnprintf(bench_report + n, sizeof(bench_report) - n,
+                       "echoed: %llu\n", b->received);
+        if (b->received) {
+                n += scnprintf(bench_report + n, sizeof(bench_report) - n,
+                               "rtt: min %llu avg %llu max %llu ns\n",
+                               b->rtt_min,
+                               div64_u64(b->rtt_sum, b->received),
+                               b->rtt_max);
+        }
+        ret = 0;
+ out:
+        kfree(b);
+
+        return ret;
+}
+
+static int
+vmpi_test_bench_show(struct seq_file *m, void *v)
+{
+        mutex_lock(&bench_lock);
+        if (bench_report[0]) {
+                seq_puts(m, bench_report);
+        } else {
+                seq_puts(m, "No benchmark run, write to this file "
+                         "to start one\n");
+        }
+        mutex_unlock(&bench_lock);
+
+        return 0;
+}
+
+/* Any write runs the benchmark, in the context of the writer. */
+static ssize_t
+vmpi_test_bench_write(struct file *file, const char __user *buf,
+                      size_t count, loff_t *ppos)
+{
+        int ret;
+
+        if (mutex_lock_interruptible(&bench_lock)) {
+                return -ERESTARTSYS;
+        }
+        bench_report[0] = '\0';
+        ret = vmpi_test_bench_run();
+        mutex_unlock(&bench_lock);
+
+        return ret < 0 ? ret : count;
+}
+
+static int
+vmpi_test_bench_open(struct inode *inode, struct file *file)
+{
+        return single_open(file, vmpi_test_bench_show, NULL);
+}
+
+static const struct file_operations vmpi_test_bench_fops = {
+        .owner     = THIS_MODULE,
+        .open      = vmpi_test_bench_open,
+        .read      = seq_read,
+        .write     = vmpi_test_bench_write,
+        .llseek    = seq_lseek,
+        .release   = single_release,
+};
+
 #define VMPI_TEST_MINOR     246
 
 static struct miscdevice vmpi_test_misc = {
@@ -331,6 +568,8 @@ vmpi_test_init(void)
                 return ret;
         }
 
+        proc_create("vmpi-test-bench", 0644, NULL, &vmpi_test_bench_fops);
+
         printk("vmpi_test_init completed\n");
 
         return 0;
@@ -339,6 +578,7 @@ vmpi_test_init(void)
 static void __exit
 vmpi_test_fini(void)
 {
+        remove_proc_entry("vmpi-test-bench", NULL);
         misc_deregister(&vmpi_test_misc);
 
         printk("vmpi_test_fini completed\n");
@@ -66,6 +66,20 @@ int vmpi_provider_unregister(unsigned int provider, unsigned int id);
 #define VMPI_RING_SIZE_MASK             (VMPI_RING_SIZE - 1)
 #define VMPI_BUF_SIZE                   PAGE_SIZE
 
+/* Maximum number of RX/TX queue pairs per VMPI instance. */
+#define VMPI_QUEUE_PAIRS_MAX            8
+
+/* Maximum number of buffers completed before notifying the peer. */
+#define VMPI_BATCH                      64
+
+/* The control channel (0) is always served by the first queue pair,
+ * data channels are spread over all the active queue pairs. */
+static inline unsigned int
+vmpi_channel_to_queue(unsigned int channel, unsigned int num_queues)
+{
+        return num_queues > 1 ? channel % num_queues : 0;
+}
+
 #if (PAGE_SIZE > 4096)
 #warning "Page size is greater than 4096: this situation has never been tested"
 #endif
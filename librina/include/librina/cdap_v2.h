@@ -799,6 +799,20 @@ private:
 	SerializerInterface * serializer;
 };
 
+/// Packs several encoded CDAP messages into a single SDU (see CDAPBatch
+/// in CDAP.proto), and splits them again at the receiver
+class CDAPBatchEncoder {
+public:
+	void encode(const std::list<ser_obj_t*>& messages, ser_obj_t& batch);
+	/// The caller owns the messages
+	/// @throws CDAPException if the batch is malformed
+	void decode(const ser_obj_t& batch, std::list<ser_obj_t*>& messages);
+	/// True if the SDU is a batch rather than a single CDAP message
+	bool is_batch(const ser_obj_t& sdu) const;
+	/// Bytes a message of message_size takes in a batch, framing included
+	static int batched_size(int message_size);
+};
+
 /// String encoder
 class StringEncoder : public Encoder<std::string>{
 public:
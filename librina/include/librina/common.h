@@ -59,6 +59,7 @@ static std::string SHIM_WIFI_IPC_PROCESS_STA= "shim-wifi-sta";
 static std::string SHIM_WIFI_IPC_PROCESS_AP= "shim-wifi-ap";
 static std::string SHIM_ETH_VLAN_IPC_PROCESS = "shim-eth-vlan";
 static std::string SHIM_TCP_UDP_IPC_PROCESS = "shim-tcp-udp";
+static std::string SHIM_LOOPBACK_IPC_PROCESS = "shim-loopback";
 
 /**
  * Returns the version number of librina
@@ -935,6 +935,13 @@ public:
 	/** The cost */
 	unsigned int cost;
 
+	/**
+	 * Number of low order address bits ignored when matching, the entry
+	 * covers the prefix address/(32 - wildcardBits). 0 for a single
+	 * address
+	 */
+	unsigned int wildcardBits;
+
         /** The N-1 portid */
         std::list<PortIdAltlist> portIdAltlists;
 
@@ -945,6 +952,8 @@ public:
 
         bool operator==(const PDUForwardingTableEntry &other) const;
         bool operator!=(const PDUForwardingTableEntry &other) const;
+        /// True if address falls within the prefix of the entry
+        bool covers(unsigned int address) const;
 #ifndef SWIG
         unsigned int getAddress() const;
         void setAddress(unsigned int address);
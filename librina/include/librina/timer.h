@@ -25,6 +25,9 @@
 #ifdef __cplusplus
 
 #include <map>
+#include <stdint.h>
+#include <string>
+#include <vector>
 #include <sys/time.h>
 
 #include "librina/concurrency.h"
@@ -53,32 +56,82 @@ public:
 	timeval time_;
 };
 
+struct TimerEntry;
+class Timer;
+
+/// Hierarchical timing wheel with millisecond ticks. Tasks are indexed
+/// by their pointer, so inserting and cancelling them is O(1). A thread
+/// waiting on a timerfd armed for the next expiry dispatches the due
+/// tasks, each on its own detached thread. Several Timers can share one
+/// scheduler (and thus one thread), see get_shared_scheduler()
 class TaskScheduler : public Lockable {
 public:
 	TaskScheduler();
 	~TaskScheduler() throw();
 	void insert(Time time, TimerTask* timer_task);
+	void insert(long delay_ms, TimerTask* timer_task, Timer * owner);
+	/// Dispatch all the tasks that are due
 	void runTasks();
 	void cancelTask(TimerTask *task);
+	/// Cancel all the pending tasks scheduled through the Timer
+	void cancelTasks(Timer * owner);
+	/// Number of pending tasks
+	unsigned int size();
+	/// Wait for the next expiry and run the due tasks; false once the
+	/// scheduler is being destroyed
+	bool execute_tasks();
+
+	/// Process-wide scheduler, created on first use and never destroyed
+	static TaskScheduler * get_shared_scheduler();
+
+	static const int LEVEL_BITS = 6;
+	static const int LEVEL_SIZE = 1 << LEVEL_BITS;
+	static const int NUM_LEVELS = 4;
+
 private:
-	std::map<Time, std::list<TimerTask*>* > tasks_;
+	void place(TimerEntry * entry);
+	void unlink(TimerEntry * entry);
+	void cascade(int level, int slot);
+	uint64_t next_expiry() const;
+	void arm(uint64_t expiry);
+	void advance();
+	TimerEntry * new_entry();
+	void free_entry(TimerEntry * entry);
+	void index_add(TimerEntry * entry);
+	void index_remove(TimerEntry * entry);
+	void remove(TimerEntry * entry, bool delete_task);
+
+	/// Wheel time, in ms since the scheduler was created
+	uint64_t now_;
+	uint64_t start_;
+	uint64_t armed_;
+	TimerEntry * slots_[NUM_LEVELS][LEVEL_SIZE];
+	uint64_t occupied_[NUM_LEVELS];
+	/// Hash of the pending entries by task pointer
+	std::vector<TimerEntry*> index_;
+	unsigned int size_;
+	TimerEntry * free_entries_;
+	int fd_;
+	bool continue_;
+	Thread * thread_;
 };
 
-/// Class that implements a timer which contains a thread
+/// Class that implements a timer. Timers share a single scheduler thread
+/// unless they are given their own TaskScheduler
 class Timer {
 public:
 	Timer();
+	Timer(TaskScheduler * scheduler);
 	~Timer();
 	void scheduleTask(TimerTask* task, long delay_ms);
 	void cancelTask(TimerTask *task);
 	TaskScheduler* get_task_scheduler() const;
-	bool execute_tasks();
 private:
-	void cancel();
-	Thread *thread_;
+	friend class TaskScheduler;
+
 	TaskScheduler *task_scheduler;
-	bool continue_;
-	Lockable continue_lock_;
+	/// Pending entries of this timer, guarded by the scheduler lock
+	TimerEntry * entries_;
 };
 
 }
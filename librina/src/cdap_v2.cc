@@ -20,7 +20,10 @@
  * MA  02110-1301  USA
  */
 #include <algorithm>
+#include <cassert>
 #include <cerrno>
+#include <map>
+#include <vector>
 
 #define RINA_PREFIX "cdap"
 
@@ -30,6 +33,9 @@
 #include "librina/cdap_v2.h"
 #include "librina/exceptions.h"
 
+#include <google/protobuf/io/coded_stream.h>
+#include <google/protobuf/wire_format_lite.h>
+
 #include "CDAP.pb.h"
 
 namespace rina {
@@ -299,6 +305,94 @@ class ConnectionStateMachine
 	TimerTask * last_timer_task;
 };
 
+/// Table indexed by invoke id. Ids below MAX_SLOTS are kept in a slot
+/// array that grows on demand, so that lookups, insertions and removals
+/// are O(1); any other id (the peer chooses the ids of its requests) goes
+/// to an overflow map.
+template<typename T>
+class InvokeIdTable
+{
+ public:
+	static const int MAX_SLOTS = 65536;
+
+	InvokeIdTable() : count(0) {};
+	T* find(int invoke_id);
+	const T* find(int invoke_id) const;
+	/// Adds or replaces the entry of invoke_id
+	void insert(int invoke_id, const T& value);
+	void erase(int invoke_id);
+	unsigned int size() const { return count; };
+ private:
+	std::vector<T> slots;
+	std::vector<bool> used;
+	std::map<int, T> overflow;
+	unsigned int count;
+};
+
+template<typename T>
+T* InvokeIdTable<T>::find(int invoke_id)
+{
+	typename std::map<int, T>::iterator it;
+
+	if (invoke_id >= 0 && invoke_id < MAX_SLOTS) {
+		if ((unsigned int) invoke_id < used.size() && used[invoke_id])
+			return &slots[invoke_id];
+		return 0;
+	}
+
+	it = overflow.find(invoke_id);
+	if (it == overflow.end())
+		return 0;
+
+	return &it->second;
+}
+
+template<typename T>
+const T* InvokeIdTable<T>::find(int invoke_id) const
+{
+	return const_cast<InvokeIdTable<T>*>(this)->find(invoke_id);
+}
+
+template<typename T>
+void InvokeIdTable<T>::insert(int invoke_id, const T& value)
+{
+	unsigned int size;
+
+	if (invoke_id < 0 || invoke_id >= MAX_SLOTS) {
+		if (overflow.find(invoke_id) == overflow.end())
+			count++;
+		overflow[invoke_id] = value;
+		return;
+	}
+
+	if ((unsigned int) invoke_id >= used.size()) {
+		size = used.size() ? used.size() : 64;
+		while (size <= (unsigned int) invoke_id)
+			size *= 2;
+		slots.resize(size, value);
+		used.resize(size, false);
+	}
+
+	if (!used[invoke_id])
+		count++;
+	used[invoke_id] = true;
+	slots[invoke_id] = value;
+}
+
+template<typename T>
+void InvokeIdTable<T>::erase(int invoke_id)
+{
+	if (invoke_id < 0 || invoke_id >= MAX_SLOTS) {
+		count -= overflow.erase(invoke_id);
+		return;
+	}
+
+	if ((unsigned int) invoke_id < used.size() && used[invoke_id]) {
+		used[invoke_id] = false;
+		count--;
+	}
+}
+
 /// It will always try to use short invokeIds (as close to 1 as possible)
 class CDAPInvokeIdManagerImpl : public CDAPInvokeIdManager, rina::Lockable
 {
@@ -309,14 +403,19 @@ class CDAPInvokeIdManagerImpl : public CDAPInvokeIdManager, rina::Lockable
 	int newInvokeId(bool sent);
 	void reserveInvokeId(int invoke_id, bool sent);
  private:
-	std::list<int> used_invoke_sent_ids_;
-	std::list<int> used_invoke_recv_ids_;
+	InvokeIdTable<char> used_invoke_sent_ids_;
+	InvokeIdTable<char> used_invoke_recv_ids_;
+	/// No id below these ones is free
+	int first_free_sent_id_;
+	int first_free_recv_id_;
 };
 
 /// Encapsulates an operation state
 class CDAPOperationState
 {
  public:
+	CDAPOperationState() : op_code_(cdap_m_t::NONE_OPCODE),
+			       sender_(false) {};
 	CDAPOperationState(cdap_m_t::Opcode op_code, bool sender);
 	~CDAPOperationState();
 	cdap_m_t::Opcode get_op_code() const;
@@ -453,9 +552,9 @@ class CDAPSession
 	void populate_con_handle(const cdap_m_t &cdap_message, bool send);
 	/// This map contains the invokeIds of the messages that
 	/// have requested a response, except for the M_CANCELREADs
-	std::map<int, CDAPOperationState*> pending_messages_sent_;
-	std::map<int, CDAPOperationState*> pending_messages_recv_;
-	std::map<int, CDAPOperationState*> cancel_read_pending_messages_;
+	InvokeIdTable<CDAPOperationState> pending_messages_sent_;
+	InvokeIdTable<CDAPOperationState> pending_messages_recv_;
+	InvokeIdTable<CDAPOperationState> cancel_read_pending_messages_;
 	/// Deals with the connection establishment and deletion messages and states
 	ConnectionStateMachine * connection_state_machine_;
 	/// This map contains the invokeIds of the messages that
@@ -915,35 +1014,44 @@ void CDAPMessageFactory::getCancelReadResponseMessage(cdap_m_t & msg,
 // CLASS CDAPSessionInvokeIdManagerImpl
 CDAPInvokeIdManagerImpl::CDAPInvokeIdManagerImpl()
 {
+	first_free_sent_id_ = 1;
+	first_free_recv_id_ = 1;
 }
 CDAPInvokeIdManagerImpl::~CDAPInvokeIdManagerImpl() throw ()
 {
-	used_invoke_sent_ids_.clear();
-	used_invoke_recv_ids_.clear();
 }
 void CDAPInvokeIdManagerImpl::freeInvokeId(int invoke_id, bool sent)
 {
 	lock();
-	if (!sent)
-		used_invoke_sent_ids_.remove(invoke_id);
-	else
-		used_invoke_recv_ids_.remove(invoke_id);
+	if (!sent) {
+		used_invoke_sent_ids_.erase(invoke_id);
+		if (invoke_id > 0 && invoke_id < first_free_sent_id_)
+			first_free_sent_id_ = invoke_id;
+	} else {
+		used_invoke_recv_ids_.erase(invoke_id);
+		if (invoke_id > 0 && invoke_id < first_free_recv_id_)
+			first_free_recv_id_ = invoke_id;
+	}
 	unlock();
 }
 int CDAPInvokeIdManagerImpl::newInvokeId(bool sent)
 {
 	lock();
-	int candidate = 1;
-	std::list<int> * invoke_ids;
-	if (sent)
+	InvokeIdTable<char> * invoke_ids;
+	int * first_free;
+	if (sent) {
 		invoke_ids = &used_invoke_sent_ids_;
-	else
+		first_free = &first_free_sent_id_;
+	} else {
 		invoke_ids = &used_invoke_recv_ids_;
-	while (std::find(invoke_ids->begin(), invoke_ids->end(), candidate)
-			!= invoke_ids->end()) {
+		first_free = &first_free_recv_id_;
+	}
+	int candidate = *first_free;
+	while (invoke_ids->find(candidate)) {
 		candidate = candidate + 1;
 	}
-	invoke_ids->push_back(candidate);
+	invoke_ids->insert(candidate, 1);
+	*first_free = candidate + 1;
 	unlock();
 	return candidate;
 }
@@ -951,9 +1059,9 @@ void CDAPInvokeIdManagerImpl::reserveInvokeId(int invoke_id, bool sent)
 {
 	lock();
 	if (sent)
-		used_invoke_sent_ids_.push_back(invoke_id);
+		used_invoke_sent_ids_.insert(invoke_id, 1);
 	else
-		used_invoke_recv_ids_.push_back(invoke_id);
+		used_invoke_recv_ids_.insert(invoke_id, 1);
 	unlock();
 }
 
@@ -1648,26 +1756,6 @@ CDAPSession::~CDAPSession() throw ()
 		delete connection_state_machine_;
 		connection_state_machine_ = 0;
 	}
-
-	for (std::map<int, CDAPOperationState*>::iterator iter =
-			pending_messages_sent_.begin();
-			iter != pending_messages_sent_.end(); ++iter) {
-		delete iter->second;
-	}
-	pending_messages_sent_.clear();
-	for (std::map<int, CDAPOperationState*>::iterator iter =
-			pending_messages_recv_.begin();
-			iter != pending_messages_recv_.end(); ++iter) {
-		delete iter->second;
-	}
-	pending_messages_recv_.clear();
-	for (std::map<int, CDAPOperationState*>::iterator iter =
-			cancel_read_pending_messages_.begin();
-			iter != cancel_read_pending_messages_.end(); ++iter) {
-		delete iter->second;
-		iter->second = 0;
-	}
-	cancel_read_pending_messages_.clear();
 }
 
 void CDAPSession::encodeNextMessageToBeSent(const cdap_m_t &cdap_message,
@@ -1963,7 +2051,7 @@ void CDAPSession::checkInvokeIdNotExists(int invoke_id,
 	if (invoke_id == 0)
 		return;
 
-	const std::map<int, CDAPOperationState*>* pending_messages;
+	const InvokeIdTable<CDAPOperationState>* pending_messages;
 	if (sent)
 		pending_messages = &pending_messages_sent_;
 	else
@@ -1971,8 +2059,7 @@ void CDAPSession::checkInvokeIdNotExists(int invoke_id,
 
 	ScopedLock g(pending_msg_lock);
 
-	if (pending_messages->find(invoke_id)
-			!= pending_messages->end()) {
+	if (pending_messages->find(invoke_id)) {
 		std::stringstream ss;
 		ss << invoke_id;
 		throw CDAPException(
@@ -1983,7 +2070,7 @@ void CDAPSession::checkCanSendOrReceiveCancelReadRequest(int invoke_id,
 							 bool sent)
 {
 	bool validationFailed = false;
-	const std::map<int, CDAPOperationState*>* pending_messages;
+	const InvokeIdTable<CDAPOperationState>* pending_messages;
 	if (sent)
 		pending_messages = &pending_messages_sent_;
 	else
@@ -1991,9 +2078,8 @@ void CDAPSession::checkCanSendOrReceiveCancelReadRequest(int invoke_id,
 
 	ScopedLock g(pending_msg_lock);
 
-	if (pending_messages->find(invoke_id)
-			!= pending_messages->end()) {
-		CDAPOperationState *state = pending_messages->find(invoke_id)->second;
+	const CDAPOperationState *state = pending_messages->find(invoke_id);
+	if (state) {
 		if (state->get_op_code() == cdap_m_t::M_READ) {
 			validationFailed = true;
 		}
@@ -2026,7 +2112,7 @@ void CDAPSession::requestMessageSentOrReceived(const cdap_m_t &cdap_message,
 	checkInvokeIdNotExists(cdap_message.invoke_id_,
 			       sent);
 
-	std::map<int, CDAPOperationState*>* pending_messages;
+	InvokeIdTable<CDAPOperationState>* pending_messages;
 	if (sent)
 		pending_messages = &pending_messages_sent_;
 	else
@@ -2035,12 +2121,8 @@ void CDAPSession::requestMessageSentOrReceived(const cdap_m_t &cdap_message,
 	ScopedLock g(pending_msg_lock);
 
 	if (cdap_message.invoke_id_ != 0) {
-		CDAPOperationState *new_operation_state =
-				new CDAPOperationState(op_code, sent);
-		pending_messages->insert(
-				std::pair<int, CDAPOperationState*>(
-						cdap_message.invoke_id_,
-						new_operation_state));
+		pending_messages->insert(cdap_message.invoke_id_,
+					 CDAPOperationState(op_code, sent));
 	}
 }
 void CDAPSession::cancelReadMessageSentOrReceived(const cdap_m_t &cdap_message,
@@ -2048,11 +2130,9 @@ void CDAPSession::cancelReadMessageSentOrReceived(const cdap_m_t &cdap_message,
 {
 	checkCanSendOrReceiveCancelReadRequest(cdap_message.invoke_id_,
 					       sender);
-	CDAPOperationState *new_operation_state = new CDAPOperationState(cdap_m_t::M_CANCELREAD,
-									 sender);
-	cancel_read_pending_messages_.insert(
-			std::pair<int, CDAPOperationState*>(cdap_message.invoke_id_,
-							    new_operation_state));
+	cancel_read_pending_messages_.insert(cdap_message.invoke_id_,
+					     CDAPOperationState(cdap_m_t::M_CANCELREAD,
+								sender));
 }
 void CDAPSession::checkCanSendOrReceiveResponse(int invoke_id,
 						cdap_m_t::Opcode op_code,
@@ -2062,7 +2142,7 @@ void CDAPSession::checkCanSendOrReceiveResponse(int invoke_id,
 		return;
 
 	bool validation_failed = false;
-	const std::map<int, CDAPOperationState*>* pending_messages;
+	const InvokeIdTable<CDAPOperationState>* pending_messages;
 	if (!sender)
 		pending_messages = &pending_messages_sent_;
 	else
@@ -2070,9 +2150,8 @@ void CDAPSession::checkCanSendOrReceiveResponse(int invoke_id,
 
 	ScopedLock g(pending_msg_lock);
 
-	std::map<int, CDAPOperationState*>::const_iterator iterator;
-	iterator = pending_messages->find(invoke_id);
-	if (iterator == pending_messages->end()) {
+	const CDAPOperationState* state = pending_messages->find(invoke_id);
+	if (!state) {
 		std::stringstream ss;
 		ss << "Cannot send a response for the " << op_code
 		   << " operation with invokeId " << invoke_id
@@ -2080,7 +2159,6 @@ void CDAPSession::checkCanSendOrReceiveResponse(int invoke_id,
 		ss << "There are " << pending_messages->size() << " entries";
 		throw CDAPException(ss.str());
 	}
-	CDAPOperationState* state = iterator->second;
 	if (state->get_op_code() != op_code) {
 		validation_failed = true;
 	}
@@ -2102,15 +2180,15 @@ void CDAPSession::checkCanSendOrReceiveCancelReadResponse(int invoke_id,
 {
 	bool validation_failed = false;
 
-	if (cancel_read_pending_messages_.find(invoke_id)
-			== cancel_read_pending_messages_.end()) {
+	const CDAPOperationState *state =
+			cancel_read_pending_messages_.find(invoke_id);
+	if (!state) {
 		std::stringstream ss;
 		ss << "Cannot send a response for the "
 		   << cdap_m_t::M_CANCELREAD << " operation with invokeId "
 		   << invoke_id;
 		throw CDAPException(ss.str());
 	}
-	CDAPOperationState *state = cancel_read_pending_messages_.find(invoke_id)->second;
 	if (state->get_op_code() != cdap_m_t::M_CANCELREAD) {
 		validation_failed = true;
 	}
@@ -2137,7 +2215,7 @@ void CDAPSession::responseMessageSentOrReceived(const cdap_m_t &cdap_message,
 				      op_code,
 				      sent);
 	bool operation_complete = true;
-	std::map<int, CDAPOperationState*>* pending_messages;
+	InvokeIdTable<CDAPOperationState>* pending_messages;
 	if (!sent)
 		pending_messages = &pending_messages_sent_;
 	else
@@ -2152,12 +2230,7 @@ void CDAPSession::responseMessageSentOrReceived(const cdap_m_t &cdap_message,
 	ScopedLock g(pending_msg_lock);
 
 	if (operation_complete) {
-		std::map<int, CDAPOperationState*>::iterator it =
-				pending_messages->find(cdap_message.invoke_id_);
-		if (it != pending_messages->end()) {
-			delete it->second;
-			pending_messages->erase(it);
-		}
+		pending_messages->erase(cdap_message.invoke_id_);
 	}
 	// check for M_READ_R and M_CANCELREAD race condition
 	if (!sent) {
@@ -2730,195 +2803,439 @@ cdap_rib::con_handle_t & CDAPSessionManager::get_con_handle(int port_id)
 }
 
 // CLASS GPBWireMessageProvider
-void GPBSerializer::deserializeMessage(const ser_obj_t &message,
-				       cdap_m_t& result)
+//
+// The codec reads and writes the wire format of messages::CDAPMessage
+// (see CDAP.proto) directly. Fields are encoded straight from the cdap_m_t
+// into a buffer of the exact final size, in field number order, so the
+// output is the same as SerializeToArray. They are decoded in place from
+// the received buffer, copying each value once into the cdap_m_t.
+namespace gpb_wire {
+
+using google::protobuf::io::CodedInputStream;
+using google::protobuf::io::CodedOutputStream;
+using google::protobuf::internal::WireFormatLite;
+typedef google::protobuf::uint8 uint8;
+typedef google::protobuf::uint32 uint32;
+typedef google::protobuf::uint64 uint64;
+
+// CDAPMessage field numbers
+enum {
+	ABS_SYNTAX = 1,
+	OP_CODE = 2,
+	INVOKE_ID = 3,
+	FLAGS = 4,
+	OBJ_CLASS = 5,
+	OBJ_NAME = 6,
+	OBJ_INST = 7,
+	OBJ_VALUE = 8,
+	RESULT = 9,
+	SCOPE = 10,
+	FILTER = 11,
+	AUTH_POLICY = 18,
+	DEST_AE_INST = 19,
+	DEST_AE_NAME = 20,
+	DEST_AP_INST = 21,
+	DEST_AP_NAME = 22,
+	SRC_AE_INST = 23,
+	SRC_AE_NAME = 24,
+	SRC_AP_INST = 25,
+	SRC_AP_NAME = 26,
+	RESULT_REASON = 27,
+	VERSION = 28,
+	// CDAPBatch
+	BATCH_MESSAGES = 31
+};
+
+// objVal_t and authPolicy_t field numbers
+enum {
+	OBJ_VALUE_BYTES = 6,
+	AUTH_NAME = 1,
+	AUTH_VERSIONS = 2,
+	AUTH_OPTIONS = 3
+};
+
+enum {
+	VARINT = 0,
+	LENGTH_DELIMITED = 2
+};
+
+#define GPB_TAG(field, type) (((field) << 3) | (type))
+
+// Negative int32 values are sign extended to 64 bits on the wire
+static inline int varint_field_size(int field, long long value)
 {
-	messages::CDAPMessage gpfCDAPMessage;
-
-	gpfCDAPMessage.ParseFromArray(message.message_, message.size_);
-	// ABS_SYNTAX
-	if (gpfCDAPMessage.has_abssyntax())
-		result.abs_syntax_ = gpfCDAPMessage.abssyntax();
-	// AUTH_POLICY
-	result.auth_policy_.name = gpfCDAPMessage.authpolicy().name();
-	for(int i=0; i<gpfCDAPMessage.authpolicy().versions_size(); i++) {
-		result.auth_policy_.versions.push_back(
-				gpfCDAPMessage.authpolicy().versions(i));
-	}
-	if (gpfCDAPMessage.authpolicy().has_options()) {
-		result.auth_policy_.options.message_ = new unsigned char[gpfCDAPMessage.authpolicy().options().size()];
-		result.auth_policy_.options.size_ = gpfCDAPMessage.authpolicy().options().size();
-		memcpy(result.auth_policy_.options.message_,
-		       gpfCDAPMessage.authpolicy().options().data(),
-		       gpfCDAPMessage.authpolicy().options().size());
-	}
-	// DEST_AE_INST
-	if (gpfCDAPMessage.has_destaeinst())
-		result.dest_ae_inst_ = gpfCDAPMessage.destaeinst();
-	// DEST_AE_NAME
-	if (gpfCDAPMessage.has_destaename())
-		result.dest_ae_name_ = gpfCDAPMessage.destaename();
-	// DEST_AP_INST
-	if (gpfCDAPMessage.has_destapinst())
-		result.dest_ap_inst_ = gpfCDAPMessage.destapinst();
-	// DEST_AP_NAME
-	if (gpfCDAPMessage.has_destapname())
-		result.dest_ap_name_ = gpfCDAPMessage.destapname();
-	// FILTER
-	if (gpfCDAPMessage.has_filter()) {
-		char *filter = new char[gpfCDAPMessage.filter().size() + 1];
-		strcpy(filter, gpfCDAPMessage.filter().c_str());
-		result.filter_ = filter;
-	}
-	// FLAGS
-	if (gpfCDAPMessage.has_flags()) {
-		int flag_value = gpfCDAPMessage.flags();
-		cdap_rib::flags_t::Flags flags =
-				static_cast<cdap_rib::flags_t::Flags>(flag_value);
-		result.flags_ = flags;
+	return CodedOutputStream::VarintSize32(GPB_TAG(field, VARINT)) +
+	       CodedOutputStream::VarintSize64(static_cast<uint64>(value));
+}
+
+static inline int bytes_field_size(int field, int len)
+{
+	return CodedOutputStream::VarintSize32(GPB_TAG(field, LENGTH_DELIMITED)) +
+	       CodedOutputStream::VarintSize32(len) + len;
+}
+
+static inline uint8* write_varint(int field, long long value, uint8* target)
+{
+	target = CodedOutputStream::WriteTagToArray(GPB_TAG(field, VARINT), target);
+	return CodedOutputStream::WriteVarint64ToArray(static_cast<uint64>(value),
+						       target);
+}
+
+static inline uint8* write_header(int field, int len, uint8* target)
+{
+	target = CodedOutputStream::WriteTagToArray(GPB_TAG(field, LENGTH_DELIMITED),
+						    target);
+	return CodedOutputStream::WriteVarint32ToArray(len, target);
+}
+
+static inline uint8* write_bytes(int field, const void* data, int len,
+				 uint8* target)
+{
+	target = write_header(field, len, target);
+	return CodedOutputStream::WriteRawToArray(data, len, target);
+}
+
+static inline uint8* write_string(int field, const std::string& str,
+				  uint8* target)
+{
+	return write_bytes(field, str.data(), str.size(), target);
+}
+
+static int auth_policy_size(const cdap_rib::auth_policy_t& auth)
+{
+	int size = bytes_field_size(AUTH_NAME, auth.name.size());
+
+	for (std::list<std::string>::const_iterator it = auth.versions.begin();
+			it != auth.versions.end(); ++it)
+		size += bytes_field_size(AUTH_VERSIONS, it->size());
+	if (auth.options.size_ > 0)
+		size += bytes_field_size(AUTH_OPTIONS, auth.options.size_);
+
+	return size;
+}
+
+static uint8* write_auth_policy(const cdap_rib::auth_policy_t& auth,
+				int size, uint8* target)
+{
+	target = write_header(AUTH_POLICY, size, target);
+	target = write_string(AUTH_NAME, auth.name, target);
+	for (std::list<std::string>::const_iterator it = auth.versions.begin();
+			it != auth.versions.end(); ++it)
+		target = write_string(AUTH_VERSIONS, *it, target);
+	if (auth.options.size_ > 0)
+		target = write_bytes(AUTH_OPTIONS, auth.options.message_,
+				     auth.options.size_, target);
+
+	return target;
+}
+
+// Returns a pointer to the next length delimited value of the stream,
+// which points into buf (the buffer the stream reads from)
+static const uint8* read_bytes(CodedInputStream& in, const uint8* buf,
+			       int* len)
+{
+	uint32 size;
+	const uint8* data;
+
+	if (!in.ReadVarint32(&size))
+		return 0;
+	data = buf + in.CurrentPosition();
+	if (!in.Skip(size))
+		return 0;
+	*len = size;
+
+	return data;
+}
+
+static bool read_string(CodedInputStream& in, const uint8* buf,
+			std::string& result)
+{
+	const uint8* data;
+	int len;
+
+	data = read_bytes(in, buf, &len);
+	if (!data)
+		return false;
+	result.assign(reinterpret_cast<const char*>(data), len);
+
+	return true;
+}
+
+static void malformed()
+{
+	throw CDAPException("Deserializing Message: malformed CDAP message");
+}
+
+static void read_obj_value(const uint8* buf, int size, ser_obj_t& result)
+{
+	CodedInputStream in(buf, size);
+	const uint8* data = 0;
+	int len = 0;
+	uint32 t;
+
+	while ((t = in.ReadTag()) != 0) {
+		if (t == GPB_TAG(OBJ_VALUE_BYTES, LENGTH_DELIMITED)) {
+			data = read_bytes(in, buf, &len);
+			if (!data)
+				malformed();
+		} else if (!WireFormatLite::SkipField(&in, t))
+			malformed();
 	}
-	// INVOKE_ID
-	if (gpfCDAPMessage.has_invokeid())
-		result.invoke_id_ = gpfCDAPMessage.invokeid();
-	// OBJECT_CLASS
-	if (gpfCDAPMessage.has_objclass())
-		result.obj_class_ = gpfCDAPMessage.objclass();
-	// OBJ_INSTANCE
-	if (gpfCDAPMessage.has_objinst())
-		result.obj_inst_ = gpfCDAPMessage.objinst();
-	// OBJ_NAME
-	if (gpfCDAPMessage.has_objname())
-		result.obj_name_ = gpfCDAPMessage.objname();
-	// OBJ_VALUE
-	if (gpfCDAPMessage.has_objvalue()) {
-		messages::objVal_t obj_val_t = gpfCDAPMessage.objvalue();
-		char unsigned *byte_val = new
-				unsigned char[obj_val_t.byteval().size()];
-		memcpy(byte_val, obj_val_t.byteval().data(),
-		       obj_val_t.byteval().size());
-		result.obj_value_.message_ = byte_val;
-		result.obj_value_.size_ = obj_val_t.byteval().size();
+
+	if (result.message_)
+		delete[] result.message_;
+	result.message_ = new unsigned char[len];
+	result.size_ = len;
+	if (len > 0)
+		memcpy(result.message_, data, len);
+}
+
+static void read_auth_policy(const uint8* buf, int size,
+			     cdap_rib::auth_policy_t& result)
+{
+	CodedInputStream in(buf, size);
+	std::string version;
+	const uint8* data;
+	int len;
+	uint32 t;
+
+	while ((t = in.ReadTag()) != 0) {
+		switch (t) {
+		case GPB_TAG(AUTH_NAME, LENGTH_DELIMITED):
+			if (!read_string(in, buf, result.name))
+				malformed();
+			break;
+		case GPB_TAG(AUTH_VERSIONS, LENGTH_DELIMITED):
+			if (!read_string(in, buf, version))
+				malformed();
+			result.versions.push_back(version);
+			break;
+		case GPB_TAG(AUTH_OPTIONS, LENGTH_DELIMITED):
+			data = read_bytes(in, buf, &len);
+			if (!data)
+				malformed();
+			if (result.options.message_)
+				delete[] result.options.message_;
+			result.options.message_ = new unsigned char[len];
+			result.options.size_ = len;
+			if (len > 0)
+				memcpy(result.options.message_, data, len);
+			break;
+		default:
+			if (!WireFormatLite::SkipField(&in, t))
+				malformed();
+		}
 	}
-	// OP_CODE
-	if (gpfCDAPMessage.has_opcode()) {
-		int opcode_val = gpfCDAPMessage.opcode();
-		CDAPMessage::Opcode opcode =
-				static_cast<CDAPMessage::Opcode>(opcode_val);
-		result.op_code_ = opcode;
+}
+
+} //namespace gpb_wire
+
+void GPBSerializer::deserializeMessage(const ser_obj_t &message,
+				       cdap_m_t& result)
+{
+	using namespace gpb_wire;
+
+	const uint8* buf = message.message_;
+	CodedInputStream in(buf, message.size_);
+	const uint8* data;
+	std::string *str;
+	uint64 value;
+	int len;
+	uint32 t;
+
+	while ((t = in.ReadTag()) != 0) {
+		str = 0;
+		switch (t) {
+		case GPB_TAG(ABS_SYNTAX, VARINT):
+			if (!in.ReadVarint64(&value))
+				malformed();
+			result.abs_syntax_ = static_cast<int>(value);
+			break;
+		case GPB_TAG(OP_CODE, VARINT):
+			if (!in.ReadVarint64(&value))
+				malformed();
+			if (messages::opCode_t_IsValid(static_cast<int>(value)))
+				result.op_code_ = static_cast<CDAPMessage::Opcode>(
+						static_cast<int>(value));
+			break;
+		case GPB_TAG(INVOKE_ID, VARINT):
+			if (!in.ReadVarint64(&value))
+				malformed();
+			result.invoke_id_ = static_cast<int>(value);
+			break;
+		case GPB_TAG(FLAGS, VARINT):
+			if (!in.ReadVarint64(&value))
+				malformed();
+			if (messages::flagValues_t_IsValid(static_cast<int>(value)))
+				result.flags_ = static_cast<cdap_rib::flags_t::Flags>(
+						static_cast<int>(value));
+			break;
+		case GPB_TAG(OBJ_CLASS, LENGTH_DELIMITED):
+			str = &result.obj_class_;
+			break;
+		case GPB_TAG(OBJ_NAME, LENGTH_DELIMITED):
+			str = &result.obj_name_;
+			break;
+		case GPB_TAG(OBJ_INST, VARINT):
+			if (!in.ReadVarint64(&value))
+				malformed();
+			result.obj_inst_ = static_cast<long>(value);
+			break;
+		case GPB_TAG(OBJ_VALUE, LENGTH_DELIMITED):
+			data = read_bytes(in, buf, &len);
+			if (!data)
+				malformed();
+			read_obj_value(data, len, result.obj_value_);
+			break;
+		case GPB_TAG(RESULT, VARINT):
+			if (!in.ReadVarint64(&value))
+				malformed();
+			result.result_ = static_cast<int>(value);
+			break;
+		case GPB_TAG(SCOPE, VARINT):
+			if (!in.ReadVarint64(&value))
+				malformed();
+			result.scope_ = static_cast<int>(value);
+			break;
+		case GPB_TAG(FILTER, LENGTH_DELIMITED):
+			data = read_bytes(in, buf, &len);
+			if (!data)
+				malformed();
+			result.filter_ = new char[len + 1];
+			memcpy(result.filter_, data, len);
+			result.filter_[len] = 0;
+			break;
+		case GPB_TAG(AUTH_POLICY, LENGTH_DELIMITED):
+			data = read_bytes(in, buf, &len);
+			if (!data)
+				malformed();
+			read_auth_policy(data, len, result.auth_policy_);
+			break;
+		case GPB_TAG(DEST_AE_INST, LENGTH_DELIMITED):
+			str = &result.dest_ae_inst_;
+			break;
+		case GPB_TAG(DEST_AE_NAME, LENGTH_DELIMITED):
+			str = &result.dest_ae_name_;
+			break;
+		case GPB_TAG(DEST_AP_INST, LENGTH_DELIMITED):
+			str = &result.dest_ap_inst_;
+			break;
+		case GPB_TAG(DEST_AP_NAME, LENGTH_DELIMITED):
+			str = &result.dest_ap_name_;
+			break;
+		case GPB_TAG(SRC_AE_INST, LENGTH_DELIMITED):
+			str = &result.src_ae_inst_;
+			break;
+		case GPB_TAG(SRC_AE_NAME, LENGTH_DELIMITED):
+			str = &result.src_ae_name_;
+			break;
+		case GPB_TAG(SRC_AP_INST, LENGTH_DELIMITED):
+			str = &result.src_ap_inst_;
+			break;
+		case GPB_TAG(SRC_AP_NAME, LENGTH_DELIMITED):
+			str = &result.src_ap_name_;
+			break;
+		case GPB_TAG(RESULT_REASON, LENGTH_DELIMITED):
+			str = &result.result_reason_;
+			break;
+		case GPB_TAG(VERSION, VARINT):
+			if (!in.ReadVarint64(&value))
+				malformed();
+			result.version_ = static_cast<long>(value);
+			break;
+		default:
+			if (!WireFormatLite::SkipField(&in, t))
+				malformed();
+		}
+
+		if (str && !read_string(in, buf, *str))
+			malformed();
 	}
-	// RESULT
-	if (gpfCDAPMessage.has_result())
-		result.result_ = gpfCDAPMessage.result();
-	// RESULT_REASON
-	if (gpfCDAPMessage.has_resultreason())
-		result.result_reason_ = gpfCDAPMessage.resultreason();
-	// SCOPE
-	if (gpfCDAPMessage.has_scope())
-		result.scope_ = gpfCDAPMessage.scope();
-	// SRC_AE_INST
-	if (gpfCDAPMessage.has_srcaeinst())
-		result.src_ae_inst_ = gpfCDAPMessage.srcaeinst();
-	// SRC_AE_NAME
-	if (gpfCDAPMessage.has_srcaename())
-		result.src_ae_name_ = gpfCDAPMessage.srcaename();
-	// SRC_AP_INST
-	if (gpfCDAPMessage.has_srcapinst())
-		result.src_ap_inst_ = gpfCDAPMessage.srcapinst();
-	// SRC_AP_NAME
-	if (gpfCDAPMessage.has_srcapname())
-		result.src_ap_name_ = gpfCDAPMessage.srcapname();
-	// VERISON
-	if (gpfCDAPMessage.has_version())
-		result.version_ = gpfCDAPMessage.version();
-}
-// FIXME: check existanc of fields before seting
+
+	if (!in.ConsumedEntireMessage())
+		malformed();
+}
+
 void GPBSerializer::serializeMessage(const cdap_m_t &cdapMessage,
 				     ser_obj_t& result)
 {
-	messages::CDAPMessage gpfCDAPMessage;
-	// ABS_SYNTAX
-	gpfCDAPMessage.set_abssyntax(cdapMessage.abs_syntax_);
-	// AUTH_POLICY
-	messages::authPolicy_t *gpb_auth_policy = new messages::authPolicy_t();
-	gpb_auth_policy->set_name(cdapMessage.auth_policy_.name);
-	std::list<std::string> versions = cdapMessage.auth_policy_.versions;
-	for(std::list<std::string>::iterator it = versions.begin();
-		it != versions.end(); ++it) {
-		gpb_auth_policy->add_versions(*it);
-	}
-	if (cdapMessage.auth_policy_.options.size_ > 0) {
-		char * gpb_opts = new char[cdapMessage.auth_policy_.options.size_];
-		memcpy(gpb_opts,
-		       cdapMessage.auth_policy_.options.message_,
-		       cdapMessage.auth_policy_.options.size_);
-		gpb_auth_policy->set_options(gpb_opts,
-					     cdapMessage.auth_policy_.options.size_);
-	}
-	gpfCDAPMessage.set_allocated_authpolicy(gpb_auth_policy);
-	// DEST_AE_INST
-	gpfCDAPMessage.set_destaeinst(cdapMessage.dest_ae_inst_);
-	// DEST_AE_NAME
-	gpfCDAPMessage.set_destaename(cdapMessage.dest_ae_name_);
-	// DEST_AP_INST
-	gpfCDAPMessage.set_destapinst(cdapMessage.dest_ap_inst_);
-	// DEST_AP_NAME
-	gpfCDAPMessage.set_destapname(cdapMessage.dest_ap_name_);
-	// FILTER
-	if (cdapMessage.filter_ != 0) {
-		gpfCDAPMessage.set_filter(cdapMessage.filter_);
-	}
-        // FLAGS
-        if (cdapMessage.flags_ != 0) {
-                int flag_value = cdapMessage.flags_;
-                rina::messages::flagValues_t flag =
-                    static_cast<rina::messages::flagValues_t>(flag_value);
-                gpfCDAPMessage.set_flags(flag);
-        }
-	// INVOKE_ID
-	gpfCDAPMessage.set_invokeid(cdapMessage.invoke_id_);
-	// OBJ_CLASS
-	gpfCDAPMessage.set_objclass(cdapMessage.obj_class_);
-	// OBJ_INST
-	gpfCDAPMessage.set_objinst(cdapMessage.obj_inst_);
-	// OBJ_NAME
-	gpfCDAPMessage.set_objname(cdapMessage.obj_name_);
-	// OBJ_VALUE
-	if (cdapMessage.obj_value_.size_ > 0) {
-		messages::objVal_t *gpb_obj_val = new messages::objVal_t();
-		char * gpb_val = new char[cdapMessage.obj_value_.size_];
-		memcpy(gpb_val,
-		       cdapMessage.obj_value_.message_,
-		       cdapMessage.obj_value_.size_);
-		gpb_obj_val->set_byteval(gpb_val,
-					 cdapMessage.obj_value_.size_);
-		gpfCDAPMessage.set_allocated_objvalue(gpb_obj_val);
-	}
+	using namespace gpb_wire;
+
+	int size, auth_size, value_size = 0;
+	uint8* target;
+
 	// OP_CODE
 	if (!messages::opCode_t_IsValid(cdapMessage.op_code_)) {
 		throw CDAPException("Serializing Message: Not a valid OpCode");
 	}
-	gpfCDAPMessage.set_opcode((messages::opCode_t) cdapMessage.op_code_);
-	// RESULT
-	gpfCDAPMessage.set_result(cdapMessage.result_);
-	// RESULT_REASON
-	gpfCDAPMessage.set_resultreason(cdapMessage.result_reason_);
-	// SCOPE
-	gpfCDAPMessage.set_scope(cdapMessage.scope_);
-	// SRC_AE_INST
-	gpfCDAPMessage.set_srcaeinst(cdapMessage.src_ae_inst_);
-	// SRC_AE_NAME
-	gpfCDAPMessage.set_srcaename(cdapMessage.src_ae_name_);
-	// SRC_AP_NAME
-	gpfCDAPMessage.set_srcapname(cdapMessage.src_ap_name_);
-	// SRC_AP_INST
-	gpfCDAPMessage.set_srcapinst(cdapMessage.src_ap_inst_);
-	// VERSION
-	gpfCDAPMessage.set_version(cdapMessage.version_);
-
-	int size = gpfCDAPMessage.ByteSize();
+
+	// Compute the size first, to encode into a single buffer
+	auth_size = auth_policy_size(cdapMessage.auth_policy_);
+	size = varint_field_size(ABS_SYNTAX, cdapMessage.abs_syntax_) +
+	       varint_field_size(OP_CODE, cdapMessage.op_code_) +
+	       varint_field_size(INVOKE_ID, cdapMessage.invoke_id_) +
+	       bytes_field_size(OBJ_CLASS, cdapMessage.obj_class_.size()) +
+	       bytes_field_size(OBJ_NAME, cdapMessage.obj_name_.size()) +
+	       varint_field_size(OBJ_INST, cdapMessage.obj_inst_) +
+	       varint_field_size(RESULT, cdapMessage.result_) +
+	       varint_field_size(SCOPE, cdapMessage.scope_) +
+	       bytes_field_size(AUTH_POLICY, auth_size) +
+	       bytes_field_size(DEST_AE_INST, cdapMessage.dest_ae_inst_.size()) +
+	       bytes_field_size(DEST_AE_NAME, cdapMessage.dest_ae_name_.size()) +
+	       bytes_field_size(DEST_AP_INST, cdapMessage.dest_ap_inst_.size()) +
+	       bytes_field_size(DEST_AP_NAME, cdapMessage.dest_ap_name_.size()) +
+	       bytes_field_size(SRC_AE_INST, cdapMessage.src_ae_inst_.size()) +
+	       bytes_field_size(SRC_AE_NAME, cdapMessage.src_ae_name_.size()) +
+	       bytes_field_size(SRC_AP_INST, cdapMessage.src_ap_inst_.size()) +
+	       bytes_field_size(SRC_AP_NAME, cdapMessage.src_ap_name_.size()) +
+	       bytes_field_size(RESULT_REASON, cdapMessage.result_reason_.size()) +
+	       varint_field_size(VERSION, cdapMessage.version_);
+	if (cdapMessage.flags_ != 0)
+		size += varint_field_size(FLAGS, cdapMessage.flags_);
+	if (cdapMessage.obj_value_.size_ > 0) {
+		value_size = bytes_field_size(OBJ_VALUE_BYTES,
+					      cdapMessage.obj_value_.size_);
+		size += bytes_field_size(OBJ_VALUE, value_size);
+	}
+	if (cdapMessage.filter_ != 0)
+		size += bytes_field_size(FILTER, strlen(cdapMessage.filter_));
+
 	result.message_ = new unsigned char[size];
 	result.size_ = size;
-	gpfCDAPMessage.SerializeToArray(result.message_, size);
+	target = result.message_;
+
+	target = write_varint(ABS_SYNTAX, cdapMessage.abs_syntax_, target);
+	target = write_varint(OP_CODE, cdapMessage.op_code_, target);
+	target = write_varint(INVOKE_ID, cdapMessage.invoke_id_, target);
+	if (cdapMessage.flags_ != 0)
+		target = write_varint(FLAGS, cdapMessage.flags_, target);
+	target = write_string(OBJ_CLASS, cdapMessage.obj_class_, target);
+	target = write_string(OBJ_NAME, cdapMessage.obj_name_, target);
+	target = write_varint(OBJ_INST, cdapMessage.obj_inst_, target);
+	if (cdapMessage.obj_value_.size_ > 0) {
+		target = write_header(OBJ_VALUE, value_size, target);
+		target = write_bytes(OBJ_VALUE_BYTES,
+				     cdapMessage.obj_value_.message_,
+				     cdapMessage.obj_value_.size_, target);
+	}
+	target = write_varint(RESULT, cdapMessage.result_, target);
+	target = write_varint(SCOPE, cdapMessage.scope_, target);
+	if (cdapMessage.filter_ != 0)
+		target = write_bytes(FILTER, cdapMessage.filter_,
+				     strlen(cdapMessage.filter_), target);
+	target = write_auth_policy(cdapMessage.auth_policy_, auth_size, target);
+	target = write_string(DEST_AE_INST, cdapMessage.dest_ae_inst_, target);
+	target = write_string(DEST_AE_NAME, cdapMessage.dest_ae_name_, target);
+	target = write_string(DEST_AP_INST, cdapMessage.dest_ap_inst_, target);
+	target = write_string(DEST_AP_NAME, cdapMessage.dest_ap_name_, target);
+	target = write_string(SRC_AE_INST, cdapMessage.src_ae_inst_, target);
+	target = write_string(SRC_AE_NAME, cdapMessage.src_ae_name_, target);
+	target = write_string(SRC_AP_INST, cdapMessage.src_ap_inst_, target);
+	target = write_string(SRC_AP_NAME, cdapMessage.src_ap_name_, target);
+	target = write_string(RESULT_REASON, cdapMessage.result_reason_, target);
+	target = write_varint(VERSION, cdapMessage.version_, target);
+
+	assert(target == result.message_ + size);
 }
 
 class CDAPProvider : public CDAPProviderInterface
@@ -4135,6 +4452,74 @@ void CDAPMessageEncoder::decode(const ser_obj_t &serobj,
 	serializer->deserializeMessage(serobj, des_obj);
 }
 
+void CDAPBatchEncoder::encode(const std::list<ser_obj_t*>& messages,
+			      ser_obj_t& batch)
+{
+	using namespace gpb_wire;
+
+	std::list<ser_obj_t*>::const_iterator it;
+	uint8* target;
+	int size = 0;
+
+	for (it = messages.begin(); it != messages.end(); ++it)
+		size += batched_size((*it)->size_);
+
+	batch.message_ = new unsigned char[size];
+	batch.size_ = size;
+	target = batch.message_;
+	for (it = messages.begin(); it != messages.end(); ++it)
+		target = write_bytes(BATCH_MESSAGES, (*it)->message_,
+				     (*it)->size_, target);
+}
+
+void CDAPBatchEncoder::decode(const ser_obj_t& batch,
+			      std::list<ser_obj_t*>& messages)
+{
+	using namespace gpb_wire;
+
+	CodedInputStream in(batch.message_, batch.size_);
+	std::list<ser_obj_t*>::iterator it;
+	const uint8* data;
+	ser_obj_t* message;
+	int len;
+	uint32 t;
+
+	while ((t = in.ReadTag()) != 0) {
+		if (t != GPB_TAG(BATCH_MESSAGES, LENGTH_DELIMITED))
+			break;
+		data = read_bytes(in, batch.message_, &len);
+		if (!data)
+			break;
+		message = new ser_obj_t();
+		message->message_ = new unsigned char[len];
+		message->size_ = len;
+		memcpy(message->message_, data, len);
+		messages.push_back(message);
+	}
+
+	if (!in.ConsumedEntireMessage()) {
+		for (it = messages.begin(); it != messages.end(); ++it)
+			delete *it;
+		messages.clear();
+		throw CDAPException("Malformed batch of CDAP messages");
+	}
+}
+
+bool CDAPBatchEncoder::is_batch(const ser_obj_t& sdu) const
+{
+	using namespace gpb_wire;
+
+	CodedInputStream in(sdu.message_, sdu.size_);
+
+	return in.ReadTag() == GPB_TAG(BATCH_MESSAGES, LENGTH_DELIMITED);
+}
+
+int CDAPBatchEncoder::batched_size(int message_size)
+{
+	return gpb_wire::bytes_field_size(gpb_wire::BATCH_MESSAGES,
+					  message_size);
+}
+
 void StringEncoder::encode(const std::string& obj, ser_obj_t& serobj)
 {
 	messages::string_t s;
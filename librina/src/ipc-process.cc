@@ -1088,6 +1088,7 @@ PDUForwardingTableEntry::PDUForwardingTableEntry() {
         address = 0;
         qosId = 0;
         cost = 0;
+        wildcardBits = 0;
 }
 
 void PDUForwardingTableEntry::from_c_pff_entry(PDUForwardingTableEntry & pf,
@@ -1098,6 +1099,7 @@ void PDUForwardingTableEntry::from_c_pff_entry(PDUForwardingTableEntry & pf,
 	pf.address = pff->fwd_info;
 	pf.cost = pff->cost;
 	pf.qosId = pff->qos_id;
+	pf.wildcardBits = pff->wildcard_bits;
 
 	list_for_each_entry(pos, &(pff->port_id_altlists), next) {
 		PortIdAltlist pia;
@@ -1118,6 +1120,7 @@ struct mod_pff_entry * PDUForwardingTableEntry::to_c_pff_entry() const
 	result->qos_id = qosId;
 	result->fwd_info = address;
 	result->cost = cost;
+	result->wildcard_bits = wildcardBits;
 
 	for(it = portIdAltlists.begin(); it != portIdAltlists.end(); ++it) {
 		pia = it->to_c_pid_list();
@@ -1138,6 +1141,9 @@ bool PDUForwardingTableEntry::operator==(
         if (cost != other.cost)
         	return false;
 
+        if (wildcardBits != other.wildcardBits)
+        	return false;
+
         return true;
 }
 
@@ -1146,6 +1152,13 @@ bool PDUForwardingTableEntry::operator!=(
         return !(*this == other);
 }
 
+bool PDUForwardingTableEntry::covers(unsigned int address) const {
+        if (wildcardBits >= 32)
+                return true;
+
+        return (this->address >> wildcardBits) == (address >> wildcardBits);
+}
+
 unsigned int PDUForwardingTableEntry::getAddress() const {
         return address;
 }
@@ -1174,7 +1187,10 @@ void PDUForwardingTableEntry::setQosId(unsigned int qosId) {
 const std::string PDUForwardingTableEntry::toString() {
         std::stringstream ss;
 
-        ss<<"Address: "<<address<<" QoS-id: "<<qosId<< " Cost: "<<cost;
+        ss<<"Address: "<<address;
+        if (wildcardBits)
+                ss<<"/"<<32 - wildcardBits;
+        ss<<" QoS-id: "<<qosId<< " Cost: "<<cost;
         ss<<"List of N-1 port-ids: ";
         for (std::list<PortIdAltlist>::iterator it = portIdAltlists.begin();
                         it != portIdAltlists.end(); it++) {
@@ -1192,7 +1208,11 @@ const std::string PDUForwardingTableEntry::toString() {
 const std::string PDUForwardingTableEntry::getKey() const
 {
 	std::stringstream ss;
-	ss << address << "-" << qosId << "-" << portIdAltlists.front().alts.front();
+	ss << address;
+	/* Not a '/', the key is part of a RIB object name */
+	if (wildcardBits)
+		ss << ":" << 32 - wildcardBits;
+	ss << "-" << qosId << "-" << portIdAltlists.front().alts.front();
 
 	return ss.str();
 }
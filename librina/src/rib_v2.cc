@@ -28,6 +28,7 @@
 
 #include <algorithm>
 #include <map>
+#include <vector>
 #define RINA_PREFIX "rib"
 #include <librina/logs.h>
 //FIXME iostream is only for debuging purposes
@@ -265,6 +266,167 @@ create_cb_t RIBSchema::get_create_callback(const std::string& class_,
 //fwd decl
 class RIBDaemon;
 
+///
+/// An object of the RIB and its position in the tree
+///
+struct RIBEntry {
+	RIBObj* obj;
+	int64_t inst_id;
+
+	/// Fully qualified name. Points to the fqn of the object (not copied)
+	const std::string* fqn;
+
+	RIBEntry* parent;
+	std::list<RIBEntry*> children;
+
+	/// Position in the children list of the parent
+	std::list<RIBEntry*>::iterator sibling;
+
+	/// Chains of the hash buckets
+	RIBEntry* next_by_name;
+	RIBEntry* next_by_id;
+	size_t name_hash;
+};
+
+///
+/// Hash table of the RIB entries, indexed by fqn and by instance id.
+/// Entries are owned by the caller.
+///
+class RIBEntryTable {
+
+public:
+	RIBEntryTable();
+
+	RIBEntry* find(const std::string& fqn) const;
+	RIBEntry* find(int64_t inst_id) const;
+	void insert(RIBEntry* entry);
+	void erase(RIBEntry* entry);
+	size_t size() const { return count; };
+	void get_all(std::vector<RIBEntry*>& entries) const;
+
+private:
+	static const size_t INITIAL_BUCKETS = 64;
+
+	static size_t hash(const std::string& fqn);
+	static size_t hash(int64_t inst_id);
+	void grow(void);
+
+	std::vector<RIBEntry*> by_name;
+	std::vector<RIBEntry*> by_id;
+	size_t count;
+};
+
+RIBEntryTable::RIBEntryTable() : by_name(INITIAL_BUCKETS, (RIBEntry*) NULL),
+				 by_id(INITIAL_BUCKETS, (RIBEntry*) NULL),
+				 count(0)
+{
+}
+
+//FNV-1a
+size_t RIBEntryTable::hash(const std::string& fqn)
+{
+	size_t h = 2166136261u;
+
+	for (std::string::const_iterator it = fqn.begin(); it != fqn.end();
+									++it) {
+		h ^= (unsigned char) *it;
+		h *= 16777619u;
+	}
+
+	return h;
+}
+
+size_t RIBEntryTable::hash(int64_t inst_id)
+{
+	uint64_t h = (uint64_t) inst_id * 0x9E3779B97F4A7C15ULL;
+
+	return (size_t) (h ^ (h >> 32));
+}
+
+RIBEntry* RIBEntryTable::find(const std::string& fqn) const
+{
+	size_t h = hash(fqn);
+	RIBEntry* entry = by_name[h & (by_name.size() - 1)];
+
+	for (; entry; entry = entry->next_by_name)
+		if (entry->name_hash == h && *entry->fqn == fqn)
+			return entry;
+
+	return NULL;
+}
+
+RIBEntry* RIBEntryTable::find(int64_t inst_id) const
+{
+	RIBEntry* entry = by_id[hash(inst_id) & (by_id.size() - 1)];
+
+	for (; entry; entry = entry->next_by_id)
+		if (entry->inst_id == inst_id)
+			return entry;
+
+	return NULL;
+}
+
+void RIBEntryTable::insert(RIBEntry* entry)
+{
+	size_t name_bucket, id_bucket;
+
+	if (count >= by_name.size())
+		grow();
+
+	entry->name_hash = hash(*entry->fqn);
+	name_bucket = entry->name_hash & (by_name.size() - 1);
+	id_bucket = hash(entry->inst_id) & (by_id.size() - 1);
+
+	entry->next_by_name = by_name[name_bucket];
+	by_name[name_bucket] = entry;
+	entry->next_by_id = by_id[id_bucket];
+	by_id[id_bucket] = entry;
+	count++;
+}
+
+void RIBEntryTable::erase(RIBEntry* entry)
+{
+	RIBEntry** link;
+
+	link = &by_name[entry->name_hash & (by_name.size() - 1)];
+	while (*link && *link != entry)
+		link = &(*link)->next_by_name;
+	if (*link)
+		*link = entry->next_by_name;
+
+	link = &by_id[hash(entry->inst_id) & (by_id.size() - 1)];
+	while (*link && *link != entry)
+		link = &(*link)->next_by_id;
+	if (*link) {
+		*link = entry->next_by_id;
+		count--;
+	}
+}
+
+void RIBEntryTable::get_all(std::vector<RIBEntry*>& entries) const
+{
+	RIBEntry* entry;
+
+	entries.reserve(entries.size() + count);
+	for (size_t i = 0; i < by_id.size(); ++i)
+		for (entry = by_id[i]; entry; entry = entry->next_by_id)
+			entries.push_back(entry);
+}
+
+void RIBEntryTable::grow(void)
+{
+	std::vector<RIBEntry*> entries;
+	size_t size = by_name.size() * 2;
+
+	get_all(entries);
+	by_name.assign(size, (RIBEntry*) NULL);
+	by_id.assign(size, (RIBEntry*) NULL);
+	count = 0;
+
+	for (size_t i = 0; i < entries.size(); ++i)
+		insert(entries[i]);
+}
+
 /// A simple RIB implementation, based on a hashtable of RIB objects
 /// indexed by object name
 class RIB {
@@ -414,20 +576,11 @@ protected:
 			const int invoke_id);
 private:
 
-	// fqn <-> obj
-	std::map<std::string, RIBObj*> obj_name_map;
-
-	// instance id <-> obj
-	std::map<int64_t, RIBObj*> obj_inst_map;
-
-	// instance id <-> fqn
-	std::map<int64_t, std::string> inst_name_map;
+	// Objects, by fqn and by instance id
+	RIBEntryTable entries;
 
-	// fqn <-> instance id
-	std::map<std::string, int64_t> name_inst_map;
-
-	// Children map instance id <-> std<int64_t> children
-	std::map<int64_t, std::list<int64_t>*> obj_inst_child_map;
+	// fqn of the root object
+	std::string root_fqn;
 
 	// delegation cache: fqn <-> inst id
 	std::map<std::string, int64_t> deleg_cache;
@@ -469,6 +622,12 @@ private:
 	//@internal only; must be called with the rwlock acquired
 	RIBObj* get_obj(int64_t inst_id);
 
+	//@internal only; must be called with the rwlock acquired
+	void get_objects_to_operate(RIBEntry* entry,
+				    int scope,
+				    std::list<std::pair<int, RIBObj*> >
+	                            &objects);
+
 	//@internal: must be called with the rwlock acquired
 	void __remove_obj(int64_t inst_id, bool force = false);
 
@@ -507,56 +666,41 @@ RIB::RIB(const rib_handle_t& handle_,
 						cdap_provider(cdap_provider_),
 						handle(handle_){
 
-	std::stringstream root_fqn;
+	std::stringstream ss;
 
 	//Create root object
-	RIBObj* root = new RootObj();
+	RIBEntry* root = new RIBEntry();
 
 	// Root fqn
-	root_fqn << schema->get_root_name() << schema->get_separator();
+	ss << schema->get_root_name() << schema->get_separator();
+	root_fqn = ss.str();
 
 	// Fill in the stuf
-	obj_name_map[root_fqn.str()] = root;
-	obj_inst_map[RIB_ROOT_INST_ID] = root;
-	inst_name_map[RIB_ROOT_INST_ID] = root_fqn.str();
-	name_inst_map[root_fqn.str()] = RIB_ROOT_INST_ID;
-	std::list<int64_t>* child_list = new std::list<int64_t>();
-	obj_inst_child_map[RIB_ROOT_INST_ID] = child_list;
+	root->obj = new RootObj();
+	root->inst_id = RIB_ROOT_INST_ID;
+	root->fqn = &root_fqn;
+	root->parent = NULL;
+	entries.insert(root);
 	security_m = sec_man;
 }
 
 RIB::~RIB() {
-	std::list<int64_t> *child_list;
-	int64_t inst_id;
-	RIBObj* obj;
-	std::map<int64_t, RIBObj*>::iterator it;
+	std::vector<RIBEntry*> all;
 
 	//Mutual exclusion
 	WriteScopedLock wlock(rwlock);
 
 	//Remove objects
-	for(it = obj_inst_map.begin(); it != obj_inst_map.end(); it++){
-		inst_id = it->first;
-		obj = it->second;
-
+	entries.get_all(all);
+	for (size_t i = 0; i < all.size(); ++i) {
 		//If there, remove from the cache
-		if(obj->delegates){
+		if(all[i]->obj->delegates){
 			//Remove cached delegated objs
 			deleg_cache.clear();
 			num_of_deleg--;
 		}
-		try{
-			child_list = obj_inst_child_map[inst_id];
-		}catch(...){
-			LOG_ERR("Unable to recover the children list/parent"
-				"children list for object '" PRId64 "';"
-				"corrupted internal state!",inst_id);
-			continue;
-		}
-		if (child_list != NULL){
-			delete child_list;
-		}
-		delete obj;
+		delete all[i]->obj;
+		delete all[i];
 	}
 
 
@@ -1301,47 +1445,51 @@ void RIB::get_objects_to_operate(const int64_t object_id,
 			         std::list<std::pair<int, RIBObj*> >
 			         &objects)
 {
-	std::list<int64_t> *child_list = NULL;
-	RIBObj *rib_obj = NULL;
+	RIBEntry *entry = entries.find(object_id);
 
-	rib_obj = get_obj(object_id);
-	if (!rib_obj)
+	if (!entry)
 		return;
 	//TODO apply filter
 
+	get_objects_to_operate(entry, scope, objects);
+}
+
+void RIB::get_objects_to_operate(RIBEntry* entry,
+			         int scope,
+			         std::list<std::pair<int, RIBObj*> >
+			         &objects)
+{
 	//Acquire the read lock over the object (make sure it is not
 	//deleted while we process the operation)
-	rib_obj->rwlock.readlock();
-	std::pair<int, RIBObj*> pair (scope, rib_obj);
+	entry->obj->rwlock.readlock();
+	std::pair<int, RIBObj*> pair (scope, entry->obj);
 	objects.push_back(pair);
 
 	if (scope == 0)
 		return;
 
-	child_list = obj_inst_child_map[object_id];
-	if (!child_list || child_list->size() == 0)
-		return;
-
-	std::list<int64_t>::const_iterator it;
-	for(it = child_list->begin(); it != child_list->end(); ++it)
+	std::list<RIBEntry*>::const_iterator it;
+	for(it = entry->children.begin(); it != entry->children.end(); ++it)
 		get_objects_to_operate(*it,
 				       scope - 1,
-				       filter,
 				       objects);
 }
 
 RIBObj* RIB::get_obj(int64_t inst_id){
-	if(obj_inst_map.find(inst_id) != obj_inst_map.end())
-		return obj_inst_map[inst_id];
+	RIBEntry* entry = entries.find(inst_id);
+
+	if(entry)
+		return entry->obj;
 	else
 		return NULL;
 }
 
 int64_t RIB::__get_obj_inst_id(const std::string& fqn){
 	int64_t id = -1;
+	RIBEntry* entry = entries.find(fqn);
 
-	if(name_inst_map.find(fqn) != name_inst_map.end())
-		id = name_inst_map[fqn];
+	if(entry)
+		id = entry->inst_id;
 
 	//If there are delegated objects
 	//Note: this block of code is specially polluted by RAII
@@ -1366,8 +1514,9 @@ int64_t RIB::__get_obj_inst_id(const std::string& fqn){
 		std::string root_name = __get_obj_fqn(0);
 		do{
 			tmp = get_parent_fqn(tmp);
-			if(name_inst_map.find(tmp) != name_inst_map.end())
-				id = name_inst_map[tmp];
+			entry = entries.find(tmp);
+			if(entry)
+				id = entry->inst_id;
 			if(id >= 0 || tmp == root_name)
 				break;
 		}while(1);
@@ -1396,12 +1545,12 @@ int64_t RIB::__get_obj_inst_id(const std::string& fqn){
 }
 
 std::string RIB::__get_obj_fqn(const int64_t inst_id) {
-	std::string fqn("");
+	RIBEntry* entry = entries.find(inst_id);
 
-	if(inst_name_map.find(inst_id) != inst_name_map.end())
-		fqn = inst_name_map[inst_id];
+	if(entry)
+		return *entry->fqn;
 
-	return fqn;
+	return std::string("");
 }
 
 int64_t RIB::get_new_inst_id(){
@@ -1417,7 +1566,7 @@ int64_t RIB::get_new_inst_id(){
 		if(curr < 0)
 			curr = next_inst_id;
 
-		if(obj_inst_map.find(next_inst_id) == obj_inst_map.end())
+		if(!entries.find(next_inst_id))
 			break;
 	}
 	return next_inst_id;
@@ -1453,6 +1602,7 @@ void RIB::__validate_fqn(const std::string& fqn){
 
 int64_t RIB::add_obj(const std::string& fqn, RIBObj** obj_) {
 	int64_t id, parent_id;
+	RIBEntry *entry, *parent;
 	std::string parent_fqn = get_parent_fqn(fqn);
 
 	//Note that obj_ cannot be NULL (checked by RIBDaemon)
@@ -1497,19 +1647,29 @@ int64_t RIB::add_obj(const std::string& fqn, RIBObj** obj_) {
 		throw eObjExists();
 	}
 
-	//Allocate space
-	std::list<int64_t>* child_list = new std::list<int64_t>();
+	//Recover the parent's entry (the parent can be a delegating
+	//object, found through the cache)
+	parent = entries.find(parent_id);
+	if(parent == NULL){
+		LOG_ERR("Unable to recover the entry of object '%" PRId64  "'; corrupted internal state!",
+						parent_id);
+		assert(0);
+		throw Exception("Corrupted internal state");
+	}
 
 	//get a (free) instance id
 	id = get_new_inst_id();
 	obj->parent_inst_id = parent_id;
 
-	//Add it and return
-	obj_name_map[fqn] = obj;
-	obj_inst_map[id] = obj;
-	inst_name_map[id] = fqn;
-	name_inst_map[fqn] = id;
-	obj_inst_child_map[id] = child_list;
+	//Add it and add ourselves to the parent's children
+	entry = new RIBEntry();
+	entry->obj = obj;
+	entry->inst_id = id;
+	entry->fqn = &obj->fqn;
+	entry->parent = parent;
+	entry->sibling = parent->children.insert(parent->children.end(),
+						 entry);
+	entries.insert(entry);
 
 	if(obj->delegates){
 		//Increase counter number of num_of_deleg
@@ -1518,20 +1678,6 @@ int64_t RIB::add_obj(const std::string& fqn, RIBObj** obj_) {
 		deleg_cache.clear();
 	}
 
-	//Recover parent's children list  and add ourselves
-	std::list<int64_t>* parent_child_list;
-	try{
-		parent_child_list = obj_inst_child_map[parent_id];
-		if(parent_child_list == NULL)
-			throw Exception();
-	}catch(...){
-		LOG_ERR("Unable to recover the children list for object '" PRId64  "'; corrupted internal state!",
-						parent_id);
-		assert(0);
-		throw Exception("Corrupted internal state");
-	}
-	parent_child_list->push_back(id);
-
 	LOG_DBG("Add object operation over RIB(%p), of object(%p) with fqn: '%s', succeeded. Instance id: '%" PRId64 "'",
 								this,
 								obj,
@@ -1548,16 +1694,16 @@ void RIB::__remove_obj(int64_t inst_id, bool force)
 {
 
 	RIBObj* obj;
-	std::list<int64_t> *child_list = NULL, *parent_child_list = NULL;
+	RIBEntry* entry;
 	std::list<int64_t> children;
 	std::list<int64_t>::iterator it;
-	int64_t parent_inst_id;
+	std::list<RIBEntry*>::iterator eit;
 
 	//Mutual exclusion
 	rwlock.writelock();
 
-	obj = get_obj(inst_id);
-	if(!obj){
+	entry = entries.find(inst_id);
+	if(!entry){
 		LOG_ERR("Unable to remove with instance id '%" PRId64  "'. Object does not exist!",
 								inst_id);
 		rwlock.unlock();
@@ -1571,33 +1717,16 @@ void RIB::__remove_obj(int64_t inst_id, bool force)
 		throw eObjInvalid();
 	}
 
-	parent_inst_id = obj->parent_inst_id;
-
-	//Check first if it has children
-	try{
-		child_list = obj_inst_child_map[inst_id];
-		if(child_list == NULL)
-			throw Exception();
-		parent_child_list = obj_inst_child_map[parent_inst_id];
-		if(parent_child_list == NULL)
-			throw Exception();
-	}catch(...){
-		LOG_ERR("Unable to recover the children list/parent children list for object '" PRId64  "'; corrupted internal state!",
-							inst_id);
-		rwlock.unlock();
-		assert(0);
-		throw Exception("Corrupted internal state");
-	}
-
-	if(child_list->size() > 0 && !force){
+	if(entry->children.size() > 0 && !force){
 		LOG_ERR("Unable to remove object '" PRId64  "'; the object has children",
 							inst_id);
 		rwlock.unlock();
 		throw eObjHasChildren();
-	} else if (child_list->size() > 0) {
+	} else if (entry->children.size() > 0) {
 		//Make a copy of the list of children
-		for(it=child_list->begin(); it != child_list->end(); ++it) {
-			children.push_back(*it);
+		for(eit = entry->children.begin();
+				eit != entry->children.end(); ++eit) {
+			children.push_back((*eit)->inst_id);
 		}
 
 		//Remove each children recursively
@@ -1609,33 +1738,24 @@ void RIB::__remove_obj(int64_t inst_id, bool force)
 			}
 			rwlock.writelock();
 		}
-	}
 
-	//Check if we are in the parent's child list
-	it = std::find(parent_child_list->begin(), parent_child_list->end(),
-								inst_id);
-	if(it == parent_child_list->end()){
-		LOG_ERR("Parent's children list does not contain object '" PRId64  "'; corrupted internal state!",
-							inst_id);
-		rwlock.unlock();
-		throw Exception("Corrupted internal state");
+		//The entry could have been removed meanwhile
+		if (entries.find(inst_id) != entry) {
+			rwlock.unlock();
+			throw eObjDoesNotExist();
+		}
 	}
 
-	//Remove from the maps
-	std::string fqn = __get_obj_fqn(inst_id);
+	obj = entry->obj;
 
 	LOG_DBG("Removing object over RIB(%p) instance id: '%" PRId64 "' fqn: '%s'",
 								this,
 								inst_id,
-								fqn.c_str());
-	obj_inst_map.erase(inst_id);
-	inst_name_map.erase(inst_id);
-	name_inst_map.erase(fqn);
-	obj_name_map.erase(fqn);
-	obj_inst_child_map.erase(inst_id);
+								entry->fqn->c_str());
 
-	//Remove ourselves from the parent's children list
-	parent_child_list->erase(it);
+	//Remove from the table and from the parent's children list
+	entries.erase(entry);
+	entry->parent->children.erase(entry->sibling);
 
 	//If there Remove from the cache
 	if(obj->delegates){
@@ -1645,7 +1765,7 @@ void RIB::__remove_obj(int64_t inst_id, bool force)
 	}
 
 	LOG_DBG("Object '%s' of class '%s' succesfully removed (id:'%" PRId64 "')",
-							fqn.c_str(),
+							entry->fqn->c_str(),
 							obj->get_class().c_str(),
 							inst_id);
 
@@ -1653,7 +1773,7 @@ void RIB::__remove_obj(int64_t inst_id, bool force)
 
 	//Delete object
 	delete obj;
-	delete child_list;
+	delete entry;
 }
 
 char RIB::get_separator() const {
@@ -1696,24 +1816,48 @@ const cdap_rib::vers_info_t& RIB::get_version() const {
 	return schema->get_version();
 }
 
+static bool compare_entry_fqns(const RIBEntry* a, const RIBEntry* b)
+{
+	return *a->fqn < *b->fqn;
+}
+
 std::list<RIBObjectData> RIB::get_all_rib_objects_data(
 		const std::string& class_,
 		const std::string& name)
 {
 	std::list<RIBObjectData> result;
+	std::vector<RIBEntry*> all;
+	std::vector<std::pair<int64_t, RIBObj*> > objects;
+	std::vector<std::pair<int64_t, RIBObj*> >::iterator it;
 	RIBObjectData data;
 	unsigned n = name.size();
 
-	for (std::map<std::string, RIBObj*>::iterator it = obj_name_map.begin();
-			it != obj_name_map.end(); ++it) {
+	/* rwlock RAII scope */ {
+		ReadScopedLock rlock(rwlock);
+
+		//Sorted by name; read lock the objects so that they are
+		//not deleted once the RIB lock is released
+		entries.get_all(all);
+		std::sort(all.begin(), all.end(), compare_entry_fqns);
+		objects.reserve(all.size());
+		for (unsigned i = 0; i < all.size(); ++i) {
+			all[i]->obj->rwlock.readlock();
+			objects.push_back(std::make_pair(all[i]->inst_id,
+							 all[i]->obj));
+		}
+	} //RAII
+
+	for (it = objects.begin(); it != objects.end(); ++it) {
+		ReadScopedLock rlock(it->second->rwlock, false);
+
 		data = it->second->get_object_data();
 		if (class_.size() && class_ != data.class_)
 			continue;
 		if (n && (name[n-1] == '/' ? data.name_.compare(0, n, name)
 					   : data.name_ != name))
 			continue;
-		if (it->first != "/")
-			data.instance_ = __get_obj_inst_id(data.name_);
+		if (it->first != RIB_ROOT_INST_ID)
+			data.instance_ = it->first;
 		result.push_back(data);
 	}
 
@@ -20,6 +20,10 @@
 //
 
 #include <cerrno>
+#include <cstring>
+#include <time.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
 
 #define RINA_PREFIX "librina.timer"
 
@@ -63,7 +67,7 @@ int Time::get_time_in_ms()
 	return (int) time_seconds * 1000 + (int) (time_.tv_usec / 1000);
 }
 
-// CLASS LockableMap
+// CLASS TaskScheduler
 void* doWorkTask(void *arg) {
 	TimerTask *timer_task = (TimerTask*) arg;
 	timer_task->run();
@@ -72,53 +76,362 @@ void* doWorkTask(void *arg) {
 	return (void *) 0;
 }
 
+void* doWorkTimer(void *arg) {
+	TaskScheduler *scheduler = (TaskScheduler*) arg;
+	while (scheduler->execute_tasks()) {
+	}
+	return (void *) 0;
+}
+
+/// A pending task. It is linked in a slot of the wheel, in a bucket of
+/// the task index and in the list of its Timer
+struct TimerEntry {
+	TimerTask * task;
+	Timer * owner;
+	uint64_t expires;
+	int level;
+	int slot;
+	TimerEntry * prev;
+	TimerEntry * next;
+	TimerEntry * index_next;
+	TimerEntry * owner_prev;
+	TimerEntry * owner_next;
+};
+
+static const uint64_t NEVER = ~(uint64_t) 0;
+static const unsigned int INITIAL_INDEX_SIZE = 64;
+
+static uint64_t monotonic_ms()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static unsigned int task_hash(const TimerTask * task, size_t size)
+{
+	uintptr_t h = (uintptr_t) task;
+
+	h ^= h >> 16;
+	h *= 0x45d9f3b;
+	h ^= h >> 16;
+	return h & (size - 1);
+}
+
+static pthread_once_t shared_scheduler_once = PTHREAD_ONCE_INIT;
+static TaskScheduler * shared_scheduler = 0;
+
+static void create_shared_scheduler()
+{
+	shared_scheduler = new TaskScheduler();
+}
+
+TaskScheduler * TaskScheduler::get_shared_scheduler()
+{
+	pthread_once(&shared_scheduler_once, create_shared_scheduler);
+	return shared_scheduler;
+}
+
 TaskScheduler::TaskScheduler() :
-		Lockable() {
+		Lockable(), index_(INITIAL_INDEX_SIZE, (TimerEntry *) 0) {
+	now_ = 0;
+	start_ = monotonic_ms();
+	armed_ = NEVER;
+	for (int i = 0; i < NUM_LEVELS; i++) {
+		occupied_[i] = 0;
+		for (int j = 0; j < LEVEL_SIZE; j++)
+			slots_[i][j] = 0;
+	}
+	size_ = 0;
+	free_entries_ = 0;
+	continue_ = true;
+
+	fd_ = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+	if (fd_ < 0) {
+		LOG_ERR("Problems creating timerfd: %s", strerror(errno));
+		throw Exception("Problems creating timerfd");
+	}
+
+	thread_ = new Thread(&doWorkTimer, (void *) this,
+			     std::string("Timer"), false);
+	thread_->start();
+	LOG_DBG("Task scheduler with timer thread %d started", thread_);
 }
+
 TaskScheduler::~TaskScheduler() throw () {
-  for (std::map<Time, std::list<TimerTask*>* >::iterator iter_map = tasks_.begin();
-      iter_map != tasks_.end(); ++iter_map) {
-    for (std::list<TimerTask*>::iterator iter_list = iter_map->second->begin();
-        iter_list != iter_map->second->end(); ++iter_list){
-      delete *iter_list;
-    }
-    iter_map->second->empty();
-    delete iter_map->second;
-  }
-  tasks_.empty();
+	TimerEntry * entry;
+	void *r;
+
+	lock();
+	continue_ = false;
+	arm(now_);
+	unlock();
+
+	LOG_DBG("Waiting for the timer %d to join", thread_);
+	thread_->join(&r);
+	delete thread_;
+	close(fd_);
+
+	for (unsigned int i = 0; i < index_.size(); i++) {
+		while (index_[i]) {
+			entry = index_[i];
+			index_[i] = entry->index_next;
+			if (entry->owner)
+				entry->owner->entries_ = 0;
+			delete entry->task;
+			delete entry;
+		}
+	}
+
+	while (free_entries_) {
+		entry = free_entries_;
+		free_entries_ = entry->next;
+		delete entry;
+	}
 }
+
+TimerEntry * TaskScheduler::new_entry() {
+	TimerEntry * entry = free_entries_;
+
+	if (entry)
+		free_entries_ = entry->next;
+	else
+		entry = new TimerEntry();
+
+	return entry;
+}
+
+void TaskScheduler::free_entry(TimerEntry * entry) {
+	entry->next = free_entries_;
+	free_entries_ = entry;
+}
+
+void TaskScheduler::index_add(TimerEntry * entry) {
+	unsigned int bucket;
+
+	if (size_ >= index_.size()) {
+		std::vector<TimerEntry*> old_index(index_.size() * 2,
+						   (TimerEntry *) 0);
+		TimerEntry * e;
+
+		old_index.swap(index_);
+		for (unsigned int i = 0; i < old_index.size(); i++) {
+			while (old_index[i]) {
+				e = old_index[i];
+				old_index[i] = e->index_next;
+				bucket = task_hash(e->task, index_.size());
+				e->index_next = index_[bucket];
+				index_[bucket] = e;
+			}
+		}
+	}
+
+	bucket = task_hash(entry->task, index_.size());
+	entry->index_next = index_[bucket];
+	index_[bucket] = entry;
+}
+
+void TaskScheduler::index_remove(TimerEntry * entry) {
+	TimerEntry ** e = &index_[task_hash(entry->task, index_.size())];
+
+	while (*e != entry)
+		e = &(*e)->index_next;
+	*e = entry->index_next;
+}
+
+void TaskScheduler::place(TimerEntry * entry) {
+	uint64_t delta = entry->expires > now_ ? entry->expires - now_ : 0;
+	int level = 0;
+	int shift = 0;
+
+	while (level < NUM_LEVELS - 1 &&
+			delta >= ((uint64_t) LEVEL_SIZE << shift)) {
+		level++;
+		shift += LEVEL_BITS;
+	}
+
+	if (delta >= ((uint64_t) LEVEL_SIZE << shift)) {
+		// Beyond the wheel, park it in the last slot to be cascaded
+		entry->slot = ((now_ >> shift) + LEVEL_SIZE - 1) &
+				(LEVEL_SIZE - 1);
+	} else {
+		entry->slot = (entry->expires >> shift) & (LEVEL_SIZE - 1);
+	}
+
+	entry->level = level;
+	entry->prev = 0;
+	entry->next = slots_[level][entry->slot];
+	if (entry->next)
+		entry->next->prev = entry;
+	slots_[level][entry->slot] = entry;
+	occupied_[level] |= (uint64_t) 1 << entry->slot;
+}
+
+void TaskScheduler::unlink(TimerEntry * entry) {
+	if (entry->prev)
+		entry->prev->next = entry->next;
+	else
+		slots_[entry->level][entry->slot] = entry->next;
+	if (entry->next)
+		entry->next->prev = entry->prev;
+
+	if (!slots_[entry->level][entry->slot])
+		occupied_[entry->level] &= ~((uint64_t) 1 << entry->slot);
+}
+
+void TaskScheduler::cascade(int level, int slot) {
+	TimerEntry * entry = slots_[level][slot];
+	TimerEntry * next;
+
+	slots_[level][slot] = 0;
+	occupied_[level] &= ~((uint64_t) 1 << slot);
+	while (entry) {
+		next = entry->next;
+		place(entry);
+		entry = next;
+	}
+}
+
+uint64_t TaskScheduler::next_expiry() const {
+	uint64_t result = NEVER;
+	uint64_t base, later, expiry;
+	int shift, current;
+
+	for (int level = 0; level < NUM_LEVELS; level++) {
+		if (!occupied_[level])
+			continue;
+
+		// Slots after the current one are processed in this turn of
+		// the level, the others in the next one
+		shift = level * LEVEL_BITS;
+		current = (now_ >> shift) & (LEVEL_SIZE - 1);
+		base = (now_ >> (shift + LEVEL_BITS)) << (shift + LEVEL_BITS);
+		later = current == LEVEL_SIZE - 1 ? 0 :
+			occupied_[level] & (~(uint64_t) 0 << (current + 1));
+		if (later) {
+			expiry = base + ((uint64_t) __builtin_ctzll(later) << shift);
+		} else {
+			expiry = base + ((uint64_t) LEVEL_SIZE << shift) +
+				((uint64_t) __builtin_ctzll(occupied_[level]) << shift);
+		}
+
+		if (expiry < result)
+			result = expiry;
+	}
+
+	return result;
+}
+
+void TaskScheduler::arm(uint64_t expiry) {
+	struct itimerspec its;
+	uint64_t abs_ms;
+
+	armed_ = expiry;
+	its.it_interval.tv_sec = 0;
+	its.it_interval.tv_nsec = 0;
+	if (expiry == NEVER) {
+		its.it_value.tv_sec = 0;
+		its.it_value.tv_nsec = 0;
+	} else {
+		// An absolute time in the past fires right away; a zero
+		// it_value would disarm the timer instead
+		abs_ms = start_ + expiry;
+		its.it_value.tv_sec = abs_ms / 1000;
+		its.it_value.tv_nsec = (abs_ms % 1000) * 1000000 + 1;
+	}
+
+	if (timerfd_settime(fd_, TFD_TIMER_ABSTIME, &its, 0) < 0)
+		LOG_ERR("Problems arming timerfd: %s", strerror(errno));
+}
+
+void TaskScheduler::remove(TimerEntry * entry, bool delete_task) {
+	unlink(entry);
+	index_remove(entry);
+	if (entry->owner) {
+		if (entry->owner_prev)
+			entry->owner_prev->owner_next = entry->owner_next;
+		else
+			entry->owner->entries_ = entry->owner_next;
+		if (entry->owner_next)
+			entry->owner_next->owner_prev = entry->owner_prev;
+	}
+	size_--;
+
+	if (delete_task)
+		delete entry->task;
+	free_entry(entry);
+}
+
 void TaskScheduler::insert(Time time, TimerTask* timer_task) {
+	Time now;
+	long delay_ms;
+
+	delay_ms = (time.time_.tv_sec - now.time_.tv_sec) * 1000 +
+		(time.time_.tv_usec - now.time_.tv_usec) / 1000;
+	insert(delay_ms, timer_task, 0);
+}
+
+void TaskScheduler::insert(long delay_ms, TimerTask* timer_task,
+			   Timer * owner) {
+	TimerEntry * entry;
+
+	if (delay_ms < 0)
+		delay_ms = 0;
+
 	lock();
 
-	std::map<Time, std::list<TimerTask*>* >::iterator iter = tasks_.find(time);
-	if (iter != tasks_.end()) {
-		iter->second->push_back(timer_task);
-	} else {
-		std::list<TimerTask*> *list = new std::list<TimerTask*>;
-		list->push_back(timer_task);
-		std::pair<Time, std::list<TimerTask*>* > pair(time, list);
-		tasks_.insert(pair);
+	entry = new_entry();
+	entry->task = timer_task;
+	entry->owner = owner;
+	// Round up, the current millisecond has already started
+	entry->expires = monotonic_ms() - start_ + delay_ms + 1;
+	if (entry->expires <= now_)
+		entry->expires = now_ + 1;
+	place(entry);
+	index_add(entry);
+	entry->owner_prev = 0;
+	entry->owner_next = 0;
+	if (owner) {
+		entry->owner_next = owner->entries_;
+		if (entry->owner_next)
+			entry->owner_next->owner_prev = entry;
+		owner->entries_ = entry;
 	}
+	size_++;
+
+	if (entry->expires < armed_)
+		arm(entry->expires);
 
 	unlock();
 }
 
-void TaskScheduler::runTasks() {
-	std::stringstream ss;
+void TaskScheduler::advance() {
+	uint64_t target = monotonic_ms() - start_;
+	uint64_t next;
+	TimerEntry * entry;
+	int slot;
 
-	lock();
-	Time now;
-	std::map<Time, std::list<TimerTask*>* >::iterator first = tasks_.begin();
-	std::map<Time, std::list<TimerTask*>* >::iterator last = tasks_.upper_bound(
-			now);
-	for (std::map<Time, std::list<TimerTask*>* >::iterator iter_map = first;
-			iter_map != last; ++iter_map) {
-		for (std::list<TimerTask*>::iterator iter_list = iter_map->second->begin();
-				iter_list != iter_map->second->end(); ++iter_list){
+	while ((next = next_expiry()) <= target) {
+		now_ = next;
+
+		// Bring down the entries of the higher levels that are due
+		for (int level = 1; level < NUM_LEVELS; level++) {
+			if (now_ & (((uint64_t) 1 << (level * LEVEL_BITS)) - 1))
+				break;
+			cascade(level, (now_ >> (level * LEVEL_BITS)) &
+					(LEVEL_SIZE - 1));
+		}
+
+		slot = now_ & (LEVEL_SIZE - 1);
+		while ((entry = slots_[0][slot])) {
+			TimerTask * task = entry->task;
+
+			remove(entry, false);
 			try {
 				Thread *t = new Thread(&doWorkTask,
-						       (void *) (*iter_list),
-						       ss.str(), true);
+						       (void *) task,
+						       std::string(), true);
 				t->start();
 				delete t;
 				t = 0;
@@ -126,106 +439,95 @@ void TaskScheduler::runTasks() {
 				LOG_ERR("Problems creating thread: %s", e.what());
 			}
 		}
-		delete iter_map->second;
 	}
-	tasks_.erase(first, last);
+
+	if (now_ < target)
+		now_ = target;
+}
+
+void TaskScheduler::runTasks() {
+	lock();
+	advance();
+	arm(next_expiry());
+	unlock();
+}
+
+bool TaskScheduler::execute_tasks() {
+	uint64_t expirations;
+	bool result;
+
+	if (read(fd_, &expirations, sizeof(expirations)) < 0 &&
+			errno != EINTR && errno != EAGAIN)
+		LOG_ERR("Problems reading timerfd: %s", strerror(errno));
+
+	lock();
+	result = continue_;
+	if (result) {
+		advance();
+		arm(next_expiry());
+	}
 	unlock();
+
+	return result;
 }
 
 void TaskScheduler::cancelTask(TimerTask *task) {
+	TimerEntry * entry;
+	TimerEntry * next;
+	bool deleted = false;
+
 	lock();
-	std::map<Time, std::list<TimerTask*>* >::iterator iter_map =
-	            tasks_.begin();
-	while(iter_map != tasks_.end()) {
-	    std::list<TimerTask*>::iterator iter_list = iter_map->second->begin();
-		while(iter_list != iter_map->second->end()){
-			if (*iter_list == task){
-				delete *iter_list;
-				iter_map->second->erase(iter_list++);
-			}
-			else
-			{
-			    ++iter_list;
-			}
-		}
-		if (iter_map->second->size() == 0){
-			delete iter_map->second;
-			tasks_.erase(iter_map++);
+	entry = index_[task_hash(task, index_.size())];
+	while (entry) {
+		next = entry->index_next;
+		if (entry->task == task) {
+			remove(entry, !deleted);
+			deleted = true;
 		}
-		else
-		    ++iter_map;
+		entry = next;
 	}
-unlock();
+	unlock();
 }
 
-// CLASS Timer
-void* doWorkTimer(void *arg) {
-	Timer *timer = (Timer*) arg;
-	Sleep sleep;
-	while (timer->execute_tasks()) {
-                sleep.sleepForMili(100);
-	}
-	return (void *) 0;
+void TaskScheduler::cancelTasks(Timer * owner) {
+	lock();
+	while (owner->entries_)
+		remove(owner->entries_, true);
+	unlock();
 }
 
+unsigned int TaskScheduler::size() {
+	unsigned int result;
+
+	lock();
+	result = size_;
+	unlock();
+
+	return result;
+}
+
+// CLASS Timer
 Timer::Timer() {
-	continue_lock_.lock();
-	continue_ = true;
-	continue_lock_.unlock();
-	task_scheduler = new TaskScheduler();
-	thread_ = new Thread(&doWorkTimer, (void *) this,
-			     std::string("Timer"), false);
-	thread_->start();
-	LOG_DBG("Timer with ID %d started", thread_);
+	task_scheduler = TaskScheduler::get_shared_scheduler();
+	entries_ = 0;
 }
-Timer::~Timer() {
-	cancel();
 
-	if (task_scheduler) {
-		delete task_scheduler;
-		task_scheduler = 0;
-	}
+Timer::Timer(TaskScheduler * scheduler) {
+	task_scheduler = scheduler;
+	entries_ = 0;
+}
 
-	if (thread_) {
-		delete thread_;
-		thread_ = 0;
-	}
+Timer::~Timer() {
+	task_scheduler->cancelTasks(this);
 }
 
 void Timer::scheduleTask(TimerTask* task, long delay_ms) {
-	Time executeTime;
-	timeval t;
-	int milisecondsNotNorm = executeTime.get_only_milliseconds() + (delay_ms % 1000);
-	int miliseconds = milisecondsNotNorm % 1000;
-	int seconds = executeTime.get_time_seconds() + (delay_ms / 1000) + (milisecondsNotNorm / 1000);
-	t.tv_sec = seconds;
-	t.tv_usec = miliseconds * 1000;
-	executeTime.set_timeval(t);
-	task_scheduler->insert(executeTime, task);
+	task_scheduler->insert(delay_ms, task, this);
 }
 void Timer::cancelTask(TimerTask* task) {
 	task_scheduler->cancelTask(task);
 }
-void Timer::cancel() {
-	continue_lock_.lock();
-	continue_ = false;
-	continue_lock_.unlock();
-	void *r;
-	LOG_DBG("Waiting for the timer %d to join", thread_);
-	thread_->join(&r);
-	LOG_DBG("Timer with ID %d ended", thread_);
-}
 TaskScheduler* Timer::get_task_scheduler() const {
 	return task_scheduler;
 }
-bool Timer::execute_tasks() {
-	continue_lock_.lock();
-        bool result = continue_;
-	if (result)
-	{
-	        get_task_scheduler()->runTasks();
-	}
-	continue_lock_.unlock();
-	return result;
-}
 }
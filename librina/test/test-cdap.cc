@@ -0,0 +1,415 @@
+//
+// Test CDAP codec
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+// MA  02110-1301  USA
+//
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <list>
+#include <new>
+#include <string>
+#include <vector>
+#include <sys/time.h>
+
+#include "librina/cdap_v2.h"
+#include "CDAP.pb.h"
+
+using namespace rina;
+using namespace rina::cdap;
+
+#define NUM_ITERATIONS 100000
+#define NUM_MESSAGES 4
+#define NUM_IN_FLIGHT 10000
+
+// Allocation counter, to report allocations per message
+static unsigned long allocations = 0;
+
+void* operator new(size_t size)
+{
+	void* p = malloc(size ? size : 1);
+
+	if (!p)
+		throw std::bad_alloc();
+	allocations++;
+	return p;
+}
+
+void operator delete(void* p)
+{
+	free(p);
+}
+
+// Drops the messages; the test drives the session manager directly
+class TestIOHandler : public CDAPIOHandler {
+public:
+	void process_message(ser_obj_t &message, unsigned int port,
+			     cdap_rib::cdap_dest_t cdap_dest) {};
+	void send(const cdap_m_t & m_sent,
+		  const cdap_rib::con_handle_t &con) {};
+};
+
+static double elapsed_ms(const struct timeval& start)
+{
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+	return (now.tv_sec - start.tv_sec) * 1000.0 +
+	       (now.tv_usec - start.tv_usec) / 1000.0;
+}
+
+static void set_value(ser_obj_t& value, int size)
+{
+	value.message_ = new unsigned char[size];
+	value.size_ = size;
+	for (int i = 0; i < size; ++i)
+		value.message_[i] = i;
+}
+
+static void set_names(cdap_m_t& msg)
+{
+	msg.src_ap_name_ = "ipcp-a.DIF";
+	msg.src_ap_inst_ = "1";
+	msg.src_ae_name_ = "Management";
+	msg.dest_ap_name_ = "ipcp-b.DIF";
+	msg.dest_ap_inst_ = "1";
+	msg.dest_ae_name_ = "Management";
+}
+
+// Typical management traffic: read, write and create requests, and a
+// connect request with authentication information
+static void build_messages(cdap_m_t* msgs)
+{
+	msgs[0].op_code_ = cdap_m_t::M_READ;
+	msgs[0].invoke_id_ = 12;
+	msgs[0].obj_class_ = "FlowStateObjectGroup";
+	msgs[0].obj_name_ = "/ra/fsos";
+	msgs[0].scope_ = 1;
+
+	msgs[1].op_code_ = cdap_m_t::M_WRITE;
+	msgs[1].obj_class_ = "FlowStateObjectGroup";
+	msgs[1].obj_name_ = "/ra/fsos";
+	msgs[1].flags_ = cdap_rib::flags_t::F_SYNC;
+	set_value(msgs[1].obj_value_, 512);
+
+	msgs[2].op_code_ = cdap_m_t::M_CREATE;
+	msgs[2].invoke_id_ = 1234;
+	msgs[2].obj_class_ = "Flow";
+	msgs[2].obj_name_ = "/fa/flows/key=1-100";
+	msgs[2].obj_inst_ = -1;
+	set_value(msgs[2].obj_value_, 96);
+
+	msgs[3].op_code_ = cdap_m_t::M_CONNECT;
+	msgs[3].abs_syntax_ = 0x0073;
+	msgs[3].invoke_id_ = 1;
+	msgs[3].version_ = 1;
+	msgs[3].filter_ = (char*) "filter";
+	msgs[3].auth_policy_.name = "PSOC_authentication-ssh2";
+	msgs[3].auth_policy_.versions.push_back("1");
+	msgs[3].auth_policy_.versions.push_back("2");
+	set_value(msgs[3].auth_policy_.options, 32);
+
+	for (int i = 0; i < NUM_MESSAGES; ++i)
+		set_names(msgs[i]);
+}
+
+static bool same_value(const ser_obj_t& a, const ser_obj_t& b)
+{
+	return a.size_ == b.size_ &&
+	       (a.size_ == 0 || memcmp(a.message_, b.message_, a.size_) == 0);
+}
+
+static bool same_message(const cdap_m_t& a, const cdap_m_t& b)
+{
+	return a.op_code_ == b.op_code_ && a.abs_syntax_ == b.abs_syntax_ &&
+	       a.invoke_id_ == b.invoke_id_ && a.flags_ == b.flags_ &&
+	       a.obj_class_ == b.obj_class_ && a.obj_name_ == b.obj_name_ &&
+	       a.obj_inst_ == b.obj_inst_ && a.result_ == b.result_ &&
+	       a.scope_ == b.scope_ && a.version_ == b.version_ &&
+	       a.result_reason_ == b.result_reason_ &&
+	       a.src_ap_name_ == b.src_ap_name_ &&
+	       a.src_ap_inst_ == b.src_ap_inst_ &&
+	       a.src_ae_name_ == b.src_ae_name_ &&
+	       a.dest_ap_name_ == b.dest_ap_name_ &&
+	       a.dest_ap_inst_ == b.dest_ap_inst_ &&
+	       a.dest_ae_name_ == b.dest_ae_name_ &&
+	       (a.filter_ == 0) == (b.filter_ == 0) &&
+	       (a.filter_ == 0 || strcmp(a.filter_, b.filter_) == 0) &&
+	       a.auth_policy_.name == b.auth_policy_.name &&
+	       a.auth_policy_.versions == b.auth_policy_.versions &&
+	       same_value(a.auth_policy_.options, b.auth_policy_.options) &&
+	       same_value(a.obj_value_, b.obj_value_);
+}
+
+int main()
+{
+	bool result = true;
+	cdap_rib::concrete_syntax_t syntax;
+	CDAPMessageEncoder encoder(syntax);
+	cdap_m_t msgs[NUM_MESSAGES];
+	unsigned long start_allocations;
+	struct timeval start;
+	double ms;
+
+	build_messages(msgs);
+
+	std::cout<<std::endl <<	"////////////////////////////////////////////" << std::endl <<
+				"//// test-cdap TEST 1 : wire compatibility //" << std::endl <<
+				"////////////////////////////////////////////" << std::endl;
+	for (int i = 0; i < NUM_MESSAGES; ++i) {
+		ser_obj_t encoded;
+		messages::CDAPMessage gpb;
+		std::string reencoded;
+		cdap_m_t decoded;
+
+		//The encoding must be the one of the generated serializer
+		encoder.encode(msgs[i], encoded);
+		if (!gpb.ParseFromArray(encoded.message_, encoded.size_) ||
+				!gpb.SerializeToString(&reencoded) ||
+				reencoded.size() != (size_t) encoded.size_ ||
+				memcmp(reencoded.data(), encoded.message_,
+				       encoded.size_) != 0) {
+			std::cout << "TEST 1 FAILED: encoding of "
+				  << "message " << i
+				  << " differs from the GPB one" << std::endl;
+			result = false;
+		}
+
+		encoder.decode(encoded, decoded);
+		if (!same_message(msgs[i], decoded)) {
+			std::cout << "TEST 1 FAILED: decoding of "
+				  << "message " << i
+				  << " does not match" << std::endl;
+			result = false;
+		}
+		delete[] decoded.filter_;
+	}
+
+	std::cout<<std::endl <<	"////////////////////////////////////////////" << std::endl <<
+				"//// test-cdap TEST 2 : malformed messages ///" << std::endl <<
+				"////////////////////////////////////////////" << std::endl;
+	/* scope */ {
+		ser_obj_t encoded;
+		cdap_m_t decoded;
+		bool thrown = false;
+
+		encoder.encode(msgs[1], encoded);
+		encoded.size_ -= 10;
+		try {
+			encoder.decode(encoded, decoded);
+		} catch (CDAPException &e) {
+			thrown = true;
+		}
+		if (!thrown) {
+			std::cout << "TEST 2 FAILED: truncated message decoded"
+				  << std::endl;
+			result = false;
+		}
+	}
+
+	std::cout<<std::endl <<	"////////////////////////////////////////////" << std::endl <<
+				"//// test-cdap TEST 3 : codec benchmark /////" << std::endl <<
+				"////////////////////////////////////////////" << std::endl;
+	/* scope */ {
+		ser_obj_t encoded[NUM_MESSAGES];
+
+		for (int i = 0; i < NUM_MESSAGES; ++i)
+			encoder.encode(msgs[i], encoded[i]);
+
+		start_allocations = allocations;
+		gettimeofday(&start, NULL);
+		for (int n = 0; n < NUM_ITERATIONS; ++n) {
+			ser_obj_t tmp;
+
+			encoder.encode(msgs[n % NUM_MESSAGES], tmp);
+		}
+		ms = elapsed_ms(start);
+		std::cout << "Encode: " << (long) (NUM_ITERATIONS / ms * 1000)
+			  << " messages/s, "
+			  << (double) (allocations - start_allocations) /
+			     NUM_ITERATIONS
+			  << " allocations/message" << std::endl;
+
+		start_allocations = allocations;
+		gettimeofday(&start, NULL);
+		for (int n = 0; n < NUM_ITERATIONS; ++n) {
+			cdap_m_t tmp;
+
+			encoder.decode(encoded[n % NUM_MESSAGES], tmp);
+			delete[] tmp.filter_;
+		}
+		ms = elapsed_ms(start);
+		std::cout << "Decode: " << (long) (NUM_ITERATIONS / ms * 1000)
+			  << " messages/s, "
+			  << (double) (allocations - start_allocations) /
+			     NUM_ITERATIONS
+			  << " allocations/message" << std::endl;
+	}
+
+	std::cout<<std::endl <<	"////////////////////////////////////////////" << std::endl <<
+				"//// test-cdap TEST 4 : in-flight requests //" << std::endl <<
+				"////////////////////////////////////////////" << std::endl;
+	/* scope */ {
+		TestIOHandler * io_handler = new TestIOHandler();
+		CDAPSessionManagerInterface * manager;
+		cdap_rib::con_handle_t client, server;
+		cdap_rib::filt_info_t filt;
+		cdap_rib::flags_t flags;
+		cdap_rib::obj_info_t obj;
+		cdap_rib::res_info_t res;
+		cdap_m_t msg, rcv;
+		ser_obj_t ser;
+
+		cdap::init(NULL, syntax, true);
+		cdap::set_cdap_io_handler(io_handler);
+		manager = io_handler->manager_;
+
+		//Connect port 1 (client) to port 2 (server)
+		client.port_id = 1;
+		client.src_.ap_name_ = "client";
+		client.src_.ae_name_ = "Management";
+		client.dest_.ap_name_ = "server";
+		client.dest_.ae_name_ = "Management";
+		server.port_id = 2;
+		manager->getOpenConnectionRequestMessage(msg, client);
+		manager->encodeNextMessageToBeSent(msg, ser, 1);
+		manager->messageSent(msg, 1);
+		manager->messageReceived(ser, rcv, 2);
+		/* scope */ {
+			cdap_m_t resp, resp_rcv;
+			ser_obj_t resp_ser;
+
+			manager->getOpenConnectionResponseMessage(resp, server,
+								  res,
+								  rcv.invoke_id_);
+			manager->encodeNextMessageToBeSent(resp, resp_ser, 2);
+			manager->messageSent(resp, 2);
+			manager->messageReceived(resp_ser, resp_rcv, 1);
+		}
+
+		//Keep NUM_IN_FLIGHT reads outstanding, then answer them all
+		obj.class_ = "FlowStateObjectGroup";
+		obj.name_ = "/ra/fsos";
+		gettimeofday(&start, NULL);
+		for (int round = 0; round < 2; ++round) {
+			std::vector<int> ids;
+
+			for (int i = 0; i < NUM_IN_FLIGHT; ++i) {
+				cdap_m_t req, req_rcv;
+				ser_obj_t req_ser;
+
+				manager->getReadObjectRequestMessage(req, filt,
+								     flags, obj,
+								     true);
+				manager->encodeNextMessageToBeSent(req, req_ser, 1);
+				manager->messageSent(req, 1);
+				manager->messageReceived(req_ser, req_rcv, 2);
+				ids.push_back(req_rcv.invoke_id_);
+			}
+
+			//Invoke ids are kept short: 1..NUM_IN_FLIGHT each round
+			for (int i = 0; i < NUM_IN_FLIGHT; ++i)
+				if (ids[i] != i + 1) {
+					std::cout << "TEST 4 FAILED: invoke id "
+						  << ids[i] << " at " << i
+						  << std::endl;
+					result = false;
+					break;
+				}
+
+			for (int i = NUM_IN_FLIGHT - 1; i >= 0; --i) {
+				cdap_m_t resp, resp_rcv;
+				ser_obj_t resp_ser;
+
+				manager->getReadObjectResponseMessage(resp, flags,
+								      obj, res,
+								      ids[i]);
+				manager->encodeNextMessageToBeSent(resp, resp_ser, 2);
+				manager->messageSent(resp, 2);
+				manager->messageReceived(resp_ser, resp_rcv, 1);
+			}
+		}
+		std::cout << 2 * NUM_IN_FLIGHT << " requests and responses in "
+			  << elapsed_ms(start) << " ms" << std::endl;
+
+		cdap::fini();
+	}
+
+	std::cout<<std::endl <<	"////////////////////////////////////////////" << std::endl <<
+				"//// test-cdap TEST 5 : batches /////////////" << std::endl <<
+				"////////////////////////////////////////////" << std::endl;
+	/* scope */ {
+		CDAPBatchEncoder batch_encoder;
+		std::list<ser_obj_t*> parts, split;
+		std::list<ser_obj_t*>::iterator it, jt;
+		ser_obj_t batch;
+
+		for (int i = 0; i < NUM_MESSAGES; ++i) {
+			parts.push_back(new ser_obj_t());
+			encoder.encode(msgs[i], *parts.back());
+			if (batch_encoder.is_batch(*parts.back())) {
+				std::cout << "TEST 5 FAILED: message taken "
+					  << "for a batch" << std::endl;
+				result = false;
+			}
+		}
+
+		batch_encoder.encode(parts, batch);
+		if (!batch_encoder.is_batch(batch)) {
+			std::cout << "TEST 5 FAILED: batch not detected"
+				  << std::endl;
+			result = false;
+		}
+
+		int size = 0;
+		for (it = parts.begin(); it != parts.end(); ++it)
+			size += CDAPBatchEncoder::batched_size((*it)->size_);
+		if (size != batch.size_) {
+			std::cout << "TEST 5 FAILED: batch of " << batch.size_
+				  << " bytes, expected " << size << std::endl;
+			result = false;
+		}
+
+		batch_encoder.decode(batch, split);
+		if (split.size() != parts.size()) {
+			std::cout << "TEST 5 FAILED: " << split.size()
+				  << " messages in the batch" << std::endl;
+			result = false;
+		}
+		for (it = parts.begin(), jt = split.begin();
+				it != parts.end() && jt != split.end(); ++it, ++jt)
+			if (!same_value(**it, **jt)) {
+				std::cout << "TEST 5 FAILED: messages differ"
+					  << std::endl;
+				result = false;
+			}
+
+		for (it = parts.begin(); it != parts.end(); ++it)
+			delete *it;
+		for (it = split.begin(); it != split.end(); ++it)
+			delete *it;
+	}
+
+	if (result) {
+		std::cout<<std::endl <<	"//////////////////////////////////////" << std::endl <<
+					"////////// CDAP TESTS PASSED /////////" << std::endl <<
+					"//////////////////////////////////////" << std::endl;
+		return 0;
+	}
+	else
+		return -1;
+}
@@ -1144,6 +1144,7 @@ int test_irati_kmsg_rmt_dump_ft(irati_msg_t msg_t)
 	struct mod_pff_entry * modata, * pos;
 	struct port_id_altlist * podata;
 	int num_entries = 0, num_entries2 = 0;
+	int wildcards = 0, wildcards2 = 0;
 
 	std::cout << "TESTING KMSG RMT DUMP FT (" << msg_t << ")" << std::endl;
 
@@ -1167,6 +1168,7 @@ int test_irati_kmsg_rmt_dump_ft(irati_msg_t msg_t)
 	modata->cost = 123;
 	modata->fwd_info = 54;
 	modata->qos_id = 2;
+	modata->wildcard_bits = 8;
 	podata = port_id_altlist_create();
 	podata->num_ports = 2;
 	podata->ports = (port_id_t *) malloc(sizeof(port_id_t) * podata->num_ports);
@@ -1207,10 +1209,12 @@ int test_irati_kmsg_rmt_dump_ft(irati_msg_t msg_t)
 
         list_for_each_entry(pos, &(msg->pft_entries->pff_entries), next) {
                 num_entries ++;
+                wildcards += pos->wildcard_bits;
         }
 
         list_for_each_entry(pos, &(resp->pft_entries->pff_entries), next) {
                 num_entries2 ++;
+                wildcards2 += pos->wildcard_bits;
         }
 
 	if (msg->result != resp->result) {
@@ -1225,6 +1229,10 @@ int test_irati_kmsg_rmt_dump_ft(irati_msg_t msg_t)
 		std::cout << "Number of entries on original and recovered "
 				<< "messages are different\n";
 		ret = -1;
+	} else if (wildcards != wildcards2) {
+		std::cout << "Wildcard bits on original and recovered "
+				<< "messages are different\n";
+		ret = -1;
 	} else {
 		std::cout << "Test ok!" << std::endl;
 		ret = 0;
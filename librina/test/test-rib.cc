@@ -0,0 +1,159 @@
+//
+// Test RIB
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+// MA  02110-1301  USA
+//
+
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include <sys/time.h>
+
+#define RINA_PREFIX "test-rib"
+
+#include "librina/logs.h"
+#include "librina/rib_v2.h"
+
+using namespace rina;
+
+#define NUM_PARENTS 100
+#define NUM_OBJECTS 100000
+
+class TestObj : public rib::RIBObj {
+public:
+	TestObj() : rib::RIBObj("TestObj") {};
+};
+
+static double elapsed_ms(const struct timeval& start)
+{
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+	return (now.tv_sec - start.tv_sec) * 1000.0 +
+	       (now.tv_usec - start.tv_usec) / 1000.0;
+}
+
+static std::string parent_fqn(int i)
+{
+	std::stringstream ss;
+	ss << "/test/p" << i;
+	return ss.str();
+}
+
+static std::string object_fqn(int i)
+{
+	std::stringstream ss;
+	ss << parent_fqn(i % NUM_PARENTS) << "/o" << i;
+	return ss.str();
+}
+
+int main()
+{
+	bool result = true;
+	cdap_rib::cdap_params params;
+	cdap_rib::vers_info_t vers;
+	rib::RIBDaemonProxy * ribd;
+	rib::rib_handle_t rib;
+	std::vector<int64_t> ids;
+	struct timeval start;
+	TestObj * obj;
+
+	std::cout<<std::endl <<	"//////////////////////////////////////////" << std::endl <<
+				"//// test-rib TEST 1 : add 100k objects ///" << std::endl <<
+				"//////////////////////////////////////////" << std::endl;
+	// The RIB logs every add and remove at DBG, keep the output short
+	setLogLevel("INFO");
+
+	params.ipcp = false;
+	vers.version_ = 1;
+	rib::init(NULL, params);
+	ribd = rib::RIBDaemonProxyFactory();
+	ribd->createSchema(vers);
+	rib = ribd->createRIB(vers);
+
+	obj = new TestObj();
+	ribd->addObjRIB(rib, "/test", &obj);
+	for (int i = 0; i < NUM_PARENTS; ++i) {
+		obj = new TestObj();
+		ribd->addObjRIB(rib, parent_fqn(i), &obj);
+	}
+
+	gettimeofday(&start, NULL);
+	for (int i = 0; i < NUM_OBJECTS; ++i) {
+		obj = new TestObj();
+		ids.push_back(ribd->addObjRIB(rib, object_fqn(i), &obj));
+	}
+	std::cout << "Added " << NUM_OBJECTS << " objects in "
+		  << elapsed_ms(start) << " ms" << std::endl;
+
+	std::cout<<std::endl <<	"//////////////////////////////////////////" << std::endl <<
+				"//// test-rib TEST 2 : lookups ////////////" << std::endl <<
+				"//////////////////////////////////////////" << std::endl;
+	gettimeofday(&start, NULL);
+	for (int i = 0; i < NUM_OBJECTS; ++i) {
+		std::string fqn = object_fqn(i);
+
+		if (ribd->getObjInstId(rib, fqn) != ids[i] ||
+				ribd->getObjFqn(rib, ids[i]) != fqn ||
+				ribd->getObjParentFqn(rib, fqn) !=
+					parent_fqn(i % NUM_PARENTS)) {
+			std::cout << "Lookup of " << fqn << " failed"
+				  << std::endl;
+			result = false;
+			break;
+		}
+	}
+	std::cout << "Looked up " << NUM_OBJECTS << " objects in "
+		  << elapsed_ms(start) << " ms" << std::endl;
+
+	if (ribd->get_rib_objects_data(rib, "",
+				parent_fqn(0) + "/").size() !=
+					NUM_OBJECTS / NUM_PARENTS) {
+		std::cout << "TEST 2 FAILED: wrong subtree size" << std::endl;
+		result = false;
+	}
+
+	std::cout<<std::endl <<	"//////////////////////////////////////////" << std::endl <<
+				"//// test-rib TEST 3 : removals ///////////" << std::endl <<
+				"//////////////////////////////////////////" << std::endl;
+	gettimeofday(&start, NULL);
+	for (int i = 0; i < NUM_OBJECTS; i += 2)
+		ribd->removeObjRIB(rib, ids[i]);
+	for (int i = 0; i < NUM_PARENTS; ++i)
+		ribd->removeObjRIB(rib, parent_fqn(i), true);
+	std::cout << "Removed " << NUM_OBJECTS << " objects in "
+		  << elapsed_ms(start) << " ms" << std::endl;
+
+	if (ribd->containsObj(rib, object_fqn(1)) ||
+			!ribd->containsObj(rib, "/test") ||
+			ribd->get_rib_objects_data(rib).size() != 2) {
+		std::cout << "TEST 3 FAILED: objects left behind" << std::endl;
+		result = false;
+	}
+
+	ribd->destroyRIB(rib);
+	delete ribd;
+	rib::fini();
+
+	if (result) {
+		std::cout<<std::endl <<	"//////////////////////////////////////" << std::endl <<
+					"////////// RIB TESTS PASSED //////////" << std::endl <<
+					"//////////////////////////////////////" << std::endl;
+		return 0;
+	}
+	else
+		return -1;
+}
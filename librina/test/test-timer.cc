@@ -21,6 +21,7 @@
 //
 
 #include <iostream>
+#include <vector>
 
 #include "librina/timer.h"
 
@@ -58,6 +59,38 @@ public:
 	bool check_;
 };
 
+#define NUM_TASKS 100000
+#define NUM_TIMED_TASKS 200
+
+/// Records when it ran, the test keeps the record after the task is deleted
+class RecordTimerTask: public TimerTask {
+public:
+	RecordTimerTask(Lockable * lock, std::vector<int> * fired, int index) :
+		lock_(lock), fired_(fired), index_(index) {};
+	void run() {
+		ScopedLock g(*lock_);
+		(*fired_)[index_] = Time::get_time_in_ms();
+	};
+
+	std::string name() const {
+		return "record";
+	}
+
+private:
+	Lockable * lock_;
+	std::vector<int> * fired_;
+	int index_;
+};
+
+static double elapsed_ms(const struct timeval& start)
+{
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+	return (now.tv_sec - start.tv_sec) * 1000.0 +
+	       (now.tv_usec - start.tv_usec) / 1000.0;
+}
+
 int main()
 {
 	bool result = true;
@@ -138,6 +171,109 @@ int main()
 
 	delete timer;
 
+	std::cout<<std::endl <<	"//////////////////////////////////////////////" << std::endl <<
+							"/ test-timer TEST 5 : timers sharing a thread /" << std::endl <<
+							"//////////////////////////////////////////////" << std::endl;
+	/* scope */ {
+		Lockable lock;
+		std::vector<int> fired(2, 0);
+		Timer * first = new Timer();
+		Timer second;
+
+		first->scheduleTask(new RecordTimerTask(&lock, &fired, 0), 100);
+		second.scheduleTask(new RecordTimerTask(&lock, &fired, 1), 100);
+		if (first->get_task_scheduler() != second.get_task_scheduler()) {
+			result = false;
+			std::cout<< "TEST 5 FAILED: timers not sharing a thread"
+				 << std::endl;
+		}
+
+		// Destroying a timer cancels its tasks only
+		delete first;
+		sleep.sleepForMili(500);
+
+		ScopedLock g(lock);
+		if (fired[0] != 0 || fired[1] == 0) {
+			result = false;
+			std::cout<< "TEST 5 FAILED"<<std::endl;
+		}
+	}
+
+	std::cout<<std::endl <<	"//////////////////////////////////////////////" << std::endl <<
+							"/ test-timer TEST 6 : schedule and cancel 100k/" << std::endl <<
+							"//////////////////////////////////////////////" << std::endl;
+	/* scope */ {
+		TaskScheduler scheduler;
+		Timer churn(&scheduler);
+		std::vector<TimerTask *> tasks;
+		Lockable lock;
+		std::vector<int> fired(NUM_TASKS, 0);
+		struct timeval start;
+
+		// From 1 second to 10 hours, beyond the span of the wheel
+		gettimeofday(&start, NULL);
+		for (int i = 0; i < NUM_TASKS; i++) {
+			tasks.push_back(new RecordTimerTask(&lock, &fired, i));
+			churn.scheduleTask(tasks.back(),
+					   1000 + (i * 7919L) % (10 * 3600 * 1000L));
+		}
+		std::cout << "Scheduled " << NUM_TASKS << " tasks in "
+			  << elapsed_ms(start) << " ms" << std::endl;
+
+		if (scheduler.size() != NUM_TASKS) {
+			result = false;
+			std::cout<< "TEST 6 FAILED: " << scheduler.size()
+				 << " tasks pending" << std::endl;
+		}
+
+		gettimeofday(&start, NULL);
+		for (int i = NUM_TASKS - 1; i >= 0; i--)
+			churn.cancelTask(tasks[i]);
+		std::cout << "Cancelled " << NUM_TASKS << " tasks in "
+			  << elapsed_ms(start) << " ms" << std::endl;
+
+		if (scheduler.size() != 0) {
+			result = false;
+			std::cout<< "TEST 6 FAILED: " << scheduler.size()
+				 << " tasks left" << std::endl;
+		}
+	}
+
+	std::cout<<std::endl <<	"//////////////////////////////////////////////" << std::endl <<
+							"/ test-timer TEST 7 : expiry across levels ////" << std::endl <<
+							"//////////////////////////////////////////////" << std::endl;
+	/* scope */ {
+		TaskScheduler scheduler;
+		Timer timed(&scheduler);
+		Lockable lock;
+		std::vector<int> fired(NUM_TIMED_TASKS, 0);
+		std::vector<int> deadline(NUM_TIMED_TASKS, 0);
+		int max_late = 0;
+
+		// Every 23 ms up to 4.6 s, crossing the 64 ms and 4096 ms levels
+		for (int i = 0; i < NUM_TIMED_TASKS; i++) {
+			deadline[i] = Time::get_time_in_ms() + i * 23;
+			timed.scheduleTask(new RecordTimerTask(&lock, &fired, i),
+					   i * 23);
+		}
+		sleep.sleepForMili(NUM_TIMED_TASKS * 23 + 500);
+
+		ScopedLock g(lock);
+		for (int i = 0; i < NUM_TIMED_TASKS; i++) {
+			if (fired[i] == 0 || fired[i] < deadline[i]) {
+				result = false;
+				std::cout<< "TEST 7 FAILED: task " << i
+					 << " fired at " << fired[i]
+					 << ", due at " << deadline[i] << std::endl;
+				break;
+			}
+			if (fired[i] - deadline[i] > max_late)
+				max_late = fired[i] - deadline[i];
+		}
+		std::cout << "Tasks fired at most " << max_late
+			  << " ms late" << std::endl;
+	}
+
 	if (result) {
 		std::cout<<std::endl <<	"//////////////////////////////////////" << std::endl <<
 								"//////////////////////////////////////" << std::endl <<
@@ -0,0 +1,78 @@
+/*
+ * Sender side congestion control policy sets for DTCP (CUBIC, BBR-like)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <linux/export.h>
+#include <linux/module.h>
+#include <linux/string.h>
+
+#define RINA_PREFIX "cc-plugin"
+#define RINA_CUBIC_PS_NAME "cubic-ps"
+#define RINA_BBR_PS_NAME   "bbr-ps"
+
+#include "logs.h"
+#include "rds/rmem.h"
+#include "dtcp-ps.h"
+
+extern struct ps_factory cubic_dtcp_factory;
+extern struct ps_factory bbr_dtcp_factory;
+
+static int __init mod_init(void)
+{
+        int ret;
+
+        strcpy(cubic_dtcp_factory.name, RINA_CUBIC_PS_NAME);
+        strcpy(bbr_dtcp_factory.name,   RINA_BBR_PS_NAME);
+
+        ret = dtcp_ps_publish(&cubic_dtcp_factory);
+        if (ret) {
+                LOG_ERR("Failed to publish CUBIC DTCP policy set factory");
+                return -1;
+        }
+
+        LOG_INFO("DTCP CUBIC policy set loaded successfully");
+
+        ret = dtcp_ps_publish(&bbr_dtcp_factory);
+        if (ret) {
+                LOG_ERR("Failed to publish BBR DTCP policy set factory");
+                dtcp_ps_unpublish(RINA_CUBIC_PS_NAME);
+                return -1;
+        }
+
+        LOG_INFO("DTCP BBR policy set loaded successfully");
+
+        return 0;
+}
+
+static void __exit mod_exit(void)
+{
+        if (dtcp_ps_unpublish(RINA_BBR_PS_NAME))
+                LOG_ERR("Failed to unpublish BBR DTCP policy set factory");
+        else
+                LOG_INFO("DTCP BBR policy set unloaded successfully");
+
+        if (dtcp_ps_unpublish(RINA_CUBIC_PS_NAME))
+                LOG_ERR("Failed to unpublish CUBIC DTCP policy set factory");
+        else
+                LOG_INFO("DTCP CUBIC policy set unloaded successfully");
+}
+
+module_init(mod_init);
+module_exit(mod_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("Sender side congestion control DTCP policy sets");
@@ -0,0 +1,46 @@
+/*
+ * Congestion control policy sets for DTCP, common helpers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef RINA_CC_H
+#define RINA_CC_H
+
+#include <linux/types.h>
+
+/* Upper bound for the congestion windows, in PDUs */
+#define CC_MAX_CWND (1U << 20)
+
+/* Integer cube root, bit by bit */
+static inline u32 cc_cbrt(u64 a)
+{
+        u64 x = 0;
+        u64 b;
+        int s;
+
+        for (s = 63; s >= 0; s -= 3) {
+                x <<= 1;
+                b = 3 * x * (x + 1) + 1;
+                if ((a >> s) >= b) {
+                        a -= b << s;
+                        x++;
+                }
+        }
+
+        return (u32) x;
+}
+
+#endif
@@ -0,0 +1,442 @@
+/*
+ * BBR-like congestion control policy set for DTCP (sender side)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <linux/export.h>
+#include <linux/module.h>
+#include <linux/string.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+
+#define RINA_PREFIX "bbr-dtcp-ps"
+
+#include "rds/rmem.h"
+#include "dtcp.h"
+#include "dtcp-ps.h"
+#include "dtp.h"
+#include "policies.h"
+#include "logs.h"
+
+#include "cc.h"
+
+/* Gains are fixed point, BBR_UNIT is 1.0 */
+#define BBR_SCALE           8
+#define BBR_UNIT            (1 << BBR_SCALE)
+/* Bandwidth is in PDUs per us, fixed point */
+#define BW_SCALE            24
+
+#define BBR_HIGH_GAIN       (BBR_UNIT * 2885 / 1000 + 1)
+#define BBR_DRAIN_GAIN      (BBR_UNIT * 1000 / 2885)
+#define BBR_CWND_GAIN       (BBR_UNIT * 2)
+#define BBR_CYCLE_LEN       8
+/* Bottleneck bandwidth filter length, in rounds */
+#define BBR_BW_ROUNDS       10
+#define BBR_MIN_RTT_WIN_MS  10000
+#define BBR_PROBE_RTT_MS    200
+#define BBR_MIN_CWND        4U
+#define BBR_INIT_CWND       10U
+/* Startup ends after 3 rounds without 25% bandwidth growth */
+#define BBR_FULL_BW_THRESH  (BBR_UNIT * 5 / 4)
+#define BBR_FULL_BW_CNT     3
+
+static const int bbr_pacing_gain[BBR_CYCLE_LEN] = {
+        BBR_UNIT * 5 / 4, BBR_UNIT * 3 / 4,
+        BBR_UNIT, BBR_UNIT, BBR_UNIT, BBR_UNIT, BBR_UNIT, BBR_UNIT
+};
+
+enum bbr_mode {
+        BBR_STARTUP,
+        BBR_DRAIN,
+        BBR_PROBE_BW,
+        BBR_PROBE_RTT
+};
+
+struct bbr_dtcp_ps_data {
+        spinlock_t    lock;
+
+        enum bbr_mode mode;
+        uint_t        cwnd;
+        uint_t        pacing_gain;
+        uint_t        cwnd_gain;
+
+        /* Max filter of the per round delivery rate */
+        u64           bw[BBR_BW_ROUNDS];
+        u64           btl_bw;
+
+        /* Min filter of the RTT */
+        uint_t        min_rtt_us;
+        ktime_t       min_rtt_stamp;
+
+        /* Round trip counting, a round ends when round_end gets acked */
+        uint_t        rounds;
+        seq_num_t     round_end;
+        ktime_t       round_start;
+        u64           round_delivered;
+        u64           delivered;
+
+        u64           full_bw;
+        uint_t        full_bw_cnt;
+        bool          full_bw_reached;
+
+        uint_t        cycle_idx;
+        ktime_t       cycle_stamp;
+
+        bool          probe_rtt_armed;
+        ktime_t       probe_rtt_done;
+        uint_t        probe_rtt_round;
+        uint_t        prior_cwnd;
+
+        /* Parameters */
+        uint_t        init_cwnd;
+};
+
+/* BDP in PDUs, scaled by @gain */
+static uint_t bbr_bdp(struct bbr_dtcp_ps_data * data, uint_t gain)
+{
+        u64 bdp;
+
+        if (!data->btl_bw || !data->min_rtt_us)
+                return data->init_cwnd;
+
+        bdp = (data->btl_bw * data->min_rtt_us) >> BW_SCALE;
+        bdp = (bdp * gain) >> BBR_SCALE;
+
+        return min_t(u64, bdp, CC_MAX_CWND);
+}
+
+/* In bytes/s, 0 until there is an RTT sample */
+static u64 bbr_pacing_rate(struct bbr_dtcp_ps_data * data, uint_t mss)
+{
+        u64 rate;
+
+        if (!data->min_rtt_us)
+                return 0;
+
+        if (!data->btl_bw) {
+                rate = div64_u64((u64) data->init_cwnd * mss * USEC_PER_SEC,
+                                 data->min_rtt_us);
+                return (rate * BBR_HIGH_GAIN) >> BBR_SCALE;
+        }
+
+        /* Keep 8 fractional bits along the way to avoid overflowing */
+        rate = (data->btl_bw * mss) >> BBR_SCALE;
+        rate = (rate * data->pacing_gain) >> BBR_SCALE;
+        rate = (rate * USEC_PER_SEC) >> (BW_SCALE - BBR_SCALE);
+
+        /* Pace slightly below the estimate to drain the queues */
+        return rate * 99 / 100;
+}
+
+static void bbr_mode_set(struct bbr_dtcp_ps_data * data,
+                         enum bbr_mode             mode,
+                         ktime_t                   now)
+{
+        data->mode = mode;
+        switch (mode) {
+        case BBR_STARTUP:
+                data->pacing_gain = BBR_HIGH_GAIN;
+                data->cwnd_gain   = BBR_HIGH_GAIN;
+                break;
+        case BBR_DRAIN:
+                data->pacing_gain = BBR_DRAIN_GAIN;
+                data->cwnd_gain   = BBR_HIGH_GAIN;
+                break;
+        case BBR_PROBE_BW:
+                /* Start the cycle anywhere but in the draining phase */
+                data->cycle_idx   = 2 + data->rounds % (BBR_CYCLE_LEN - 2);
+                data->cycle_stamp = now;
+                data->pacing_gain = bbr_pacing_gain[data->cycle_idx];
+                data->cwnd_gain   = BBR_CWND_GAIN;
+                break;
+        case BBR_PROBE_RTT:
+                data->pacing_gain = BBR_UNIT;
+                data->cwnd_gain   = BBR_UNIT;
+                break;
+        }
+}
+
+/* One delivery rate sample per round trip */
+static void bbr_round_end(struct bbr_dtcp_ps_data * data,
+                          seq_num_t                 max_sent,
+                          ktime_t                   now)
+{
+        s64 us;
+        int i;
+
+        us = ktime_us_delta(now, data->round_start);
+        if (data->rounds && us > 0)
+                data->bw[data->rounds % BBR_BW_ROUNDS] =
+                        div64_u64((data->delivered - data->round_delivered)
+                                  << BW_SCALE, us);
+
+        data->rounds++;
+        data->bw[data->rounds % BBR_BW_ROUNDS] = 0;
+        data->round_end       = max_sent;
+        data->round_start     = now;
+        data->round_delivered = data->delivered;
+
+        data->btl_bw = 0;
+        for (i = 0; i < BBR_BW_ROUNDS; i++)
+                data->btl_bw = max(data->btl_bw, data->bw[i]);
+
+        if (data->full_bw_reached || !data->btl_bw)
+                return;
+
+        if (data->btl_bw >= (data->full_bw * BBR_FULL_BW_THRESH) >> BBR_SCALE) {
+                data->full_bw     = data->btl_bw;
+                data->full_bw_cnt = 0;
+                return;
+        }
+        if (++data->full_bw_cnt >= BBR_FULL_BW_CNT)
+                data->full_bw_reached = true;
+}
+
+static void bbr_update_mode(struct bbr_dtcp_ps_data * data,
+                            uint_t                    inflight,
+                            bool                      rtt_expired,
+                            ktime_t                   now)
+{
+        switch (data->mode) {
+        case BBR_STARTUP:
+                if (data->full_bw_reached)
+                        bbr_mode_set(data, BBR_DRAIN, now);
+                break;
+        case BBR_DRAIN:
+                if (inflight <= bbr_bdp(data, BBR_UNIT))
+                        bbr_mode_set(data, BBR_PROBE_BW, now);
+                break;
+        case BBR_PROBE_BW:
+                /* Each phase of the gain cycle lasts one min_rtt */
+                if (ktime_us_delta(now, data->cycle_stamp) >
+                    data->min_rtt_us) {
+                        data->cycle_idx   = (data->cycle_idx + 1) %
+                                BBR_CYCLE_LEN;
+                        data->cycle_stamp = now;
+                        data->pacing_gain = bbr_pacing_gain[data->cycle_idx];
+                }
+                break;
+        case BBR_PROBE_RTT:
+                if (!data->probe_rtt_armed) {
+                        if (inflight > BBR_MIN_CWND)
+                                break;
+                        data->probe_rtt_armed = true;
+                        data->probe_rtt_done  =
+                                ktime_add_ms(now, BBR_PROBE_RTT_MS);
+                        data->probe_rtt_round = data->rounds;
+                        break;
+                }
+                if (ktime_after(now, data->probe_rtt_done) &&
+                    data->rounds != data->probe_rtt_round) {
+                        data->min_rtt_stamp = now;
+                        data->cwnd = max(data->cwnd, data->prior_cwnd);
+                        bbr_mode_set(data, data->full_bw_reached ?
+                                     BBR_PROBE_BW : BBR_STARTUP, now);
+                }
+                break;
+        }
+
+        if (rtt_expired && data->mode != BBR_PROBE_RTT) {
+                data->prior_cwnd      = data->cwnd;
+                data->probe_rtt_armed = false;
+                bbr_mode_set(data, BBR_PROBE_RTT, now);
+        }
+}
+
+static void bbr_update_cwnd(struct bbr_dtcp_ps_data * data, uint_t acked)
+{
+        uint_t target;
+
+        target = bbr_bdp(data, data->cwnd_gain) + 3;
+        if (data->full_bw_reached)
+                data->cwnd = min(data->cwnd + acked, target);
+        else if (data->cwnd < target ||
+                 data->delivered < data->init_cwnd)
+                data->cwnd += acked;
+
+        data->cwnd = clamp(data->cwnd, BBR_MIN_CWND, CC_MAX_CWND);
+        if (data->mode == BBR_PROBE_RTT)
+                data->cwnd = min(data->cwnd, BBR_MIN_CWND);
+}
+
+static void bbr_on_ack(struct dtcp_ps * ps,
+                       seq_num_t        seq,
+                       uint_t           acked,
+                       uint_t           rtt_us)
+{
+        struct dtcp *             dtcp = ps->dm;
+        struct bbr_dtcp_ps_data * data = ps->priv;
+        ktime_t                   now  = ktime_get();
+        seq_num_t                 max_sent;
+        uint_t                    inflight;
+        bool                      rtt_expired;
+        uint_t                    cwnd;
+        u64                       rate;
+
+        inflight = dtcp_cc_inflight(dtcp);
+        max_sent = dtcp->parent->sv->max_seq_nr_sent;
+
+        spin_lock_bh(&data->lock);
+        data->delivered += acked;
+
+        rtt_expired = ktime_after(now, ktime_add_ms(data->min_rtt_stamp,
+                                                    BBR_MIN_RTT_WIN_MS));
+        if (rtt_us && (!data->min_rtt_us ||
+                       rtt_us <= data->min_rtt_us || rtt_expired)) {
+                data->min_rtt_us    = rtt_us;
+                data->min_rtt_stamp = now;
+        }
+
+        if (seq >= data->round_end)
+                bbr_round_end(data, max_sent, now);
+
+        bbr_update_mode(data, inflight, rtt_expired, now);
+        bbr_update_cwnd(data, acked);
+
+        cwnd = data->cwnd;
+        rate = bbr_pacing_rate(data, dtcp_cc_mss(dtcp));
+        spin_unlock_bh(&data->lock);
+
+        dtcp_cc_cwnd_set(dtcp, cwnd);
+        dtcp_cc_pacing_rate_set(dtcp, rate);
+}
+
+/* The model is loss agnostic, the rtx timer takes care of the PDUs */
+static void bbr_on_loss(struct dtcp_ps * ps)
+{ LOG_DBG("BBR ignoring loss on DTCP %pK", ps->dm); }
+
+static int bbr_flow_init(struct dtcp_ps * ps)
+{
+        struct bbr_dtcp_ps_data * data = ps->priv;
+
+        dtcp_cc_cwnd_set(ps->dm, data->cwnd);
+
+        return 0;
+}
+
+static int dtcp_ps_bbr_set_policy_set_param(struct ps_base * bps,
+                                            const char    * name,
+                                            const char    * value)
+{
+        struct dtcp_ps *          ps = container_of(bps, struct dtcp_ps,
+                                                    base);
+        struct bbr_dtcp_ps_data * data = ps->priv;
+        int                       ival;
+        int                       ret;
+
+        if (!name) {
+                LOG_ERR("Null parameter name");
+                return -1;
+        }
+
+        if (!value) {
+                LOG_ERR("Null parameter value");
+                return -1;
+        }
+
+        if (strcmp(name, "init_cwnd") == 0) {
+                ret = kstrtoint(value, 10, &ival);
+                if (!ret && ival >= (int) BBR_MIN_CWND) {
+                        data->init_cwnd = ival;
+                        data->cwnd      = ival;
+                }
+        }
+
+        return 0;
+}
+
+static struct ps_base *
+dtcp_ps_bbr_create(struct rina_component * component)
+{
+        struct dtcp *             dtcp = dtcp_from_component(component);
+        struct dtcp_ps *          ps;
+        struct bbr_dtcp_ps_data * data;
+        struct policy_parm *      ps_param;
+
+        if (!dtcp)
+                return NULL;
+
+        ps = rkzalloc(sizeof(*ps), GFP_KERNEL);
+        if (!ps)
+                return NULL;
+
+        data = rkzalloc(sizeof(*data), GFP_KERNEL);
+        if (!data) {
+                rkfree(ps);
+                return NULL;
+        }
+
+        spin_lock_init(&data->lock);
+        data->init_cwnd     = BBR_INIT_CWND;
+        data->cwnd          = BBR_INIT_CWND;
+        data->min_rtt_stamp = ktime_get();
+        data->round_start   = data->min_rtt_stamp;
+        bbr_mode_set(data, BBR_STARTUP, data->min_rtt_stamp);
+
+        ps->base.set_policy_set_param   = dtcp_ps_bbr_set_policy_set_param;
+        ps->dm                          = dtcp;
+        ps->priv                        = data;
+
+        if (dtcp->cfg && dtcp->cfg->dtcp_ps) {
+                ps_param = policy_param_find(dtcp->cfg->dtcp_ps, "init_cwnd");
+                if (ps_param)
+                        dtcp_ps_bbr_set_policy_set_param(&ps->base,
+                                policy_param_name(ps_param),
+                                policy_param_value(ps_param));
+        }
+
+        ps->flow_init                   = bbr_flow_init;
+        ps->lost_control_pdu            = NULL;
+        ps->rtt_estimator               = NULL;
+        ps->retransmission_timer_expiry = NULL;
+        ps->received_retransmission     = NULL;
+        ps->sender_ack                  = NULL;
+        ps->sending_ack                 = NULL;
+        ps->receiving_ack_list          = NULL;
+        ps->initial_rate                = NULL;
+        ps->receiving_flow_control      = NULL;
+        ps->update_credit               = NULL;
+        ps->rcvr_ack                    = NULL;
+        ps->rcvr_flow_control           = NULL;
+        ps->rate_reduction              = NULL;
+        ps->rcvr_control_ack            = NULL;
+        ps->no_rate_slow_down           = NULL;
+        ps->no_override_default_peak    = NULL;
+        ps->cc_on_ack                   = bbr_on_ack;
+        ps->cc_on_loss                  = bbr_on_loss;
+        ps->cc_on_ecn                   = NULL;
+
+        LOG_INFO("BBR DTCP policy created, initial cwnd %u", data->init_cwnd);
+
+        return &ps->base;
+}
+
+static void dtcp_ps_bbr_destroy(struct ps_base * bps)
+{
+        struct dtcp_ps *ps = container_of(bps, struct dtcp_ps, base);
+
+        if (bps) {
+                if (ps->priv)
+                        rkfree(ps->priv);
+                rkfree(ps);
+        }
+}
+
+struct ps_factory bbr_dtcp_factory = {
+        .owner   = THIS_MODULE,
+        .create  = dtcp_ps_bbr_create,
+        .destroy = dtcp_ps_bbr_destroy,
+};
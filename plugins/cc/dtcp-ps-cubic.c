@@ -0,0 +1,396 @@
+/*
+ * CUBIC congestion control policy set for DTCP (sender side)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <linux/export.h>
+#include <linux/module.h>
+#include <linux/string.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+
+#define RINA_PREFIX "cubic-dtcp-ps"
+
+#include "rds/rmem.h"
+#include "dtcp.h"
+#include "dtcp-ps.h"
+#include "dtp.h"
+#include "policies.h"
+#include "logs.h"
+
+#include "cc.h"
+
+/* Multiplicative decrease factor, 717/1024 ~ 0.7 */
+#define CUBIC_BETA            717U
+#define CUBIC_BETA_SCALE      1024U
+/* Reno-friendly additive increase factor, 3 * (1 - beta) / (1 + beta) */
+#define CUBIC_FRIENDLY_SCALE  15U
+/* 1 / C in ms^3 per PDU, C = 0.4, K = cbrt(W_max * (1 - beta) / C) */
+#define CUBIC_K_FACTOR        2500000000ULL
+/* W(t) - W_max = C * t^3 with t in ms, i.e. t^3 * 4 / 10^10 */
+#define CUBIC_C_DIV           10000000000ULL
+/* Bounds the time offset so that its cube does not overflow */
+#define CUBIC_MAX_OFFS_MS     (1ULL << 20)
+#define CUBIC_INIT_CWND       10U
+#define CUBIC_MIN_CWND        2U
+
+struct cubic_dtcp_ps_data {
+        spinlock_t    lock;
+
+        uint_t        cwnd;       /* in PDUs */
+        uint_t        cwnd_cnt;   /* PDUs acked towards the next increase */
+        uint_t        ssthresh;
+        uint_t        w_max;      /* cwnd before the last reduction */
+        uint_t        origin;     /* plateau of the cubic function */
+        u32           k_ms;       /* time to get back to the plateau */
+        bool          in_epoch;
+        ktime_t       epoch;
+        uint_t        tcp_cwnd;   /* Reno-friendly estimate */
+        uint_t        ack_cnt;
+        uint_t        min_rtt_us;
+        uint_t        srtt_us;
+        seq_num_t     recover;    /* no reductions until acked */
+
+        /* Parameters */
+        uint_t        init_cwnd;
+        uint_t        max_cwnd;
+        bool          pacing;
+        bool          fast_convergence;
+};
+
+static void cubic_update(struct cubic_dtcp_ps_data * data, uint_t acked)
+{
+        ktime_t now = ktime_get();
+        u64     t_ms;
+        u64     offs;
+        u64     delta;
+        uint_t  target;
+        uint_t  cnt;
+        uint_t  max_cnt;
+
+        if (!data->in_epoch) {
+                data->in_epoch = true;
+                data->epoch    = now;
+                data->ack_cnt  = acked;
+                data->tcp_cwnd = data->cwnd;
+                if (data->cwnd < data->w_max) {
+                        data->k_ms   = cc_cbrt((u64) (data->w_max -
+                                                      data->cwnd) *
+                                               CUBIC_K_FACTOR);
+                        data->origin = data->w_max;
+                } else {
+                        data->k_ms   = 0;
+                        data->origin = data->cwnd;
+                }
+        } else {
+                data->ack_cnt += acked;
+        }
+
+        /* Where the window should be one RTT from now */
+        t_ms = ktime_to_ms(ktime_sub(now, data->epoch)) +
+                data->min_rtt_us / USEC_PER_MSEC;
+        offs = t_ms > data->k_ms ? t_ms - data->k_ms : data->k_ms - t_ms;
+        offs = min_t(u64, offs, CUBIC_MAX_OFFS_MS);
+        delta = div64_u64(offs * offs * offs * 4, CUBIC_C_DIV);
+        if (t_ms < data->k_ms)
+                target = delta < data->origin ? data->origin - delta : 1;
+        else
+                target = min_t(u64, data->origin + delta, data->max_cwnd);
+
+        if (target > data->cwnd)
+                cnt = data->cwnd / (target - data->cwnd);
+        else
+                cnt = 100 * data->cwnd;
+
+        /* Never slower than Reno would be on the same path */
+        delta = (data->cwnd * CUBIC_FRIENDLY_SCALE) >> 3;
+        while (delta && data->ack_cnt > delta) {
+                data->ack_cnt -= delta;
+                data->tcp_cwnd++;
+        }
+        if (data->tcp_cwnd > data->cwnd) {
+                max_cnt = data->cwnd / (data->tcp_cwnd - data->cwnd);
+                if (cnt > max_cnt)
+                        cnt = max_cnt;
+        }
+
+        /* At most 1 PDU every 2 acked, i.e. 1.5x per RTT */
+        cnt = max(cnt, 2U);
+
+        data->cwnd_cnt += acked;
+        if (data->cwnd_cnt >= cnt) {
+                data->cwnd     += data->cwnd_cnt / cnt;
+                data->cwnd_cnt %= cnt;
+        }
+}
+
+/* Called with the data lock held */
+static u64 cubic_pacing_rate(struct dtcp *              dtcp,
+                             struct cubic_dtcp_ps_data * data)
+{
+        u64 rate;
+
+        if (!data->pacing || !data->srtt_us)
+                return 0;
+
+        rate = div64_u64((u64) data->cwnd * dtcp_cc_mss(dtcp) * USEC_PER_SEC,
+                         data->srtt_us);
+
+        /* Fill the pipe faster while probing, keep headroom afterwards */
+        if (data->cwnd < data->ssthresh)
+                return rate * 2;
+
+        return rate * 6 / 5;
+}
+
+/*
+ * Called with the data lock held, so that the sender never sees an older
+ * window or rate after a newer one
+ */
+static void cubic_publish(struct dtcp *               dtcp,
+                          struct cubic_dtcp_ps_data * data)
+{
+        dtcp_cc_cwnd_set(dtcp, data->cwnd);
+        if (data->pacing)
+                dtcp_cc_pacing_rate_set(dtcp, cubic_pacing_rate(dtcp, data));
+}
+
+static void cubic_on_ack(struct dtcp_ps * ps,
+                         seq_num_t        seq,
+                         uint_t           acked,
+                         uint_t           rtt_us)
+{
+        struct dtcp *               dtcp = ps->dm;
+        struct cubic_dtcp_ps_data * data = ps->priv;
+
+        spin_lock_bh(&data->lock);
+        if (rtt_us) {
+                if (!data->min_rtt_us || rtt_us < data->min_rtt_us)
+                        data->min_rtt_us = rtt_us;
+                data->srtt_us = data->srtt_us ?
+                        (7 * data->srtt_us + rtt_us) >> 3 : rtt_us;
+        }
+
+        if (data->cwnd < data->ssthresh) {
+                data->cwnd = min(data->cwnd + acked, data->ssthresh);
+        } else {
+                cubic_update(data, acked);
+        }
+        data->cwnd = min(data->cwnd, data->max_cwnd);
+
+        cubic_publish(dtcp, data);
+        spin_unlock_bh(&data->lock);
+}
+
+/* Loss and ECN are handled alike, at most once per window of data */
+static void cubic_reduce(struct dtcp_ps * ps, seq_num_t seq)
+{
+        struct dtcp *               dtcp = ps->dm;
+        struct cubic_dtcp_ps_data * data = ps->priv;
+        seq_num_t                   max_sent;
+
+        max_sent = dtcp_cc_max_sent(dtcp);
+
+        spin_lock_bh(&data->lock);
+        if (seq < data->recover) {
+                spin_unlock_bh(&data->lock);
+                return;
+        }
+
+        data->in_epoch = false;
+        /* Release bandwidth for newer flows if we are shrinking */
+        if (data->fast_convergence && data->cwnd < data->w_max)
+                data->w_max = data->cwnd * (CUBIC_BETA_SCALE + CUBIC_BETA) /
+                        (2 * CUBIC_BETA_SCALE);
+        else
+                data->w_max = data->cwnd;
+
+        data->ssthresh = max((data->cwnd * CUBIC_BETA) / CUBIC_BETA_SCALE,
+                             CUBIC_MIN_CWND);
+        data->cwnd     = data->ssthresh;
+        data->cwnd_cnt = 0;
+        data->recover  = max_sent + 1;
+
+        LOG_DBG("CUBIC reduction, cwnd %u, w_max %u", data->cwnd,
+                data->w_max);
+
+        cubic_publish(dtcp, data);
+        spin_unlock_bh(&data->lock);
+}
+
+static void cubic_on_loss(struct dtcp_ps * ps)
+{
+        struct dtcp * dtcp = ps->dm;
+
+        cubic_reduce(ps, dtcp->sv->snd_una);
+}
+
+static void cubic_on_ecn(struct dtcp_ps * ps, seq_num_t seq)
+{ cubic_reduce(ps, seq); }
+
+static int cubic_flow_init(struct dtcp_ps * ps)
+{
+        struct cubic_dtcp_ps_data * data = ps->priv;
+
+        spin_lock_bh(&data->lock);
+        dtcp_cc_cwnd_set(ps->dm, data->cwnd);
+        spin_unlock_bh(&data->lock);
+
+        return 0;
+}
+
+static int dtcp_ps_cubic_set_policy_set_param(struct ps_base * bps,
+                                              const char    * name,
+                                              const char    * value)
+{
+        struct dtcp_ps *            ps = container_of(bps, struct dtcp_ps,
+                                                      base);
+        struct cubic_dtcp_ps_data * data = ps->priv;
+        int                         ival;
+        int                         ret;
+
+        if (!name) {
+                LOG_ERR("Null parameter name");
+                return -1;
+        }
+
+        if (!value) {
+                LOG_ERR("Null parameter value");
+                return -1;
+        }
+
+        if (strcmp(name, "init_cwnd") == 0) {
+                ret = kstrtoint(value, 10, &ival);
+                if (!ret && ival >= (int) CUBIC_MIN_CWND) {
+                        data->init_cwnd = ival;
+                        data->cwnd      = ival;
+                }
+        }
+
+        if (strcmp(name, "max_cwnd") == 0) {
+                ret = kstrtoint(value, 10, &ival);
+                if (!ret && ival >= (int) CUBIC_MIN_CWND)
+                        data->max_cwnd = ival;
+        }
+
+        if (strcmp(name, "pacing") == 0) {
+                ret = kstrtoint(value, 10, &ival);
+                if (!ret)
+                        data->pacing = ival;
+        }
+
+        if (strcmp(name, "fast_convergence") == 0) {
+                ret = kstrtoint(value, 10, &ival);
+                if (!ret)
+                        data->fast_convergence = ival;
+        }
+
+        return 0;
+}
+
+static const char * cubic_params[] = {
+        "init_cwnd", "max_cwnd", "pacing", "fast_convergence"
+};
+
+static struct ps_base *
+dtcp_ps_cubic_create(struct rina_component * component)
+{
+        struct dtcp *               dtcp = dtcp_from_component(component);
+        struct dtcp_ps *            ps;
+        struct cubic_dtcp_ps_data * data;
+        struct policy_parm *        ps_param;
+        int                         i;
+
+        if (!dtcp)
+                return NULL;
+
+        ps = rkzalloc(sizeof(*ps), GFP_KERNEL);
+        if (!ps)
+                return NULL;
+
+        data = rkzalloc(sizeof(*data), GFP_KERNEL);
+        if (!data) {
+                rkfree(ps);
+                return NULL;
+        }
+
+        spin_lock_init(&data->lock);
+        data->init_cwnd        = CUBIC_INIT_CWND;
+        data->cwnd             = CUBIC_INIT_CWND;
+        data->max_cwnd         = CC_MAX_CWND;
+        data->ssthresh         = CC_MAX_CWND;
+        data->fast_convergence = true;
+        data->pacing           = false;
+
+        ps->base.set_policy_set_param   = dtcp_ps_cubic_set_policy_set_param;
+        ps->dm                          = dtcp;
+        ps->priv                        = data;
+
+        if (dtcp->cfg && dtcp->cfg->dtcp_ps) {
+                for (i = 0; i < ARRAY_SIZE(cubic_params); i++) {
+                        ps_param = policy_param_find(dtcp->cfg->dtcp_ps,
+                                                     cubic_params[i]);
+                        if (!ps_param)
+                                continue;
+                        dtcp_ps_cubic_set_policy_set_param(&ps->base,
+                                policy_param_name(ps_param),
+                                policy_param_value(ps_param));
+                }
+        }
+
+        ps->flow_init                   = cubic_flow_init;
+        ps->lost_control_pdu            = NULL;
+        ps->rtt_estimator               = NULL;
+        ps->retransmission_timer_expiry = NULL;
+        ps->received_retransmission     = NULL;
+        ps->sender_ack                  = NULL;
+        ps->sending_ack                 = NULL;
+        ps->receiving_ack_list          = NULL;
+        ps->initial_rate                = NULL;
+        ps->receiving_flow_control      = NULL;
+        ps->update_credit               = NULL;
+        ps->rcvr_ack                    = NULL;
+        ps->rcvr_flow_control           = NULL;
+        ps->rate_reduction              = NULL;
+        ps->rcvr_control_ack            = NULL;
+        ps->no_rate_slow_down           = NULL;
+        ps->no_override_default_peak    = NULL;
+        ps->cc_on_ack                   = cubic_on_ack;
+        ps->cc_on_loss                  = cubic_on_loss;
+        ps->cc_on_ecn                   = cubic_on_ecn;
+
+        LOG_INFO("CUBIC DTCP policy created, initial cwnd %u, pacing %d",
+                 data->init_cwnd, data->pacing);
+
+        return &ps->base;
+}
+
+static void dtcp_ps_cubic_destroy(struct ps_base * bps)
+{
+        struct dtcp_ps *ps = container_of(bps, struct dtcp_ps, base);
+
+        if (bps) {
+                if (ps->priv)
+                        rkfree(ps->priv);
+                rkfree(ps);
+        }
+}
+
+struct ps_factory cubic_dtcp_factory = {
+        .owner   = THIS_MODULE,
+        .create  = dtcp_ps_cubic_create,
+        .destroy = dtcp_ps_cubic_destroy,
+};
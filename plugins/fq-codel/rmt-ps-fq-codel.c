@@ -0,0 +1,758 @@
+/*
+ * RMT FQ-CoDel policy set
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <linux/export.h>
+#include <linux/module.h>
+#include <linux/string.h>
+#include <linux/list.h>
+#include <linux/jhash.h>
+#include <linux/log2.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/skbuff.h>
+#include <linux/atomic.h>
+
+#define RINA_PREFIX "rmt-fq-codel"
+#define RINA_PS_FQ_CODEL_NAME "fq-codel-ps"
+
+#include "logs.h"
+#include "debug.h"
+#include "rds/rmem.h"
+#include "rds/robjects.h"
+#include "rds/rring.h"
+#include "rmt-ps.h"
+#include "rmt.h"
+#include "pci.h"
+#include "policies.h"
+
+#define DEFAULT_Q_MAX		1000
+#define DEFAULT_FLOWS		256
+#define DEFAULT_QUANTUM		1500
+#define DEFAULT_TARGET_US	5000
+#define DEFAULT_INTERVAL_US	100000
+#define MAX_FLOWS		(1 << 16)
+/* Initial ring sizes, the rings double whenever they fill up */
+#define FLOW_Q_INIT_SIZE	16
+#define MGT_Q_INIT_SIZE		64
+
+/*
+ * FQ-CoDel (RFC 8290): data PDUs are hashed by (qos-id, destination cep-id)
+ * into sub-queues served by deficit round robin, newly active sub-queues
+ * first. Each sub-queue runs CoDel (RFC 8289) on the time its PDUs spent
+ * queued: once the sojourn time stays above target for an interval, PDUs
+ * are marked with the ECN flag (or dropped, when ecn is off) at a rate
+ * growing with the square root of the marks so far. DTCP policies reacting
+ * to PDU_FLAGS_EXPLICIT_CONGESTION (e.g. red-ps, dctcp-ps) then slow down.
+ *
+ * Management PDUs go to a separate queue with strict priority, as in the
+ * default policy. The policy is always called with the n1_port lock held.
+ *
+ * All the queues are rings, so that nothing is allocated per PDU. They start
+ * small and are grown on a full push: the data PDUs are bounded as a whole
+ * by q_max, not per ring, and the management queue is not bounded at all.
+ */
+
+/* Per-PDU state, kept in the skb control buffer while the PDU is queued */
+struct fqc_cb {
+	u64 enq_ns;
+};
+
+#define fqc_cb(DU) ((struct fqc_cb *) (DU)->skb->cb)
+
+struct fqc_codel_vars {
+	u32  count;
+	u32  lastcount;
+	bool dropping;
+	u64  first_above_ns;
+	u64  drop_next_ns;
+};
+
+struct fqc_flow {
+	struct rring *	      queue;
+	struct list_head      flowchain;
+	int		      deficit;
+	unsigned int	      backlog; /* bytes */
+	unsigned int	      qlen;
+	struct fqc_codel_vars cvars;
+};
+
+struct fqc_queue {
+	struct rring *	  mgt_queue;
+	struct fqc_flow * flows;
+	unsigned int	  flows_cnt;
+	unsigned int	  qlen;	/* data PDUs in all the flows */
+	struct list_head  new_flows;
+	struct list_head  old_flows;
+};
+
+struct fqc_ps_data {
+	unsigned int  q_max;
+	unsigned int  flows;
+	unsigned int  quantum;
+	unsigned int  target_us;
+	unsigned int  interval_us;
+	bool	      ecn;
+
+	atomic_long_t codel_drops;
+	atomic_long_t ecn_marks;
+	atomic_long_t overlimit_drops;
+	atomic_long_t new_flows;
+
+	struct robject robj;
+};
+
+static ssize_t fqc_ps_attr_show(struct robject *	robj,
+				struct robj_attribute * attr,
+				char *			buf)
+{
+	struct fqc_ps_data * data;
+
+	data = container_of(robj, struct fqc_ps_data, robj);
+	if (!data)
+		return 0;
+
+	if (strcmp(robject_attr_name(attr), "q_max") == 0)
+		return sprintf(buf, "%u\n", data->q_max);
+	if (strcmp(robject_attr_name(attr), "flows") == 0)
+		return sprintf(buf, "%u\n", data->flows);
+	if (strcmp(robject_attr_name(attr), "quantum") == 0)
+		return sprintf(buf, "%u\n", data->quantum);
+	if (strcmp(robject_attr_name(attr), "target_us") == 0)
+		return sprintf(buf, "%u\n", data->target_us);
+	if (strcmp(robject_attr_name(attr), "interval_us") == 0)
+		return sprintf(buf, "%u\n", data->interval_us);
+	if (strcmp(robject_attr_name(attr), "ecn") == 0)
+		return sprintf(buf, "%d\n", data->ecn ? 1 : 0);
+	if (strcmp(robject_attr_name(attr), "codel_drops") == 0)
+		return sprintf(buf, "%ld\n",
+			       atomic_long_read(&data->codel_drops));
+	if (strcmp(robject_attr_name(attr), "ecn_marks") == 0)
+		return sprintf(buf, "%ld\n",
+			       atomic_long_read(&data->ecn_marks));
+	if (strcmp(robject_attr_name(attr), "overlimit_drops") == 0)
+		return sprintf(buf, "%ld\n",
+			       atomic_long_read(&data->overlimit_drops));
+	if (strcmp(robject_attr_name(attr), "new_flows") == 0)
+		return sprintf(buf, "%ld\n",
+			       atomic_long_read(&data->new_flows));
+	return 0;
+}
+RINA_SYSFS_OPS(fqc_ps);
+RINA_ATTRS(fqc_ps, q_max, flows, quantum, target_us, interval_us, ecn,
+	   codel_drops, ecn_marks, overlimit_drops, new_flows);
+RINA_KTYPE(fqc_ps);
+
+static void fqc_queue_destroy(struct fqc_queue * q)
+{
+	unsigned int i;
+
+	if (q->flows) {
+		for (i = 0; i < q->flows_cnt; i++)
+			if (q->flows[i].queue)
+				rring_destroy(q->flows[i].queue,
+					      (void (*)(void *)) du_destroy);
+		rkfree(q->flows);
+	}
+
+	if (q->mgt_queue)
+		rring_destroy(q->mgt_queue, (void (*)(void *)) du_destroy);
+
+	rkfree(q);
+}
+
+static void * fqc_q_create(struct rmt_ps *	ps,
+			   struct rmt_n1_port * n1_port)
+{
+	struct fqc_ps_data * data;
+	struct fqc_queue *   q;
+	unsigned int	     i;
+
+	if (!ps || !n1_port || !ps->priv) {
+		LOG_ERR("Wrong input parameters");
+		return NULL;
+	}
+
+	data = ps->priv;
+
+	q = rkzalloc(sizeof(*q), GFP_ATOMIC);
+	if (!q)
+		return NULL;
+
+	INIT_LIST_HEAD(&q->new_flows);
+	INIT_LIST_HEAD(&q->old_flows);
+
+	q->mgt_queue = rring_create_ni(MGT_Q_INIT_SIZE, RRING_SPSC);
+	if (!q->mgt_queue) {
+		fqc_queue_destroy(q);
+		return NULL;
+	}
+
+	/* Sub-queue rings are only created when a flow first hashes there */
+	q->flows_cnt = data->flows;
+	q->flows = rkzalloc(q->flows_cnt * sizeof(*q->flows), GFP_ATOMIC);
+	if (!q->flows) {
+		LOG_ERR("Could not allocate %u flows for n1_port %u",
+			q->flows_cnt, n1_port->port_id);
+		fqc_queue_destroy(q);
+		return NULL;
+	}
+	for (i = 0; i < q->flows_cnt; i++)
+		INIT_LIST_HEAD(&q->flows[i].flowchain);
+
+	return q;
+}
+
+static int fqc_q_destroy(struct rmt_ps *      ps,
+			 struct rmt_n1_port * n1_port)
+{
+	if (!ps || !n1_port) {
+		LOG_ERR("Wrong input parameters");
+		return -1;
+	}
+
+	if (!n1_port->rmt_ps_queues) {
+		LOG_ERR("Could not find queue for n1_port %u",
+			n1_port->port_id);
+		return -1;
+	}
+
+	fqc_queue_destroy(n1_port->rmt_ps_queues);
+
+	return 0;
+}
+
+/* Doubles a full ring, the push that follows fails if this could not */
+static void fqc_ring_grow(struct rring * r)
+{
+	if (rring_is_full(r) && rring_capacity(r) < RRING_MAX_SIZE)
+		rring_resize_ni(r, 2 * rring_capacity(r));
+}
+
+static inline unsigned int fqc_classify(struct fqc_queue * q,
+					const struct du *  du)
+{
+	u32 hash;
+
+	hash = jhash_2words((u32) pci_qos_id(&du->pci),
+			    (u32) pci_cep_destination(&du->pci), 0);
+
+	return hash & (q->flows_cnt - 1);
+}
+
+static struct du * fqc_flow_pop(struct rmt_n1_port * n1_port,
+				struct fqc_queue *   q,
+				struct fqc_flow *    flow)
+{
+	struct du * du;
+	ssize_t	    len;
+
+	du = rring_pop(flow->queue);
+	if (!du)
+		return NULL;
+
+	len = du_len(du);
+	flow->backlog -= len;
+	flow->qlen--;
+	q->qlen--;
+	n1_port->qbytes -= len;
+
+	return du;
+}
+
+/* Drops a PDU that is already accounted in n1_port->plen */
+static void fqc_drop_queued(struct rmt_n1_port * n1_port,
+			    struct du *		 du)
+{
+	du_destroy(du);
+	rmt_n1_port_drop_queued(n1_port);
+}
+
+/*
+ * Makes room for one more PDU: drops the head of the fattest flow, as
+ * RFC 8290 does, so that a single unresponsive flow can not push the
+ * others out
+ */
+static void fqc_drop_fattest(struct rmt_n1_port * n1_port,
+			     struct fqc_queue *	  q)
+{
+	struct fqc_flow * fat = NULL;
+	struct du *	  du;
+	unsigned int	  i;
+
+	for (i = 0; i < q->flows_cnt; i++)
+		if (!fat || q->flows[i].backlog > fat->backlog)
+			fat = &q->flows[i];
+
+	if (!fat || !fat->qlen)
+		return;
+
+	du = fqc_flow_pop(n1_port, q, fat);
+	if (du)
+		fqc_drop_queued(n1_port, du);
+}
+
+static int fqc_enqueue(struct rmt_ps *	    ps,
+		       struct rmt_n1_port * n1_port,
+		       struct du *	    du,
+		       bool		    must_enqueue)
+{
+	struct fqc_ps_data * data;
+	struct fqc_queue *   q;
+	struct fqc_flow *    flow;
+	ssize_t		     len;
+
+	if (!ps || !n1_port || !du) {
+		LOG_ERR("Wrong input parameters");
+		return RMT_PS_ENQ_ERR;
+	}
+
+	data = ps->priv;
+	q = n1_port->rmt_ps_queues;
+	if (!q) {
+		LOG_ERR("Could not find queue for n1_port %u",
+			n1_port->port_id);
+		du_destroy(du);
+		return RMT_PS_ENQ_ERR;
+	}
+
+	len = du_len(du);
+	if (pci_type(&du->pci) == PDU_TYPE_MGMT) {
+		if (!must_enqueue && rring_is_empty(q->mgt_queue))
+			return RMT_PS_ENQ_SEND;
+
+		fqc_ring_grow(q->mgt_queue);
+		if (rring_push(q->mgt_queue, du)) {
+			du_destroy(du);
+			return RMT_PS_ENQ_DROP;
+		}
+		n1_port->qbytes += len;
+		return RMT_PS_ENQ_SCHED;
+	}
+
+	if (!must_enqueue && !q->qlen)
+		return RMT_PS_ENQ_SEND;
+
+	flow = &q->flows[fqc_classify(q, du)];
+	if (!flow->queue) {
+		flow->queue = rring_create_ni(FLOW_Q_INIT_SIZE, RRING_SPSC);
+		if (!flow->queue) {
+			du_destroy(du);
+			return RMT_PS_ENQ_ERR;
+		}
+	}
+
+	if (q->qlen >= data->q_max) {
+		atomic_long_inc(&data->overlimit_drops);
+		fqc_drop_fattest(n1_port, q);
+	}
+
+	if (du->skb)
+		fqc_cb(du)->enq_ns = ktime_get_ns();
+
+	fqc_ring_grow(flow->queue);
+	if (rring_push(flow->queue, du)) {
+		du_destroy(du);
+		return RMT_PS_ENQ_DROP;
+	}
+
+	flow->backlog += len;
+	flow->qlen++;
+	q->qlen++;
+	n1_port->qbytes += len;
+
+	if (list_empty(&flow->flowchain)) {
+		list_add_tail(&flow->flowchain, &q->new_flows);
+		flow->deficit = data->quantum;
+		atomic_long_inc(&data->new_flows);
+	}
+
+	return RMT_PS_ENQ_SCHED;
+}
+
+static u64 fqc_control_law(struct fqc_ps_data * data,
+			   u64			t,
+			   u32			count)
+{
+	/* t + interval / sqrt(count), sqrt in 10 bits fixed point */
+	return t + div64_u64((u64) data->interval_us * NSEC_PER_USEC << 10,
+			     int_sqrt((unsigned long) count << 20));
+}
+
+static bool fqc_should_drop(struct fqc_ps_data * data,
+			    struct fqc_flow *	 flow,
+			    struct du *		 du,
+			    u64			 now)
+{
+	struct fqc_codel_vars * v = &flow->cvars;
+	u64			sojourn;
+
+	sojourn = du->skb ? now - fqc_cb(du)->enq_ns : 0;
+
+	/* A flow with less than a quantum queued can not build a standing queue */
+	if (sojourn < (u64) data->target_us * NSEC_PER_USEC ||
+	    flow->backlog <= data->quantum) {
+		v->first_above_ns = 0;
+		return false;
+	}
+
+	if (!v->first_above_ns) {
+		v->first_above_ns = now +
+			(u64) data->interval_us * NSEC_PER_USEC;
+		return false;
+	}
+
+	return now >= v->first_above_ns;
+}
+
+/*
+ * Signals congestion on du: returns du marked, or drops it and returns
+ * NULL when it can not carry the mark
+ */
+static struct du * fqc_signal(struct fqc_ps_data * data,
+			      struct rmt_n1_port * n1_port,
+			      struct du *	   du)
+{
+	if (data->ecn && pci_type(&du->pci) == PDU_TYPE_DT) {
+		pci_flags_set(&du->pci, pci_flags_get(&du->pci) |
+			      PDU_FLAGS_EXPLICIT_CONGESTION);
+		atomic_long_inc(&data->ecn_marks);
+		return du;
+	}
+
+	atomic_long_inc(&data->codel_drops);
+	fqc_drop_queued(n1_port, du);
+
+	return NULL;
+}
+
+/* The CoDel state machine of RFC 8289, run on flow's head */
+static struct du * fqc_codel_dequeue(struct fqc_ps_data * data,
+				     struct rmt_n1_port * n1_port,
+				     struct fqc_queue *	  q,
+				     struct fqc_flow *	  flow)
+{
+	struct fqc_codel_vars * v = &flow->cvars;
+	struct du *		du;
+	u64			now;
+	u32			delta;
+
+	du = fqc_flow_pop(n1_port, q, flow);
+	if (!du) {
+		v->dropping = false;
+		return NULL;
+	}
+
+	now = ktime_get_ns();
+
+	if (v->dropping) {
+		if (!fqc_should_drop(data, flow, du, now)) {
+			v->dropping = false;
+			return du;
+		}
+
+		while (v->dropping && now >= v->drop_next_ns) {
+			v->count++;
+			v->drop_next_ns = fqc_control_law(data,
+							  v->drop_next_ns,
+							  v->count);
+			if (fqc_signal(data, n1_port, du))
+				return du;
+
+			du = fqc_flow_pop(n1_port, q, flow);
+			if (!du) {
+				v->dropping = false;
+				return NULL;
+			}
+			if (!fqc_should_drop(data, flow, du, now))
+				v->dropping = false;
+		}
+
+		return du;
+	}
+
+	if (!fqc_should_drop(data, flow, du, now))
+		return du;
+
+	v->dropping = true;
+	delta = v->count - v->lastcount;
+	if (delta > 1 && now - v->drop_next_ns <
+	    16 * (u64) data->interval_us * NSEC_PER_USEC)
+		v->count = delta;
+	else
+		v->count = 1;
+	v->lastcount = v->count;
+	v->drop_next_ns = fqc_control_law(data, now, v->count);
+
+	if (fqc_signal(data, n1_port, du))
+		return du;
+
+	/* The head was dropped, hand out the next one as is */
+	return fqc_flow_pop(n1_port, q, flow);
+}
+
+static struct du * fqc_dequeue(struct rmt_ps *	    ps,
+			       struct rmt_n1_port * n1_port)
+{
+	struct fqc_ps_data * data;
+	struct fqc_queue *   q;
+	struct fqc_flow *    flow;
+	struct list_head *   head;
+	struct du *	     du;
+
+	if (!ps || !n1_port) {
+		LOG_ERR("Wrong input parameters");
+		return NULL;
+	}
+
+	data = ps->priv;
+	q = n1_port->rmt_ps_queues;
+	if (!q) {
+		LOG_ERR("Could not find queue for n1_port %u",
+			n1_port->port_id);
+		return NULL;
+	}
+
+	if (!rring_is_empty(q->mgt_queue)) {
+		du = rring_pop(q->mgt_queue);
+		if (du)
+			n1_port->qbytes -= du_len(du);
+		return du;
+	}
+
+	for (;;) {
+		if (!list_empty(&q->new_flows))
+			head = &q->new_flows;
+		else if (!list_empty(&q->old_flows))
+			head = &q->old_flows;
+		else
+			return NULL;
+
+		flow = list_first_entry(head, struct fqc_flow, flowchain);
+
+		if (flow->deficit <= 0) {
+			flow->deficit += data->quantum;
+			list_move_tail(&flow->flowchain, &q->old_flows);
+			continue;
+		}
+
+		du = fqc_codel_dequeue(data, n1_port, q, flow);
+		if (!du) {
+			/*
+			 * An emptied new flow goes through the old list once,
+			 * so it can not jump the queue by going idle shortly
+			 */
+			if (head == &q->new_flows &&
+			    !list_empty(&q->old_flows))
+				list_move_tail(&flow->flowchain,
+					       &q->old_flows);
+			else
+				list_del_init(&flow->flowchain);
+			continue;
+		}
+
+		flow->deficit -= du_len(du);
+		return du;
+	}
+}
+
+static int fqc_set_policy_set_param(struct ps_base * bps,
+				    const char *     name,
+				    const char *     value)
+{
+	struct rmt_ps *	     ps = container_of(bps, struct rmt_ps, base);
+	struct fqc_ps_data * data = ps->priv;
+	unsigned int	     uval;
+	int		     ret;
+
+	if (!name) {
+		LOG_ERR("Null parameter name");
+		return -1;
+	}
+
+	if (!value) {
+		LOG_ERR("Null parameter value");
+		return -1;
+	}
+
+	ret = kstrtouint(value, 10, &uval);
+	if (ret) {
+		LOG_ERR("Invalid value '%s' for parameter %s", value, name);
+		return -1;
+	}
+
+	if (strcmp(name, "q_max") == 0) {
+		if (uval)
+			data->q_max = uval;
+	} else if (strcmp(name, "flows") == 0) {
+		/* Only applies to the N-1 ports bound afterwards */
+		if (uval && uval <= MAX_FLOWS)
+			data->flows = roundup_pow_of_two(uval);
+	} else if (strcmp(name, "quantum") == 0) {
+		if (uval)
+			data->quantum = uval;
+	} else if (strcmp(name, "target_us") == 0) {
+		if (uval)
+			data->target_us = uval;
+	} else if (strcmp(name, "interval_us") == 0) {
+		if (uval)
+			data->interval_us = uval;
+	} else if (strcmp(name, "ecn") == 0) {
+		data->ecn = !!uval;
+	} else {
+		LOG_ERR("Unknown parameter %s", name);
+		return -1;
+	}
+
+	return 0;
+}
+
+static void fqc_load_param(struct rmt_ps *	       ps,
+			   const struct rmt_config * rmt_cfg,
+			   const char *		       name)
+{
+	struct policy_parm * parm;
+
+	parm = policy_param_find(rmt_cfg->policy_set, name);
+	if (!parm)
+		return;
+
+	fqc_set_policy_set_param(&ps->base,
+				 policy_param_name(parm),
+				 policy_param_value(parm));
+}
+
+static struct ps_base * fqc_create(struct rina_component * component)
+{
+	struct rmt *		  rmt;
+	struct rmt_ps *		  ps;
+	struct fqc_ps_data *	  data;
+	const struct rmt_config * rmt_cfg;
+
+	rmt = rmt_from_component(component);
+	if (!rmt)
+		return NULL;
+
+	ps = rkzalloc(sizeof(*ps), GFP_KERNEL);
+	if (!ps)
+		return NULL;
+
+	data = rkzalloc(sizeof(*data), GFP_KERNEL);
+	if (!data) {
+		rkfree(ps);
+		return NULL;
+	}
+
+	if (robject_init_and_add(&data->robj, &fqc_ps_rtype,
+				 rmt_robject(rmt), "ps")) {
+		rkfree(data);
+		rkfree(ps);
+		return NULL;
+	}
+
+	ps->base.set_policy_set_param = fqc_set_policy_set_param;
+	ps->dm = rmt;
+	ps->priv = data;
+
+	data->q_max = DEFAULT_Q_MAX;
+	data->flows = DEFAULT_FLOWS;
+	data->quantum = DEFAULT_QUANTUM;
+	data->target_us = DEFAULT_TARGET_US;
+	data->interval_us = DEFAULT_INTERVAL_US;
+	data->ecn = true;
+
+	/* RMT config is available at assign-to-dif time only */
+	rmt_cfg = rmt_config_get(rmt);
+	if (rmt_cfg) {
+		fqc_load_param(ps, rmt_cfg, "q_max");
+		fqc_load_param(ps, rmt_cfg, "flows");
+		fqc_load_param(ps, rmt_cfg, "quantum");
+		fqc_load_param(ps, rmt_cfg, "target_us");
+		fqc_load_param(ps, rmt_cfg, "interval_us");
+		fqc_load_param(ps, rmt_cfg, "ecn");
+	}
+
+	ps->rmt_dequeue_policy = fqc_dequeue;
+	ps->rmt_enqueue_policy = fqc_enqueue;
+	ps->rmt_q_create_policy = fqc_q_create;
+	ps->rmt_q_destroy_policy = fqc_q_destroy;
+
+	return &ps->base;
+}
+
+static void fqc_destroy(struct ps_base * bps)
+{
+	struct rmt_ps *	     ps;
+	struct fqc_ps_data * data;
+
+	if (!bps)
+		return;
+
+	ps = container_of(bps, struct rmt_ps, base);
+	data = ps->priv;
+	if (data) {
+		robject_del(&data->robj);
+		rkfree(data);
+	}
+	rkfree(ps);
+}
+
+static struct ps_factory rmt_factory = {
+	.owner	 = THIS_MODULE,
+	.create	 = fqc_create,
+	.destroy = fqc_destroy,
+};
+
+static int __init mod_init(void)
+{
+	int ret;
+
+	BUILD_BUG_ON(sizeof(struct fqc_cb) >
+		     sizeof(((struct sk_buff *) 0)->cb));
+
+	strcpy(rmt_factory.name, RINA_PS_FQ_CODEL_NAME);
+
+	ret = rmt_ps_publish(&rmt_factory);
+	if (ret) {
+		LOG_ERR("Failed to publish RMT policy set factory");
+		return -1;
+	}
+
+	LOG_INFO("RMT FQ-CoDel policy set loaded successfully");
+
+	return 0;
+}
+
+static void __exit mod_exit(void)
+{
+	int ret;
+
+	ret = rmt_ps_unpublish(RINA_PS_FQ_CODEL_NAME);
+	if (ret) {
+		LOG_ERR("Failed to unpublish RMT policy set factory");
+		return;
+	}
+
+	LOG_INFO("RMT FQ-CoDel policy set unloaded successfully");
+}
+
+module_init(mod_init);
+module_exit(mod_exit);
+
+MODULE_DESCRIPTION("RMT FQ-CoDel policy set");
+MODULE_LICENSE("GPL");
+MODULE_VERSION("1");
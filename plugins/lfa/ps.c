@@ -168,7 +168,8 @@ static int pfte_port_add(struct pft_entry *entry,
 	if (!pe)
 		return -1;
 
-	list_add(&pe->next, &entry->alt_ports);
+	/* Keep the order of preference computed by the routing daemon */
+	list_add_tail(&pe->next, &entry->alt_ports);
 
 	return 0;
 }
@@ -219,6 +220,37 @@ static struct pft_entry *pft_find(struct pff_ps_priv *priv,
 	return NULL;
 }
 
+static bool pft_is_port_down(struct pff_ps_priv *priv,
+			     port_id_t port_id)
+{
+	struct pft_port_entry *pos;
+
+	list_for_each_entry(pos, &priv->ports_down, next)
+		if (pft_pe_port(pos) == port_id)
+			return true;
+
+	return false;
+}
+
+/*
+ * The primary if it is up, otherwise the first alternate that is up. With
+ * nothing available the primary is kept until the daemon fixes the entry.
+ */
+static port_id_t pfte_nhop_select(struct pff_ps_priv *priv,
+				  struct pft_entry *entry)
+{
+	struct pft_port_entry *pos;
+
+	if (!pft_is_port_down(priv, entry->port))
+		return entry->port;
+
+	list_for_each_entry(pos, &entry->alt_ports, next)
+		if (!pft_is_port_down(priv, pft_pe_port(pos)))
+			return pft_pe_port(pos);
+
+	return entry->port;
+}
+
 static int __pff_add(struct pff_ps *ps,
 		     struct pff_ps_priv *priv,
 		     struct mod_pff_entry *entry)
@@ -251,7 +283,6 @@ static int __pff_add(struct pff_ps *ps,
 	}
 
 	tmp->port = alts->ports[0];
-	tmp->nhop = tmp->port;
 
 	for (i = 1; i < alts->num_ports; i++) {
 		if (pfte_port_add(tmp, alts->ports[i])) {
@@ -260,6 +291,9 @@ static int __pff_add(struct pff_ps *ps,
 		}
 	}
 
+	/* The primary may already be known to be down */
+	tmp->nhop = pfte_nhop_select(priv, tmp);
+
 	return 0;
 }
 
@@ -363,68 +397,43 @@ static bool lfa_is_empty(struct pff_ps *ps)
 	return empty;
 }
 
-static bool pft_is_port_down(struct pff_ps_priv *priv,
-			     port_id_t port_id)
-{
-	struct pft_port_entry *pos;
-
-	list_for_each_entry(pos, &priv->ports_down, next)
-		if (pft_pe_port(pos) == port_id)
-			return true;
-
-	return false;
-}
-
 static int pft_port_up(struct pff_ps_priv *priv,
 		       port_id_t port_id)
 {
 	struct pft_entry *pos;
 	struct pft_port_entry *pos2, *next;
 
-	if (!react_to_flow_up) {
-		LOG_INFO("Port-id %d went up", port_id);
-		return 0;
-	}
-
 	ASSERT(is_port_id_ok(port_id));
 	ASSERT(priv);
 
 	spin_lock_bh(&priv->lock);
 
-	/* Remove port_id from list of ports that are down */
+	/*
+	 * Remove port_id from list of ports that are down, whatever
+	 * react_to_flow_up says: a later failover must be able to pick it
+	 */
 	list_for_each_entry_safe(pos2, next,
 				&priv->ports_down, next)
 		if (pft_pe_port(pos2) == port_id)
 			pft_pe_destroy(pos2);
 
+	if (!react_to_flow_up) {
+		spin_unlock_bh(&priv->lock);
+		LOG_INFO("Port-id %d went up", port_id);
+		return 0;
+	}
+
 	list_for_each_entry(pos, &priv->entries, next) {
 		/* Check if the primary port is being used */
 		if (pos->port == pos->nhop)
 			continue;
-		LOG_DBG("Recomputing nhop port-id for destination "
-				"address %u", pos->destination);
-		/* Primary is down, may be up again */
-		if (pos->port == port_id) {
-			LOG_DBG("Primary port-id %d is available again",
-				pos->port);
-			pos->nhop = pos->port;
-			continue;
-		} else {
-			/*
-			 * Alternate is needed, and now
-			 * one may be available
-			 */
-			list_for_each_entry(pos2,
-					    &pos->alt_ports, next) {
-				if (!pft_is_port_down(priv,
-						      pft_pe_port(pos2))) {
-					pos->nhop = pft_pe_port(pos2);
-					LOG_DBG("Found port-id %d", pos->nhop);
-					break;
-				}
-				LOG_DBG("No port-id is available");
-			}
-		}
+		/*
+		 * Primary is down or was: it may be up again, or a more
+		 * preferred alternate may now be available
+		 */
+		pos->nhop = pfte_nhop_select(priv, pos);
+		LOG_DBG("Destination address %u now uses port-id %d",
+			pos->destination, pos->nhop);
 	}
 
 	spin_unlock_bh(&priv->lock);
@@ -436,32 +445,31 @@ static int pft_port_down(struct pff_ps_priv *priv,
 {
 	struct pft_port_entry *pe;
 	struct pft_entry *pos;
-	struct pft_port_entry *pos2;
 
 	ASSERT(is_port_id_ok(port_id));
 	ASSERT(priv);
 
 	spin_lock_bh(&priv->lock);
 
+	/* Already handled, e.g. carrier loss followed by the unbinding */
+	if (pft_is_port_down(priv, port_id)) {
+		spin_unlock_bh(&priv->lock);
+		return 0;
+	}
+
 	/* Add port_id to list of ports that are down */
 	pe = pft_pe_create_ni(port_id);
+	if (!pe) {
+		spin_unlock_bh(&priv->lock);
+		return -1;
+	}
 	list_add(&pe->next, &priv->ports_down);
 
 	list_for_each_entry(pos, &priv->entries, next)
 		if (pos->nhop == port_id) {
-			LOG_DBG("Looking for an alternate port-id for "
-				"destination address %u", pos->destination);
-			/* See if there is an alternate */
-			list_for_each_entry(pos2, &pos->alt_ports, next) {
-				if (!pft_is_port_down(priv,
-						      pft_pe_port(pos2))) {
-					pos->nhop = pft_pe_port(pos2);
-					LOG_DBG("Found alternate port-id %d",
-						pos->nhop);
-					break;
-				}
-				LOG_DBG("No alternate port-id is available");
-			}
+			pos->nhop = pfte_nhop_select(priv, pos);
+			LOG_DBG("Destination address %u fails over to "
+				"port-id %d", pos->destination, pos->nhop);
 		}
 
 	spin_unlock_bh(&priv->lock);
@@ -680,6 +688,7 @@ static int lfa_dump(struct pff_ps *ps,
 
 		entry->fwd_info = pos->destination;
 		entry->qos_id = pos->qos_id;
+		entry->wildcard_bits = 0;
 		INIT_LIST_HEAD(&entry->port_id_altlists);
 		if (pfte_port_id_altlists_copy(pos, &entry->port_id_altlists)) {
 			rkfree(entry);
@@ -738,6 +747,7 @@ static void pff_ps_lfa_destroy(struct ps_base *bps)
 
 	if (bps) {
 		struct pff_ps_priv *priv;
+		struct pft_port_entry *pe, *next;
 
 		priv = (struct pff_ps_priv *) ps->priv;
 		if (!priv_is_ok(priv))
@@ -747,6 +757,9 @@ static void pff_ps_lfa_destroy(struct ps_base *bps)
 
 		__pft_flush(priv);
 
+		list_for_each_entry_safe(pe, next, &priv->ports_down, next)
+			pft_pe_destroy(pe);
+
 		spin_unlock_bh(&priv->lock);
 
 		rkfree(priv);
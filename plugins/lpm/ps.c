@@ -0,0 +1,813 @@
+/*
+ * Longest Prefix Match policy set for PFF
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <linux/export.h>
+#include <linux/module.h>
+#include <linux/string.h>
+#include <linux/bitops.h>
+
+#define RINA_PREFIX "pff-lpm"
+
+#include "logs.h"
+#include "rds/rmem.h"
+#include "rds/robjects.h"
+#include "pff-ps.h"
+#include "debug.h"
+
+#define LPM_ADDR_BITS 32
+
+/*
+ * Entries live in a path compressed binary trie (Patricia) keyed by address
+ * prefix: a lookup visits at most one node per prefix length in use on the
+ * way to the destination, whatever the number of entries. Nodes without
+ * entries are only kept to join two subtries.
+ */
+struct pft_port_entry {
+	port_id_t port_id;
+	struct list_head next;
+};
+
+struct pft_entry {
+	qos_id_t qos_id;
+	uint32_t cost;
+	struct list_head ports;
+	struct list_head next;
+};
+
+struct lpm_node {
+	address_t key;          /* Host bits are always 0 */
+	unsigned int plen;
+	struct lpm_node *child[2];
+	struct list_head entries;
+};
+
+struct pff_ps_priv {
+	spinlock_t lock;
+	struct lpm_node *root;
+	unsigned int prefixes;  /* Nodes with entries */
+	unsigned int nodes;
+	struct robject robj;
+};
+
+static inline address_t lpm_mask(unsigned int plen)
+{ return plen ? ~((address_t) 0) << (LPM_ADDR_BITS - plen) : 0; }
+
+/* The bit following a plen long prefix, plen < LPM_ADDR_BITS */
+static inline unsigned int lpm_bit(address_t addr, unsigned int plen)
+{ return (addr >> (LPM_ADDR_BITS - 1 - plen)) & 1; }
+
+static inline bool lpm_node_matches(struct lpm_node *node, address_t addr)
+{ return ((addr ^ node->key) & lpm_mask(node->plen)) == 0; }
+
+static struct pft_port_entry *pft_pe_create_ni(port_id_t port_id)
+{
+	struct pft_port_entry *tmp;
+
+	ASSERT(is_port_id_ok(port_id));
+
+	tmp = rkmalloc(sizeof(*tmp), GFP_ATOMIC);
+	if (!tmp)
+		return NULL;
+
+	tmp->port_id = port_id;
+	INIT_LIST_HEAD(&tmp->next);
+
+	return tmp;
+}
+
+static void pft_pe_destroy(struct pft_port_entry *pe)
+{
+	list_del(&pe->next);
+	rkfree(pe);
+}
+
+static struct pft_entry *pfte_create_ni(qos_id_t qos_id)
+{
+	struct pft_entry *tmp;
+
+	tmp = rkmalloc(sizeof(*tmp), GFP_ATOMIC);
+	if (!tmp)
+		return NULL;
+
+	tmp->qos_id = qos_id;
+	tmp->cost = 0;
+	INIT_LIST_HEAD(&tmp->ports);
+	INIT_LIST_HEAD(&tmp->next);
+
+	return tmp;
+}
+
+static void pfte_destroy(struct pft_entry *entry)
+{
+	struct pft_port_entry *pos, *next;
+
+	list_for_each_entry_safe(pos, next, &entry->ports, next)
+		pft_pe_destroy(pos);
+
+	list_del(&entry->next);
+	rkfree(entry);
+}
+
+static struct pft_port_entry *pfte_port_find(struct pft_entry *entry,
+					     port_id_t id)
+{
+	struct pft_port_entry *pos;
+
+	list_for_each_entry(pos, &entry->ports, next) {
+		if (pos->port_id == id)
+			return pos;
+	}
+
+	return NULL;
+}
+
+static int pfte_port_add(struct pft_entry *entry,
+			 port_id_t id)
+{
+	struct pft_port_entry *pe;
+
+	if (pfte_port_find(entry, id))
+		return 0;
+
+	pe = pft_pe_create_ni(id);
+	if (!pe)
+		return -1;
+
+	list_add(&pe->next, &entry->ports);
+
+	return 0;
+}
+
+static int pfte_ports_copy(struct pft_entry *entry,
+			   port_id_t **port_ids,
+			   size_t *entries)
+{
+	struct pft_port_entry *pos;
+	size_t count;
+	int i;
+
+	count = 0;
+	list_for_each_entry(pos, &entry->ports, next)
+		count++;
+
+	if (*entries != count) {
+		if (*entries > 0)
+			rkfree(*port_ids);
+		if (count > 0) {
+			*port_ids = rkmalloc(count * sizeof(**port_ids),
+					     GFP_ATOMIC);
+			if (!*port_ids) {
+				*entries = 0;
+				return -1;
+			}
+		}
+		*entries = count;
+	}
+
+	i = 0;
+	list_for_each_entry(pos, &entry->ports, next)
+		(*port_ids)[i++] = pos->port_id;
+
+	return 0;
+}
+
+static struct pft_entry *lpm_node_entry(struct lpm_node *node,
+					qos_id_t qos_id,
+					bool exact)
+{
+	struct pft_entry *pos;
+
+	list_for_each_entry(pos, &node->entries, next) {
+		if (pos->qos_id == qos_id || (!exact && pos->qos_id == 0))
+			return pos;
+	}
+
+	return NULL;
+}
+
+static struct lpm_node *lpm_node_create_ni(struct pff_ps_priv *priv,
+					   address_t key,
+					   unsigned int plen)
+{
+	struct lpm_node *tmp;
+
+	tmp = rkzalloc(sizeof(*tmp), GFP_ATOMIC);
+	if (!tmp)
+		return NULL;
+
+	tmp->key = key & lpm_mask(plen);
+	tmp->plen = plen;
+	INIT_LIST_HEAD(&tmp->entries);
+	priv->nodes++;
+
+	return tmp;
+}
+
+static void lpm_node_destroy(struct pff_ps_priv *priv,
+			     struct lpm_node *node)
+{
+	struct pft_entry *pos, *next;
+
+	if (!list_empty(&node->entries))
+		priv->prefixes--;
+
+	list_for_each_entry_safe(pos, next, &node->entries, next)
+		pfte_destroy(pos);
+
+	priv->nodes--;
+	rkfree(node);
+}
+
+/* Returns the node for key/plen, creating it (and a glue node) if needed */
+static struct lpm_node *lpm_node_get(struct pff_ps_priv *priv,
+				     address_t key,
+				     unsigned int plen)
+{
+	struct lpm_node **pp, *n, *new, *glue;
+	unsigned int common;
+
+	key &= lpm_mask(plen);
+	pp = &priv->root;
+
+	while (*pp) {
+		n = *pp;
+		common = min(plen, n->plen);
+		if ((key ^ n->key) & lpm_mask(common))
+			common = LPM_ADDR_BITS - 1 - __fls(key ^ n->key);
+
+		if (common == n->plen && common == plen)
+			return n;
+
+		if (common == n->plen) {
+			pp = &n->child[lpm_bit(key, n->plen)];
+			continue;
+		}
+
+		/* n has to hang below the new node, or below a glue node */
+		new = lpm_node_create_ni(priv, key, plen);
+		if (!new)
+			return NULL;
+
+		if (common == plen) {
+			new->child[lpm_bit(n->key, plen)] = n;
+			*pp = new;
+			return new;
+		}
+
+		glue = lpm_node_create_ni(priv, key, common);
+		if (!glue) {
+			lpm_node_destroy(priv, new);
+			return NULL;
+		}
+
+		glue->child[lpm_bit(n->key, common)] = n;
+		glue->child[lpm_bit(key, common)] = new;
+		*pp = glue;
+
+		return new;
+	}
+
+	*pp = lpm_node_create_ni(priv, key, plen);
+
+	return *pp;
+}
+
+/*
+ * Removes the node with no entries at *pp if it is not joining two subtries
+ * any more, returns true if it did
+ */
+static bool lpm_node_prune(struct pff_ps_priv *priv,
+			   struct lpm_node **pp)
+{
+	struct lpm_node *n = *pp;
+
+	if (!list_empty(&n->entries) || (n->child[0] && n->child[1]))
+		return false;
+
+	*pp = n->child[0] ? n->child[0] : n->child[1];
+	lpm_node_destroy(priv, n);
+
+	return true;
+}
+
+static struct pft_entry *lpm_lookup(struct pff_ps_priv *priv,
+				    address_t addr,
+				    qos_id_t qos_id)
+{
+	struct lpm_node *n;
+	struct pft_entry *best, *tmp;
+
+	best = NULL;
+	n = priv->root;
+	while (n && lpm_node_matches(n, addr)) {
+		tmp = lpm_node_entry(n, qos_id, false);
+		if (tmp && !list_empty(&tmp->ports))
+			best = tmp;
+
+		if (n->plen == LPM_ADDR_BITS)
+			break;
+
+		n = n->child[lpm_bit(addr, n->plen)];
+	}
+
+	return best;
+}
+
+static void __lpm_flush(struct pff_ps_priv *priv,
+			struct lpm_node *n)
+{
+	if (!n)
+		return;
+
+	/* Depth is bounded by the address length */
+	__lpm_flush(priv, n->child[0]);
+	__lpm_flush(priv, n->child[1]);
+	lpm_node_destroy(priv, n);
+}
+
+static void __pft_flush(struct pff_ps_priv *priv)
+{
+	__lpm_flush(priv, priv->root);
+	priv->root = NULL;
+}
+
+static unsigned int entry_plen(struct mod_pff_entry *entry)
+{
+	if (entry->wildcard_bits >= LPM_ADDR_BITS)
+		return 0;
+
+	return LPM_ADDR_BITS - entry->wildcard_bits;
+}
+
+static bool priv_is_ok(struct pff_ps_priv *priv)
+{ return priv != NULL; }
+
+static int __pff_add(struct pff_ps_priv *priv,
+		     struct mod_pff_entry *entry)
+{
+	struct lpm_node *n;
+	struct pft_entry *tmp;
+	struct port_id_altlist *alts;
+
+	n = lpm_node_get(priv, entry->fwd_info, entry_plen(entry));
+	if (!n)
+		return -1;
+
+	tmp = lpm_node_entry(n, entry->qos_id, true);
+	if (!tmp) {
+		tmp = pfte_create_ni(entry->qos_id);
+		if (!tmp)
+			return -1;
+
+		if (list_empty(&n->entries))
+			priv->prefixes++;
+		list_add(&tmp->next, &n->entries);
+	}
+	tmp->cost = entry->cost;
+
+	list_for_each_entry(alts, &entry->port_id_altlists, next) {
+		if (alts->num_ports < 1) {
+			LOG_INFO("Port id alternative set is empty");
+			continue;
+		}
+
+		/* Just add the first alternative and ignore the others. */
+		if (pfte_port_add(tmp, alts->ports[0]))
+			return -1;
+	}
+
+	return 0;
+}
+
+static int lpm_add(struct pff_ps *ps,
+		   struct mod_pff_entry *entry)
+{
+	struct pff_ps_priv *priv;
+	int result;
+
+	priv = (struct pff_ps_priv *) ps->priv;
+	if (!priv_is_ok(priv))
+		return -1;
+
+	if (!entry) {
+		LOG_ERR("Bogus output parameters, won't add");
+		return -1;
+	}
+
+	if (!is_qos_id_ok(entry->qos_id)) {
+		LOG_ERR("Bogus qos-id passed, cannot add");
+		return -1;
+	}
+
+	spin_lock_bh(&priv->lock);
+	result = __pff_add(priv, entry);
+	spin_unlock_bh(&priv->lock);
+
+	return result;
+}
+
+static int lpm_remove(struct pff_ps *ps,
+		      struct mod_pff_entry *entry)
+{
+	struct pff_ps_priv *priv;
+	struct lpm_node **path[LPM_ADDR_BITS + 2];
+	struct lpm_node **pp, *n;
+	struct port_id_altlist *alts;
+	struct pft_port_entry *pe;
+	struct pft_entry *tmp;
+	unsigned int plen;
+	address_t key;
+	int depth;
+
+	priv = (struct pff_ps_priv *) ps->priv;
+	if (!priv_is_ok(priv))
+		return -1;
+
+	if (!entry) {
+		LOG_ERR("Bogus output parameters, won't remove");
+		return -1;
+	}
+
+	if (!is_qos_id_ok(entry->qos_id)) {
+		LOG_ERR("Bogus qos-id passed, cannot remove");
+		return -1;
+	}
+
+	plen = entry_plen(entry);
+	key = entry->fwd_info & lpm_mask(plen);
+
+	spin_lock_bh(&priv->lock);
+
+	/* Remember the way down, to prune the nodes left empty */
+	depth = 0;
+	pp = &priv->root;
+	while ((n = *pp) && n->plen <= plen && lpm_node_matches(n, key)) {
+		path[depth++] = pp;
+		if (n->plen == plen)
+			break;
+		pp = &n->child[lpm_bit(key, n->plen)];
+	}
+
+	if (!n || n->plen != plen || n->key != key) {
+		spin_unlock_bh(&priv->lock);
+		return -1;
+	}
+
+	tmp = lpm_node_entry(n, entry->qos_id, true);
+	if (!tmp) {
+		spin_unlock_bh(&priv->lock);
+		return -1;
+	}
+
+	list_for_each_entry(alts, &entry->port_id_altlists, next) {
+		if (alts->num_ports < 1) {
+			LOG_INFO("Port id alternative set is empty");
+			continue;
+		}
+
+		pe = pfte_port_find(tmp, alts->ports[0]);
+		if (pe)
+			pft_pe_destroy(pe);
+	}
+
+	if (list_empty(&tmp->ports)) {
+		pfte_destroy(tmp);
+		if (list_empty(&n->entries))
+			priv->prefixes--;
+	}
+
+	while (depth > 0 && lpm_node_prune(priv, path[--depth]));
+
+	spin_unlock_bh(&priv->lock);
+
+	return 0;
+}
+
+static bool lpm_is_empty(struct pff_ps *ps)
+{
+	struct pff_ps_priv *priv;
+	bool empty;
+
+	priv = (struct pff_ps_priv *) ps->priv;
+	if (!priv_is_ok(priv))
+		return false;
+
+	spin_lock_bh(&priv->lock);
+	empty = priv->root == NULL;
+	spin_unlock_bh(&priv->lock);
+
+	return empty;
+}
+
+static int lpm_flush(struct pff_ps *ps)
+{
+	struct pff_ps_priv *priv;
+
+	priv = (struct pff_ps_priv *) ps->priv;
+	if (!priv_is_ok(priv))
+		return -1;
+
+	spin_lock_bh(&priv->lock);
+	__pft_flush(priv);
+	spin_unlock_bh(&priv->lock);
+
+	return 0;
+}
+
+static int lpm_nhop(struct pff_ps *ps,
+		    struct pci *pci,
+		    port_id_t **ports,
+		    size_t *count)
+{
+	struct pff_ps_priv *priv;
+	address_t destination;
+	qos_id_t qos_id;
+	struct pft_entry *tmp;
+
+	priv = (struct pff_ps_priv *) ps->priv;
+	if (!priv_is_ok(priv))
+		return -1;
+
+	destination = pci_destination(pci);
+	if (!is_address_ok(destination)) {
+		LOG_ERR("Bogus destination address, cannot get NHOP");
+		return -1;
+	}
+
+	qos_id = pci_qos_id(pci);
+	if (!is_qos_id_ok(qos_id)) {
+		LOG_ERR("Bogus qos-id, cannot get NHOP");
+		return -1;
+	}
+
+	if (!ports || !count) {
+		LOG_ERR("Bogus output parameters, won't get NHOP");
+		return -1;
+	}
+
+	spin_lock_bh(&priv->lock);
+
+	tmp = lpm_lookup(priv, destination, qos_id);
+	if (!tmp) {
+		LOG_ERR("No entry for addr %u, qos_id %d", destination, qos_id);
+		spin_unlock_bh(&priv->lock);
+		return -1;
+	}
+
+	if (pfte_ports_copy(tmp, ports, count)) {
+		spin_unlock_bh(&priv->lock);
+		return -1;
+	}
+
+	spin_unlock_bh(&priv->lock);
+
+	return 0;
+}
+
+static int pfte_port_id_altlists_copy(struct pft_entry *entry,
+				      struct list_head *port_id_altlists)
+{
+	struct pft_port_entry *pos;
+	struct port_id_altlist *alt;
+
+	list_for_each_entry(pos, &entry->ports, next) {
+		alt = rkmalloc(sizeof(*alt), GFP_ATOMIC);
+		if (!alt)
+			return -1;
+
+		alt->ports = rkmalloc(sizeof(*(alt->ports)), GFP_ATOMIC);
+		if (!alt->ports) {
+			rkfree(alt);
+			return -1;
+		}
+
+		alt->ports[0] = pos->port_id;
+		alt->num_ports = 1;
+
+		list_add_tail(&alt->next, port_id_altlists);
+	}
+
+	return 0;
+}
+
+static int __lpm_dump(struct lpm_node *n,
+		      struct list_head *entries)
+{
+	struct pft_entry *pos;
+	struct mod_pff_entry *entry;
+
+	if (!n)
+		return 0;
+
+	list_for_each_entry(pos, &n->entries, next) {
+		entry = rkmalloc(sizeof(*entry), GFP_ATOMIC);
+		if (!entry)
+			return -1;
+
+		entry->fwd_info = n->key;
+		entry->qos_id = pos->qos_id;
+		entry->cost = pos->cost;
+		entry->wildcard_bits = LPM_ADDR_BITS - n->plen;
+		INIT_LIST_HEAD(&entry->port_id_altlists);
+		if (pfte_port_id_altlists_copy(pos,
+					       &entry->port_id_altlists)) {
+			rkfree(entry);
+			return -1;
+		}
+
+		list_add(&entry->next, entries);
+	}
+
+	if (__lpm_dump(n->child[0], entries))
+		return -1;
+
+	return __lpm_dump(n->child[1], entries);
+}
+
+static int lpm_dump(struct pff_ps *ps,
+		    struct list_head *entries)
+{
+	struct pff_ps_priv *priv;
+	int ret;
+
+	priv = (struct pff_ps_priv *) ps->priv;
+	if (!priv_is_ok(priv))
+		return -1;
+
+	spin_lock_bh(&priv->lock);
+	ret = __lpm_dump(priv->root, entries);
+	spin_unlock_bh(&priv->lock);
+
+	return ret;
+}
+
+static int lpm_modify(struct pff_ps *ps,
+		      struct list_head *entries)
+{
+	struct pff_ps_priv *priv;
+	struct mod_pff_entry *entry;
+
+	priv = (struct pff_ps_priv *) ps->priv;
+	if (!priv_is_ok(priv))
+		return -1;
+
+	spin_lock_bh(&priv->lock);
+
+	__pft_flush(priv);
+
+	list_for_each_entry(entry, entries, next) {
+		if (!is_qos_id_ok(entry->qos_id))
+			continue;
+
+		__pff_add(priv, entry);
+	}
+
+	spin_unlock_bh(&priv->lock);
+
+	return 0;
+}
+
+static ssize_t lpm_ps_attr_show(struct robject *robj,
+				struct robj_attribute *attr,
+				char *buf)
+{
+	struct pff_ps_priv *priv;
+
+	priv = container_of(robj, struct pff_ps_priv, robj);
+
+	if (strcmp(robject_attr_name(attr), "prefixes") == 0)
+		return sprintf(buf, "%u\n", READ_ONCE(priv->prefixes));
+	if (strcmp(robject_attr_name(attr), "nodes") == 0)
+		return sprintf(buf, "%u\n", READ_ONCE(priv->nodes));
+
+	return 0;
+}
+RINA_SYSFS_OPS(lpm_ps);
+RINA_ATTRS(lpm_ps, prefixes, nodes);
+RINA_KTYPE(lpm_ps);
+
+static struct ps_base *
+pff_ps_lpm_create(struct rina_component *component)
+{
+	struct pff_ps *ps;
+	struct pff_ps_priv *priv;
+	struct pff *pff = pff_from_component(component);
+
+	priv = rkzalloc(sizeof(*priv), GFP_KERNEL);
+	if (!priv)
+		return NULL;
+
+	spin_lock_init(&priv->lock);
+	priv->root = NULL;
+
+	ps = rkzalloc(sizeof(*ps), GFP_KERNEL);
+	if (!ps) {
+		rkfree(priv);
+		return NULL;
+	}
+
+	if (robject_rset_init_and_add(&priv->robj, &lpm_ps_rtype,
+				      pff_rset(pff), "lpm")) {
+		rkfree(ps);
+		rkfree(priv);
+		return NULL;
+	}
+
+	ps->base.set_policy_set_param = NULL; /* default */
+	ps->dm = pff;
+	ps->priv = (void *) priv;
+
+	ps->pff_add = lpm_add;
+	ps->pff_remove = lpm_remove;
+	ps->pff_port_state_change = NULL;
+	ps->pff_is_empty = lpm_is_empty;
+	ps->pff_flush = lpm_flush;
+	ps->pff_nhop = lpm_nhop;
+	ps->pff_dump = lpm_dump;
+	ps->pff_modify = lpm_modify;
+
+	return &ps->base;
+}
+
+static void pff_ps_lpm_destroy(struct ps_base *bps)
+{
+	struct pff_ps *ps = container_of(bps, struct pff_ps, base);
+
+	if (bps) {
+		struct pff_ps_priv *priv;
+
+		priv = (struct pff_ps_priv *) ps->priv;
+		if (!priv_is_ok(priv))
+			return;
+
+		robject_del(&priv->robj);
+
+		spin_lock_bh(&priv->lock);
+		__pft_flush(priv);
+		spin_unlock_bh(&priv->lock);
+
+		rkfree(priv);
+		rkfree(ps);
+	}
+}
+
+struct ps_factory pff_factory = {
+	.owner   = THIS_MODULE,
+	.create  = pff_ps_lpm_create,
+	.destroy = pff_ps_lpm_destroy,
+};
+
+#define RINA_PFF_LPM_NAME "lpm"
+
+static int __init mod_init(void)
+{
+	int ret;
+
+	strcpy(pff_factory.name, RINA_PFF_LPM_NAME);
+
+	ret = pff_ps_publish(&pff_factory);
+	if (ret) {
+		LOG_ERR("Failed to publish policy set factory");
+		return -1;
+	}
+
+	LOG_INFO("PFF LPM policy set loaded successfully");
+
+	return 0;
+}
+
+static void __exit mod_exit(void)
+{
+	int ret;
+
+	ret = pff_ps_unpublish(RINA_PFF_LPM_NAME);
+
+	if (ret) {
+		LOG_ERR("Failed to unpublish policy set factory");
+		return;
+	}
+
+	LOG_INFO("PFF LPM policy set unloaded successfully");
+}
+
+module_init(mod_init);
+module_exit(mod_exit);
+
+MODULE_DESCRIPTION("PFF longest prefix match policy set");
+
+MODULE_LICENSE("GPL");
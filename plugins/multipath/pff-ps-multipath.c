@@ -21,9 +21,13 @@
 #include <linux/export.h>
 #include <linux/module.h>
 #include <linux/string.h>
-#include <linux/crc16.h>
+#include <linux/jhash.h>
 #include <linux/random.h>
 #include <linux/list.h>
+#include <linux/hashtable.h>
+#include <linux/kernel.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
 #include <linux/types.h>
 #include <linux/slab.h>
 
@@ -31,19 +35,59 @@
 
 #include "logs.h"
 #include "rds/rmem.h"
+#include "rds/robjects.h"
 #include "pff-ps.h"
 #include "pff.h"
+#include "rmt.h"
+#include "policies.h"
 #include "debug.h"
 
+/* Weight of a cost 1 path, a cost c path gets MP_WEIGHT_SCALE / c */
+#define MP_WEIGHT_SCALE      1024
+/* Must be a power of two */
+#define MP_FLOWLET_BUCKETS   1024
+#define MP_PORT_HASHBITS     4
+#define MP_DEFAULT_WEIGHTED  1
+/* Flowlet switching is off by default, flows stick to their hashed path */
+#define MP_DEFAULT_GAP_US    0
+
+/*
+ * Per N-1 port counters, shared by all the entries using the port. Freed
+ * when the last path using the port goes away.
+ */
+struct mp_port_stats {
+        port_id_t         port_id;
+        unsigned int      refs;     /* paths pointing here */
+        unsigned long     tx_pdus;
+        unsigned long     flowlets; /* flowlets started on the port */
+        unsigned long     moves;    /* flowlets moved in from another port */
+        struct hlist_node hnode;
+};
+
+/* Selection table of an entry, weight_end is the cumulative weight */
+struct mp_path {
+        port_id_t              port_id;
+        u32                    weight_end;
+        struct mp_port_stats * stats;
+};
+
+struct mp_flowlet {
+        u32       hash;
+        port_id_t port_id;
+        u64       last_ns;
+};
+
 
 /* FIXME: This representation is crappy and MUST be changed */
 struct pft_port_entry {
         port_id_t        port_id;
+        uint32_t         cost;
         struct list_head next;
 };
 
 static struct pft_port_entry * pft_pe_create_gfp(gfp_t     flags,
-                                                 port_id_t port_id)
+                                                 port_id_t port_id,
+                                                 uint32_t  cost)
 {
         struct pft_port_entry * tmp;
 
@@ -54,13 +98,15 @@ static struct pft_port_entry * pft_pe_create_gfp(gfp_t     flags,
                 return NULL;
 
         tmp->port_id = port_id;
+        tmp->cost    = cost;
         INIT_LIST_HEAD(&tmp->next);
 
         return tmp;
 }
 
-static struct pft_port_entry * pft_pe_create_ni(port_id_t port_id)
-{ return pft_pe_create_gfp(GFP_ATOMIC, port_id); }
+static struct pft_port_entry * pft_pe_create_ni(port_id_t port_id,
+                                                uint32_t  cost)
+{ return pft_pe_create_gfp(GFP_ATOMIC, port_id, cost); }
 
 /* FIXME: This thing is bogus and has to be fixed properly */
 #ifdef CONFIG_RINA_ASSERTIONS
@@ -88,6 +134,10 @@ struct pft_entry {
         address_t        destination;
         qos_id_t         qos_id;
         struct list_head ports;
+        /* Rebuilt from ports on every change, see pfte_paths_build() */
+        struct mp_path * paths;
+        unsigned int     npaths;
+        u32              total_weight;
         struct list_head next;
 };
 
@@ -103,6 +153,9 @@ static struct pft_entry * pfte_create_gfp(gfp_t     flags,
 
         tmp->destination = destination;
         tmp->qos_id      = qos_id;
+        tmp->paths       = NULL;
+        tmp->npaths      = 0;
+        tmp->total_weight = 0;
         INIT_LIST_HEAD(&tmp->ports);
         INIT_LIST_HEAD(&tmp->next);
 
@@ -119,6 +172,20 @@ static bool pfte_is_ok(struct pft_entry * entry)
 { return entry ? true : false; }
 #endif
 
+static void mp_paths_put(struct mp_path * paths, unsigned int n)
+{
+        unsigned int i;
+
+        for (i = 0; i < n; i++) {
+                if (--paths[i].stats->refs)
+                        continue;
+                hash_del(&paths[i].stats->hnode);
+                rkfree(paths[i].stats);
+        }
+
+        rkfree(paths);
+}
+
 static void pfte_destroy(struct pft_entry * entry)
 {
         struct pft_port_entry * pos, * next;
@@ -129,6 +196,8 @@ static void pfte_destroy(struct pft_entry * entry)
                 pft_pe_destroy(pos);
         }
 
+        if (entry->paths)
+                mp_paths_put(entry->paths, entry->npaths);
         list_del(&entry->next);
         rkfree(entry);
 }
@@ -149,17 +218,20 @@ static struct pft_port_entry * pfte_port_find(struct pft_entry * entry,
 }
 
 static int pfte_port_add(struct pft_entry * entry,
-                         port_id_t          id)
+                         port_id_t          id,
+                         uint32_t           cost)
 {
         struct pft_port_entry * pe;
 
         ASSERT(pfte_is_ok(entry));
 
         pe = pfte_port_find(entry, id);
-        if (pe)
+        if (pe) {
+                pe->cost = cost;
                 return 0;
+        }
 
-        pe = pft_pe_create_ni(id);
+        pe = pft_pe_create_ni(id, cost);
         if (!pe)
                 return -1;
 
@@ -185,7 +257,7 @@ static void pfte_port_remove(struct pft_entry * entry,
 
 }
 
-static int pfte_ports_copy(struct  pft_port_entry * port,
+static int pfte_ports_copy(struct mp_path *   path,
                            port_id_t **       port_ids,
                            size_t *           entries)
 {
@@ -208,14 +280,21 @@ static int pfte_ports_copy(struct  pft_port_entry * port,
                 *entries = count;
         }
 
-        (*port_ids)[0] = pft_pe_port(port);
+        (*port_ids)[0] = path->port_id;
 
         return 0;
 }
 
 struct pff_ps_priv {
-        spinlock_t       lock;
-        struct list_head entries;
+        spinlock_t          lock;
+        struct list_head    entries;
+        struct rmt *        rmt;
+        u32                 seed;
+        bool                weighted;
+        unsigned int        flowlet_gap_us;
+        struct mp_flowlet * flowlets;
+        DECLARE_HASHTABLE(ports, MP_PORT_HASHBITS);
+        struct robject      robj;
 };
 
 static bool priv_is_ok(struct pff_ps_priv * priv)
@@ -241,6 +320,132 @@ static struct pft_entry * pft_find(struct pff_ps_priv * priv,
         return NULL;
 }
 
+static struct mp_port_stats * mp_port_stats_get(struct pff_ps_priv * priv,
+                                                port_id_t            port_id)
+{
+        struct mp_port_stats * pos;
+
+        hash_for_each_possible(priv->ports, pos, hnode, port_id) {
+                if (pos->port_id == port_id) {
+                        pos->refs++;
+                        return pos;
+                }
+        }
+
+        pos = rkzalloc(sizeof(*pos), GFP_ATOMIC);
+        if (!pos)
+                return NULL;
+
+        pos->port_id = port_id;
+        pos->refs    = 1;
+        hash_add(priv->ports, &pos->hnode, port_id);
+
+        return pos;
+}
+
+static u32 mp_weight(struct pff_ps_priv * priv, uint32_t cost)
+{
+        if (!priv->weighted || cost <= 1)
+                return MP_WEIGHT_SCALE;
+
+        return max_t(u32, MP_WEIGHT_SCALE / cost, 1);
+}
+
+/*
+ * Lays the ports of the entry out in an array, each one owning a share of
+ * [0, total_weight) proportional to the inverse of its routing cost
+ */
+static int pfte_paths_build(struct pff_ps_priv * priv,
+                            struct pft_entry *   entry)
+{
+        struct pft_port_entry * pos;
+        struct mp_path *        paths;
+        unsigned int            n;
+        u32                     total;
+
+        n = 0;
+        list_for_each_entry(pos, &entry->ports, next) {
+                n++;
+        }
+
+        paths = NULL;
+        if (n) {
+                paths = rkmalloc(n * sizeof(*paths), GFP_ATOMIC);
+                if (!paths)
+                        return -1;
+        }
+
+        n     = 0;
+        total = 0;
+        list_for_each_entry(pos, &entry->ports, next) {
+                paths[n].stats = mp_port_stats_get(priv, pos->port_id);
+                if (!paths[n].stats) {
+                        mp_paths_put(paths, n);
+                        return -1;
+                }
+                total += mp_weight(priv, pos->cost);
+                paths[n].port_id    = pos->port_id;
+                paths[n].weight_end = total;
+                n++;
+        }
+
+        /* After taking the new references, so shared stats survive */
+        if (entry->paths)
+                mp_paths_put(entry->paths, entry->npaths);
+        entry->paths        = paths;
+        entry->npaths       = n;
+        entry->total_weight = total;
+
+        return 0;
+}
+
+static int __pft_paths_rebuild(struct pff_ps_priv * priv)
+{
+        struct pft_entry * pos;
+
+        list_for_each_entry(pos, &priv->entries, next) {
+                if (pfte_paths_build(priv, pos))
+                        return -1;
+        }
+
+        return 0;
+}
+
+static ssize_t mp_ps_attr_show(struct robject *        robj,
+                               struct robj_attribute * attr,
+                               char *                  buf)
+{
+        struct pff_ps_priv *   priv;
+        struct mp_port_stats * pos;
+        ssize_t                len;
+        int                    bkt;
+
+        priv = container_of(robj, struct pff_ps_priv, robj);
+
+        if (strcmp(robject_attr_name(attr), "weighted") == 0)
+                return sprintf(buf, "%u\n", priv->weighted ? 1 : 0);
+        if (strcmp(robject_attr_name(attr), "flowlet_gap_us") == 0)
+                return sprintf(buf, "%u\n", priv->flowlet_gap_us);
+        if (strcmp(robject_attr_name(attr), "paths") == 0) {
+                /* One line per N-1 port: port tx_pdus flowlets moves */
+                len = 0;
+                spin_lock_bh(&priv->lock);
+                hash_for_each(priv->ports, bkt, pos, hnode) {
+                        len += scnprintf(buf + len, PAGE_SIZE - len,
+                                         "%d %lu %lu %lu\n", pos->port_id,
+                                         pos->tx_pdus, pos->flowlets,
+                                         pos->moves);
+                }
+                spin_unlock_bh(&priv->lock);
+                return len;
+        }
+
+        return 0;
+}
+RINA_SYSFS_OPS(mp_ps);
+RINA_ATTRS(mp_ps, weighted, flowlet_gap_us, paths);
+RINA_KTYPE(mp_ps);
+
 static int __pff_add(struct pff_ps *        ps,
 		     struct pff_ps_priv * priv,
 		     struct mod_pff_entry * entry)
@@ -264,12 +469,17 @@ static int __pff_add(struct pff_ps *        ps,
 			continue;
 		}
 
-                if (pfte_port_add(tmp, alts->ports[0])) {
+                if (pfte_port_add(tmp, alts->ports[0], entry->cost)) {
                         pfte_destroy(tmp);
                         return -1;
                 }
 	}
 
+        if (pfte_paths_build(priv, tmp)) {
+                pfte_destroy(tmp);
+                return -1;
+        }
+
 	return 0;
 }
 
@@ -354,6 +564,9 @@ static int mp_remove(struct pff_ps *        ps,
 	
         if (list_empty(&tmp->ports)) {
                 pfte_destroy(tmp);
+        } else if (pfte_paths_build(priv, tmp)) {
+                /* Stale paths would still point to the removed ports */
+                pfte_destroy(tmp);
         }
 	
 
@@ -408,59 +621,139 @@ static int mp_flush(struct pff_ps * ps)
 
 
 
-/**
- * @brief Selects the next hop pft_entry from a list based
- * on hash-threshold algorithm
- * @param entry_list: list of possible next hop pft_entries
- * @param pci: PCI to extract the source & dest address and QoS
- * of the PDU
- * @return pointer to selected pft_entry
+/* Hash of the connection the PDU belongs to, stable for the whole flow */
+static u32 mp_flow_hash(struct pci * pci, u32 seed)
+{
+        return jhash_3words((u32) pci_cep_source(pci),
+                            (u32) pci_cep_destination(pci),
+                            (u32) pci_qos_id(pci),
+                            jhash_2words((u32) pci_source(pci),
+                                         (u32) pci_destination(pci),
+                                         seed));
+}
+
+/* Weighted hash-threshold: the share of [0, total_weight) the hash maps to */
+static struct mp_path * mp_path_by_hash(struct pft_entry * entry,
+                                        u32                hash)
+{
+        unsigned int i;
+        u32          region;
+
+        if (!entry->npaths)
+                return NULL;
+
+        region = reciprocal_scale(hash, entry->total_weight);
+        for (i = 0; i < entry->npaths - 1; i++) {
+                if (region < entry->paths[i].weight_end)
+                        break;
+        }
+
+        return &entry->paths[i];
+}
+
+static struct mp_path * mp_path_by_port(struct pft_entry * entry,
+                                        port_id_t          port_id)
+{
+        unsigned int i;
+
+        for (i = 0; i < entry->npaths; i++) {
+                if (entry->paths[i].port_id == port_id)
+                        return &entry->paths[i];
+        }
+
+        return NULL;
+}
+
+static u32 mp_path_weight(struct pft_entry * entry,
+                          struct mp_path *   path)
+{
+        if (path == entry->paths)
+                return path->weight_end;
+
+        return path->weight_end - (path - 1)->weight_end;
+}
+
+/*
+ * Picks the path with the lowest RMT backlog relative to its weight, ties
+ * (e.g. all the queues empty) keep the hashed path
  */
-struct pft_port_entry * select_entry(struct pft_entry * entry,
-                                struct pci * pci)
+static struct mp_path * mp_path_least_loaded(struct pff_ps_priv * priv,
+                                             struct pft_entry *   entry,
+                                             struct mp_path *     hashed)
 {
-        int num_entries;
-        struct pft_port_entry * pos;
-        int i;
-
-        unsigned short hash_key;
-        const int KEYSPACE = 0xFFFF;
-        int region_size;
-        unsigned short region;
-        
-	typedef struct {
-		address_t pci_source;
-		address_t pci_destination;
-		address_t pci_qos_id;
-		cep_id_t  pci_cep_source;
-		cep_id_t  pci_cep_destination;
-	} connection_id;
-	connection_id c_id;
-
-	c_id.pci_source = pci_source(pci);
-	c_id.pci_destination = pci_destination(pci);
-	c_id.pci_qos_id = pci_qos_id(pci);
-	c_id.pci_cep_source = pci_cep_source(pci);
-	c_id.pci_cep_destination = pci_cep_destination(pci);
-
-        num_entries = 0;
-        list_for_each_entry(pos, &entry->ports, next) {
-                num_entries++;
-        }
-        
-        hash_key = crc16(0, (const u8 *)&c_id, sizeof(c_id));
-        
-        region_size = KEYSPACE / num_entries;
-        region = hash_key / region_size;
-        
-        i = 0;
-        list_for_each_entry(pos, &entry->ports, next) {
-                if (region == i++) {
-                        return pos;
+        struct mp_path * best;
+        u64              best_load, load;
+        unsigned int     i;
+        int              backlog;
+
+        best      = hashed;
+        backlog   = rmt_n1port_backlog(priv->rmt, hashed->port_id);
+        best_load = backlog < 0 ? U64_MAX :
+                div_u64((u64) backlog * MP_WEIGHT_SCALE,
+                        mp_path_weight(entry, hashed));
+        if (!best_load)
+                return best;
+
+        for (i = 0; i < entry->npaths; i++) {
+                if (&entry->paths[i] == hashed)
+                        continue;
+
+                backlog = rmt_n1port_backlog(priv->rmt,
+                                             entry->paths[i].port_id);
+                if (backlog < 0)
+                        continue;
+
+                load = div_u64((u64) backlog * MP_WEIGHT_SCALE,
+                               mp_path_weight(entry, &entry->paths[i]));
+                if (load < best_load) {
+                        best      = &entry->paths[i];
+                        best_load = load;
                 }
         }
-        
-        return pos;
+
+        return best;
+}
+
+/*
+ * PDUs of a flow keep their path while they are closer than flowlet_gap_us.
+ * After a longer pause the next burst (a new flowlet) can be moved to the
+ * least loaded path without reordering, provided the gap exceeds the delay
+ * skew between the paths.
+ */
+static struct mp_path * mp_path_by_flowlet(struct pff_ps_priv * priv,
+                                           struct pft_entry *   entry,
+                                           u32                  hash)
+{
+        struct mp_flowlet * fl;
+        struct mp_path *    path;
+        u64                 now;
+
+        fl  = &priv->flowlets[hash & (MP_FLOWLET_BUCKETS - 1)];
+        now = ktime_get_ns();
+
+        if (fl->hash == hash &&
+            now - fl->last_ns < (u64) priv->flowlet_gap_us * NSEC_PER_USEC) {
+                path = mp_path_by_port(entry, fl->port_id);
+                if (path) {
+                        fl->last_ns = now;
+                        return path;
+                }
+        }
+
+        path = mp_path_by_hash(entry, hash);
+        if (!path)
+                return NULL;
+
+        path = mp_path_least_loaded(priv, entry, path);
+        if (fl->hash == hash && fl->port_id != path->port_id)
+                path->stats->moves++;
+        path->stats->flowlets++;
+
+        fl->hash    = hash;
+        fl->port_id = path->port_id;
+        fl->last_ns = now;
+
+        return path;
 }
 
 static int mp_next_hop(struct pff_ps * ps,
@@ -472,7 +765,8 @@ static int mp_next_hop(struct pff_ps * ps,
         address_t               destination;
         qos_id_t                qos_id;
         struct pft_entry *      tmp;
-	struct pft_port_entry * port;
+	struct mp_path *        path;
+        u32                     hash;
 
         priv = (struct pff_ps_priv *) ps->priv;
         if (priv == NULL) {
@@ -510,22 +804,23 @@ static int mp_next_hop(struct pff_ps * ps,
                 return -1;
         }
 
-        /* 
-         * Hash-threshold algorithm based on
-         * CRC16 Linux kernel implementation
-        */
-        port = select_entry(tmp, pci);
-	if (!port) {
+        hash = mp_flow_hash(pci, priv->seed);
+        if (priv->flowlet_gap_us)
+                path = mp_path_by_flowlet(priv, tmp, hash);
+        else
+                path = mp_path_by_hash(tmp, hash);
+	if (!path) {
                 LOG_ERR("Could not select destination port for dest "
                          "address %u and qos_id %d", destination, qos_id);
                 spin_unlock_bh(&priv->lock);
                 return -1;
          }
 
-        if (pfte_ports_copy(port, ports, count)) {
+        if (pfte_ports_copy(path, ports, count)) {
                 spin_unlock_bh(&priv->lock);
                 return -1;
         }
+        path->stats->tx_pdus++;
 
         spin_unlock_bh(&priv->lock);
 	
@@ -563,6 +858,20 @@ static int pfte_port_id_altlists_copy(struct pft_entry * entry,
         return 0;
 }
 
+/* Entries hold a single cost, report the one of the cheapest path */
+static uint32_t pfte_cost(struct pft_entry * entry)
+{
+        struct pft_port_entry * pos;
+        uint32_t                cost;
+
+        cost = U32_MAX;
+        list_for_each_entry(pos, &entry->ports, next) {
+                cost = min(cost, pos->cost);
+        }
+
+        return cost == U32_MAX ? 0 : cost;
+}
+
 static int mp_dump(struct pff_ps *    ps,
                         struct list_head * entries)
 {
@@ -584,6 +893,8 @@ static int mp_dump(struct pff_ps *    ps,
 
                 entry->fwd_info = pos->destination;
                 entry->qos_id = pos->qos_id;
+                entry->wildcard_bits = 0;
+                entry->cost = pfte_cost(pos);
 		INIT_LIST_HEAD(&entry->port_id_altlists);
                 if (pfte_port_id_altlists_copy(pos, &entry->port_id_altlists)) {
                         rkfree(entry);
@@ -630,14 +941,14 @@ int mp_modify(struct pff_ps *    ps,
         return 0;
 }
 
-/* NOTE: This is skeleton code that was directly copy pasted */
 static int pff_ps_set_policy_set_param(struct ps_base * bps,
                                        const char *     name,
                                        const char *     value)
 {
-        struct pff_ps * ps = container_of(bps, struct pff_ps, base);
-
-        (void) ps;
+        struct pff_ps *      ps = container_of(bps, struct pff_ps, base);
+        struct pff_ps_priv * priv = ps->priv;
+        unsigned int         uval;
+        int                  ret;
 
         if (!name) {
                 LOG_ERR("Null parameter name");
@@ -649,9 +960,46 @@ static int pff_ps_set_policy_set_param(struct ps_base * bps,
                 return -1;
         }
 
-        LOG_ERR("No such parameter to set");
+        ret = kstrtouint(value, 10, &uval);
+        if (ret) {
+                LOG_ERR("Invalid value '%s' for parameter %s", value, name);
+                return -1;
+        }
+
+        if (strcmp(name, "weighted") == 0) {
+                spin_lock_bh(&priv->lock);
+                priv->weighted = !!uval;
+                ret = __pft_paths_rebuild(priv);
+                spin_unlock_bh(&priv->lock);
+                if (ret) {
+                        LOG_ERR("Could not rebuild the path tables");
+                        return -1;
+                }
+        } else if (strcmp(name, "flowlet_gap_us") == 0) {
+                spin_lock_bh(&priv->lock);
+                priv->flowlet_gap_us = uval;
+                spin_unlock_bh(&priv->lock);
+        } else {
+                LOG_ERR("Unknown parameter %s", name);
+                return -1;
+        }
 
-        return -1;
+        return 0;
+}
+
+static void mp_load_param(struct pff_ps *           ps,
+                          const struct rmt_config * rmt_cfg,
+                          const char *              name)
+{
+        struct policy_parm * parm;
+
+        parm = policy_param_find(rmt_cfg->pff_conf->policy_set, name);
+        if (!parm)
+                return;
+
+        pff_ps_set_policy_set_param(&ps->base,
+                                    policy_param_name(parm),
+                                    policy_param_value(parm));
 }
 
 static struct ps_base *
@@ -660,6 +1008,7 @@ pff_ps_multipath_create(struct rina_component * component)
         struct pff_ps * ps;
         struct pff_ps_priv * priv;
         struct pff * pff = pff_from_component(component);
+        const struct rmt_config * rmt_cfg;
 
         priv = rkzalloc(sizeof(*priv), GFP_KERNEL);
         if (!priv) {
@@ -669,13 +1018,34 @@ pff_ps_multipath_create(struct rina_component * component)
         spin_lock_init(&priv->lock);
 
         INIT_LIST_HEAD(&priv->entries);
+        hash_init(priv->ports);
+        priv->rmt            = pff_rmt_get(pff);
+        priv->seed           = prandom_u32();
+        priv->weighted       = MP_DEFAULT_WEIGHTED;
+        priv->flowlet_gap_us = MP_DEFAULT_GAP_US;
+
+        priv->flowlets = rkzalloc(MP_FLOWLET_BUCKETS *
+                                  sizeof(*priv->flowlets), GFP_KERNEL);
+        if (!priv->flowlets) {
+                rkfree(priv);
+                return NULL;
+        }
 
         ps = rkzalloc(sizeof(*ps), GFP_KERNEL);
         if (!ps) {
+                rkfree(priv->flowlets);
         	rkfree(priv);
                 return NULL;
         }
 
+        if (robject_rset_init_and_add(&priv->robj, &mp_ps_rtype,
+                                      pff_rset(pff), "multipath")) {
+                rkfree(ps);
+                rkfree(priv->flowlets);
+                rkfree(priv);
+                return NULL;
+        }
+
         ps->base.set_policy_set_param = pff_ps_set_policy_set_param;
         ps->dm = pff;
         ps->priv = (void *) priv;
@@ -688,6 +1058,13 @@ pff_ps_multipath_create(struct rina_component * component)
         ps->pff_dump = mp_dump;
         ps->pff_modify = mp_modify;
 
+        /* RMT config is available at assign-to-dif time only */
+        rmt_cfg = priv->rmt ? rmt_config_get(priv->rmt) : NULL;
+        if (rmt_cfg && rmt_cfg->pff_conf) {
+                mp_load_param(ps, rmt_cfg, "weighted");
+                mp_load_param(ps, rmt_cfg, "flowlet_gap_us");
+        }
+
         return &ps->base;
 }
 
@@ -696,19 +1073,30 @@ static void pff_ps_multipath_destroy(struct ps_base * bps)
 	struct pff_ps * ps = container_of(bps, struct pff_ps, base);
 
         if (bps) {
-                struct pff_ps_priv * priv;
+                struct pff_ps_priv *   priv;
+                struct mp_port_stats * pos;
+                struct hlist_node *    tmp;
+                int                    bkt;
 
                 priv = (struct pff_ps_priv *) ps->priv;
                 if(!priv_is_ok(priv)) {
                         return;
                 }
 
+                robject_del(&priv->robj);
+
                 spin_lock_bh(&priv->lock);
 
                 __pft_flush(priv);
 
+                hash_for_each_safe(priv->ports, bkt, tmp, pos, hnode) {
+                        hash_del(&pos->hnode);
+                        rkfree(pos);
+                }
+
                 spin_unlock_bh(&priv->lock);
 
+                rkfree(priv->flowlets);
                 rkfree(priv);
                 rkfree(ps);
         }
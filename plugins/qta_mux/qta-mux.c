@@ -24,6 +24,9 @@
 #include <linux/string.h>
 #include <linux/random.h>
 #include <linux/ktime.h>
+#include <linux/bitmap.h>
+#include <linux/hashtable.h>
+#include <linux/math64.h>
 
 #define RINA_PREFIX "qta-mux-plugin"
 
@@ -38,7 +41,17 @@
 #define RINA_QTA_MUX_PS_NAME "qta-mux-ps"
 #define NORM_PROB                100
 
-#define TIMER_T  100
+/* Urgency levels are 0 .. QTA_MUX_MAX_URGENCY - 1, a bitmap tracks backlog */
+#define QTA_MUX_MAX_URGENCY	 64
+#define QTA_MUX_TBF_HASH_BITS	 5
+
+/*
+ * Token buckets are credited in whole ticks of 2^QTA_TB_TICK_SHIFT ns
+ * (~131 us), each tick worth tick_credit bytes in QTA_TB_FRAC bits fixed
+ * point, so that refilling on enqueue takes a shift and a multiplication
+ */
+#define QTA_TB_TICK_SHIFT	 17
+#define QTA_TB_FRAC		 12
 
 struct pdu_entry {
 	struct list_head list;
@@ -64,6 +77,8 @@ struct urgency_queue {
 
 struct cu_mux {
 	struct list_head      urgency_queues;
+	struct urgency_queue * uqs[QTA_MUX_MAX_URGENCY];
+	DECLARE_BITMAP(backlogged, QTA_MUX_MAX_URGENCY);
 	struct list_head      mgmt_queue;
 	struct robject	      robj;
 	struct rset *         rset;
@@ -71,6 +86,8 @@ struct cu_mux {
 
 struct token_bucket_filter {
 	struct list_head list;
+	struct hlist_node hnode; /* in the qta_mux tbf_map, by qos_id */
+	struct urgency_queue * uq;
 	qos_id_t         qos_id;
 	uint_t		 urgency_level;
 	uint_t		 cherish_level;
@@ -80,7 +97,10 @@ struct token_bucket_filter {
 	s64              bucket_capacity;  /* in bytes */
 	s64              tokens; /* in bytes */
 	uint_t           max_rate; /* in bps */
-	s64		 last_pdu_time; /* in ns */
+	s64		 last_pdu_time; /* in ns, start of the current tick */
+	u64		 tick_credit;
+	u64		 ticks_to_fill;
+	u64		 credit_rem;
 	bool		 drop; /* true to drop the packets, false to set ECN flag */
 	uint_t		 dropped_pdus;
 	uint_t		 dropped_pdus_cu_mux;
@@ -121,6 +141,7 @@ struct qta_mux_conf {
 struct qta_mux {
 	struct list_head list;
 	struct list_head token_bucket_filters;
+	DECLARE_HASHTABLE(tbf_map, QTA_MUX_TBF_HASH_BITS);
 	struct cu_mux    cu_mux;
 	port_id_t        port_id;
 	struct robject   robj;
@@ -426,6 +447,7 @@ static void token_bucket_filter_destroy(struct token_bucket_filter * sq)
 		return;
 
 	list_del(&sq->list);
+	hash_del(&sq->hnode);
 
 	robject_del(&sq->robj);
 
@@ -484,6 +506,7 @@ static struct qta_mux * qta_mux_create(port_id_t port_id,
 	INIT_LIST_HEAD(&tmp->token_bucket_filters);
 	INIT_LIST_HEAD(&tmp->cu_mux.urgency_queues);
 	INIT_LIST_HEAD(&tmp->cu_mux.mgmt_queue);
+	hash_init(tmp->tbf_map);
 	tmp->port_id = port_id;
 
 	if (robject_init_and_add(&tmp->robj, &qta_mux_rtype, parent, "qta_mux")) {
@@ -515,6 +538,56 @@ static struct qta_mux * qta_mux_create(port_id_t port_id,
 	return tmp;
 }
 
+static void tbf_set_rate(struct token_bucket_filter * tbf,
+			 uint_t max_rate,
+			 uint_t max_burst_size)
+{
+	tbf->max_rate = max_rate;
+	tbf->bucket_capacity = max_burst_size;
+	if (tbf->tokens > tbf->bucket_capacity)
+		tbf->tokens = tbf->bucket_capacity;
+
+	/* bytes per tick = rate * 2^TICK_SHIFT / (8 * 10^9) */
+	tbf->tick_credit = div_u64((u64) max_rate <<
+				   (QTA_TB_TICK_SHIFT + QTA_TB_FRAC),
+				   8 * NSEC_PER_SEC);
+	tbf->ticks_to_fill = tbf->tick_credit ?
+		div64_u64((u64) max_burst_size << QTA_TB_FRAC,
+			  tbf->tick_credit) + 1 : 0;
+	tbf->credit_rem = 0;
+}
+
+/* Credits the ticks elapsed since the last refill */
+static void tbf_refill(struct token_bucket_filter * tbf, s64 now)
+{
+	u64 ticks;
+	u64 credit;
+
+	/* No credit at all at this rate, ticks_to_fill would be 0 too */
+	if (!tbf->tick_credit)
+		return;
+
+	ticks = (u64) (now - tbf->last_pdu_time) >> QTA_TB_TICK_SHIFT;
+	if (!ticks)
+		return;
+
+	if (ticks >= tbf->ticks_to_fill) {
+		tbf->tokens = tbf->bucket_capacity;
+		tbf->credit_rem = 0;
+		tbf->last_pdu_time = now;
+		return;
+	}
+
+	credit = ticks * tbf->tick_credit + tbf->credit_rem;
+	tbf->tokens += credit >> QTA_TB_FRAC;
+	tbf->credit_rem = credit & ((1ULL << QTA_TB_FRAC) - 1);
+	if (tbf->tokens > tbf->bucket_capacity) {
+		tbf->tokens = tbf->bucket_capacity;
+		tbf->credit_rem = 0;
+	}
+	tbf->last_pdu_time += ticks << QTA_TB_TICK_SHIFT;
+}
+
 static struct token_bucket_filter * token_bucket_filter_create(struct urgency_queue_conf * uq_conf,
 						 	       struct token_bucket_conf * sq_conf,
 							       struct rset * parent)
@@ -531,7 +604,7 @@ static struct token_bucket_filter * token_bucket_filter_create(struct urgency_qu
 	cherish_thres = uq_conf->cherish_thresholds[sq_conf->cherish_level -1];
 
 	INIT_LIST_HEAD(&tmp->list);
-	tmp->max_rate = sq_conf->max_rate;
+	INIT_HLIST_NODE(&tmp->hnode);
 	tmp->qos_id = sq_conf->qos_id;
 	tmp->urgency_level = sq_conf->urgency_level;
 	tmp->cherish_level = sq_conf->cherish_level;
@@ -540,8 +613,7 @@ static struct token_bucket_filter * token_bucket_filter_create(struct urgency_qu
 	tmp->drop_probability = cherish_thres.drop_probability;
 	tmp->last_pdu_time = ktime_get_ns();
 	tmp->tokens = sq_conf->max_burst_size;
-	tmp->bucket_capacity = sq_conf->max_burst_size;
-	tmp->max_rate = sq_conf->max_rate;
+	tbf_set_rate(tmp, sq_conf->max_rate, sq_conf->max_burst_size);
 	tmp->drop = cherish_thres.drop;
 
 	tmp->dropped_bytes = 0;
@@ -639,7 +711,7 @@ static struct token_bucket_filter * tbf_find(struct qta_mux * qta_mux,
 {
 	struct token_bucket_filter * pos;
 
-	list_for_each_entry(pos, &qta_mux->token_bucket_filters, list) {
+	hash_for_each_possible(qta_mux->tbf_map, pos, hnode, qos_id) {
 		if (pos->qos_id == qos_id)
 			return pos;
 	}
@@ -650,14 +722,10 @@ static struct token_bucket_filter * tbf_find(struct qta_mux * qta_mux,
 static struct urgency_queue * urgency_queue_find(struct qta_mux * qta_mux,
 						 uint_t urgency_level)
 {
-	struct urgency_queue * pos;
-
-	list_for_each_entry(pos, &qta_mux->cu_mux.urgency_queues, list) {
-		if (pos->urgency_level == urgency_level)
-			return pos;
-	}
+	if (urgency_level >= QTA_MUX_MAX_URGENCY)
+		return NULL;
 
-	return NULL;
+	return qta_mux->cu_mux.uqs[urgency_level];
 }
 
 static struct du * dequeue_pdu(struct list_head * list)
@@ -683,7 +751,7 @@ struct du * qta_rmt_dequeue_policy(struct rmt_ps	  *ps,
 	struct du *            ret_pdu;
 	struct qta_mux *       qta_mux;
 	struct urgency_queue * pos;
-	uint_t		       random_bytes;
+	uint_t		       level;
 	struct urgency_queue * candidate;
 
 	if (!ps || !n1_port || !n1_port->rmt_ps_queues) {
@@ -700,30 +768,30 @@ struct du * qta_rmt_dequeue_policy(struct rmt_ps	  *ps,
 	if (!list_empty(&qta_mux->cu_mux.mgmt_queue))
 		return dequeue_pdu(&qta_mux->cu_mux.mgmt_queue);
 
-	/* Go through the urgency queues in urgency level: the queues */
-	/* with a higher urgency level are checked first */
+	/* Go through the backlogged urgency queues in urgency level: the */
+	/* queues with a higher urgency level are checked first */
 	candidate = NULL;
-	list_for_each_entry(pos, &qta_mux->cu_mux.urgency_queues, list) {
-		if (!list_empty(&pos->queued_pdus)) {
-			/* This queue is not empty, can be a candidate */
-			get_random_bytes(&random_bytes, sizeof(random_bytes));
-			random_bytes = random_bytes % NORM_PROB;
-			if (pos->dequeue_prob > random_bytes) {
-				/* We can dequeue from this urgency queue */
-				candidate = pos;
-				goto exit;
-			} else if (!candidate) {
-				candidate = pos;
-			}
+	for_each_set_bit(level, qta_mux->cu_mux.backlogged,
+			 QTA_MUX_MAX_URGENCY) {
+		pos = qta_mux->cu_mux.uqs[level];
+		if (!candidate)
+			candidate = pos;
+		if (pos->dequeue_prob >= NORM_PROB ||
+		    pos->dequeue_prob > prandom_u32() % NORM_PROB) {
+			/* We can dequeue from this urgency queue */
+			candidate = pos;
+			break;
 		}
 	}
 
-exit:
 	if (!candidate)
 		return NULL;
 
 	ret_pdu = dequeue_pdu(&candidate->queued_pdus);
 	candidate->length--;
+	if (!candidate->length)
+		__clear_bit(candidate->urgency_level,
+			    qta_mux->cu_mux.backlogged);
 	candidate->tx_pdus++;
 	candidate->tx_bytes += du_len(ret_pdu);
 
@@ -738,55 +806,21 @@ if (candidate->debug_info->q_index < UQUEUE_DEBUG_SIZE) {
 	return ret_pdu;
 }
 
-int qta_rmt_enqueue_policy(struct rmt_ps	  *ps,
-			   struct rmt_n1_port *n1_port,
-			   struct du	  *du,
-			   bool must_enqueue)
+/* Polices and queues a data PDU, once classified by its qos-id */
+static int qta_enqueue_data(struct qta_mux * qta_mux,
+			    struct du *	     du,
+			    qos_id_t	     qos_id,
+			    bool	     must_enqueue)
 {
-	struct qta_mux * 	     qta_mux;
 	struct token_bucket_filter * tbf;
 	struct urgency_queue *       urgency_queue;
-	qos_id_t               	     qos_id;
-	pdu_type_t 		     pdu_type;
 	struct pdu_entry * 	     pdu_entry;
 	s64			     now;
-	s64			     delta_tokens;
 	ssize_t			     pdu_length;
-	uint_t			     random_bytes;
 	bool 			     ecn_mark;
 	pdu_flags_t     	     pci_flags;
 
-	if (!ps || !n1_port || !du) {
-		LOG_ERR("Wrong input parameters for "
-				"rmt_enqueu_scheduling_policy_tx");
-		return RMT_PS_ENQ_ERR;
-	}
-
-	qta_mux = n1_port->rmt_ps_queues;
-
-	/*
-	 * If layer management PDU enqueue in dedicated queue, bypass P/S
-	 * TODO: add dedicated P/S for layer management traffic,
-	 * to avoid (D)DoS
-	 */
-	pdu_type = pci_type(&du->pci);
-	if (pdu_type == PDU_TYPE_MGMT) {
-		if (!must_enqueue && list_empty(&qta_mux->cu_mux.mgmt_queue))
-			return RMT_PS_ENQ_SEND;
-
-		pdu_entry = pdu_entry_create(du);
-		if (!pdu_entry) {
-			LOG_ERR("Problems allocating memory for PDU entry");
-			du_destroy(du);
-			return RMT_PS_ENQ_ERR;
-		}
-
-		list_add_tail(&pdu_entry->list, &qta_mux->cu_mux.mgmt_queue);
-		return RMT_PS_ENQ_SCHED;
-	}
-
 	/* Retrieve token bucket filter for the PDU's qos-id */
-	qos_id = pci_qos_id(&du->pci);
 	tbf = tbf_find(qta_mux, qos_id);
 	if (!tbf) {
 		LOG_ERR("No TBF for QoS id %u, dropping PDU", qos_id);
@@ -796,13 +830,7 @@ int qta_rmt_enqueue_policy(struct rmt_ps	  *ps,
 
 	/* Update num tokens and see if PDU can go through */
 	now = ktime_get_ns();
-	delta_tokens = (now - tbf->last_pdu_time) * tbf->max_rate;
-	do_div(delta_tokens, 1000000000);
-	do_div(delta_tokens, 8);
-	tbf->tokens += delta_tokens;
-	if (tbf->tokens > tbf->bucket_capacity)
-		tbf->tokens = tbf->bucket_capacity;
-	tbf->last_pdu_time = now;
+	tbf_refill(tbf, now);
 
 	pdu_length = du_len(du);
 	if (pdu_length > tbf->tokens) {
@@ -823,7 +851,7 @@ int qta_rmt_enqueue_policy(struct rmt_ps	  *ps,
 		return RMT_PS_ENQ_SEND;
 
 	/* Put PDU put it in the right urgency queue */
-	urgency_queue = urgency_queue_find(qta_mux, tbf->urgency_level);
+	urgency_queue = tbf->uq;
 	if (!urgency_queue) {
 		LOG_ERR("No urgency queue for level %u, dropping PDU",
 			tbf->urgency_level);
@@ -843,9 +871,7 @@ int qta_rmt_enqueue_policy(struct rmt_ps	  *ps,
 	/* queue length is larger than probabilistic ch. threshold */
 	ecn_mark = false;
 	if (urgency_queue->length > tbf->prob_cherish_threshold) {
-		get_random_bytes(&random_bytes, sizeof(random_bytes));
-		random_bytes = random_bytes % NORM_PROB;
-		if (tbf->drop_probability > random_bytes) {
+		if (tbf->drop_probability > prandom_u32() % NORM_PROB) {
 			if (tbf->drop) {
 				urgency_queue->dropped_bytes += pdu_length;
 				urgency_queue->dropped_pdus++;
@@ -872,6 +898,7 @@ int qta_rmt_enqueue_policy(struct rmt_ps	  *ps,
 	}
 	list_add_tail(&pdu_entry->list, &urgency_queue->queued_pdus);
 	urgency_queue->length++;
+	__set_bit(urgency_queue->urgency_level, qta_mux->cu_mux.backlogged);
 	if (urgency_queue->length > urgency_queue->max_occupation)
 		urgency_queue->max_occupation = urgency_queue->length;
 
@@ -886,6 +913,48 @@ int qta_rmt_enqueue_policy(struct rmt_ps	  *ps,
 	return RMT_PS_ENQ_SCHED;
 }
 
+int qta_rmt_enqueue_policy(struct rmt_ps	  *ps,
+			   struct rmt_n1_port *n1_port,
+			   struct du	  *du,
+			   bool must_enqueue)
+{
+	struct qta_mux * 	     qta_mux;
+	pdu_type_t 		     pdu_type;
+	struct pdu_entry * 	     pdu_entry;
+
+	if (!ps || !n1_port || !du) {
+		LOG_ERR("Wrong input parameters for "
+				"rmt_enqueu_scheduling_policy_tx");
+		return RMT_PS_ENQ_ERR;
+	}
+
+	qta_mux = n1_port->rmt_ps_queues;
+
+	/*
+	 * If layer management PDU enqueue in dedicated queue, bypass P/S
+	 * TODO: add dedicated P/S for layer management traffic,
+	 * to avoid (D)DoS
+	 */
+	pdu_type = pci_type(&du->pci);
+	if (pdu_type == PDU_TYPE_MGMT) {
+		if (!must_enqueue && list_empty(&qta_mux->cu_mux.mgmt_queue))
+			return RMT_PS_ENQ_SEND;
+
+		pdu_entry = pdu_entry_create(du);
+		if (!pdu_entry) {
+			LOG_ERR("Problems allocating memory for PDU entry");
+			du_destroy(du);
+			return RMT_PS_ENQ_ERR;
+		}
+
+		list_add_tail(&pdu_entry->list, &qta_mux->cu_mux.mgmt_queue);
+		return RMT_PS_ENQ_SCHED;
+	}
+
+	return qta_enqueue_data(qta_mux, du, pci_qos_id(&du->pci),
+				must_enqueue);
+}
+
 static struct urgency_queue_conf * uqc_find(struct qta_mux_conf * conf,
 					    uint_t urgency_level)
 {
@@ -917,6 +986,8 @@ static void qta_mux_add_uqueue(struct qta_mux *     qta_mux,
 {
 	struct urgency_queue * pos;
 
+	qta_mux->cu_mux.uqs[uq->urgency_level] = uq;
+
 	if (list_empty(&qta_mux->cu_mux.urgency_queues)) {
 		list_add(&uq->list, &qta_mux->cu_mux.urgency_queues);
 		return;
@@ -959,6 +1030,23 @@ void * qta_rmt_q_create_policy(struct rmt_ps      *ps,
 	}
 	list_add(&qta_mux->list, &qta_mux_set->qta_muxes);
 
+	/* Create one urgency_queue per urgency level, add it to the qta_mux */
+	list_for_each_entry(uq_conf, &config->urgency_queue_conf, list) {
+		urgency_queue = urgency_queue_create(uq_conf->urgency_level,
+						     uq_conf->dequeue_prob,
+						     n1_port->port_id,
+						     qta_mux->cu_mux.rset);
+		if (!urgency_queue) {
+			LOG_ERR("Problems creating urgency queue");
+			qta_mux_destroy(qta_mux);
+			return NULL;
+		}
+
+		qta_mux_add_uqueue(qta_mux, urgency_queue);
+		LOG_INFO("Added urgency queue for urgency level %d",
+			 uq_conf->urgency_level);
+	}
+
 	/* Create one token bucket filter per QoS level */
 	list_for_each_entry(pos, &config->token_buckets_conf, list) {
 		uq_conf = uqc_find(config, pos->urgency_level);
@@ -975,27 +1063,12 @@ void * qta_rmt_q_create_policy(struct rmt_ps      *ps,
 			return NULL;
 		}
 
+		tbf->uq = urgency_queue_find(qta_mux, tbf->urgency_level);
 		list_add_tail(&tbf->list, &qta_mux->token_bucket_filters);
+		hash_add(qta_mux->tbf_map, &tbf->hnode, tbf->qos_id);
 		LOG_INFO("Added token bucket filter for QoS id %u", pos->qos_id);
 	}
 
-	/* Create one urgency_queue per urgency level, add it to the qta_mux */
-	list_for_each_entry(uq_conf, &config->urgency_queue_conf, list) {
-		urgency_queue = urgency_queue_create(uq_conf->urgency_level,
-						     uq_conf->dequeue_prob,
-						     n1_port->port_id,
-						     qta_mux->cu_mux.rset);
-		if (!urgency_queue) {
-			LOG_ERR("Problems creating urgency queue");
-			qta_mux_destroy(qta_mux);
-			return NULL;
-		}
-
-		qta_mux_add_uqueue(qta_mux, urgency_queue);
-		LOG_INFO("Added urgency queue for urgency level %d",
-			 uq_conf->urgency_level);
-	}
-
 	return qta_mux;
 }
 
@@ -1109,6 +1182,12 @@ static int qta_mux_ps_set_policy_set_param_priv(struct qta_mux_set * data,
 				    &delta_offset))
 			return -1;
 
+		if (urgency_level >= QTA_MUX_MAX_URGENCY) {
+			LOG_ERR("Urgency level %u out of range, max is %d",
+				urgency_level, QTA_MUX_MAX_URGENCY - 1);
+			return -1;
+		}
+
 		LOG_INFO("Values for qos_id %u: %u, %u, %u, %u",
 			 qos_id, urgency_level, cherish_level,
 			 max_burst_size, max_rate);
@@ -1141,10 +1220,12 @@ static int qta_mux_ps_set_policy_set_param_priv(struct qta_mux_set * data,
 				//FIXME add lock to qta_mux and take it
 				list_for_each_entry(tbf, &qta_mux->token_bucket_filters, list) {
 					if (tbf->qos_id == qos_id) {
-						tbf->max_rate = max_rate;
+						tbf_set_rate(tbf, max_rate,
+							     max_burst_size);
 						tbf->urgency_level = urgency_level;
 						tbf->cherish_level = cherish_level;
-						tbf->bucket_capacity = max_burst_size;
+						tbf->uq = urgency_queue_find(qta_mux,
+									     urgency_level);
 					}
 				}
 			}
@@ -1166,6 +1247,12 @@ static int qta_mux_ps_set_policy_set_param_priv(struct qta_mux_set * data,
 				    &delta_offset))
 			return -1;
 
+		if (urgency_level >= QTA_MUX_MAX_URGENCY) {
+			LOG_ERR("Urgency level %u out of range, max is %d",
+				urgency_level, QTA_MUX_MAX_URGENCY - 1);
+			return -1;
+		}
+
 		/* Parse # of cherish levels from the parameter value */
 		offset = 0;
 		if (parse_int_value(value, ':', (int *) &cherish_level,
@@ -1355,6 +1442,106 @@ static void rmt_ps_qta_destroy(struct ps_base * bps)
 	}
 }
 
+static bool bench;
+module_param(bench, bool, 0444);
+MODULE_PARM_DESC(bench, "Run the enqueue/dequeue benchmark at module load");
+
+#define QTA_MUX_BENCH_POOL   256
+#define QTA_MUX_BENCH_ROUNDS 1000
+#define QTA_MUX_BENCH_LEN    1000
+
+RINA_EMPTY_KTYPE(qta_mux_bench);
+
+/*
+ * Pushes QTA_MUX_BENCH_ROUNDS times a pool of data PDUs, spread round robin
+ * over the given number of QoS cubes (4 urgency x 2 cherish levels, rates
+ * high enough never to police), through the data path of the enqueue policy
+ * and the dequeue policy. The PDUs carry no PCI, so they are classified by
+ * the bench itself; the cherish thresholds are far above the pool size, so
+ * the PCI flags are never touched for ECN marking either.
+ */
+static void qta_mux_bench_run(int cubes)
+{
+	struct qta_mux_set * set;
+	struct qta_mux *     qta_mux;
+	struct rmt_ps	     ps;
+	struct rmt_n1_port * n1_port;
+	struct du **	     pool;
+	char		     name[16], value[64];
+	int		     i, r;
+	ktime_t		     start;
+	s64		     ns;
+
+	set = qta_mux_set_create();
+	n1_port = rkzalloc(sizeof(*n1_port), GFP_KERNEL);
+	pool = rkzalloc(QTA_MUX_BENCH_POOL * sizeof(*pool), GFP_KERNEL);
+	if (!set || !n1_port || !pool)
+		goto out;
+
+	set->qta_mux_conf = qta_mux_conf_create();
+	if (!set->qta_mux_conf)
+		goto out;
+
+	memset(&ps, 0, sizeof(ps));
+	ps.priv = set;
+
+	for (i = 1; i <= 4; i++) {
+		snprintf(name, sizeof(name), "%d.cumux", i);
+		qta_mux_ps_set_policy_set_param_priv(set, name,
+			"2:1:90:100000,100000,0:100000,100000,0");
+	}
+	for (i = 1; i <= cubes; i++) {
+		snprintf(name, sizeof(name), "%d.qosid", i);
+		snprintf(value, sizeof(value), "%d:%d:1000000000:2000000000",
+			 (i - 1) % 4 + 1, (i - 1) / 4 % 2 + 1);
+		qta_mux_ps_set_policy_set_param_priv(set, name, value);
+	}
+
+	if (robject_init_and_add(&n1_port->robj, &qta_mux_bench_rtype, NULL,
+				 "qta_mux_bench_%d", cubes))
+		goto out;
+	n1_port->port_id = 1;
+	n1_port->rmt_ps_queues = qta_rmt_q_create_policy(&ps, n1_port);
+	if (!n1_port->rmt_ps_queues)
+		goto out_robj;
+	qta_mux = n1_port->rmt_ps_queues;
+
+	for (i = 0; i < QTA_MUX_BENCH_POOL; i++) {
+		pool[i] = du_create(QTA_MUX_BENCH_LEN);
+		if (!pool[i])
+			goto out_q;
+	}
+
+	start = ktime_get();
+	for (r = 0; r < QTA_MUX_BENCH_ROUNDS; r++) {
+		for (i = 0; i < QTA_MUX_BENCH_POOL; i++)
+			qta_enqueue_data(qta_mux, pool[i], i % cubes + 1, true);
+		for (i = 0; i < QTA_MUX_BENCH_POOL; i++)
+			pool[i] = qta_rmt_dequeue_policy(&ps, n1_port);
+	}
+	ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	LOG_INFO("%d QoS cubes: %lld ns per enqueue+dequeue, %lld kPDUs/s",
+		 cubes, ns / (QTA_MUX_BENCH_ROUNDS * QTA_MUX_BENCH_POOL),
+		 ns ? div64_s64((s64) QTA_MUX_BENCH_ROUNDS *
+				QTA_MUX_BENCH_POOL * USEC_PER_SEC, ns) : 0);
+
+ out_q:
+	for (i = 0; i < QTA_MUX_BENCH_POOL; i++)
+		if (pool[i])
+			du_destroy(pool[i]);
+	qta_rmt_q_destroy_policy(&ps, n1_port);
+ out_robj:
+	robject_del(&n1_port->robj);
+ out:
+	if (set)
+		qta_mux_set_destroy(set);
+	if (pool)
+		rkfree(pool);
+	if (n1_port)
+		rkfree(n1_port);
+}
+
 static struct ps_factory qta_factory = {
 		.owner   = THIS_MODULE,
 		.create  = rmt_ps_qta_create,
@@ -1377,6 +1564,12 @@ static int __init mod_init(void)
 	qta_mux_debug_proc_init();
 #endif
 
+	if (bench) {
+		qta_mux_bench_run(8);
+		qta_mux_bench_run(16);
+		qta_mux_bench_run(32);
+	}
+
 	LOG_INFO("RMT QTA MUX policy set loaded successfully");
 
 	return 0;
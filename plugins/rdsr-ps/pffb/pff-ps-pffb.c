@@ -968,6 +968,7 @@ static int pffb_dump(struct pff_ps * ps, struct list_head * entries) {
 
                 entry->fwd_info = pos->destination;
                 entry->qos_id = pos->qos_id;
+                entry->wildcard_bits = 0;
 		INIT_LIST_HEAD(&entry->port_id_altlists);
 
                 if (pfte_copy_alts(pos, &entry->port_id_altlists)) {
@@ -20,6 +20,8 @@ DIFConfigValidator::DIFConfigValidator(const rina::DIFInformation &dif_info,
 		type_ = SHIM_TCP_UDP;
 	else if (type == "shim-hv")
 		type_ = SHIM_HV;
+	else if (type == "shim-loopback")
+		type_ = SHIM_LOOPBACK;
 	else
 		type_ = SHIM_NOT_DEFINED;
 }
@@ -36,6 +38,8 @@ bool DIFConfigValidator::validateConfigs()
 		return validateShimTcpUdp();
 	else if(type_ == SHIM_HV)
 		return validateShimHv();
+	else if(type_ == SHIM_LOOPBACK)
+		return validateShimLoopback();
 	else
 		return validateBasicDIFConfigs();
 }
@@ -65,6 +69,11 @@ bool DIFConfigValidator::validateShimHv()
 		validateConfigParameters(expected_params);
 }
 
+bool DIFConfigValidator::validateShimLoopback()
+{
+	return validateBasicDIFConfigs();
+}
+
 bool DIFConfigValidator::validateShimDummy()
 {
 	return validateBasicDIFConfigs();
@@ -47,6 +47,7 @@ public:
                 SHIM_DUMMY,
                 SHIM_TCP_UDP,
                 SHIM_HV,
+                SHIM_LOOPBACK,
                 SHIM_NOT_DEFINED
         };
         DIFConfigValidator(const rina::DIFInformation &dif_info,
@@ -60,6 +61,7 @@ private:
 	bool validateShimHv();
 	bool validateShimDummy();
         bool validateShimTcpUdp();
+        bool validateShimLoopback();
         bool validateNormal();
 	bool validateBasicDIFConfigs();
 	bool validateConfigParameters(const std::vector< std::string >&
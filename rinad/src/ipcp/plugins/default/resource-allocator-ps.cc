@@ -22,7 +22,9 @@
 #define IPCP_MODULE "resource-allocator-ps-default"
 #include "../../ipcp-logging.h"
 
+#include <algorithm>
 #include <string>
+#include <vector>
 
 #include "ipcp/components.h"
 
@@ -38,16 +40,133 @@ public:
 
 private:
 	void parse_qosid_map_entry(const rina::PolicyParameter& param);
+	void aggregate_entries(std::list<rina::PDUForwardingTableEntry *>& pduft);
+	void aggregate_range(std::vector<rina::PDUForwardingTableEntry *>::iterator first,
+			     std::vector<rina::PDUForwardingTableEntry *>::iterator last,
+			     unsigned int base, unsigned int wildcard_bits,
+			     std::list<rina::PDUForwardingTableEntry *>& result);
 
         // Data model of the resource allocator component.
         IResourceAllocator * res_alloc;
 
         // Stores qos-id to N-1 flow characteristics mappings
         std::map<int, rina::FlowSpecification> qosid_map;
+
+        // Emit prefix entries, for PFF policies doing longest prefix match
+        bool aggregate;
+
+        // Shortest prefix the aggregated entries may have
+        unsigned int aggregate_min_prefix;
+
+        // Whether the PFF policy set of the DIF does longest prefix match
+        bool lpm_pff;
 };
 
 DefaultPDUFTGeneratorPs::DefaultPDUFTGeneratorPs(IResourceAllocator * ra) : res_alloc(ra)
-{ }
+{
+	aggregate = false;
+	aggregate_min_prefix = 0;
+	lpm_pff = false;
+}
+
+static bool address_lt(const rina::PDUForwardingTableEntry * a,
+		       const rina::PDUForwardingTableEntry * b)
+{
+	return a->address < b->address;
+}
+
+static bool same_next_hops(const rina::PDUForwardingTableEntry * a,
+			   const rina::PDUForwardingTableEntry * b)
+{
+	std::list<rina::PortIdAltlist>::const_iterator it, jt;
+
+	if (a->portIdAltlists.size() != b->portIdAltlists.size())
+		return false;
+
+	for (it = a->portIdAltlists.begin(), jt = b->portIdAltlists.begin();
+			it != a->portIdAltlists.end(); ++it, ++jt) {
+		if (it->alts != jt->alts)
+			return false;
+	}
+
+	return true;
+}
+
+/// Covers [first, last), all of them within base/(32 - wildcard_bits), with
+/// as few prefixes as possible. A prefix is only emitted for a range where
+/// every address has an entry: a hole may be an address we have no route to,
+/// or our own address, and a prefix would forward its PDUs anyway.
+void DefaultPDUFTGeneratorPs::aggregate_range(std::vector<rina::PDUForwardingTableEntry *>::iterator first,
+					      std::vector<rina::PDUForwardingTableEntry *>::iterator last,
+					      unsigned int base, unsigned int wildcard_bits,
+					      std::list<rina::PDUForwardingTableEntry *>& result)
+{
+	std::vector<rina::PDUForwardingTableEntry *>::iterator it, mid;
+	rina::PDUForwardingTableEntry * entry;
+	unsigned int half;
+	bool same = true;
+
+	if (first == last)
+		return;
+
+	// A single address is better left as a host entry
+	if (last - first == 1) {
+		result.push_back(*first);
+		return;
+	}
+
+	for (it = first + 1; it != last && same; ++it)
+		same = same_next_hops(*first, *it);
+
+	if (wildcard_bits == 0) {
+		// Duplicated host entries, nothing to merge
+		result.insert(result.end(), first, last);
+		return;
+	}
+
+	// Entries are unique per address, so a full range has 2^wildcard_bits
+	if (same && 32 - wildcard_bits >= aggregate_min_prefix &&
+			wildcard_bits < 32 &&
+			(unsigned int) (last - first) == 1u << wildcard_bits) {
+		entry = new rina::PDUForwardingTableEntry(**first);
+		entry->address = base;
+		entry->wildcardBits = wildcard_bits;
+		for (it = first; it != last; ++it) {
+			entry->cost = std::min(entry->cost, (*it)->cost);
+			delete *it;
+		}
+		result.push_back(entry);
+		return;
+	}
+
+	half = base | (1u << (wildcard_bits - 1));
+	for (mid = first; mid != last && (*mid)->address < half; ++mid);
+
+	aggregate_range(first, mid, base, wildcard_bits - 1, result);
+	aggregate_range(mid, last, half, wildcard_bits - 1, result);
+}
+
+void DefaultPDUFTGeneratorPs::aggregate_entries(std::list<rina::PDUForwardingTableEntry *>& pduft)
+{
+	std::map<unsigned int, std::vector<rina::PDUForwardingTableEntry *> > by_qos;
+	std::map<unsigned int, std::vector<rina::PDUForwardingTableEntry *> >::iterator it;
+	std::list<rina::PDUForwardingTableEntry *>::iterator jt;
+	std::list<rina::PDUForwardingTableEntry *> result;
+
+	for (jt = pduft.begin(); jt != pduft.end(); ++jt)
+		by_qos[(*jt)->qosId].push_back(*jt);
+
+	for (it = by_qos.begin(); it != by_qos.end(); ++it) {
+		std::sort(it->second.begin(), it->second.end(), address_lt);
+		aggregate_range(it->second.begin(), it->second.end(), 0, 32,
+				result);
+	}
+
+	LOG_IPCP_DBG("Aggregated %zu PDU Forwarding Table entries into %zu",
+		     pduft.size(), result.size());
+
+	pduft.swap(result);
+}
 
 void DefaultPDUFTGeneratorPs::parse_qosid_map_entry(const rina::PolicyParameter& param)
 {
@@ -86,13 +205,23 @@ void DefaultPDUFTGeneratorPs::set_dif_configuration(const rina::DIFConfiguration
 	std::list<rina::PolicyParameter>::const_iterator it;
 	rina::PolicyConfig psconf;
 
+	lpm_pff = dif_configuration.rmt_configuration_.pft_conf_.policy_set_.name_
+			== "lpm";
+
 	psconf = dif_configuration.ra_configuration_.pduftg_conf_.policy_set_;
 	for (it = psconf.parameters_.begin();
 			it != psconf.parameters_.end(); ++it) {
 		if (it->name_.find("qosid") != std::string::npos) {
 			parse_qosid_map_entry(*it);
+		} else {
+			set_policy_set_param(it->name_, it->value_);
 		}
 	}
+
+	if (aggregate && !lpm_pff) {
+		LOG_IPCP_WARN("The PFF policy set does not do longest prefix "
+			      "match, entries will not be aggregated");
+	}
 }
 
 void DefaultPDUFTGeneratorPs::routingTableUpdated(const std::list<rina::RoutingTableEntry*>& rt)
@@ -193,6 +322,11 @@ void DefaultPDUFTGeneratorPs::routingTableUpdated(const std::list<rina::RoutingT
 		}
 	}
 
+	// Other PFF policy sets match addresses exactly, prefixes are lost
+	if (aggregate && lpm_pff) {
+		aggregate_entries(pduft);
+	}
+
 	try {
 		rina::kernelIPCProcess->modifyPDUForwardingTableEntries(pduft, 2);
 	} catch (rina::Exception & e) {
@@ -208,9 +342,29 @@ void DefaultPDUFTGeneratorPs::routingTableUpdated(const std::list<rina::RoutingT
 int DefaultPDUFTGeneratorPs::set_policy_set_param(const std::string& name,
                                             	  const std::string& value)
 {
-        LOG_IPCP_DBG("No policy-set-specific parameters to set (%s, %s)",
-                        name.c_str(), value.c_str());
-        return -1;
+	int ival;
+
+	if (name != "aggregate" && name != "aggregate_min_prefix") {
+		LOG_IPCP_DBG("No such policy-set-specific parameter (%s, %s)",
+			     name.c_str(), value.c_str());
+		return -1;
+	}
+
+	if (rina::string2int(value, ival) || ival < 0 || ival > 32) {
+		LOG_IPCP_WARN("Invalid value for %s: %s", name.c_str(),
+			      value.c_str());
+		return -1;
+	}
+
+	if (name == "aggregate") {
+		aggregate = ival != 0;
+	} else {
+		aggregate_min_prefix = ival;
+	}
+
+	LOG_IPCP_DBG("Set %s to %d", name.c_str(), ival);
+
+	return 0;
 }
 
 extern "C" rina::IPolicySet *
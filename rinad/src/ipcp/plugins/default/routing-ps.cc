@@ -22,11 +22,16 @@
 // MA  02110-1301  USA
 //
 
+#include <algorithm>
 #include <assert.h>
 #include <climits>
+#include <functional>
+#include <queue>
 #include <set>
 #include <sstream>
 #include <string>
+#include <sys/time.h>
+#include <unistd.h>
 
 #define IPCP_MODULE "routing-ps-link-state"
 #include "../../ipcp-logging.h"
@@ -175,6 +180,7 @@ void Graph::set_flow_state_objects(const std::list<FlowStateObject>& flow_state_
 	flow_state_objects_ = flow_state_objects;
 	init_vertices();
 	init_edges();
+	init_adjacency();
 }
 
 Graph::~Graph()
@@ -188,55 +194,170 @@ Graph::~Graph()
 	for (edgeIt = edges_.begin(); edgeIt != edges_.end(); ++edgeIt) {
 		delete (*edgeIt);
 	}
+
+	// The edges taken down are only in the adjacency, once per endpoint
+	for (unsigned int v = 0; v + 1 < adj_offset_.size(); v++) {
+		for (unsigned int i = adj_offset_[v]; i < adj_offset_[v + 1]; i++) {
+			if (adj_weight_[i] < 0 && adj_vertex_[i] > v) {
+				delete adj_edge_[i];
+			}
+		}
+	}
 }
 
 void Graph::init_vertices()
 {
 	std::list<FlowStateObject>::const_iterator it;
+	std::map<std::string, unsigned int>::iterator iit;
+	unsigned int id = 0;
+
 	for (it = flow_state_objects_.begin(); it != flow_state_objects_.end();
 			++it) {
-		if (!contains_vertex(it->name)) {
+		if (ids_.insert(std::make_pair(it->name, 0)).second) {
 			vertices_.push_back(it->name);
 		}
 
-		if (!contains_vertex(it->neighbor_name)) {
+		if (ids_.insert(std::make_pair(it->neighbor_name, 0)).second) {
 			vertices_.push_back(it->neighbor_name);
 		}
 	}
+
+	// The map is sorted by name
+	names_.reserve(ids_.size());
+	for (iit = ids_.begin(); iit != ids_.end(); ++iit) {
+		iit->second = id++;
+		names_.push_back(iit->first);
+	}
 }
 
 bool Graph::contains_vertex(const std::string& name) const
 {
-	std::list<std::string>::const_iterator it;
-	for (it = vertices_.begin(); it != vertices_.end(); ++it) {
-		if ((*it) == name) {
-			return true;
+	return ids_.find(name) != ids_.end();
+}
+
+bool Graph::contains_edge(const std::string& name1,
+			  const std::string& name2) const
+{
+	int id1 = vertex_id(name1);
+	int id2 = vertex_id(name2);
+
+	if (id1 < 0 || id2 < 0 || adj_offset_.empty()) {
+		return false;
+	}
+
+	return edge_weight(id1, id2) >= 0;
+}
+
+int Graph::edge_weight(unsigned int v1, unsigned int v2) const
+{
+	for (unsigned int i = adj_offset_[v1]; i < adj_offset_[v1 + 1]; i++) {
+		if (adj_vertex_[i] == v2) {
+			return adj_weight_[i];
 		}
 	}
 
-	return false;
+	return -1;
 }
 
-bool Graph::contains_edge(const std::string& name1,
-			  const std::string& name2) const
+bool Graph::set_edge_weight(unsigned int v1, unsigned int v2, int weight)
 {
-	for(std::list<Edge *>::const_iterator eit = edges_.begin();
-					eit != edges_.end(); ++eit) {
-		if (*(*eit) == Edge(name1, name2, (*eit)->weight_)) {
-			return true;
+	unsigned int i;
+
+	if (v1 >= names_.size() || v2 >= names_.size()) {
+		return false;
+	}
+
+	for (i = adj_offset_[v1]; i < adj_offset_[v1 + 1]; i++) {
+		if (adj_vertex_[i] == v2) {
+			break;
 		}
 	}
 
-	return false;
+	if (i == adj_offset_[v1 + 1]) {
+		return false;
+	}
+
+	if (weight < 0 && adj_weight_[i] >= 0) {
+		edges_.remove(adj_edge_[i]);
+	} else if (weight >= 0 && adj_weight_[i] < 0) {
+		edges_.push_back(adj_edge_[i]);
+	}
+
+	if (weight >= 0) {
+		adj_edge_[i]->weight_ = weight;
+	}
+	adj_weight_[i] = weight;
+
+	for (i = adj_offset_[v2]; i < adj_offset_[v2 + 1]; i++) {
+		if (adj_vertex_[i] == v1) {
+			adj_weight_[i] = weight;
+			break;
+		}
+	}
+
+	return true;
+}
+
+bool Graph::set_edge_weights(const std::map<std::pair<std::string, std::string>, int>& links,
+			     std::list<std::pair<unsigned int, unsigned int> >& edges)
+{
+	std::map<std::pair<std::string, std::string>, int>::const_iterator it;
+	int v1, v2;
+
+	for (it = links.begin(); it != links.end(); ++it) {
+		v1 = vertex_id(it->first.first);
+		v2 = vertex_id(it->first.second);
+		if (v1 < 0 || v2 < 0) {
+			// New IPCP in the DIF
+			return false;
+		}
+
+		if (edge_weight(v1, v2) == it->second) {
+			continue;
+		}
+
+		if (!set_edge_weight(v1, v2, it->second)) {
+			if (it->second < 0) {
+				// Was not up in the graph either
+				continue;
+			}
+
+			// New adjacency
+			return false;
+		}
+
+		edges.push_back(std::make_pair(v1, v2));
+	}
+
+	return true;
+}
+
+unsigned int Graph::num_vertices() const
+{
+	return names_.size();
+}
+
+int Graph::vertex_id(const std::string& name) const
+{
+	std::map<std::string, unsigned int>::const_iterator it;
+
+	it = ids_.find(name);
+	if (it == ids_.end()) {
+		return -1;
+	}
+
+	return it->second;
 }
 
 void Graph::init_edges()
 {
-	std::list<std::string>::const_iterator it;
+	std::vector<CheckedVertex *> checked(names_.size());
 	std::list<FlowStateObject>::const_iterator flowIt;
+	std::map<std::string, unsigned int>::const_iterator it;
 
-	for (it = vertices_.begin(); it != vertices_.end(); ++it) {
-		checked_vertices_.push_back(new CheckedVertex((*it)));
+	for (it = ids_.begin(); it != ids_.end(); ++it) {
+		checked[it->second] = new CheckedVertex(it->first);
+		checked_vertices_.push_back(checked[it->second]);
 	}
 
 	CheckedVertex * origin = 0;
@@ -250,19 +371,9 @@ void Graph::init_edges()
 		LOG_IPCP_DBG("Processing flow state object: %s",
 				flowIt->object_name.c_str());
 
-		origin = get_checked_vertex(flowIt->name);
-		if (origin == 0) {
-			LOG_IPCP_WARN("Could not find checked vertex for address %s",
-					flowIt->name.c_str());
-			continue;
-		}
-
-		dest = get_checked_vertex(flowIt->neighbor_name);
-		if (dest == 0) {
-			LOG_IPCP_WARN("Could not find checked vertex for address %s",
-					flowIt->neighbor_name.c_str());
-			continue;
-		}
+		// Both endpoints have been added by init_vertices()
+		origin = checked[ids_.find(flowIt->name)->second];
+		dest = checked[ids_.find(flowIt->neighbor_name)->second];
 
 		if (origin->connection_contains_name(dest->name_)
 				&& dest->connection_contains_name(origin->name_)) {
@@ -278,16 +389,35 @@ void Graph::init_edges()
 	}
 }
 
-Graph::CheckedVertex * Graph::get_checked_vertex(const std::string& name) const
+void Graph::init_adjacency()
 {
-	std::list<Graph::CheckedVertex *>::const_iterator it;
-	for (it = checked_vertices_.begin(); it != checked_vertices_.end(); ++it) {
-		if ((*it)->name_ == name) {
-			return (*it);
-		}
+	std::list<Edge *>::const_iterator it;
+	std::vector<unsigned int> fill;
+	unsigned int v1, v2;
+
+	adj_offset_.assign(names_.size() + 1, 0);
+	for (it = edges_.begin(); it != edges_.end(); ++it) {
+		adj_offset_[ids_[(*it)->name1_] + 1]++;
+		adj_offset_[ids_[(*it)->name2_] + 1]++;
+	}
+	for (unsigned int v = 0; v < names_.size(); v++) {
+		adj_offset_[v + 1] += adj_offset_[v];
 	}
 
-	return 0;
+	adj_vertex_.resize(adj_offset_[names_.size()]);
+	adj_weight_.resize(adj_offset_[names_.size()]);
+	adj_edge_.resize(adj_offset_[names_.size()]);
+	fill.assign(adj_offset_.begin(), adj_offset_.end() - 1);
+	for (it = edges_.begin(); it != edges_.end(); ++it) {
+		v1 = ids_[(*it)->name1_];
+		v2 = ids_[(*it)->name2_];
+		adj_vertex_[fill[v1]] = v2;
+		adj_edge_[fill[v1]] = *it;
+		adj_weight_[fill[v1]++] = (*it)->weight_;
+		adj_vertex_[fill[v2]] = v1;
+		adj_edge_[fill[v2]] = *it;
+		adj_weight_[fill[v2]++] = (*it)->weight_;
+	}
 }
 
 void Graph::print() const
@@ -303,213 +433,452 @@ void Graph::print() const
 	}
 }
 
-PredecessorInfo::PredecessorInfo(const std::string& nPredecessor)
-{
-	predecessor_ = nPredecessor;
-}
+// Orders vertices by (distance, id), the order in which the SPF settles
+// them when all the edge weights are positive
+struct SettleOrder {
+	SettleOrder(const std::vector<int>& dist) : dist_(dist) {}
+	bool operator()(unsigned int a, unsigned int b) const {
+		return dist_[a] < dist_[b] || (dist_[a] == dist_[b] && a < b);
+	}
+	const std::vector<int>& dist_;
+};
 
-DijkstraAlgorithm::DijkstraAlgorithm()
+SPFTree::SPFTree()
 {
+	source_ = 0;
+	ecmp_ = false;
+	zero_weights_ = false;
 }
 
-void DijkstraAlgorithm::clear()
+void SPFTree::compute(const Graph& graph, unsigned int source, bool ecmp)
 {
-	unsettled_nodes_.clear();
-	settled_nodes_.clear();
-	predecessors_.clear();
-	distances_.clear();
+	typedef std::pair<int, unsigned int> HeapItem;
+	std::priority_queue<HeapItem, std::vector<HeapItem>,
+			    std::greater<HeapItem> > heap;
+	std::vector<bool> settled(graph.num_vertices(), false);
+	unsigned int v, t;
+	int d;
+
+	source_ = source;
+	ecmp_ = ecmp;
+	zero_weights_ = std::find(graph.adj_weight_.begin(),
+				  graph.adj_weight_.end(), 0) !=
+			graph.adj_weight_.end();
+
+	dist_.assign(graph.num_vertices(), INT_MAX);
+	pred_.assign(graph.num_vertices(), -1);
+	order_.clear();
+	preds_.clear();
+	if (ecmp) {
+		preds_.resize(graph.num_vertices());
+	}
+
+	dist_[source] = 0;
+	heap.push(HeapItem(0, source));
+
+	while (!heap.empty()) {
+		v = heap.top().second;
+		heap.pop();
+		if (settled[v]) {
+			continue;
+		}
+		settled[v] = true;
+		order_.push_back(v);
+
+		for (unsigned int i = graph.adj_offset_[v];
+				i < graph.adj_offset_[v + 1]; i++) {
+			t = graph.adj_vertex_[i];
+			if (settled[t] || graph.adj_weight_[i] < 0) {
+				continue;
+			}
+
+			d = dist_[v] + graph.adj_weight_[i];
+			if (d < dist_[t]) {
+				dist_[t] = d;
+				pred_[t] = v;
+				if (ecmp) {
+					preds_[t].clear();
+					preds_[t].push_back(v);
+				}
+				heap.push(HeapItem(d, t));
+			} else if (ecmp && d == dist_[t]) {
+				preds_[t].push_back(v);
+			}
+		}
+	}
 }
 
-void DijkstraAlgorithm::computeShortestDistances(const Graph& graph,
-						 const std::string& source_name,
-						 std::map<std::string, int>& distances)
+void SPFTree::set_preds(const Graph& graph, unsigned int v)
 {
-	execute(graph, source_name);
+	std::vector<unsigned int> preds;
+	unsigned int n;
+
+	pred_[v] = -1;
+	if (ecmp_) {
+		preds_[v].clear();
+	}
 
-	// Write back the result
-	distances = distances_;
+	if (v == source_ || dist_[v] == INT_MAX) {
+		return;
+	}
+
+	for (unsigned int i = graph.adj_offset_[v];
+			i < graph.adj_offset_[v + 1]; i++) {
+		n = graph.adj_vertex_[i];
+		if (graph.adj_weight_[i] >= 0 && dist_[n] != INT_MAX &&
+				dist_[n] + graph.adj_weight_[i] == dist_[v]) {
+			preds.push_back(n);
+		}
+	}
 
-	clear();
+	// compute() records them in settle order
+	std::sort(preds.begin(), preds.end(), SettleOrder(dist_));
+	if (!preds.empty()) {
+		pred_[v] = preds.front();
+	}
+	if (ecmp_) {
+		preds_[v] = preds;
+	}
 }
 
-void DijkstraAlgorithm::computeRoutingTable(const Graph& graph,
- 	 	    	    	    	    const std::list<FlowStateObject>& fsoList,
-					    const std::string& source_name,
-					    std::list<rina::RoutingTableEntry *>& rt)
+int SPFTree::update(const Graph& graph, unsigned int source,
+		    const std::list<std::pair<unsigned int, unsigned int> >& edges)
 {
-	std::list<std::string>::const_iterator it;
-	rina::RoutingTableEntry * entry;
-	rina::IPCPNameAddresses ipcpna;
+	typedef std::pair<int, unsigned int> HeapItem;
+	std::priority_queue<HeapItem, std::vector<HeapItem>,
+			    std::greater<HeapItem> > heap;
+	std::list<std::pair<unsigned int, unsigned int> >::const_iterator it;
+	std::vector<unsigned int> child_offset, children, stack;
+	std::vector<unsigned int> affected, touched, recheck;
+	std::vector<int> old_dist;
+	std::vector<char> mark;
+	unsigned int n = graph.num_vertices();
+	unsigned int v, t;
+	int d, w;
 
-	execute(graph, source_name);
+	// Marks of the vertices
+	const char AFFECTED = 1, TOUCHED = 2, RECHECK = 4;
 
-	for (it = graph.vertices_.begin(); it != graph.vertices_.end(); ++it) {
-		if ((*it) != source_name) {
-			ipcpna.name = getNextHop((*it), source_name);
-			if (ipcpna.name != std::string()) {
-				entry = new rina::RoutingTableEntry();
-				entry->destination.name = (*it);
-				entry->nextHopNames.push_back(rina::NHopAltList(ipcpna));
-				entry->qosId = 0;
-				entry->cost = 1;
-				rt.push_back(entry);
-				LOG_IPCP_DBG("Added entry to routing table: destination %s, next-hop %s",
-						entry->destination.name.c_str(), ipcpna.name.c_str());
+	if (source != source_ || dist_.size() != n || zero_weights_) {
+		compute(graph, source, ecmp_);
+		return -1;
+	}
+
+	for (it = edges.begin(); it != edges.end(); ++it) {
+		if (graph.edge_weight(it->first, it->second) == 0) {
+			compute(graph, source, ecmp_);
+			return -1;
+		}
+	}
+
+	mark.assign(n, 0);
+
+	// 1. The vertices whose tree path goes through a changed edge lose
+	// their distance: the subtrees below the changed tree edges
+	for (it = edges.begin(); it != edges.end(); ++it) {
+		if (pred_[it->second] == (int) it->first) {
+			stack.push_back(it->second);
+		} else if (pred_[it->first] == (int) it->second) {
+			stack.push_back(it->first);
+		}
+	}
+
+	if (!stack.empty()) {
+		child_offset.assign(n + 1, 0);
+		for (v = 0; v < n; v++) {
+			if (pred_[v] >= 0) {
+				child_offset[pred_[v] + 1]++;
+			}
+		}
+		for (v = 0; v < n; v++) {
+			child_offset[v + 1] += child_offset[v];
+		}
+		children.resize(child_offset[n]);
+		std::vector<unsigned int> fill(child_offset.begin(),
+					       child_offset.end() - 1);
+		for (v = 0; v < n; v++) {
+			if (pred_[v] >= 0) {
+				children[fill[pred_[v]]++] = v;
+			}
+		}
+
+		while (!stack.empty()) {
+			v = stack.back();
+			stack.pop_back();
+			if (mark[v] & AFFECTED) {
+				continue;
+			}
+			mark[v] |= AFFECTED;
+			affected.push_back(v);
+			for (unsigned int i = child_offset[v];
+					i < child_offset[v + 1]; i++) {
+				stack.push_back(children[i]);
 			}
 		}
 	}
 
-	clear();
-}
+	// Too much to recompute, a full run is cheaper
+	if (affected.size() > n / 2) {
+		compute(graph, source, ecmp_);
+		return -1;
+	}
 
-void DijkstraAlgorithm::execute(const Graph& graph, const std::string& source)
-{
-	distances_[source] = 0;
-	unsettled_nodes_.insert(source);
+	for (std::vector<unsigned int>::iterator ait = affected.begin();
+			ait != affected.end(); ++ait) {
+		mark[*ait] |= TOUCHED;
+		touched.push_back(*ait);
+		old_dist.push_back(dist_[*ait]);
+		dist_[*ait] = INT_MAX;
+	}
+
+	// Restart the affected vertices from their unaffected neighbors
+	for (std::vector<unsigned int>::iterator ait = affected.begin();
+			ait != affected.end(); ++ait) {
+		v = *ait;
+		for (unsigned int i = graph.adj_offset_[v];
+				i < graph.adj_offset_[v + 1]; i++) {
+			t = graph.adj_vertex_[i];
+			if ((mark[t] & AFFECTED) || dist_[t] == INT_MAX ||
+					graph.adj_weight_[i] < 0) {
+				continue;
+			}
+
+			d = dist_[t] + graph.adj_weight_[i];
+			if (d < dist_[v]) {
+				dist_[v] = d;
+			}
+		}
 
-	std::string node;
-	while (unsettled_nodes_.size() > 0) {
-		node = getMinimum();
-		settled_nodes_.insert(node);
-		unsettled_nodes_.erase(node);
-		findMinimalDistances(graph, node);
+		if (dist_[v] != INT_MAX) {
+			heap.push(HeapItem(dist_[v], v));
+		}
 	}
-}
 
-std::string DijkstraAlgorithm::getMinimum() const
-{
-	std::string minimum = std::string();
-	std::set<std::string>::iterator it;
+	// 2. Changed edges may also give a shorter path to one endpoint
+	for (it = edges.begin(); it != edges.end(); ++it) {
+		w = graph.edge_weight(it->first, it->second);
+		if (w < 0) {
+			continue;
+		}
 
-	for (it = unsettled_nodes_.begin(); it != unsettled_nodes_.end(); ++it) {
-		if (minimum == std::string()) {
-			minimum = (*it);
-		} else {
-			if (getShortestDistance((*it)) < getShortestDistance(minimum)) {
-				minimum = (*it);
+		for (int k = 0; k < 2; k++) {
+			v = k ? it->second : it->first;
+			t = k ? it->first : it->second;
+			if (dist_[v] == INT_MAX || dist_[v] + w >= dist_[t]) {
+				continue;
+			}
+
+			if (!(mark[t] & TOUCHED)) {
+				mark[t] |= TOUCHED;
+				touched.push_back(t);
+				old_dist.push_back(dist_[t]);
 			}
+			dist_[t] = dist_[v] + w;
+			heap.push(HeapItem(dist_[t], t));
 		}
 	}
 
-	return minimum;
-}
+	// 3. Propagate the new distances as in compute()
+	while (!heap.empty()) {
+		d = heap.top().first;
+		v = heap.top().second;
+		heap.pop();
+		if (d != dist_[v]) {
+			continue;
+		}
 
-int DijkstraAlgorithm::getShortestDistance(const std::string& destination) const
-{
-	std::map<std::string, int>::const_iterator it;
-	int distance = INT_MAX;
+		for (unsigned int i = graph.adj_offset_[v];
+				i < graph.adj_offset_[v + 1]; i++) {
+			t = graph.adj_vertex_[i];
+			if (graph.adj_weight_[i] < 0 ||
+					d + graph.adj_weight_[i] >= dist_[t]) {
+				continue;
+			}
 
-	it = distances_.find(destination);
-	if (it != distances_.end()) {
-		distance = it->second;
+			if (!(mark[t] & TOUCHED)) {
+				mark[t] |= TOUCHED;
+				touched.push_back(t);
+				old_dist.push_back(dist_[t]);
+			}
+			dist_[t] = d + graph.adj_weight_[i];
+			heap.push(HeapItem(dist_[t], t));
+		}
 	}
 
-	return distance;
-}
+	// 4. The predecessors depend on the distances of the vertex and its
+	// neighbors, and on the weights of the edges between them
+	for (it = edges.begin(); it != edges.end(); ++it) {
+		for (int k = 0; k < 2; k++) {
+			v = k ? it->second : it->first;
+			if (!(mark[v] & RECHECK)) {
+				mark[v] |= RECHECK;
+				recheck.push_back(v);
+			}
+		}
+	}
 
-void DijkstraAlgorithm::findMinimalDistances(const Graph& graph,
-					     const std::string& node)
-{
-	std::list<std::string> adjacentNodes;
-	std::list<Edge *>::const_iterator edgeIt;
+	bool reorder = false;
+	for (unsigned int j = 0; j < touched.size(); j++) {
+		v = touched[j];
+		if (dist_[v] == old_dist[j]) {
+			continue;
+		}
 
-	std::string target = std::string();
-	int shortestDistance;
-	for (edgeIt = graph.edges_.begin(); edgeIt != graph.edges_.end();
-			++edgeIt) {
-		if (isNeighbor((*edgeIt), node)) {
-			target = (*edgeIt)->getOtherEndpoint(node);
-			shortestDistance = getShortestDistance(node) + (*edgeIt)->weight_;
-			if (getShortestDistance(target) > shortestDistance) {
-				distances_[target] = shortestDistance;
-				predecessors_[target] = new PredecessorInfo(node);
-				unsettled_nodes_.insert(target);
+		reorder = true;
+		if (!(mark[v] & RECHECK)) {
+			mark[v] |= RECHECK;
+			recheck.push_back(v);
+		}
+		for (unsigned int i = graph.adj_offset_[v];
+				i < graph.adj_offset_[v + 1]; i++) {
+			t = graph.adj_vertex_[i];
+			if (!(mark[t] & RECHECK)) {
+				mark[t] |= RECHECK;
+				recheck.push_back(t);
 			}
 		}
 	}
-}
 
-bool DijkstraAlgorithm::isNeighbor(Edge * edge, const std::string& node) const
-{
-	if (edge->isVertexIn(node)) {
-		if (!isSettled(edge->getOtherEndpoint(node))) {
-			return true;
+	for (std::vector<unsigned int>::iterator rit = recheck.begin();
+			rit != recheck.end(); ++rit) {
+		set_preds(graph, *rit);
+	}
+
+	// 5. Settle order, only if some distance changed
+	if (reorder) {
+		order_.clear();
+		for (v = 0; v < n; v++) {
+			if (dist_[v] != INT_MAX) {
+				order_.push_back(v);
+			}
 		}
+		std::sort(order_.begin(), order_.end(), SettleOrder(dist_));
 	}
 
-	return false;
+	return touched.size();
 }
 
-bool DijkstraAlgorithm::isSettled(const std::string& node) const
+DijkstraAlgorithm::DijkstraAlgorithm()
 {
-	std::set<std::string>::iterator it;
+}
 
-	for (it = settled_nodes_.begin(); it != settled_nodes_.end(); ++it) {
-		if ((*it) == node) {
-			return true;
-		}
+void DijkstraAlgorithm::computeShortestDistances(const Graph& graph,
+						 const std::string& source_name,
+						 std::map<std::string, int>& distances)
+{
+	std::vector<unsigned int>::const_iterator it;
+	int source = graph.vertex_id(source_name);
+	SPFTree spf;
+
+	distances.clear();
+	if (source < 0) {
+		distances[source_name] = 0;
+		return;
 	}
 
-	return false;
+	// Not spf_, that one is kept for updateRoutingTable()
+	spf.compute(graph, source, false);
+	for (it = spf.order_.begin(); it != spf.order_.end(); ++it) {
+		distances[graph.names_[*it]] = spf.dist_[*it];
+	}
 }
 
-std::string DijkstraAlgorithm::getNextHop(const std::string& target,
-					  const std::string& source)
+void DijkstraAlgorithm::computeRoutingTable(const Graph& graph,
+ 	 	    	    	    	    const std::list<FlowStateObject>& fsoList,
+					    const std::string& source_name,
+					    std::list<rina::RoutingTableEntry *>& rt)
 {
-	std::map<std::string, PredecessorInfo *>::iterator it;
-	PredecessorInfo * step;
-	std::string nextHop = target;
+	int source = graph.vertex_id(source_name);
 
-	it = predecessors_.find(target);
-	if (it == predecessors_.end()) {
-		return std::string();
-	} else {
-		step = it->second;
+	(void)fsoList; // avoid compiler barfs
+
+	if (source < 0) {
+		return;
 	}
 
-	it = predecessors_.find(step->predecessor_);
-	while (it != predecessors_.end()) {
-		nextHop = step->predecessor_;
-		step = it->second;
-		if (step->predecessor_ == source) {
-			break;
-		}
+	spf_.compute(graph, source, false);
+	fillRoutingTable(graph, source, rt);
+}
 
-		it = predecessors_.find(step->predecessor_);
-	}
+int DijkstraAlgorithm::updateRoutingTable(const Graph& graph,
+					  const std::list<std::pair<unsigned int, unsigned int> >& edges,
+					  const std::string& source_name,
+					  std::list<rina::RoutingTableEntry *>& rt)
+{
+	int source = graph.vertex_id(source_name);
+	int result;
 
-	if (step->predecessor_ == target) {
-		return std::string();
+	if (source < 0) {
+		return -1;
 	}
 
-	return nextHop;
+	result = spf_.update(graph, source, edges);
+	fillRoutingTable(graph, source, rt);
+
+	return result;
 }
 
-// ECMP Dijkstra algorithm
-ECMPDijkstraAlgorithm::ECMPDijkstraAlgorithm()
+void DijkstraAlgorithm::fillRoutingTable(const Graph& graph,
+					 unsigned int source,
+					 std::list<rina::RoutingTableEntry *>& rt)
 {
-	t = NULL;
+	std::list<std::string>::const_iterator it;
+	std::vector<unsigned int>::const_iterator oit;
+	std::vector<int> next_hop;
+	rina::RoutingTableEntry * entry;
+	rina::IPCPNameAddresses ipcpna;
+	int v;
+
+	// The next hop of a vertex is the one of its predecessor, or the
+	// vertex itself for the neighbors of the source
+	next_hop.assign(graph.num_vertices(), -1);
+	for (oit = spf_.order_.begin() + 1; oit != spf_.order_.end(); ++oit) {
+		v = spf_.pred_[*oit];
+		next_hop[*oit] = (v == (int) source) ? (int) *oit : next_hop[v];
+	}
+
+	for (it = graph.vertices_.begin(); it != graph.vertices_.end(); ++it) {
+		v = graph.vertex_id(*it);
+		if (v == (int) source || next_hop[v] < 0) {
+			continue;
+		}
+
+		ipcpna.name = graph.names_[next_hop[v]];
+		entry = new rina::RoutingTableEntry();
+		entry->destination.name = (*it);
+		entry->nextHopNames.push_back(rina::NHopAltList(ipcpna));
+		entry->qosId = 0;
+		entry->cost = 1;
+		rt.push_back(entry);
+		LOG_IPCP_DBG("Added entry to routing table: destination %s, next-hop %s",
+				entry->destination.name.c_str(), ipcpna.name.c_str());
+	}
 }
 
-void ECMPDijkstraAlgorithm::clear()
+// ECMP Dijkstra algorithm
+ECMPDijkstraAlgorithm::ECMPDijkstraAlgorithm()
 {
-	unsettled_nodes_.clear();
-	settled_nodes_.clear();
-	predecessors_.clear();
-	distances_.clear();
-	delete t;
 }
 
 void ECMPDijkstraAlgorithm::computeShortestDistances(const Graph& graph,
 			      	      	      	     const std::string& source_name,
 						     std::map<std::string, int>& distances)
 {
-	execute(graph, source_name);
+	std::vector<unsigned int>::const_iterator it;
+	int source = graph.vertex_id(source_name);
+	SPFTree spf;
 
-	// Write back the result
-	distances = distances_;
+	distances.clear();
+	if (source < 0) {
+		distances[source_name] = 0;
+		return;
+	}
 
-	clear();
+	// Not spf_, that one is kept for updateRoutingTable()
+	spf.compute(graph, source, false);
+	for (it = spf.order_.begin(); it != spf.order_.end(); ++it) {
+		distances[graph.names_[*it]] = spf.dist_[*it];
+	}
 }
 
 void ECMPDijkstraAlgorithm::computeRoutingTable(const Graph& graph,
@@ -517,216 +886,202 @@ void ECMPDijkstraAlgorithm::computeRoutingTable(const Graph& graph,
 						const std::string& source_name,
 						std::list<rina::RoutingTableEntry *>& rt)
 {
-	std::list<std::string>::const_iterator it;
-	std::list<std::string>::const_iterator nextHopsIt;
-	std::list<std::string> nextHops;
-	rina::RoutingTableEntry * entry;
-	rina::IPCPNameAddresses ipcpna;
+	int source = graph.vertex_id(source_name);
 
 	(void)fsoList; // avoid compiler barfs
 
-	execute(graph, source_name);
+	if (source < 0) {
+		return;
+	}
 
-	for(std::set<TreeNode *>::iterator it = t->chl.begin(); it != t->chl.end(); it++){
-		std::list<rina::RoutingTableEntry *>::iterator pos = findEntry(rt,
-									       (*it)->name);
+	spf_.compute(graph, source, true);
+	fillRoutingTable(graph, source, rt);
+}
 
-		if(pos != rt.end()){
-			ipcpna.name = (*it)->name;
-			(*pos)->nextHopNames.push_back(ipcpna);
-		}
-		else{
-			entry = new rina::RoutingTableEntry();
-		        entry->destination.name = (*it)->name;
-		        entry->qosId = 1;
-		        entry->cost = (*it)->metric;
-		        ipcpna.name = (*it)->name;
-			entry->nextHopNames.push_back(ipcpna);
-			LOG_IPCP_DBG("Added entry to routing table: destination %s, next-hop %s",
-                        entry->destination.name.c_str(), (*it)->name.c_str());
-			rt.push_back(entry);
-		}
-		addRecursive(rt, 1, (*it)->name, *it);
+int ECMPDijkstraAlgorithm::updateRoutingTable(const Graph& graph,
+					      const std::list<std::pair<unsigned int, unsigned int> >& edges,
+					      const std::string& source_name,
+					      std::list<rina::RoutingTableEntry *>& rt)
+{
+	int source = graph.vertex_id(source_name);
+	int result;
+
+	if (source < 0) {
+		return -1;
 	}
-	clear();
+
+	result = spf_.update(graph, source, edges);
+	fillRoutingTable(graph, source, rt);
+
+	return result;
 }
 
-void ECMPDijkstraAlgorithm::addRecursive(std::list<rina::RoutingTableEntry *> &table,
-					 int qos,
-					 const std::string& next,
-					 TreeNode * node)
+void ECMPDijkstraAlgorithm::fillRoutingTable(const Graph& graph,
+					     unsigned int source,
+					     std::list<rina::RoutingTableEntry *>& rt)
 {
+	std::list<std::string>::const_iterator it;
+	std::vector<unsigned int>::const_iterator oit, pit;
+	std::vector<std::set<unsigned int> > next_hops;
+	std::set<unsigned int>::const_iterator nit;
+	rina::RoutingTableEntry * entry;
 	rina::IPCPNameAddresses ipcpna;
+	int v;
+
+	// The next hops of a vertex are the union of the ones of all its
+	// shortest path predecessors. Predecessors are settled first.
+	next_hops.resize(graph.num_vertices());
+	for (oit = spf_.order_.begin() + 1; oit != spf_.order_.end(); ++oit) {
+		const std::vector<unsigned int>& preds = spf_.preds_[*oit];
+		for (pit = preds.begin(); pit != preds.end(); ++pit) {
+			if (*pit == source) {
+				next_hops[*oit].insert(*oit);
+			} else {
+				next_hops[*oit].insert(next_hops[*pit].begin(),
+						       next_hops[*pit].end());
+			}
+		}
+	}
 
-	for(std::set<TreeNode *>::iterator it = node->chl.begin(); it != node->chl.end(); it++){
-		std::list<rina::RoutingTableEntry *>::iterator pos = findEntry(table,
-									       (*it)->name);
-
-
-		if(pos != table.end()){
-			ipcpna.name = next;
-			(*pos)->nextHopNames.push_back(ipcpna);
+	for (it = graph.vertices_.begin(); it != graph.vertices_.end(); ++it) {
+		v = graph.vertex_id(*it);
+		if (v == (int) source || next_hops[v].empty()) {
+			continue;
 		}
-		else{
-			rina::RoutingTableEntry * entry = new rina::RoutingTableEntry();
-		        entry->destination.name = (*it)->name;
-		        entry->qosId = 1;
-		        entry->cost = (*it)->metric;
-		        ipcpna.name = next;
+
+		entry = new rina::RoutingTableEntry();
+		entry->destination.name = (*it);
+		entry->qosId = 1;
+		entry->cost = spf_.dist_[v];
+		for (nit = next_hops[v].begin(); nit != next_hops[v].end(); ++nit) {
+			ipcpna.name = graph.names_[*nit];
 			entry->nextHopNames.push_back(ipcpna);
 			LOG_IPCP_DBG("Added entry to routing table: destination %s, next-hop %s",
-                        entry->destination.name.c_str(), next.c_str());
-			table.push_back(entry);
+				     entry->destination.name.c_str(), ipcpna.name.c_str());
 		}
-		addRecursive(table, 1, next, *it);
+		rt.push_back(entry);
 	}
 }
 
-std::list<rina::RoutingTableEntry *>::iterator ECMPDijkstraAlgorithm::findEntry(std::list<rina::RoutingTableEntry *> &table,
-										const std::string& name)
+//Class SPFJob
+SPFJob::SPFJob(const Graph& graph, IRoutingAlgorithm& ra,
+	       const std::string& root)
+	: graph_(graph), routing_algorithm_(ra), root_(root)
 {
-	std::list<rina::RoutingTableEntry *>::iterator it;
-	for(it = table.begin(); it != table.end(); it++)
-	{
-		if((*it)->destination.name == name){
-			return it;
-		}
-	}
-	return it;
 }
 
-void ECMPDijkstraAlgorithm::execute(const Graph& graph,
-				    const std::string& source)
+void SPFJob::run()
 {
-	distances_[source] = 0;
-	settled_nodes_.insert(source);
-	t = new TreeNode(source, 0);
-
-	std::list<Edge *>::const_iterator edgeIt;
-	int cost;
-	std::string target = std::string();
-	int shortestDistance;
-	for (edgeIt = graph.edges_.begin();
-			edgeIt != graph.edges_.end(); ++edgeIt) {
-		if (isNeighbor((*edgeIt), source)) {
-			target = (*edgeIt)->getOtherEndpoint(source);
-			distances_[target]=(*edgeIt)->weight_;
-			predecessors_[target].push_front(t);
-			unsettled_nodes_.insert(target);
-		}
-	}
-
-	while (unsettled_nodes_.size() > 0) {
-		std::set<std::string>::iterator it;
-		getMinimum();
-		for(it = minimum_nodes_.begin(); it != minimum_nodes_.end(); ++it){
-			settled_nodes_.insert(*it);
+	routing_algorithm_.computeShortestDistances(graph_, root_, distances_);
+}
 
-			TreeNode * nt = new TreeNode(*it, distances_.find(*it)->second);
-			bool fPar = true;
-			for(std::list<TreeNode *>::iterator par = predecessors_.find(*it)->second.begin();
-					par != predecessors_.find(*it)->second.end(); ++par){
-				if(fPar){
-					(*par)->chldel.insert(nt);
-					fPar = false;
-				}
-				(*par)->chl.insert(nt);
-			}
+//Class SPFWorker
+SPFWorker::SPFWorker(SPFWorkerPool * pool)
+	: rina::SimpleThread(std::string("spf-worker"), false)
+{
+	pool_ = pool;
+}
 
-			unsettled_nodes_.erase(*it);
-			findMinimalDistances(graph, nt);
-		}
-	}
+int SPFWorker::run()
+{
+	pool_->work();
+	return 0;
 }
 
-void ECMPDijkstraAlgorithm::getMinimum()
+//Class SPFWorkerPool
+SPFWorkerPool::SPFWorkerPool(unsigned int num_threads)
 {
-	std::string minimum = std::string();
-	std::set<std::string>::iterator it;
-	minimum_nodes_.clear();
-	std::list<Edge *>::const_iterator edgeIt;
-	for (it = unsettled_nodes_.begin(); it != unsettled_nodes_.end(); ++it) {
-		if (minimum == std::string()) {
-			minimum_nodes_.insert(*it);
-			minimum = (*it);
-		} else {
-			if (getShortestDistance((*it)) < getShortestDistance(minimum)) {
-								
-				minimum = (*it);
-				minimum_nodes_.clear();
-			}
-			if (getShortestDistance((*it)) == getShortestDistance(minimum)) {
-								
-				minimum_nodes_.insert(*it);
-			}
-		}
+	SPFWorker * worker;
+
+	jobs_ = 0;
+	next_job_ = 0;
+	pending_jobs_ = 0;
+	stop_ = false;
+
+	// The thread calling run() is one of them
+	for (unsigned int i = 1; i < num_threads; i++) {
+		worker = new SPFWorker(this);
+		worker->start();
+		workers_.push_back(worker);
 	}
 }
 
-int ECMPDijkstraAlgorithm::getShortestDistance(const std::string& destination) const
+SPFWorkerPool::~SPFWorkerPool()
 {
-	std::map<std::string, int>::const_iterator it;
-	int distance = INT_MAX;
+	std::vector<SPFWorker *>::iterator it;
 
-	it = distances_.find(destination);
-	if (it != distances_.end()) {
-		distance = it->second;
+	cond_.lock();
+	stop_ = true;
+	cond_.broadcast();
+	cond_.unlock();
+
+	for (it = workers_.begin(); it != workers_.end(); ++it) {
+		(*it)->join(NULL);
+		delete *it;
 	}
+}
 
-	return distance;
+unsigned int SPFWorkerPool::num_threads() const
+{
+	return workers_.size() + 1;
 }
 
-void ECMPDijkstraAlgorithm::findMinimalDistances(const Graph& graph,
-						 TreeNode * pred)
+void SPFWorkerPool::work()
 {
-	std::list<std::string> adjacentNodes;
-	std::list<Edge *>::const_iterator edgeIt;
-	int cost;
+	SPFJob * job;
 
-	std::string target = std::string();
-	int shortestDistance;
-	for (edgeIt = graph.edges_.begin(); edgeIt != graph.edges_.end();
-			++edgeIt) {
-		if (isNeighbor((*edgeIt), pred->name)) {
-			target = (*edgeIt)->getOtherEndpoint(pred->name);
-			cost = (*edgeIt)->weight_;
-			shortestDistance = getShortestDistance(pred->name) + cost;
-			if (shortestDistance < getShortestDistance(target)) {
-				distances_[target] = shortestDistance;
-				predecessors_[target].clear();
-			}
-			if (shortestDistance == getShortestDistance(target)) {
-				predecessors_[target].push_front(pred);
-				unsettled_nodes_.insert(target);
-			}
+	cond_.lock();
+	while (true) {
+		while (!stop_ && (!jobs_ || next_job_ == jobs_->size())) {
+			cond_.doWait();
 		}
-	}
-}
 
-bool ECMPDijkstraAlgorithm::isNeighbor(Edge * edge,
-				       const std::string& node) const
-{
-	if (edge->isVertexIn(node)) {
-		if (!isSettled(edge->getOtherEndpoint(node))) {
-			return true;
+		if (stop_) {
+			break;
 		}
-	}
 
-	return false;
+		job = (*jobs_)[next_job_++];
+		cond_.unlock();
+		job->run();
+		cond_.lock();
+
+		if (--pending_jobs_ == 0) {
+			cond_.broadcast();
+		}
+	}
+	cond_.unlock();
 }
 
-bool ECMPDijkstraAlgorithm::isSettled(const std::string& node) const
+void SPFWorkerPool::run(std::vector<SPFJob *>& jobs)
 {
-	std::set<std::string>::iterator it;
+	SPFJob * job;
 
-	for (it = settled_nodes_.begin();
-			it != settled_nodes_.end(); ++it) {
-		if ((*it) == node) {
-			return true;
+	if (workers_.empty()) {
+		for (unsigned int i = 0; i < jobs.size(); i++) {
+			jobs[i]->run();
 		}
+		return;
 	}
 
-	return false;
+	cond_.lock();
+	jobs_ = &jobs;
+	next_job_ = 0;
+	pending_jobs_ = jobs.size();
+	cond_.broadcast();
+
+	while (next_job_ < jobs.size()) {
+		job = jobs[next_job_++];
+		cond_.unlock();
+		job->run();
+		cond_.lock();
+		pending_jobs_--;
+	}
+
+	while (pending_jobs_ > 0) {
+		cond_.doWait();
+	}
+	jobs_ = 0;
+	cond_.unlock();
 }
 
 //Class IResiliencyAlgorithm
@@ -736,36 +1091,23 @@ IResiliencyAlgorithm::IResiliencyAlgorithm(IRoutingAlgorithm& ra)
 }
 
 //Class LoopFreeAlternateAlgorithm
-LoopFreeAlternateAlgorithm::LoopFreeAlternateAlgorithm(IRoutingAlgorithm& ra)
-						: IResiliencyAlgorithm(ra)
+LoopFreeAlternateAlgorithm::LoopFreeAlternateAlgorithm(IRoutingAlgorithm& ra,
+						       unsigned int num_threads)
+						: IResiliencyAlgorithm(ra),
+						  pool_(num_threads)
 {
 }
 
 void LoopFreeAlternateAlgorithm::extendRoutingTableEntry(
-			std::list<rina::RoutingTableEntry *>& rt,
-			const std::string& target_name,
+			rina::RoutingTableEntry * entry,
 			const std::string& nexthop)
 {
-	std::list<rina::RoutingTableEntry *>::iterator rit;
 	bool found = false;
 	rina::IPCPNameAddresses ipcpna;
 
-	// Find the involved routing table entry
-	for (rit = rt.begin(); rit != rt.end(); rit++) {
-		if ((*rit)->destination.name == target_name) {
-			break;
-		}
-	}
-
-	if (rit == rt.end()) {
-		LOG_WARN("LFA: Couldn't find routing table entry for "
-			 "target name %s", target_name.c_str());
-		return;
-	}
-
 	// Assume unicast and try to extend the routing table entry
 	// with the new alternative 'nexthop'
-	rina::NHopAltList& altlist = (*rit)->nextHopNames.front();
+	rina::NHopAltList& altlist = entry->nextHopNames.front();
 
 	for (std::list<rina::IPCPNameAddresses>::iterator
 			hit = altlist.alts.begin();
@@ -781,7 +1123,8 @@ void LoopFreeAlternateAlgorithm::extendRoutingTableEntry(
 		ipcpna.name = nexthop;
 		altlist.alts.push_back(ipcpna);
 		LOG_DBG("Node %s selected as LFA node towards the "
-			 "destination node %s", nexthop.c_str(), target_name.c_str());
+			 "destination node %s", nexthop.c_str(),
+			 entry->destination.name.c_str());
 	}
 }
 
@@ -789,23 +1132,29 @@ void LoopFreeAlternateAlgorithm::fortifyRoutingTable(const Graph& graph,
 						     const std::string& source_name,
 						     std::list<rina::RoutingTableEntry *>& rt)
 {
-	std::map<std::string, std::map< std::string, int > > neighbors_dist_trees;
-	std::map<std::string, int> src_dist_tree;
+	std::map<std::string, rina::RoutingTableEntry *> entries;
+	std::list<rina::RoutingTableEntry *>::iterator rit;
+	std::vector<SPFJob *> jobs;
+	std::vector<std::string>::const_iterator nit;
+
+	// The shortest distance map rooted at the source, and at each of its
+	// neighbors, in name order. They are independent, so they are
+	// computed in parallel and then merged in this order.
+	jobs.push_back(new SPFJob(graph, routing_algorithm, source_name));
+	for (nit = graph.names_.begin(); nit != graph.names_.end(); ++nit) {
+		if ((*nit) != source_name && graph.contains_edge(source_name, *nit)) {
+			jobs.push_back(new SPFJob(graph, routing_algorithm, *nit));
+		}
+	}
 
-	// TODO avoid this, can be computed when invoke computeRoutingTable()
-	routing_algorithm.computeShortestDistances(graph, source_name, src_dist_tree);
+	pool_.run(jobs);
 
-	// Collect all the neighbors, and for each one use the routing algorithm to
-	// compute the shortest distance map rooted at that neighbor
-	for (std::list<std::string>::const_iterator it = graph.vertices_.begin();
-						it != graph.vertices_.end(); ++it) {
-		if ((*it) != source_name && graph.contains_edge(source_name, *it)) {
-			neighbors_dist_trees[*it] = std::map<std::string, int>();
-			routing_algorithm.computeShortestDistances(graph,
-						*it, neighbors_dist_trees[*it]);
-		}
+	for (rit = rt.begin(); rit != rt.end(); ++rit) {
+		entries.insert(std::make_pair((*rit)->destination.name, *rit));
 	}
 
+	std::map<std::string, int>& src_dist_tree = jobs[0]->distances_;
+
 	// For each node X other than than the source node
 	for (std::list<std::string>::const_iterator it = graph.vertices_.begin();
 						it != graph.vertices_.end(); ++it) {
@@ -814,14 +1163,12 @@ void LoopFreeAlternateAlgorithm::fortifyRoutingTable(const Graph& graph,
 		}
 
 		// For each neighbor of the source node, excluding X
-		for (std::map<std::string, std::map<std::string, int> >::iterator
-			nit = neighbors_dist_trees.begin();
-				nit != neighbors_dist_trees.end(); nit++) {
+		for (unsigned int j = 1; j < jobs.size(); j++) {
 			// If this neighbor is a LFA node for the current
 			// destination (*it) extend the routing table to take it
 			// into account
-			std::map< std::string, int>& neigh_dist_map = nit->second;
-			std::string neigh = nit->first;
+			std::map< std::string, int>& neigh_dist_map = jobs[j]->distances_;
+			const std::string& neigh = jobs[j]->root_;
 
 			if (neigh == *it) {
 				continue;
@@ -831,10 +1178,20 @@ void LoopFreeAlternateAlgorithm::fortifyRoutingTable(const Graph& graph,
 			if (neigh_dist_map[*it] < src_dist_tree[neigh] + src_dist_tree[*it]) {
 				//LOG_DBG("Node %u is a possible LFA for destination %u",
 				//	neigh, *it);
-				extendRoutingTableEntry(rt, *it, neigh);
+				if (entries.find(*it) == entries.end()) {
+					LOG_WARN("LFA: Couldn't find routing table entry for "
+						 "target name %s", it->c_str());
+					continue;
+				}
+
+				extendRoutingTableEntry(entries[*it], neigh);
 			}
 		}
 	}
+
+	for (unsigned int j = 0; j < jobs.size(); j++) {
+		delete jobs[j];
+	}
 }
 
 // CLASS FlowStateObject
@@ -844,6 +1201,7 @@ FlowStateObject::FlowStateObject()
 	state_up = false;
 	seq_num = 0;
 	age = 0;
+	age_tick = 0;
 	modified = false;
 	avoid_port = 0;
 	being_erased = true;
@@ -862,6 +1220,7 @@ FlowStateObject::FlowStateObject(const std::string& name_,
 	state_up = up;
 	seq_num = sequence_number;
 	age = age_;
+	age_tick = 0;
 	std::stringstream ss;
 	ss << FlowStateRIBObject::object_name_prefix
 	   << getKey();
@@ -995,10 +1354,12 @@ const std::string FlowStateObject::getKey() const
 const std::string FlowStateRIBObject::clazz_name = "FlowStateObject";
 const std::string FlowStateRIBObject::object_name_prefix = "/ra/fsos/key=";
 
-FlowStateRIBObject::FlowStateRIBObject(FlowStateObject* new_obj):
+FlowStateRIBObject::FlowStateRIBObject(FlowStateObject* new_obj,
+				       const FlowStateObjects * new_fsos):
 rina::rib::RIBObj(clazz_name)
 {
 	obj = new_obj;
+	fsos = new_fsos;
 }
 
 void FlowStateRIBObject::read(const rina::cdap_rib::con_handle_t &con, 
@@ -1007,39 +1368,69 @@ void FlowStateRIBObject::read(const rina::cdap_rib::con_handle_t &con,
 	rina::ser_obj_t &obj_reply, rina::cdap_rib::res_info_t& res)
 {
 	FlowStateObjectEncoder encoder;
-	encoder.encode(*obj, obj_reply);
+	FlowStateObject current = *obj;
+
+	current.age = fsos->currentAge(*obj);
+	encoder.encode(current, obj_reply);
 
 	res.code_ = rina::cdap_rib::CDAP_SUCCESS;
 }
 
 const std::string FlowStateRIBObject::get_displayable_value() const
 {
-	return obj->toString();
+	FlowStateObject current = *obj;
+
+	// The stored age is the one of the last update
+	current.age = fsos->currentAge(*obj);
+	return current.toString();
 }
 
 // CLASS FlowStateObjects
+const unsigned int FlowStateObjects::SNAPSHOT_MAX_AGE = 60;
+
+// The RIB the FSDB objects are published in, none if the FSDB is used
+// without an IPC Process (as in the unit tests)
+static IPCPRIBDaemon * fsdbRIBDaemon()
+{
+	IPCProcessImpl * ipcp = IPCPFactory::getIPCP();
+
+	if (!ipcp) {
+		return 0;
+	}
+
+	return (IPCPRIBDaemon*) ipcp->get_rib_daemon();
+}
+
 FlowStateObjects::FlowStateObjects(LinkStateRoutingPolicy * ps)
 {
 	modified_ = false;
 	ps_ = ps;
-	rina::rib::RIBObj *rib_objects = new FlowStateRIBObjects(this, ps);
-	IPCPRIBDaemon* rib_daemon = (IPCPRIBDaemon*)IPCPFactory::getIPCP()
-		->get_rib_daemon();
-	rib_daemon->addObjRIB(FlowStateRIBObjects::object_name, &rib_objects);
+	snapshot_valid = false;
+	snapshot_max_objects = 0;
+	snapshot_age = 0;
+	packed_encoding = false;
+	age_clock = 0;
+	maximum_age = UINT_MAX;
+	IPCPRIBDaemon* rib_daemon = fsdbRIBDaemon();
+	if (rib_daemon) {
+		rina::rib::RIBObj *rib_objects = new FlowStateRIBObjects(this, ps);
+		rib_daemon->addObjRIB(FlowStateRIBObjects::object_name, &rib_objects);
+	}
 	wait_until_remove_object = 0;
 }
 
 FlowStateObjects::~FlowStateObjects()
 {
-	for (std::map<std::string, FlowStateObject*>::iterator it = 
-		objects.begin(); it != objects.end(); ++it)
+	for (fso_iterator it = objects.begin(); it != objects.end(); ++it)
 	{
 		delete it->second;
 	}
 	objects.clear();
-	IPCPRIBDaemon* rib_daemon = (IPCPRIBDaemon*)IPCPFactory::getIPCP()
-		->get_rib_daemon();
-	rib_daemon->removeObjRIB(FlowStateRIBObjects::object_name);
+	clearSnapshot();
+	IPCPRIBDaemon* rib_daemon = fsdbRIBDaemon();
+	if (rib_daemon) {
+		rib_daemon->removeObjRIB(FlowStateRIBObjects::object_name);
+	}
 }
 
 void FlowStateObjects::set_wait_until_remove_object(unsigned int wait_object)
@@ -1047,11 +1438,85 @@ void FlowStateObjects::set_wait_until_remove_object(unsigned int wait_object)
 	wait_until_remove_object = wait_object;
 }
 
+void FlowStateObjects::set_maximum_age(unsigned int max_age)
+{
+	rina::ScopedLock g(lock);
+
+	maximum_age = max_age;
+	rebuildExpiries();
+}
+
+void FlowStateObjects::set_packed_encoding(bool packed)
+{
+	rina::ScopedLock g(lock);
+
+	packed_encoding = packed;
+	clearSnapshot();
+}
+
+unsigned int FlowStateObjects::internName(const std::string& name)
+{
+	std::map<std::string, unsigned int>::iterator it = name_ids.find(name);
+	if (it != name_ids.end())
+		return it->second;
+
+	unsigned int id = name_ids.size();
+	name_ids[name] = id;
+	return id;
+}
+
+bool FlowStateObjects::findName(const std::string& name,
+				unsigned int& id) const
+{
+	std::map<std::string, unsigned int>::const_iterator it =
+			name_ids.find(name);
+	if (it == name_ids.end())
+		return false;
+
+	id = it->second;
+	return true;
+}
+
+FlowStateObjects::fso_iterator
+FlowStateObjects::findObject(const std::string& name,
+			     const std::string& neighbor_name)
+{
+	unsigned int id1, id2;
+
+	if (!findName(name, id1) || !findName(neighbor_name, id2))
+		return objects.end();
+
+	return objects.find(std::make_pair(id1, id2));
+}
+
+FlowStateObjects::fso_iterator
+FlowStateObjects::findObject(const std::string& fqn)
+{
+	const std::string& prefix = FlowStateRIBObject::object_name_prefix;
+	std::string::size_type pos;
+	fso_iterator it;
+
+	if (fqn.compare(0, prefix.size(), prefix) != 0)
+		return objects.end();
+
+	// The key is <name>-<neighbor name>, and names can contain '-'
+	pos = fqn.find('-', prefix.size());
+	while (pos != std::string::npos) {
+		it = findObject(fqn.substr(prefix.size(), pos - prefix.size()),
+				fqn.substr(pos + 1));
+		if (it != objects.end())
+			return it;
+		pos = fqn.find('-', pos + 1);
+	}
+
+	return objects.end();
+}
+
 bool FlowStateObjects::addObject(const FlowStateObject& object)
 {
 	rina::ScopedLock g(lock);
 
-	if (objects.find(object.object_name) == objects.end())
+	if (findObject(object.name, object.neighbor_name) == objects.end())
 	{
 		addCheckedObject(object);
 		return true;
@@ -1069,24 +1534,31 @@ void FlowStateObjects::addAddressToFSOs(const std::string& name,
 					bool neighbor)
 {
 	rina::ScopedLock g(lock);
-	std::map<std::string, FlowStateObject *>::iterator it;
-	std::string my_name = IPCPFactory::getIPCP()->get_name();
+	fso_iterator it, last;
+	unsigned int id;
+
+	if (neighbor) {
+		it = findObject(IPCPFactory::getIPCP()->get_name(), name);
+		last = it;
+		if (it != objects.end())
+			++last;
+	} else if (findName(name, id)) {
+		it = objects.lower_bound(std::make_pair(id, 0u));
+		last = objects.lower_bound(std::make_pair(id + 1, 0u));
+	} else {
+		it = last = objects.end();
+	}
 
-	for (it = objects.begin(); it != objects.end(); ++it) {
-		if (neighbor) {
-			if (it->second->name == my_name
-					&& it->second->neighbor_name == name) {
-				it->second->add_neighboraddress(address);
-				it->second->modified = true;
-				it->second->age = 0;
-				it->second->seq_num = it->second->seq_num + 1;
-			}
-		} else if (it->second->name == name) {
+	for (; it != last; ++it) {
+		if (neighbor)
+			it->second->add_neighboraddress(address);
+		else
 			it->second->add_address(address);
-			it->second->modified = true;
-			it->second->age = 0;
-			it->second->seq_num = it->second->seq_num + 1;
-		}
+		it->second->modified = true;
+		it->second->age = 0;
+		it->second->seq_num = it->second->seq_num + 1;
+		ageChanged(it);
+		objectChanged(it, false);
 	}
 
 	modified_ = true;
@@ -1097,24 +1569,31 @@ void FlowStateObjects::removeAddressFromFSOs(const std::string& name,
 					     bool neighbor)
 {
 	rina::ScopedLock g(lock);
-	std::map<std::string, FlowStateObject *>::iterator it;
-	std::string my_name = IPCPFactory::getIPCP()->get_name();
+	fso_iterator it, last;
+	unsigned int id;
+
+	if (neighbor) {
+		it = findObject(IPCPFactory::getIPCP()->get_name(), name);
+		last = it;
+		if (it != objects.end())
+			++last;
+	} else if (findName(name, id)) {
+		it = objects.lower_bound(std::make_pair(id, 0u));
+		last = objects.lower_bound(std::make_pair(id + 1, 0u));
+	} else {
+		it = last = objects.end();
+	}
 
-	for (it = objects.begin(); it != objects.end(); ++it) {
-		if (neighbor) {
-			if (it->second->name == my_name
-					&& it->second->neighbor_name == name) {
-				it->second->remove_neighboraddress(address);
-				it->second->modified = true;
-				it->second->age = 0;
-				it->second->seq_num = it->second->seq_num + 1;
-			}
-		} else if (it->second->name == name) {
+	for (; it != last; ++it) {
+		if (neighbor)
+			it->second->remove_neighboraddress(address);
+		else
 			it->second->remove_address(address);
-			it->second->modified = true;
-			it->second->age = 0;
-			it->second->seq_num = it->second->seq_num + 1;
-		}
+		it->second->modified = true;
+		it->second->age = 0;
+		it->second->seq_num = it->second->seq_num + 1;
+		ageChanged(it);
+		objectChanged(it, false);
 	}
 
 	modified_ = true;
@@ -1132,10 +1611,15 @@ void FlowStateObjects::addCheckedObject(const FlowStateObject& object)
 	fso->set_addresses(object.addresses);
 	fso->set_neighboraddresses(object.neighbor_addresses);
 
-	objects[object.object_name] = fso;
-	rina::rib::RIBObj* rib_obj = new FlowStateRIBObject(fso);
-	IPCPRIBDaemon* rib_daemon = (IPCPRIBDaemon*)IPCPFactory::getIPCP()->get_rib_daemon();
-	rib_daemon->addObjRIB(fso->object_name, &rib_obj);
+	fso_key_t key(internName(fso->name), internName(fso->neighbor_name));
+	fso_iterator it = objects.insert(std::make_pair(key, fso)).first;
+	ageChanged(it);
+	objectChanged(it, true);
+	IPCPRIBDaemon* rib_daemon = fsdbRIBDaemon();
+	if (rib_daemon) {
+		rina::rib::RIBObj* rib_obj = new FlowStateRIBObject(fso, this);
+		rib_daemon->addObjRIB(fso->object_name, &rib_obj);
+	}
 	modified_ = true;
 }
 
@@ -1144,185 +1628,401 @@ void FlowStateObjects::deprecateObject(const std::string& fqn,
 {
 	rina::ScopedLock g(lock);
 
-	std::map<std::string, FlowStateObject*>::iterator it =
-			objects.find(fqn);
+	fso_iterator it = findObject(fqn);
 	if(it != objects.end())
 	{
 		it->second->deprecateObject(max_age);
+		ageChanged(it);
+		objectChanged(it, true);
+	}
+}
+
+void FlowStateObjects::deprecateObjects(const std::string& neigh_name,
+		      	      	        const std::string& name,
+		     	     	        unsigned int max_age)
+{
+	rina::ScopedLock g(lock);
+
+	fso_iterator it = findObject(name, neigh_name);
+	if (it != objects.end()) {
+		it->second->deprecateObject(max_age);
+		ageChanged(it);
+		objectChanged(it, true);
+		modified_ = true;
+	}
+}
+
+void FlowStateObjects::updateCost(const std::string& neigh_name,
+		      	      	  const std::string& name,
+				  unsigned int cost)
+{
+	rina::ScopedLock g(lock);
+
+	fso_iterator it = findObject(name, neigh_name);
+	if (it != objects.end()) {
+		it->second->cost = cost;
+		it->second->seq_num = it->second->seq_num + 1;
+		it->second->modified = true;
+		objectChanged(it, true);
+		modified_ = true;
+	}
+}
+
+void FlowStateObjects::deprecateObjectsWithName(const std::string& name,
+						unsigned int max_age,
+						bool neighbor)
+{
+	rina::ScopedLock g(lock);
+	fso_iterator it, last;
+	unsigned int id;
+
+	if (neighbor) {
+		it = findObject(IPCPFactory::getIPCP()->get_name(), name);
+		last = it;
+		if (it != objects.end())
+			++last;
+	} else if (findName(name, id)) {
+		it = objects.lower_bound(std::make_pair(id, 0u));
+		last = objects.lower_bound(std::make_pair(id + 1, 0u));
+	} else {
+		it = last = objects.end();
+	}
+
+	for (; it != last; ++it) {
+		it->second->deprecateObject(max_age);
+		ageChanged(it);
+		objectChanged(it, true);
+		modified_ = true;
+	}
+}
+
+void FlowStateObjects::removeObject(const std::string& fqn)
+{
+	rina::ScopedLock g(lock);
+
+	LOG_IPCP_DBG("Trying to remove object %s", fqn.c_str());
+
+	fso_iterator it = findObject(fqn);
+
+	if (it == objects.end())
+		return;
+
+	IPCPRIBDaemon* rib_daemon = fsdbRIBDaemon();
+	if (rib_daemon) {
+		rib_daemon->removeObjRIB(it->second->object_name);
+	}
+	objectChanged(it, true);
+
+	dirty.erase(it->first);
+	delete it->second;
+	objects.erase(it);
+}
+
+FlowStateObject* FlowStateObjects::getObject(const std::string& fqn)
+{
+	rina::ScopedLock g(lock);
+
+	fso_iterator it = findObject(fqn);
+	if ( it != objects.end())
+		return it->second;
+
+	return 0;
+}
+
+FlowStateObject* FlowStateObjects::getObject(const std::string& name,
+					     const std::string& neighbor_name)
+{
+	rina::ScopedLock g(lock);
+
+	fso_iterator it = findObject(name, neighbor_name);
+	if ( it != objects.end())
+		return it->second;
+
+	return 0;
+}
+
+void FlowStateObjects::has_modified(bool modified)
+{
+	modified_ = modified;
+}
+
+static bool compareObjectNames(const FlowStateObject * a,
+			       const FlowStateObject * b)
+{
+	return a->object_name < b->object_name;
+}
+
+void FlowStateObjects::getAllFSOs(std::list<FlowStateObject>& result)
+{
+	rina::ScopedLock g(lock);
+	std::vector<FlowStateObject *> sorted;
+
+	sorted.reserve(objects.size());
+	for (fso_iterator it = objects.begin(); it != objects.end(); ++it)
+	{
+		sorted.push_back(it->second);
+	}
+	std::sort(sorted.begin(), sorted.end(), compareObjectNames);
+
+	for (std::vector<FlowStateObject *>::iterator it = sorted.begin();
+			it != sorted.end(); ++it)
+	{
+		result.push_back(**it);
+		result.back().age = currentAge(**it);
 	}
 }
 
-void FlowStateObjects::deprecateObjects(const std::string& neigh_name,
-		      	      	        const std::string& name,
-		     	     	        unsigned int max_age)
+unsigned int FlowStateObjects::currentAge(const FlowStateObject& object) const
+{
+	unsigned int elapsed = age_clock - object.age_tick;
+
+	if (object.age > UINT_MAX - elapsed)
+		return UINT_MAX;
+
+	return object.age + elapsed;
+}
+
+unsigned int FlowStateObjects::expiryTick(const FlowStateObject& object) const
 {
-	rina::ScopedLock g(lock);
+	if (maximum_age == UINT_MAX)
+		return UINT_MAX;
 
-	std::map<std::string, FlowStateObject *>::iterator it;
-	for (it = objects.begin(); it != objects.end();
-			++it) {
-		if (it->second->neighbor_name == neigh_name &&
-				it->second->name == name) {
-			it->second->deprecateObject(max_age);
-			modified_ = true;
-		}
-	}
+	if (object.age >= maximum_age)
+		return object.age_tick;
+
+	if (maximum_age - object.age > UINT_MAX - object.age_tick)
+		return UINT_MAX;
+
+	return object.age_tick + maximum_age - object.age;
 }
 
-void FlowStateObjects::updateCost(const std::string& neigh_name,
-		      	      	  const std::string& name,
-				  unsigned int cost)
+void FlowStateObjects::ageChanged(fso_iterator it)
 {
-	rina::ScopedLock g(lock);
+	unsigned int expiry;
 
-	std::map<std::string, FlowStateObject *>::iterator it;
-	for (it = objects.begin(); it != objects.end();
-			++it) {
-		if (it->second->neighbor_name == neigh_name &&
-				it->second->name == name) {
-			it->second->cost = cost;
-			it->second->seq_num = it->second->seq_num + 1;
-			it->second->modified = true;
-			modified_ = true;
-		}
-	}
+	it->second->age_tick = age_clock;
+	expiry = expiryTick(*it->second);
+	if (expiry == UINT_MAX)
+		return;
+
+	expiries.insert(std::make_pair(expiry, it->first));
+	if (expiries.size() > 2 * objects.size() + 64)
+		rebuildExpiries();
 }
 
-void FlowStateObjects::deprecateObjectsWithName(const std::string& name,
-						unsigned int max_age,
-						bool neighbor)
+void FlowStateObjects::rebuildExpiries()
 {
-	rina::ScopedLock g(lock);
-	std::string my_name = IPCPFactory::getIPCP()->get_name();
+	unsigned int expiry;
 
-	std::map<std::string, FlowStateObject *>::iterator it;
-	for (it = objects.begin(); it != objects.end();
-			++it) {
-		if (!neighbor && it->second->name == name) {
-			it->second->deprecateObject(max_age);
-			modified_ = true;
-		} else if (neighbor && it->second->neighbor_name == name &&
-				it->second->name == my_name) {
-			it->second->deprecateObject(max_age);
-			modified_ = true;
-		}
+	expiries.clear();
+	for (fso_iterator it = objects.begin(); it != objects.end(); ++it) {
+		expiry = expiryTick(*it->second);
+		if (expiry != UINT_MAX && !it->second->being_erased)
+			expiries.insert(std::make_pair(expiry, it->first));
 	}
 }
 
-void FlowStateObjects::removeObject(const std::string& fqn)
+void FlowStateObjects::incrementAge(rina::Timer* timer)
 {
 	rina::ScopedLock g(lock);
+	std::set<std::pair<unsigned int, fso_key_t> >::iterator it;
+	std::list<std::string> expired;
+	fso_iterator fit;
+
+	age_clock++;
+	snapshot_age++;
+
+	while (!expiries.empty() && expiries.begin()->first <= age_clock) {
+		it = expiries.begin();
+		fit = objects.find(it->second);
+		if (fit != objects.end() && !fit->second->being_erased &&
+				expiryTick(*fit->second) == it->first) {
+			LOG_IPCP_DBG("Object to erase age: %d",
+				     currentAge(*fit->second));
+			fit->second->being_erased = true;
+			expired.push_back(fit->second->object_name);
+		}
+		expiries.erase(it);
+	}
 
-	LOG_IPCP_DBG("Trying to remove object %s", fqn.c_str());
+	if (!expired.empty()) {
+		KillFlowStateObjectTimerTask* ksttask =
+			new KillFlowStateObjectTimerTask(ps_, expired);
 
-	std::map<std::string, FlowStateObject*>::iterator it =
-			objects.find(fqn);
+		timer->scheduleTask(ksttask, wait_until_remove_object);
+	}
+}
 
+void FlowStateObjects::updateObject(const std::string& fqn, 
+				    unsigned int avoid_port_)
+{
+	rina::ScopedLock g(lock);
+	fso_iterator it = findObject(fqn);
 	if (it == objects.end())
 		return;
 
-	IPCPRIBDaemon* rib_daemon = (IPCPRIBDaemon*) IPCPFactory::getIPCP()->get_rib_daemon();
-	rib_daemon->removeObjRIB(it->second->object_name);
+	FlowStateObject* obj = it->second;
+	obj->age = 0;
+	obj->avoid_port = avoid_port_;
+	obj->being_erased = false;
+	obj->state_up = true;
+	obj->seq_num = 1;
+	obj->modified = true;
+	ageChanged(it);
+	objectChanged(it, true);
+}
 
-	objects.erase(it);
-	delete it->second;
+void FlowStateObjects::addChangedLink(const FlowStateObject& object)
+{
+	if (object.name < object.neighbor_name) {
+		changed_links.insert(std::make_pair(object.name,
+						    object.neighbor_name));
+	} else {
+		changed_links.insert(std::make_pair(object.neighbor_name,
+						    object.name));
+	}
 }
 
-FlowStateObject* FlowStateObjects::getObject(const std::string& fqn)
+void FlowStateObjects::objectChanged(fso_iterator it, bool link)
 {
-	rina::ScopedLock g(lock);
+	if (it->second->modified)
+		dirty.insert(it->first);
 
-	std::map<std::string, FlowStateObject*>::iterator it =
-		objects.find(fqn);
-	if ( it != objects.end())
-		return it->second;
+	if (link)
+		addChangedLink(*it->second);
 
-	return 0;
+	snapshot_valid = false;
 }
 
-void FlowStateObjects::has_modified(bool modified)
+void FlowStateObjects::objectUpdated(const FlowStateObject& object)
 {
-	modified_ = modified;
+	rina::ScopedLock g(lock);
+
+	fso_iterator it = findObject(object.name, object.neighbor_name);
+	if (it != objects.end()) {
+		ageChanged(it);
+		objectChanged(it, true);
+	}
 }
 
-void FlowStateObjects::getModifiedFSOs(std::list<FlowStateObject *>& result)
+void FlowStateObjects::getChangedLinks(std::map<std::pair<std::string, std::string>, int>& links)
 {
 	rina::ScopedLock g(lock);
-
-	for (std::map<std::string, FlowStateObject*>::iterator it
-		= objects.begin(); it != objects.end();++it)
-	{
-		if (it->second->modified)
-		{
-			result.push_back(it->second);
+	std::set<std::pair<std::string, std::string> >::iterator it;
+	fso_iterator it1, it2;
+
+	for (it = changed_links.begin(); it != changed_links.end(); ++it) {
+		it1 = findObject(it->first, it->second);
+		it2 = findObject(it->second, it->first);
+
+		// Same rule as Graph::init_edges(): the link has to be up in
+		// both directions, the cost is the one of the FSO found last
+		if (it1 == objects.end() || it2 == objects.end() ||
+				!it1->second->state_up || !it2->second->state_up) {
+			links[*it] = -1;
+		} else if (it1->second->object_name < it2->second->object_name) {
+			links[*it] = it2->second->cost;
+		} else {
+			links[*it] = it1->second->cost;
 		}
 	}
+
+	changed_links.clear();
 }
 
-void FlowStateObjects::getAllFSOs(std::list<FlowStateObject>& result)
+void FlowStateObjects::getAddresses(std::map<std::string, std::list<unsigned int> >& addresses)
 {
 	rina::ScopedLock g(lock);
 
-	for (std::map<std::string, FlowStateObject*>::iterator it
-			= objects.begin(); it != objects.end();++it)
+	for (fso_iterator it = objects.begin(); it != objects.end(); ++it)
 	{
-		result.push_back(*(it->second));
+		if (addresses.find(it->second->name) == addresses.end())
+			addresses[it->second->name] = it->second->addresses;
 	}
 }
 
-void FlowStateObjects::incrementAge(unsigned int max_age, rina::Timer* timer)
+void FlowStateObjects::encodeGroups(const std::list<FlowStateObject *>& fsos,
+				    int skip_port,
+				    unsigned int max_objects,
+				    std::list<rina::ser_obj_t *>& messages)
 {
-	rina::ScopedLock g(lock);
-
-	for (std::map<std::string, FlowStateObject *>::iterator
-		it = objects.begin(); it != objects.end(); ++it) 
-	{
-		if (it->second->age < UINT_MAX)
-			it->second->age = it->second->age + 1;
+	FlowStateObjectListEncoder encoder(packed_encoding);
+	std::list<FlowStateObject> group;
+	std::list<FlowStateObject *>::const_iterator it;
+	rina::ser_obj_t * message;
 
-		if (it->second->age >= max_age && !it->second->being_erased) {
-			LOG_IPCP_DBG("Object to erase age: %d", it->second->age);
-			it->second->being_erased = true;
-			KillFlowStateObjectTimerTask* ksttask =
-				new KillFlowStateObjectTimerTask(ps_, it->second->object_name);
+	for (it = fsos.begin(); it != fsos.end(); ++it) {
+		if (skip_port != FlowStateManager::NO_AVOID_PORT &&
+				(*it)->avoid_port == skip_port)
+			continue;
 
-			timer->scheduleTask(ksttask, wait_until_remove_object);
+		group.push_back(**it);
+		group.back().age = currentAge(**it);
+		if (group.size() == max_objects) {
+			message = new rina::ser_obj_t();
+			encoder.encode(group, *message);
+			messages.push_back(message);
+			group.clear();
 		}
 	}
+
+	if (!group.empty()) {
+		message = new rina::ser_obj_t();
+		encoder.encode(group, *message);
+		messages.push_back(message);
+	}
 }
 
-void FlowStateObjects::updateObject(const std::string& fqn, 
-				    unsigned int avoid_port_)
+void FlowStateObjects::clearSnapshot()
+{
+	for (std::list<rina::ser_obj_t *>::iterator it = snapshot.begin();
+			it != snapshot.end(); ++it) {
+		delete *it;
+	}
+	snapshot.clear();
+	snapshot_valid = false;
+}
+
+void FlowStateObjects::getEncodedFSOs(std::list<rina::ser_obj_t *>& messages,
+				      unsigned int max_objects)
 {
 	rina::ScopedLock g(lock);
-	std::map<std::string, FlowStateObject*>::iterator it =
-		objects.find(fqn);
-	if (it == objects.end())
-		return;
+	std::list<rina::ser_obj_t *>::iterator it;
+	rina::ser_obj_t * message;
+
+	// Only the ages of the FSOs can be stale
+	if (!snapshot_valid || snapshot_max_objects != max_objects
+			|| snapshot_age >= SNAPSHOT_MAX_AGE) {
+		std::list<FlowStateObject *> fsos;
+
+		clearSnapshot();
+		for (fso_iterator fit = objects.begin(); fit != objects.end();
+				++fit) {
+			fsos.push_back(fit->second);
+		}
+		encodeGroups(fsos, FlowStateManager::NO_AVOID_PORT,
+			     max_objects, snapshot);
+		snapshot_valid = true;
+		snapshot_max_objects = max_objects;
+		snapshot_age = 0;
+	}
 
-	FlowStateObject* obj = it->second;
-	obj->age = 0;
-	obj->avoid_port = avoid_port_;
-	obj->being_erased = false;
-	obj->state_up = true;
-	obj->seq_num = 1;
-	obj->modified = true;
+	for (it = snapshot.begin(); it != snapshot.end(); ++it) {
+		message = new rina::ser_obj_t();
+		*message = **it;
+		messages.push_back(message);
+	}
 }
 
 void FlowStateObjects::encodeAllFSOs(rina::ser_obj_t& obj)
 {
-	rina::ScopedLock g(lock);
+	std::list<rina::ser_obj_t *> messages;
 
-	FlowStateObjectListEncoder encoder;
-	std::list<FlowStateObject> result;
-	if (!objects.empty())
+	getEncodedFSOs(messages, UINT_MAX);
+	if (!messages.empty())
 	{
-		for (std::map<std::string, FlowStateObject*>::iterator it
-			= objects.begin(); it != objects.end();++it)
-		{
-			result.push_back(*(it->second));
-		}
-		encoder.encode(result, obj);
+		obj = *messages.front();
+		delete messages.front();
 	}
 	else
 	{
@@ -1331,28 +2031,71 @@ void FlowStateObjects::encodeAllFSOs(rina::ser_obj_t& obj)
 	}
 }
 
-void FlowStateObjects::getAllFSOsForPropagation(std::list< std::list<FlowStateObject> >& fsos,
-						unsigned int max_objects)
+void FlowStateObjects::encodeModifiedFSOs(const std::list<int>& ports,
+					  unsigned int max_objects,
+					  unsigned int max_fsos,
+					  std::map<int, std::list<rina::ser_obj_t *> >& to_send,
+					  std::list<rina::ser_obj_t *>& messages)
 {
 	rina::ScopedLock g(lock);
-	std::list<FlowStateObject> fsolist;
+	std::list<FlowStateObject *> fsos;
+	std::list<FlowStateObject *>::iterator it;
+	std::list<int>::const_iterator pit;
+	std::set<int> avoided;
+	std::set<fso_key_t>::iterator dit;
+	std::list<rina::ser_obj_t *> common;
+	bool common_encoded = false;
+	fso_iterator fit;
 
-	if (objects.empty())
-		return;
+	//1 Get the FSOs to propagate
+	for (dit = dirty.begin(); dit != dirty.end(); ++dit) {
+		if (max_fsos != 0 && fsos.size() == max_fsos)
+			break;
 
-	for (std::map<std::string, FlowStateObject*>::iterator it
-			= objects.begin(); it != objects.end();++it)
-	{
-		if (fsolist.size() == max_objects) {
-			fsos.push_back(fsolist);
-			fsolist.clear();
-		}
+		fit = objects.find(*dit);
+		if (fit == objects.end() || !fit->second->modified)
+			continue;
+
+		LOG_DBG("Propagation: Check modified object %s with age %d and status %d",
+			fit->second->object_name.c_str(),
+			currentAge(*fit->second),
+			fit->second->state_up);
+
+		fsos.push_back(fit->second);
+		avoided.insert(fit->second->avoid_port);
+	}
+	dirty.erase(dirty.begin(), dit);
+
+	//2 Encode them once for all the ports not avoided by any of them,
+	// and once for each of the other ports
+	if (!fsos.empty()) {
+		for (pit = ports.begin(); pit != ports.end(); ++pit) {
+			if (to_send.find(*pit) != to_send.end())
+				continue;
+
+			std::list<rina::ser_obj_t *>& port_msgs = to_send[*pit];
+
+			if (avoided.find(*pit) != avoided.end()) {
+				encodeGroups(fsos, *pit, max_objects, port_msgs);
+				messages.insert(messages.end(), port_msgs.begin(),
+						port_msgs.end());
+				continue;
+			}
 
-		fsolist.push_back(*(it->second));
+			if (!common_encoded) {
+				encodeGroups(fsos, FlowStateManager::NO_AVOID_PORT,
+					     max_objects, common);
+				messages.insert(messages.end(), common.begin(),
+						common.end());
+				common_encoded = true;
+			}
+			port_msgs = common;
+		}
 	}
 
-	if (fsolist.size() != 0) {
-		fsos.push_back(fsolist);
+	for (it = fsos.begin(); it != fsos.end(); ++it) {
+		(*it)->modified = false;
+		(*it)->avoid_port = FlowStateManager::NO_AVOID_PORT;
 	}
 }
 
@@ -1361,6 +2104,21 @@ bool FlowStateObjects::is_modified() const
 	return modified_;
 }
 
+//Class RoutingComputationRIBObject
+const std::string RoutingComputationRIBObject::clazz_name = "RoutingComputation";
+const std::string RoutingComputationRIBObject::object_name = "/ra/routing";
+
+RoutingComputationRIBObject::RoutingComputationRIBObject(LinkStateRoutingPolicy * ps)
+	: rina::rib::RIBObj(clazz_name)
+{
+	ps_ = ps;
+}
+
+const std::string RoutingComputationRIBObject::get_displayable_value() const
+{
+	return ps_->getComputationStats();
+}
+
 //Class FlowStateRIBObjects
 const std::string FlowStateRIBObjects::clazz_name = "FlowStateObjects";
 const std::string FlowStateRIBObjects::object_name= "/ra/fsos";
@@ -1395,7 +2153,16 @@ void FlowStateRIBObjects::write(const rina::cdap_rib::con_handle_t &con,
 {
 	FlowStateObjectListEncoder encoder;
 	std::list<FlowStateObject> new_objects;
-	encoder.decode(obj_req, new_objects);
+
+	try {
+		encoder.decode(obj_req, new_objects);
+	} catch (rina::Exception &e) {
+		LOG_IPCP_ERR("Rejecting malformed flow state objects from port %d: %s",
+			     con.port_id, e.what());
+		res.code_ = rina::cdap_rib::CDAP_SER_DES_ERRORSUPPORTED;
+		return;
+	}
+
 	ps_->updateObjects(new_objects,
 			   con.port_id);
 }
@@ -1459,7 +2226,7 @@ void FlowStateManager::removeAddressFromFSOs(const std::string& name,
 
 void FlowStateManager::incrementAge()
 {
-	fsos->incrementAge(maximum_age, timer);
+	fsos->incrementAge(timer);
 }
 
 void FlowStateManager::updateObjects(const std::list<FlowStateObject>& newObjects,
@@ -1473,7 +2240,8 @@ void FlowStateManager::updateObjects(const std::list<FlowStateObject>& newObject
 	for (std::list<FlowStateObject>::const_iterator
 		newIt = newObjects.begin(); newIt != newObjects.end(); ++newIt)
 	{
-		FlowStateObject * obj_to_up = fsos->getObject(newIt->object_name);
+		FlowStateObject * obj_to_up = fsos->getObject(newIt->name,
+							      newIt->neighbor_name);
 
 		//1 If the object exists update
 		if (obj_to_up != NULL)
@@ -1511,6 +2279,7 @@ void FlowStateManager::updateObjects(const std::list<FlowStateObject>& newObject
 				}
 
 				obj_to_up->modified = true;
+				fsos->objectUpdated(*obj_to_up);
 				fsos->has_modified(true);
 			}
 		}
@@ -1530,52 +2299,14 @@ void FlowStateManager::updateObjects(const std::list<FlowStateObject>& newObject
 	}
 }
 
-void FlowStateManager::prepareForPropagation(std::map<int, std::list< std::list<FlowStateObject> > >&  to_propagate,
-					     unsigned int max_objects) const
+void FlowStateManager::prepareForPropagation(const std::list<int>& ports,
+					     unsigned int max_objects,
+					     unsigned int max_fsos,
+					     std::map<int, std::list<rina::ser_obj_t *> >& to_send,
+					     std::list<rina::ser_obj_t *>& messages) const
 {
-	std::list<FlowStateObject> newfsolist;
-	bool added = false;
-
-	//1 Get the FSOs to propagate
-	std::list<FlowStateObject *> modifiedFSOs;
-	fsos->getModifiedFSOs(modifiedFSOs);
-
-	//2 add each modified object to its port list
-	for (std::list<FlowStateObject*>::iterator it = modifiedFSOs.begin();
-			it != modifiedFSOs.end(); ++it)
-	{
-		LOG_DBG("Propagation: Check modified object %s with age %d and status %d",
-			(*it)->object_name.c_str(),
-			(*it)->age,
-			(*it)->state_up);
-
-		for(std::map<int, std::list< std::list<FlowStateObject> > >::iterator it2 =
-				to_propagate.begin(); it2 != to_propagate.end(); ++it2)
-		{
-			if(it2->first != (*it)->avoid_port)
-			{
-				added = false;
-				newfsolist.clear();
-
-				for(std::list< std::list<FlowStateObject> >::iterator it3 = it2->second.begin();
-						it3 != it2->second.end(); ++it3) {
-					if (it3->size() < max_objects) {
-						it3->push_back(**it);
-						added = true;
-						break;
-					}
-				}
-
-				if (!added) {
-					newfsolist.push_back(**it);
-					it2->second.push_back(newfsolist);
-				}
-			}
-		}
-
-		(*it)->modified = false;
-		(*it)->avoid_port = NO_AVOID_PORT;
-	}
+	fsos->encodeModifiedFSOs(ports, max_objects, max_fsos, to_send,
+				 messages);
 }
 
 void FlowStateManager::removeObject(const std::string& fqn)
@@ -1591,6 +2322,7 @@ void FlowStateManager::encodeAllFSOs(rina::ser_obj_t& obj) const
 void FlowStateManager::set_maximum_age(unsigned int max_age)
 {
 	maximum_age = max_age;
+	fsos->set_maximum_age(max_age);
 }
 
 void FlowStateManager::set_wait_until_remove_object(unsigned int wait_object)
@@ -1598,15 +2330,30 @@ void FlowStateManager::set_wait_until_remove_object(unsigned int wait_object)
 	fsos->set_wait_until_remove_object(wait_object);
 }
 
+void FlowStateManager::set_packed_encoding(bool packed)
+{
+	fsos->set_packed_encoding(packed);
+}
+
 void FlowStateManager::getAllFSOs(std::list<FlowStateObject>& list) const
 {
 	fsos->getAllFSOs(list);
 }
 
-void FlowStateManager::getAllFSOsForPropagation(std::list< std::list<FlowStateObject> >& fsolist,
-						unsigned int max_objects)
+void FlowStateManager::getChangedLinks(std::map<std::pair<std::string, std::string>, int>& links) const
+{
+	fsos->getChangedLinks(links);
+}
+
+void FlowStateManager::getAddresses(std::map<std::string, std::list<unsigned int> >& addresses) const
+{
+	fsos->getAddresses(addresses);
+}
+
+void FlowStateManager::getEncodedFSOs(std::list<rina::ser_obj_t *>& messages,
+				      unsigned int max_objects) const
 {
-	fsos->getAllFSOsForPropagation(fsolist, max_objects);
+	fsos->getEncodedFSOs(messages, max_objects);
 }
 
 void FlowStateManager::deprecateObjectsNeighbor(const std::string& neigh_name,
@@ -1664,15 +2411,16 @@ void ComputeRoutingTimerTask::run()
 	lsr_policy_->timer_->scheduleTask(task, delay_);
 }
 
-KillFlowStateObjectTimerTask::KillFlowStateObjectTimerTask(LinkStateRoutingPolicy *ps, std::string fqn)
+KillFlowStateObjectTimerTask::KillFlowStateObjectTimerTask(LinkStateRoutingPolicy *ps,
+							   const std::list<std::string>& fqns)
 {
 	ps_ = ps;
-	fqn_ = fqn;
+	fqns_ = fqns;
 }
 
 void KillFlowStateObjectTimerTask::run()
 {
-	ps_->removeFlowStateObject(fqn_);
+	ps_->removeFlowStateObjects(fqns_);
 }
 
 PropagateFSODBTimerTask::PropagateFSODBTimerTask(
@@ -1739,6 +2487,12 @@ const int LinkStateRoutingPolicy::MAXIMUM_BUFFER_SIZE = 4096;
 const std::string LinkStateRoutingPolicy::DIJKSTRA_ALG = "Dijkstra";
 const std::string LinkStateRoutingPolicy::ECMP_DIJKSTRA_ALG = "ECMPDijkstra";
 const std::string LinkStateRoutingPolicy::MAXIMUM_OBJECTS_PER_ROUTING_UPDATE = "maxObjectsPerUpdate";
+const std::string LinkStateRoutingPolicy::MAXIMUM_INCREMENTAL_SPF_CHANGES = "maxIncrementalSPFChanges";
+const std::string LinkStateRoutingPolicy::RESILIENCY_ALGORITHM = "resiliencyAlgorithm";
+const std::string LinkStateRoutingPolicy::ROUTING_THREADS = "routingThreads";
+const std::string LinkStateRoutingPolicy::MAXIMUM_OBJECTS_PER_PROPAGATION = "maxObjectsPerPropagation";
+const std::string LinkStateRoutingPolicy::PACKED_ROUTING_UPDATES = "packedRoutingUpdates";
+const std::string LinkStateRoutingPolicy::LFA_ALG = "LoopFreeAlternate";
 
 LinkStateRoutingPolicy::LinkStateRoutingPolicy(IPCProcess * ipcp)
 {
@@ -1750,18 +2504,32 @@ LinkStateRoutingPolicy::LinkStateRoutingPolicy(IPCProcess * ipcp)
 	db_ = 0;
 	wait_until_deprecate_address_ = 0;
 	max_objects_per_rupdate_ = MAX_OBJECTS_PER_ROUTING_UPDATE_DEFAULT;
+	max_objects_per_propagation_ = 0;
+	graph_ = 0;
+	max_incremental_changes_ = MAX_INCREMENTAL_SPF_CHANGES_DEFAULT;
+	full_computations_ = 0;
+	incremental_computations_ = 0;
+	last_changes_ = 0;
+	last_affected_ = -1;
+	last_computation_us_ = 0;
+	last_full_computation_us_ = 0;
 
 	subscribeToEvents();
 	timer_ = new rina::Timer();
 	db_ = new FlowStateManager(timer_, UINT_MAX, this);
+
+	rina::rib::RIBObj * rib_obj = new RoutingComputationRIBObject(this);
+	rib_daemon_->addObjRIB(RoutingComputationRIBObject::object_name, &rib_obj);
 }
 
 LinkStateRoutingPolicy::~LinkStateRoutingPolicy()
 {
+	rib_daemon_->removeObjRIB(RoutingComputationRIBObject::object_name);
 	delete timer_;
-	delete routing_algorithm_;
 	delete resiliency_algorithm_;
+	delete routing_algorithm_;
 	delete db_;
+	delete graph_;
 }
 
 void LinkStateRoutingPolicy::subscribeToEvents()
@@ -1784,6 +2552,8 @@ void LinkStateRoutingPolicy::set_dif_configuration(
 		const rina::DIFConfiguration& dif_configuration)
 {
 	std::string routing_alg;
+	std::string resiliency_alg;
+	unsigned int routing_threads;
         rina::PolicyConfig psconf;
         long delay;
 
@@ -1805,9 +2575,37 @@ void LinkStateRoutingPolicy::set_dif_configuration(
         } else {
         	throw rina::Exception("Unsupported routing algorithm");
         }
-#if 0
-	resiliency_algorithm_ = new LoopFreeAlternateAlgorithm(*routing_algorithm_);
-#endif
+        try {
+        	resiliency_alg = psconf.get_param_value_as_string(RESILIENCY_ALGORITHM);
+        } catch (rina::Exception &e) {
+        	resiliency_alg = std::string();
+        }
+
+        try {
+        	routing_threads = psconf.get_param_value_as_uint(ROUTING_THREADS);
+        } catch (rina::Exception &e) {
+        	routing_threads = sysconf(_SC_NPROCESSORS_ONLN);
+        	if (routing_threads > MAX_ROUTING_THREADS_DEFAULT)
+        		routing_threads = MAX_ROUTING_THREADS_DEFAULT;
+        }
+
+        if (routing_threads == 0)
+        	routing_threads = 1;
+
+        if (resiliency_alg == LFA_ALG) {
+        	resiliency_algorithm_ = new LoopFreeAlternateAlgorithm(*routing_algorithm_,
+        							       routing_threads);
+                LOG_IPCP_DBG("Using Loop Free Alternates with %u threads",
+                	     routing_threads);
+        } else if (!resiliency_alg.empty()) {
+        	throw rina::Exception("Unsupported resiliency algorithm");
+        }
+
+        try {
+        	max_incremental_changes_ = psconf.get_param_value_as_uint(MAXIMUM_INCREMENTAL_SPF_CHANGES);
+        } catch (rina::Exception &e) {
+        	max_incremental_changes_ = MAX_INCREMENTAL_SPF_CHANGES_DEFAULT;
+        }
 
 
 	if (!test_) {
@@ -1864,6 +2662,18 @@ void LinkStateRoutingPolicy::set_dif_configuration(
 		} catch (rina::Exception &e) {
 			max_objects_per_rupdate_ = MAX_OBJECTS_PER_ROUTING_UPDATE_DEFAULT;
 		}
+
+		try {
+			max_objects_per_propagation_ = psconf.get_param_value_as_uint(MAXIMUM_OBJECTS_PER_PROPAGATION);
+		} catch (rina::Exception &e) {
+			max_objects_per_propagation_ = 0;
+		}
+
+		try {
+			db_->set_packed_encoding(psconf.get_param_value_as_bool(PACKED_ROUTING_UPDATES));
+		} catch (rina::Exception &e) {
+			db_->set_packed_encoding(false);
+		}
 	}
 
 }
@@ -1920,12 +2730,9 @@ void LinkStateRoutingPolicy::processAddressChangeEvent(rina::AddressChangeEvent
 
 void LinkStateRoutingPolicy::processNeighborAddressChangeEvent(rina::NeighborAddressChangeEvent * event)
 {
-	std::list<FlowStateObject> all_fsos;
 	unsigned int address = IPCPFactory::getIPCP()->get_address();
 	unsigned int old_address = IPCPFactory::getIPCP()->get_old_address();
 
-	db_->getAllFSOs(all_fsos);
-
 	LOG_IPCP_DBG("Neighbor %s address changed: old address %d, new address %d",
 		      event->neigh_name.c_str(),
 		      event->old_address,
@@ -2001,17 +2808,16 @@ void LinkStateRoutingPolicy::processNeighborAddedEvent(rina::NeighborAddedEvent
 				ipc_process_->get_name(), 10000);
 	}
 
-	std::list< std::list<FlowStateObject> > all_fsos;
-	FlowStateObjectListEncoder encoder;
-	db_->getAllFSOsForPropagation(all_fsos, max_objects_per_rupdate_);
-	for (std::list< std::list<FlowStateObject> >::iterator it = all_fsos.begin();
-			it != all_fsos.end(); ++it) {
+	std::list<rina::ser_obj_t *> messages;
+	db_->getEncodedFSOs(messages, max_objects_per_rupdate_);
+	for (std::list<rina::ser_obj_t *>::iterator it = messages.begin();
+			it != messages.end(); ++it) {
 		try {
 			rina::cdap_rib::obj_info_t obj;
 			rina::cdap_rib::con_handle_t con;
 			obj.class_ = FlowStateRIBObjects::clazz_name;
 			obj.name_ = FlowStateRIBObjects::object_name;
-			encoder.encode(*it, obj.value_);
+			obj.value_ = **it;
 			obj.inst_ = 0;
 			rina::cdap_rib::flags_t flags;
 			rina::cdap_rib::filt_info_t filt;
@@ -2025,6 +2831,7 @@ void LinkStateRoutingPolicy::processNeighborAddedEvent(rina::NeighborAddedEvent
 		} catch (rina::Exception &e) {
 			LOG_IPCP_ERR("Problems encoding and sending CDAP message: %s", e.what());
 		}
+		delete *it;
 	}
 
 	//Force a routing table update
@@ -2039,31 +2846,19 @@ void LinkStateRoutingPolicy::propagateFSDB()
 	//1 Get the active N-1 flows
 	std::list<int> n1_ports =
 			ipc_process_->resource_allocator_->get_n_minus_one_flow_manager()->getManagementFlowsToAllNeighbors();
-	//2 Initialize the map
-	std::map <int, std::list< std::list<FlowStateObject> > > objectsToSend;
-	for(std::list<int>::iterator it = n1_ports.begin();
-		it != n1_ports.end(); ++it)
-	{
-		objectsToSend[*it] = std::list< std::list<FlowStateObject> >();
-	}
-
-	//3 Get the objects to send
-	db_->prepareForPropagation(objectsToSend, max_objects_per_rupdate_);
+	//2 Get the encoded objects to send
+	std::map<int, std::list<rina::ser_obj_t *> > objectsToSend;
+	std::list<rina::ser_obj_t *> messages;
+	db_->prepareForPropagation(n1_ports, max_objects_per_rupdate_,
+				   max_objects_per_propagation_,
+				   objectsToSend, messages);
 
-	if (objectsToSend.size() == 0) {
-		return;
-	}
-
-	FlowStateObjectListEncoder encoder;
 	rina::cdap_rib::con_handle_t con;
-	for (std::map<int, std::list< std::list<FlowStateObject> > >::iterator it = objectsToSend.begin();
+	for (std::map<int, std::list<rina::ser_obj_t *> >::iterator it = objectsToSend.begin();
 		it != objectsToSend.end(); ++it)
 
 	{
-		if (it->second.size() == 0)
-			continue;
-
-		for (std::list< std::list<FlowStateObject> >::iterator it2 = it->second.begin();
+		for (std::list<rina::ser_obj_t *>::iterator it2 = it->second.begin();
 				it2 != it->second.end(); ++it2) {
 			rina::cdap_rib::flags flags;
 			rina::cdap_rib::filt_info_t filter;
@@ -2072,7 +2867,7 @@ void LinkStateRoutingPolicy::propagateFSDB()
 				rina::cdap_rib::object_info obj;
 				obj.class_ = FlowStateRIBObjects::clazz_name;
 				obj.name_ = FlowStateRIBObjects::object_name;
-				encoder.encode(*it2, obj.value_);
+				obj.value_ = **it2;
 				con.port_id = it->first;
 				rib_daemon_->getProxy()->remote_write(con,
 						obj,
@@ -2086,6 +2881,11 @@ void LinkStateRoutingPolicy::propagateFSDB()
 			}
 		}
 	}
+
+	for (std::list<rina::ser_obj_t *>::iterator it = messages.begin();
+			it != messages.end(); ++it) {
+		delete *it;
+	}
 }
 
 void LinkStateRoutingPolicy::updateAge()
@@ -2118,21 +2918,12 @@ void LinkStateRoutingPolicy::printNhopTable(std::list<rina::RoutingTableEntry *>
 }
 
 void LinkStateRoutingPolicy::populateAddresses(std::list<rina::RoutingTableEntry *>& rt,
-		      	      	               const std::list<rinad::FlowStateObject>& fsos)
+		      	      	               const std::map<std::string, std::list<unsigned int> >& name_address_map)
 {
-	std::map<std::string, std::list<unsigned int> > name_address_map;
-	std::list<rinad::FlowStateObject>::const_iterator it;
-	std::map<std::string, std::list<unsigned int> >::iterator jt;
+	std::map<std::string, std::list<unsigned int> >::const_iterator jt;
 	std::list<rina::RoutingTableEntry *>::iterator kt;
 	std::list<rina::NHopAltList>::iterator nt;
 	std::list<rina::IPCPNameAddresses>::iterator ot;
-	std::list<unsigned int> aux;
-
-	for (it = fsos.begin(); it != fsos.end(); ++it) {
-		jt = name_address_map.find(it->name);
-		if (jt == name_address_map.end())
-			name_address_map[it->name] = it->addresses;
-	}
 
 	for (kt = rt.begin(); kt != rt.end(); ++kt) {
 		jt = name_address_map.find((*kt)->destination.name);
@@ -2166,49 +2957,126 @@ void LinkStateRoutingPolicy::routingTableUpdate()
 	_routingTableUpdate();
 }
 
-void LinkStateRoutingPolicy::_routingTableUpdate()
+bool LinkStateRoutingPolicy::incrementalRoutingTableUpdate(const std::string& my_name,
+							   std::list<rina::RoutingTableEntry *>& rt)
 {
-	std::list<rina::RoutingTableEntry *> rt;
-	std::string my_name = ipc_process_->get_name();
-	std::list<FlowStateObject> flow_state_objects;
+	std::map<std::pair<std::string, std::string>, int> links;
+	std::list<std::pair<unsigned int, unsigned int> > edges;
 
-	if (!db_->tableUpdate()) {
-		return;
+	// Always drain the changes, a full update covers them too
+	db_->getChangedLinks(links);
+	last_changes_ = links.size();
+
+	if (!graph_ || links.size() > max_incremental_changes_) {
+		return false;
+	}
+
+	if (!graph_->set_edge_weights(links, edges)) {
+		return false;
 	}
 
+	last_affected_ = routing_algorithm_->updateRoutingTable(*graph_,
+								edges,
+								my_name,
+								rt);
+
+	return true;
+}
+
+void LinkStateRoutingPolicy::fullRoutingTableUpdate(const std::string& my_name,
+						    std::list<rina::RoutingTableEntry *>& rt)
+{
+	std::list<FlowStateObject> flow_state_objects;
+
 	db_->getAllFSOs(flow_state_objects);
 
 	// Build a graph out of the FSO database
-	Graph graph(flow_state_objects);
+	delete graph_;
+	graph_ = new Graph(flow_state_objects);
 
 	// Invoke the routing algorithm to compute the routing table
 	// Main arguments are the graph and the source vertex.
 	// The list of FSOs may be useless, but has been left there
 	// for the moment (and it is currently unused by the Dijkstra
 	// algorithm).
-	routing_algorithm_->computeRoutingTable(graph,
+	routing_algorithm_->computeRoutingTable(*graph_,
 						flow_state_objects,
 						my_name,
 						rt);
+	last_affected_ = -1;
+}
+
+void LinkStateRoutingPolicy::_routingTableUpdate()
+{
+	std::list<rina::RoutingTableEntry *> rt;
+	std::string my_name = ipc_process_->get_name();
+	std::map<std::string, std::list<unsigned int> > addresses;
+	timeval start, end;
+
+	if (!db_->tableUpdate()) {
+		return;
+	}
+
+	gettimeofday(&start, 0);
+
+	// Apply the changed links to the graph and the shortest path tree of
+	// the last computation, or start from scratch if there are too many
+	if (!incrementalRoutingTableUpdate(my_name, rt)) {
+		fullRoutingTableUpdate(my_name, rt);
+	}
 
 	// Run the resiliency algorithm, if any, to extend the routing table
 	if (resiliency_algorithm_) {
-		resiliency_algorithm_->fortifyRoutingTable(graph,
+		resiliency_algorithm_->fortifyRoutingTable(*graph_,
 							   my_name,
 							   rt);
 	}
 
-
 	//Populate addresses (right now there are only names int he RT entries)
-	populateAddresses(rt, flow_state_objects);
+	db_->getAddresses(addresses);
+	populateAddresses(rt, addresses);
+
+	gettimeofday(&end, 0);
+	last_computation_us_ = (end.tv_sec - start.tv_sec) * 1000000L +
+			       (end.tv_usec - start.tv_usec);
+	if (last_affected_ < 0) {
+		full_computations_++;
+		last_full_computation_us_ = last_computation_us_;
+	} else {
+		incremental_computations_++;
+	}
 
-	LOG_IPCP_DBG("Computed new Next Hop and PDU Forwarding Tables");
+	LOG_IPCP_DBG("Computed new Next Hop and PDU Forwarding Tables in %ld us "
+		     "(%u changed links, %s)", last_computation_us_,
+		     last_changes_, last_affected_ < 0 ? "full SPF" :
+		     "incremental SPF");
 	printNhopTable(rt);
 
 	assert(ipc_process_->resource_allocator_->pduft_gen_ps);
 	ipc_process_->resource_allocator_->pduft_gen_ps->routingTableUpdated(rt);
 }
 
+const std::string LinkStateRoutingPolicy::getComputationStats()
+{
+	rina::ScopedLock g(lock_);
+	std::stringstream ss;
+
+	ss << "Full computations: " << full_computations_
+	   << "; Incremental computations: " << incremental_computations_
+	   << std::endl;
+	ss << "Last computation: " << last_computation_us_ << " us, "
+	   << last_changes_ << " changed links, ";
+	if (last_affected_ < 0) {
+		ss << "full SPF" << std::endl;
+	} else {
+		ss << "incremental SPF (" << last_affected_
+		   << " vertices recomputed)" << std::endl;
+	}
+	ss << "Last full computation: " << last_full_computation_us_ << " us";
+
+	return ss.str();
+}
+
 void LinkStateRoutingPolicy::expireOldAddress(const std::string& name,
 					      unsigned int address,
 					      bool neighbor)
@@ -2225,10 +3093,14 @@ void LinkStateRoutingPolicy::updateObjects(const std::list<FlowStateObject>& new
 			   avoidPort);
 }
 
-void LinkStateRoutingPolicy::removeFlowStateObject(const std::string& fqn)
+void LinkStateRoutingPolicy::removeFlowStateObjects(const std::list<std::string>& fqns)
 {
 	rina::ScopedLock g(lock_);
-	db_->removeObject(fqn);
+
+	for (std::list<std::string>::const_iterator it = fqns.begin();
+			it != fqns.end(); ++it) {
+		db_->removeObject(*it);
+	}
 }
 
 // CLASS FlowStateObjectEncoder
@@ -2274,6 +3146,33 @@ void toModel(
 		fso.add_neighboraddress(gpb_fso.neighbor_addresses(i));
 	}
 }
+
+unsigned int nameIndex(const std::string& name,
+		       std::map<std::string, unsigned int>& indexes,
+		       rina::messages::flowStateObjectGroup_t &gpb)
+{
+	std::map<std::string, unsigned int>::iterator it = indexes.find(name);
+	if (it != indexes.end())
+		return it->second;
+
+	unsigned int index = gpb.names_size();
+	gpb.add_names(name);
+	indexes[name] = index;
+	return index;
+}
+
+const std::string& indexedName(
+	const rina::messages::flowStateObjectGroup_t &gpb, unsigned int index)
+{
+	if (index >= (unsigned int) gpb.names_size()) {
+		std::stringstream ss;
+		ss << "Name index " << index << " out of range, the group has "
+		   << gpb.names_size() << " names";
+		throw rina::Exception(ss.str().c_str());
+	}
+
+	return gpb.names(index);
+}
 } //namespace fso_helpers
 
 void FlowStateObjectEncoder::encode(const FlowStateObject &obj, 
@@ -2297,10 +3196,16 @@ void FlowStateObjectEncoder::decode(const rina::ser_obj_t &serobj,
 	fso_helpers::toModel(gpb, des_obj);
 }
 
+FlowStateObjectListEncoder::FlowStateObjectListEncoder(bool packed)
+{
+	packed_ = packed;
+}
+
 void FlowStateObjectListEncoder::encode(const std::list<FlowStateObject> &obj,
 					rina::ser_obj_t& serobj)
 {
 	rina::messages::flowStateObjectGroup_t gpb;
+	std::map<std::string, unsigned int> indexes;
 
 	for (std::list<FlowStateObject>::const_iterator it= obj.begin();
 		it != obj.end(); ++it) 
@@ -2308,6 +3213,14 @@ void FlowStateObjectListEncoder::encode(const std::list<FlowStateObject> &obj,
 		rina::messages::flowStateObject_t *gpb_fso;
 		gpb_fso = gpb.add_flow_state_objects();
 		fso_helpers::toGPB(*it, *gpb_fso);
+		if (packed_) {
+			gpb_fso->clear_name();
+			gpb_fso->clear_neighbor_name();
+			gpb_fso->set_name_index(
+				fso_helpers::nameIndex(it->name, indexes, gpb));
+			gpb_fso->set_neighbor_name_index(
+				fso_helpers::nameIndex(it->neighbor_name, indexes, gpb));
+		}
 	}
 
 	serobj.size_ = gpb.ByteSize();
@@ -2323,7 +3236,16 @@ void FlowStateObjectListEncoder::decode(const rina::ser_obj_t &serobj,
 	for(int i=0; i<gpb.flow_state_objects_size(); i++)
 	{
 		FlowStateObject fso;
-		fso_helpers::toModel(gpb.flow_state_objects(i), fso);
+		const rina::messages::flowStateObject_t& gpb_fso =
+				gpb.flow_state_objects(i);
+		fso_helpers::toModel(gpb_fso, fso);
+		// Packed groups carry the names once, referenced by index
+		if (gpb_fso.has_name_index())
+			fso.name = fso_helpers::indexedName(gpb,
+					gpb_fso.name_index());
+		if (gpb_fso.has_neighbor_name_index())
+			fso.neighbor_name = fso_helpers::indexedName(gpb,
+					gpb_fso.neighbor_name_index());
 		std::stringstream ss;
 		ss << FlowStateRIBObject::object_name_prefix
 		   << fso.getKey();
@@ -23,8 +23,11 @@
 #ifndef IPCP_LINK_STATE_ROUTING_HH
 #define IPCP_LINK_STATE_ROUTING_HH
 
+#include <map>
 #include <set>
 #include <stdint.h>
+#include <vector>
+#include <librina/concurrency.h>
 #include <librina/internal-events.h>
 #include <librina/timer.h>
 
@@ -32,37 +35,6 @@
 
 namespace rinad {
 
-struct TreeNode {
-    std::string name;
-    int metric;
-    std::set<TreeNode*> chldel;
-    std::set<TreeNode*> chl;
-    TreeNode(){
-            name = std::string();
-            metric = UINT16_MAX;
-    }
-    TreeNode(const std::string &_name, const int &_metric){
-        name = _name;
-        metric = _metric;
-    }
-    bool operator == (const TreeNode &b) const
-    {
-        return name == b.name;
-    }
-    bool operator < (const TreeNode &b) const
-    {
-        return name < b.name;
-    }
-
-    ~TreeNode(){
-	std::set<TreeNode*>::iterator c;
-        for(c=chldel.begin(); c != chldel.end(); ++c){
-            delete *c;
-        }
-    }
-
-};
-
 class LinkStateRoutingPolicy;
 
 class LinkStateRoutingPs: public IRoutingPs {
@@ -107,10 +79,35 @@ public:
 	std::list<Edge *> edges_;
 	std::list<std::string> vertices_;
 
+	// Compact adjacency (CSR) of edges_, built once with the graph. The
+	// neighbors of vertex v are adj_vertex_[adj_offset_[v] ..
+	// adj_offset_[v + 1]). Vertex ids follow the order of the names, so
+	// that the SPF tie breaking does not depend on the FSO order. Edges
+	// taken down after the graph was built keep their slot, with a
+	// negative weight.
+	std::vector<std::string> names_;
+	std::vector<unsigned int> adj_offset_;
+	std::vector<unsigned int> adj_vertex_;
+	std::vector<int> adj_weight_;
+
 	void set_flow_state_objects(const std::list<FlowStateObject>& flow_state_objects);
 	bool contains_vertex(const std::string& name) const;
 	bool contains_edge(const std::string& name1,
 			   const std::string& name2) const;
+	unsigned int num_vertices() const;
+	// -1 if the vertex is not in the graph
+	int vertex_id(const std::string& name) const;
+	// Change the weight of the edge between two vertices, a negative
+	// weight takes it down. Returns false if the adjacency has no slot
+	// for the edge, then the graph has to be built again.
+	bool set_edge_weight(unsigned int v1, unsigned int v2, int weight);
+	// -1 if there is no edge between the vertices or it is down
+	int edge_weight(unsigned int v1, unsigned int v2) const;
+	// Apply the link costs reported by the FSDB (-1 for links that are
+	// down), adding the edges that changed. Returns false if a vertex or
+	// an adjacency is new, then the graph has to be built again.
+	bool set_edge_weights(const std::map<std::pair<std::string, std::string>, int>& links,
+			      std::list<std::pair<unsigned int, unsigned int> >& edges);
 
 	void print() const;
 
@@ -139,10 +136,49 @@ private:
 
 	std::list<FlowStateObject> flow_state_objects_;
 	std::list<CheckedVertex *> checked_vertices_;
+	std::map<std::string, unsigned int> ids_;
+	// Edge of each adjacency slot, the edges taken down are not in edges_
+	std::vector<Edge *> adj_edge_;
 
 	void init_vertices();
-	CheckedVertex * get_checked_vertex(const std::string& name) const;
 	void init_edges();
+	void init_adjacency();
+};
+
+/// Single source shortest paths over the graph adjacency, with a binary
+/// heap. Vertices are settled in (distance, id) order. With ecmp all the
+/// predecessors on a shortest path are kept, otherwise only the first.
+class SPFTree {
+public:
+	SPFTree();
+	void compute(const Graph& graph, unsigned int source, bool ecmp);
+
+	// Bring the tree up to date after the weights of the given edges
+	// changed in the graph it was computed on (dynamic SPF). Only the
+	// vertices whose distance depends on a changed edge are recomputed,
+	// the result is the same as the one of compute(). Returns the number
+	// of vertices recomputed, or -1 if a full compute() was done because
+	// the change was too large.
+	int update(const Graph& graph, unsigned int source,
+		   const std::list<std::pair<unsigned int, unsigned int> >& edges);
+
+	// INT_MAX if not reachable
+	std::vector<int> dist_;
+	// First predecessor, -1 for the source and unreachable vertices
+	std::vector<int> pred_;
+	// All the predecessors on a shortest path (ecmp only)
+	std::vector<std::vector<unsigned int> > preds_;
+	// Reachable vertices in settle order, starting with the source
+	std::vector<unsigned int> order_;
+
+private:
+	void set_preds(const Graph& graph, unsigned int v);
+
+	unsigned int source_;
+	bool ecmp_;
+	// Edges of weight 0 break the (distance, id) settle order that
+	// update() relies on, such trees are always fully recomputed
+	bool zero_weights_;
 };
 
 class IRoutingAlgorithm {
@@ -156,6 +192,14 @@ public:
 					 const std::string& source_name,
 					 std::list<rina::RoutingTableEntry *>& rt) = 0;
 
+	//Update the routing table computed by the last computeRoutingTable
+	//call after the weights of some edges of the same graph changed.
+	//Returns the number of vertices recomputed, -1 if all of them were
+	virtual int updateRoutingTable(const Graph& graph,
+				       const std::list<std::pair<unsigned int, unsigned int> >& edges,
+				       const std::string& source_name,
+				       std::list<rina::RoutingTableEntry *>& rt) = 0;
+
 	//Compute the distance of the shortest path between the node identified
 	//by source_address and all the other nodes
 	virtual void computeShortestDistances(const Graph& graph,
@@ -163,14 +207,6 @@ public:
 				              std::map<std::string, int>& distances) = 0;
 };
 
-/// Contains the information of a predecessor, needed by the Dijkstra Algorithm
-class PredecessorInfo {
-public:
-	PredecessorInfo(const std::string& nPredecessor);
-
-	std::string predecessor_;
-};
-
 /// The routing algorithm used to compute the PDU forwarding table is a Shortest
 /// Path First (SPF) algorithm. Instances of the algorithm are run independently
 /// and concurrently by all IPC processes in their forwarding table generator
@@ -182,23 +218,18 @@ public:
 	 	 	    	 const std::list<FlowStateObject>& fsoList,
 				 const std::string& source_name,
 				 std::list<rina::RoutingTableEntry *>& rt);
+	int updateRoutingTable(const Graph& graph,
+			       const std::list<std::pair<unsigned int, unsigned int> >& edges,
+			       const std::string& source_name,
+			       std::list<rina::RoutingTableEntry *>& rt);
 	void computeShortestDistances(const Graph& graph,
 				      const std::string& source_name,
 				      std::map<std::string, int>& distances);
 private:
-	std::set<std::string> settled_nodes_;
-	std::set<std::string> unsettled_nodes_;
-	std::map<std::string, PredecessorInfo *> predecessors_;
-	std::map<std::string, int> distances_;
+	void fillRoutingTable(const Graph& graph, unsigned int source,
+			      std::list<rina::RoutingTableEntry *>& rt);
 
-	void execute(const Graph& graph, const std::string& source);
-	std::string getMinimum() const;
-	void findMinimalDistances (const Graph& graph, const std::string& node);
-	int getShortestDistance(const std::string& destination) const;
-	bool isNeighbor(Edge * edge, const std::string& node) const;
-	bool isSettled(const std::string& node) const;
-	std::string getNextHop(const std::string& name, const std::string& sourceName);
-	void clear();
+	SPFTree spf_;
 };
 
 /// The routing algorithm used to compute the PDU forwarding table is a Shortest
@@ -212,31 +243,69 @@ public:
 	 	 	    	 const std::list<FlowStateObject>& fsoList,
 				 const std::string& source_name,
 				 std::list<rina::RoutingTableEntry *>& rt);
+	int updateRoutingTable(const Graph& graph,
+			       const std::list<std::pair<unsigned int, unsigned int> >& edges,
+			       const std::string& source_name,
+			       std::list<rina::RoutingTableEntry *>& rt);
 	void computeShortestDistances(const Graph& graph,
 				      const std::string& source_name,
 				      std::map<std::string, int>& distances);
 
 private:
-	std::set<std::string> settled_nodes_;
-	std::set<std::string> unsettled_nodes_;
-	std::set<std::string> minimum_nodes_;
-	std::map<std::string, std::list<TreeNode *> > predecessors_;
+	void fillRoutingTable(const Graph& graph, unsigned int source,
+			      std::list<rina::RoutingTableEntry *>& rt);
+
+	SPFTree spf_;
+};
+
+/// Shortest distances from one root, computed by an SPFWorkerPool. The
+/// computeShortestDistances() of the routing algorithm has to be
+/// reentrant, since several jobs run at the same time on the same graph.
+class SPFJob {
+public:
+	SPFJob(const Graph& graph, IRoutingAlgorithm& ra,
+	       const std::string& root);
+	void run();
+
+	const Graph& graph_;
+	IRoutingAlgorithm& routing_algorithm_;
+	std::string root_;
 	std::map<std::string, int> distances_;
-	TreeNode* t;
-	void execute(const Graph& graph,
-		     const std::string& source);
-	void addRecursive(std::list<rina::RoutingTableEntry *> &table,
-			  int qos,
-			  const std::string& next,
-			  TreeNode * node);
-	std::list<rina::RoutingTableEntry *>::iterator findEntry(std::list<rina::RoutingTableEntry *> &table,
-							    	 const std::string& name);
-	void getMinimum();
-	void findMinimalDistances (const Graph& graph, TreeNode * pred);
-	int getShortestDistance(const std::string& destination) const;
-	bool isNeighbor(Edge * edge, const std::string& node) const;
-	bool isSettled(const std::string& node) const;
-	void clear();
+};
+
+class SPFWorkerPool;
+class SPFWorker : public rina::SimpleThread {
+public:
+	SPFWorker(SPFWorkerPool * pool);
+	~SPFWorker() throw() {};
+	int run();
+
+private:
+	SPFWorkerPool * pool_;
+};
+
+/// Fixed set of threads that run batches of SPF jobs. The thread calling
+/// run() takes jobs too, and run() returns once all the jobs of the batch
+/// are done, so that the caller merges the results in the order of the
+/// batch whatever the thread that ran each job. With a single thread the
+/// jobs are run by the caller. Only one batch runs at a time.
+class SPFWorkerPool {
+public:
+	SPFWorkerPool(unsigned int num_threads);
+	~SPFWorkerPool();
+	void run(std::vector<SPFJob *>& jobs);
+	unsigned int num_threads() const;
+
+private:
+	friend class SPFWorker;
+	void work();
+
+	rina::ConditionVariable cond_;
+	std::vector<SPFWorker *> workers_;
+	std::vector<SPFJob *> * jobs_;
+	unsigned int next_job_;
+	unsigned int pending_jobs_;
+	bool stop_;
 };
 
 class IResiliencyAlgorithm {
@@ -255,16 +324,20 @@ protected:
 	IRoutingAlgorithm& routing_algorithm;
 };
 
+/// The shortest distances from the source and from each of its neighbors
+/// are computed in parallel by num_threads threads
 class LoopFreeAlternateAlgorithm : public IResiliencyAlgorithm {
 public:
-	LoopFreeAlternateAlgorithm(IRoutingAlgorithm& ra);
+	LoopFreeAlternateAlgorithm(IRoutingAlgorithm& ra,
+				   unsigned int num_threads = 1);
 	void fortifyRoutingTable(const Graph& graph,
 				 const std::string& source_name,
 				 std::list<rina::RoutingTableEntry *>& rt);
 private:
-	void extendRoutingTableEntry(std::list<rina::RoutingTableEntry *>& rt,
-				     const std::string& target_name,
+	void extendRoutingTableEntry(rina::RoutingTableEntry * entry,
 				     const std::string& nexthop);
+
+	SPFWorkerPool pool_;
 };
 
 /// The object exchanged between IPC Processes to disseminate the state of
@@ -310,6 +383,9 @@ public:
 	// Age of this FSO (in seconds)
 	unsigned int age;
 
+	// Age clock of the FSDB when age was set
+	unsigned int age_tick;
+
 	// The port_id assigned by the neighbor IPC Process to the N-1 flow
 	unsigned int cost;
 
@@ -333,10 +409,12 @@ public:
 };
 
 class FlowStateManager;
+class FlowStateObjects;
 /// A single flow state object
 class FlowStateRIBObject: public rina::rib::RIBObj {
 public:
-	FlowStateRIBObject(FlowStateObject* new_obj);
+	FlowStateRIBObject(FlowStateObject* new_obj,
+			   const FlowStateObjects * new_fsos);
 	void read(const rina::cdap_rib::con_handle_t &con, const std::string& fqn,
 		const std::string& clas, const rina::cdap_rib::filt_info_t &filt,
 		const int invoke_id, rina::ser_obj_t &obj_reply, 
@@ -344,15 +422,18 @@ public:
 	const std::string get_displayable_value() const;
 
 	FlowStateObject* obj;
+	// The FSDB, which knows the current age of obj
+	const FlowStateObjects * fsos;
 
 	const static std::string clazz_name;
 	const static std::string object_name_prefix;
 };
 
-class FlowStateObjects;
+/// Removes the FSOs that expired in the same age increment
 class KillFlowStateObjectTimerTask : public rina::TimerTask {
 public:
-	KillFlowStateObjectTimerTask(LinkStateRoutingPolicy *ps, std::string fqn);
+	KillFlowStateObjectTimerTask(LinkStateRoutingPolicy *ps,
+				     const std::list<std::string>& fqns);
 	~KillFlowStateObjectTimerTask() throw(){};
 	void run();
 	std::string name() const {
@@ -360,7 +441,7 @@ public:
 	}
 
 private:
-	std::string fqn_;
+	std::list<std::string> fqns_;
 	LinkStateRoutingPolicy* ps_;
 };
 
@@ -389,23 +470,88 @@ public:
 				      unsigned int max_age,
 				      bool neighbor);
 	FlowStateObject * getObject(const std::string& fqn);
-	void getModifiedFSOs(std::list<FlowStateObject *>& result);
+	FlowStateObject * getObject(const std::string& name,
+				    const std::string& neighbor_name);
+	// Sorted by object name
 	void getAllFSOs(std::list<FlowStateObject>& result);
-	void incrementAge(unsigned int max_age,
-			  rina::Timer* timer);
+	// Advance the age clock and schedule the removal of the FSOs
+	// that reached the maximum age
+	void incrementAge(rina::Timer* timer);
 	void updateObject(const std::string& fqn, 
 			  unsigned int avoid_port);
 	void encodeAllFSOs(rina::ser_obj_t& obj);
-	void getAllFSOsForPropagation(std::list< std::list<FlowStateObject> >& fsos,
-				      unsigned int max_objects);
+	// Copies of the encoded FSDB in groups of max_objects, to be
+	// deleted by the caller
+	void getEncodedFSOs(std::list<rina::ser_obj_t *>& messages,
+			    unsigned int max_objects);
+	// Encode up to max_fsos (0 for all) of the FSOs modified since the
+	// last call for each port, in groups of max_objects. The rest are
+	// left for the next call. Ports that get the same FSOs share the
+	// messages, which are deleted by the caller
+	void encodeModifiedFSOs(const std::list<int>& ports,
+				unsigned int max_objects,
+				unsigned int max_fsos,
+				std::map<int, std::list<rina::ser_obj_t *> >& to_send,
+				std::list<rina::ser_obj_t *>& messages);
+	void set_packed_encoding(bool packed);
 	bool is_modified() const;
 	void has_modified(bool modified);
 	void set_wait_until_remove_object(unsigned int wait_object);
+	void set_maximum_age(unsigned int max_age);
 	void removeObject(const std::string& fqn);
+	// Record that the FSO has been updated in place, including its age
+	void objectUpdated(const FlowStateObject& object);
+	// Links whose FSOs changed since the last call, with their current
+	// cost (-1 if the link is not up in both directions)
+	void getChangedLinks(std::map<std::pair<std::string, std::string>, int>& links);
+	void getAddresses(std::map<std::string, std::list<unsigned int> >& addresses);
+	// Stored age plus the age increments since it was set
+	unsigned int currentAge(const FlowStateObject& object) const;
+
+	// Age increments after which the encoded FSDB is regenerated even
+	// if no FSO changed
+	static const unsigned int SNAPSHOT_MAX_AGE;
 
 private:
+	// Ids of the name and the neighbor name of the FSO
+	typedef std::pair<unsigned int, unsigned int> fso_key_t;
+	typedef std::map<fso_key_t, FlowStateObject*>::iterator fso_iterator;
+
+	unsigned int internName(const std::string& name);
+	bool findName(const std::string& name, unsigned int& id) const;
+	fso_iterator findObject(const std::string& name,
+				const std::string& neighbor_name);
+	fso_iterator findObject(const std::string& fqn);
 	void addCheckedObject(const FlowStateObject& object);
-	std::map<std::string,FlowStateObject*> objects;
+	void addChangedLink(const FlowStateObject& object);
+	void objectChanged(fso_iterator it, bool link);
+	unsigned int expiryTick(const FlowStateObject& object) const;
+	void ageChanged(fso_iterator it);
+	void rebuildExpiries();
+	void encodeGroups(const std::list<FlowStateObject *>& fsos,
+			  int skip_port,
+			  unsigned int max_objects,
+			  std::list<rina::ser_obj_t *>& messages);
+	void clearSnapshot();
+
+	std::map<std::string, unsigned int> name_ids;
+	std::map<fso_key_t, FlowStateObject*> objects;
+	// FSOs to propagate
+	std::set<fso_key_t> dirty;
+	// Ages are computed from the age clock, which advances once per
+	// age increment. Expiry ticks of the FSOs, entries of FSOs whose
+	// age changed later are skipped.
+	unsigned int age_clock;
+	unsigned int maximum_age;
+	std::set<std::pair<unsigned int, fso_key_t> > expiries;
+	// Endpoints of the links changed, in name order
+	std::set<std::pair<std::string, std::string> > changed_links;
+	// Encoded FSDB sent to new neighbors
+	std::list<rina::ser_obj_t *> snapshot;
+	bool snapshot_valid;
+	unsigned int snapshot_max_objects;
+	unsigned int snapshot_age;
+	bool packed_encoding;
 	//Signals a modification in the FlowStateDB
 	bool modified_;
 	LinkStateRoutingPolicy * ps_;
@@ -490,14 +636,19 @@ public:
 	void incrementAge();
 	void updateObjects(const std::list<FlowStateObject>& newObjects,
 			   unsigned int avoidPort);
-	void prepareForPropagation(std::map<int, std::list< std::list<FlowStateObject> > >& to_propagate,
-				   unsigned int max_objects) const;
+	void prepareForPropagation(const std::list<int>& ports,
+				   unsigned int max_objects,
+				   unsigned int max_fsos,
+				   std::map<int, std::list<rina::ser_obj_t *> >& to_send,
+				   std::list<rina::ser_obj_t *>& messages) const;
 	void encodeAllFSOs(rina::ser_obj_t& obj) const;
 	void getAllFSOs(std::list<FlowStateObject>& list) const;
+	void getChangedLinks(std::map<std::pair<std::string, std::string>, int>& links) const;
+	void getAddresses(std::map<std::string, std::list<unsigned int> >& addresses) const;
 	bool tableUpdate() const;
 	void removeObject(const std::string& fqn);
-	void getAllFSOsForPropagation(std::list< std::list<FlowStateObject> >& fsos,
-				      unsigned int max_objects);
+	void getEncodedFSOs(std::list<rina::ser_obj_t *>& messages,
+			    unsigned int max_objects) const;
 
 	//Force a routing table update;
 	void force_table_update();
@@ -505,6 +656,7 @@ public:
 	// accessors
 	void set_maximum_age(unsigned int max_age);
 	void set_wait_until_remove_object(unsigned int wait_object);
+	void set_packed_encoding(bool packed);
 private:
 	FlowStateObjects* fsos;
 	unsigned int maximum_age;
@@ -556,6 +708,19 @@ private:
 	long delay_;
 };
 
+/// Statistics of the routing table computations, the time it took to
+/// process the last FSDB change and whether it was done incrementally
+class RoutingComputationRIBObject: public rina::rib::RIBObj {
+public:
+	RoutingComputationRIBObject(LinkStateRoutingPolicy * ps);
+	const std::string get_displayable_value() const;
+
+	const static std::string clazz_name;
+	const static std::string object_name;
+private:
+	LinkStateRoutingPolicy * ps_;
+};
+
 class ExpireOldAddressTimerTask : public rina::TimerTask {
 public:
 	ExpireOldAddressTimerTask(LinkStateRoutingPolicy * lsr_policy,
@@ -605,6 +770,11 @@ public:
 	static const std::string WAIT_UNTIL_DEPRECATE_OLD_ADDRESS;
 	static const std::string ROUTING_ALGORITHM;
 	static const std::string MAXIMUM_OBJECTS_PER_ROUTING_UPDATE;
+	static const std::string MAXIMUM_INCREMENTAL_SPF_CHANGES;
+	static const std::string RESILIENCY_ALGORITHM;
+	static const std::string ROUTING_THREADS;
+	static const std::string MAXIMUM_OBJECTS_PER_PROPAGATION;
+	static const std::string PACKED_ROUTING_UPDATES;
 
         static const int PULSES_UNTIL_FSO_EXPIRATION_DEFAULT = 100000;
         static const int WAIT_UNTIL_READ_CDAP_DEFAULT = 5001;
@@ -615,8 +785,11 @@ public:
         static const long WAIT_UNTIL_REMOVE_OBJECT_DEFAULT = 2300;
         static const long WAIT_UNTIL_DEPRECATE_OLD_ADDRESS_DEFAULT = 10000;
         static const unsigned int MAX_OBJECTS_PER_ROUTING_UPDATE_DEFAULT = 15;
+        static const unsigned int MAX_INCREMENTAL_SPF_CHANGES_DEFAULT = 64;
         static const std::string DIJKSTRA_ALG;
         static const std::string ECMP_DIJKSTRA_ALG;
+        static const std::string LFA_ALG;
+        static const unsigned int MAX_ROUTING_THREADS_DEFAULT = 8;
 
 	LinkStateRoutingPolicy(IPCProcess * ipcp);
 	~LinkStateRoutingPolicy();
@@ -661,7 +834,9 @@ public:
 	void updateObjects(const std::list<FlowStateObject>& newObjects,
 			   unsigned int avoidPort);
 
-	void removeFlowStateObject(const std::string& fqn);
+	void removeFlowStateObjects(const std::list<std::string>& fqns);
+
+	const std::string getComputationStats();
 
 	rina::Timer *timer_;
 private:
@@ -673,10 +848,26 @@ private:
 	unsigned int wait_until_deprecate_address_;
 	unsigned int maximum_age_;
 	unsigned int max_objects_per_rupdate_;
+	// FSOs sent per propagation round at most, 0 for no limit
+	unsigned int max_objects_per_propagation_;
 	bool test_;
 	FlowStateManager *db_;
 	rina::Lockable lock_;
 
+	// Graph of the last routing table computation, the changed links are
+	// applied to it and to the SPF tree of the routing algorithm. Up to
+	// max_incremental_changes_ links, otherwise both are rebuilt.
+	Graph * graph_;
+	unsigned int max_incremental_changes_;
+
+	// Computation statistics
+	unsigned int full_computations_;
+	unsigned int incremental_computations_;
+	unsigned int last_changes_;
+	int last_affected_;
+	long last_computation_us_;
+	long last_full_computation_us_;
+
 	void subscribeToEvents();
 
 	/// The Resource Allocator has deallocated an existing N-1 flow dedicated to data
@@ -717,8 +908,12 @@ private:
 	void printNhopTable(std::list<rina::RoutingTableEntry *>& rt);
 
 	void populateAddresses(std::list<rina::RoutingTableEntry *>& rt,
-			       const std::list<FlowStateObject>& fsos);
+			       const std::map<std::string, std::list<unsigned int> >& addresses);
 
+	bool incrementalRoutingTableUpdate(const std::string& my_name,
+					   std::list<rina::RoutingTableEntry *>& rt);
+	void fullRoutingTableUpdate(const std::string& my_name,
+				    std::list<rina::RoutingTableEntry *>& rt);
 	void _routingTableUpdate();
 };
 
@@ -732,10 +927,17 @@ public:
 class FlowStateObjectListEncoder: 
 	public rina::Encoder<std::list<FlowStateObject> > {
 public:
+	// If packed, the names are encoded once per group and the FSOs
+	// refer to them by index. Both forms are decoded; decode throws
+	// rina::Exception if an index is out of range.
+	FlowStateObjectListEncoder(bool packed = false);
 	void encode(const std::list<FlowStateObject> &obj,
 		rina::ser_obj_t& serobj);
 	void decode(const rina::ser_obj_t &serobj, 
 		std::list<FlowStateObject> &des_obj);
+
+private:
+	bool packed_;
 };
 
 }
@@ -20,12 +20,18 @@
 // MA  02110-1301  USA
 //
 
+#include <algorithm>
 #include <iostream>
+#include <set>
+#include <sstream>
+#include <sys/time.h>
 
 #define IPCP_MODULE "lsr-tests"
 #include "../../ipcp-logging.h"
 
 #include "routing-ps.h"
+#include "common/encoders/FlowStateMessage.pb.h"
+#include "common/encoders/FlowStateGroupMessage.pb.h"
 
 int ipcp_id = 1;
 
@@ -1065,8 +1071,18 @@ int getRoutingTable_MultipathGraphRoutesTest() {
 	std::list<rina::RoutingTableEntry *>::iterator it;
 	for (it = rtable.begin(); it != rtable.end(); ++it) {
 		const rina::RoutingTableEntry& e = **it;
+		// d is 3 away over a-b-d, a-c-b-d, a-c-d and a-e-d: the
+		// first hops are b, c and e, each listed once
 		if (e.destination.name == "d") {
-		    if (e.nextHopNames.size() != 4) {
+		    std::set<std::string> nhops;
+		    for (std::list<rina::NHopAltList>::const_iterator
+			    altl = e.nextHopNames.begin();
+			    altl != e.nextHopNames.end(); altl++) {
+			    nhops.insert(altl->alts.front().name);
+		    }
+		    if (e.nextHopNames.size() != 3 || nhops.size() != 3 ||
+			!nhops.count("b") || !nhops.count("c") ||
+			!nhops.count("e")) {
 			result = -1;
 		    }
 		}
@@ -1120,6 +1136,590 @@ int test_mp_dijkstra() {
 	return result;
 }
 
+// Ring of n nodes plus a few pseudo-random chords per node, costs 1 to 4.
+// Deterministic, so that runs can be compared.
+void buildSyntheticTopology(unsigned int n,
+			    std::list<rinad::FlowStateObject>& objects)
+{
+	unsigned int seed = 12345;
+	unsigned int peer, cost;
+	std::vector<std::string> names(n);
+
+	for (unsigned int i = 0; i < n; i++) {
+		std::stringstream ss;
+		ss << "n" << i;
+		names[i] = ss.str();
+	}
+
+	for (unsigned int i = 0; i < n; i++) {
+		for (unsigned int j = 0; j < 3; j++) {
+			seed = seed * 1103515245 + 12345;
+			peer = j == 0 ? (i + 1) % n : (seed >> 8) % n;
+			cost = 1 + (seed >> 4) % 4;
+			if (peer == i) {
+				continue;
+			}
+			objects.push_back(rinad::FlowStateObject(names[i],
+					names[peer], cost, true, 1, 1));
+			objects.push_back(rinad::FlowStateObject(names[peer],
+					names[i], cost, true, 1, 1));
+		}
+	}
+}
+
+double elapsedMs(const struct timeval& start)
+{
+	struct timeval now;
+
+	gettimeofday(&now, 0);
+	return (now.tv_sec - start.tv_sec) * 1000.0 +
+		(now.tv_usec - start.tv_usec) / 1000.0;
+}
+
+int benchRoutingAlgorithm(rinad::IRoutingAlgorithm * algorithm,
+			  const char * algorithm_name,
+			  unsigned int n)
+{
+	std::list<rinad::FlowStateObject> objects;
+	std::list<rina::RoutingTableEntry *> rtable;
+	std::list<rina::RoutingTableEntry *>::iterator it;
+	struct timeval start;
+	double graph_ms;
+	int result = 0;
+
+	buildSyntheticTopology(n, objects);
+
+	gettimeofday(&start, 0);
+	rinad::Graph graph(objects);
+	graph_ms = elapsedMs(start);
+
+	gettimeofday(&start, 0);
+	algorithm->computeRoutingTable(graph, objects, "n0", rtable);
+
+	std::cout << algorithm_name << ": " << n << " nodes, "
+		  << graph.edges_.size() << " edges, graph "
+		  << graph_ms << " ms, routing table "
+		  << elapsedMs(start) << " ms" << std::endl;
+
+	// The ring keeps every node reachable
+	if (rtable.size() != n - 1) {
+		result = -1;
+	}
+
+	for (it = rtable.begin(); it != rtable.end(); ++it) {
+		delete *it;
+	}
+
+	return result;
+}
+
+int bench_routing() {
+	unsigned int sizes[] = {100, 1000, 3000, 10000};
+	rinad::DijkstraAlgorithm dijkstra;
+	rinad::ECMPDijkstraAlgorithm ecmp;
+	int result = 0;
+
+	for (unsigned int i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		result = benchRoutingAlgorithm(&dijkstra, "Dijkstra", sizes[i]);
+		if (result < 0) {
+			LOG_IPCP_ERR("Dijkstra benchmark failed with %u nodes",
+				     sizes[i]);
+			return result;
+		}
+
+		result = benchRoutingAlgorithm(&ecmp, "ECMP Dijkstra", sizes[i]);
+		if (result < 0) {
+			LOG_IPCP_ERR("ECMP Dijkstra benchmark failed with %u nodes",
+				     sizes[i]);
+			return result;
+		}
+	}
+
+	return result;
+}
+
+// Unique links of a ring plus pseudo-random chords, costs 1 to 4
+void buildSyntheticLinks(unsigned int n,
+			 std::vector<std::pair<unsigned int, unsigned int> >& links,
+			 std::vector<int>& costs)
+{
+	std::set<std::pair<unsigned int, unsigned int> > seen;
+	unsigned int seed = 4321;
+	unsigned int peer;
+
+	for (unsigned int i = 0; i < n; i++) {
+		for (unsigned int j = 0; j < 3; j++) {
+			seed = seed * 1103515245 + 12345;
+			peer = j == 0 ? (i + 1) % n : (seed >> 8) % n;
+			if (peer == i || !seen.insert(std::make_pair(std::min(i, peer),
+					std::max(i, peer))).second) {
+				continue;
+			}
+			links.push_back(std::make_pair(i, peer));
+			costs.push_back(1 + (seed >> 4) % 4);
+		}
+	}
+}
+
+void linksToFSOs(const std::vector<std::pair<unsigned int, unsigned int> >& links,
+		 const std::vector<int>& costs,
+		 std::list<rinad::FlowStateObject>& objects)
+{
+	for (unsigned int i = 0; i < links.size(); i++) {
+		std::stringstream n1, n2;
+		n1 << "n" << links[i].first;
+		n2 << "n" << links[i].second;
+		objects.push_back(rinad::FlowStateObject(n1.str(), n2.str(),
+				costs[i] < 0 ? 1 : costs[i], costs[i] >= 0, 1, 1));
+		objects.push_back(rinad::FlowStateObject(n2.str(), n1.str(),
+				costs[i] < 0 ? 1 : costs[i], costs[i] >= 0, 1, 1));
+	}
+}
+
+std::string routingTableToString(std::list<rina::RoutingTableEntry *>& rt)
+{
+	std::list<rina::RoutingTableEntry *>::iterator it;
+	std::list<rina::NHopAltList>::iterator nt;
+	std::stringstream ss;
+
+	for (it = rt.begin(); it != rt.end(); ++it) {
+		ss << (*it)->destination.name << ":" << (*it)->cost << ":";
+		for (nt = (*it)->nextHopNames.begin();
+				nt != (*it)->nextHopNames.end(); ++nt) {
+			std::list<rina::IPCPNameAddresses>::iterator at;
+			for (at = nt->alts.begin(); at != nt->alts.end(); ++at) {
+				ss << at->name << "/";
+			}
+			ss << ",";
+		}
+		ss << "|";
+		delete *it;
+	}
+	rt.clear();
+
+	return ss.str();
+}
+
+// Apply batches of link down, up and cost changes incrementally, and check
+// the routing table against a full computation over a new graph
+int incrementalRoutingTable_SameAsFull(bool ecmp)
+{
+	std::vector<std::pair<unsigned int, unsigned int> > links;
+	std::vector<int> costs;
+	std::list<rinad::FlowStateObject> objects;
+	std::list<std::pair<unsigned int, unsigned int> > edges;
+	std::list<rina::RoutingTableEntry *> rt;
+	rinad::IRoutingAlgorithm * algorithm;
+	rinad::IRoutingAlgorithm * reference;
+	unsigned int seed = 777;
+	unsigned int incremental = 0;
+	int result = 0;
+	int v1, v2;
+
+	if (ecmp) {
+		algorithm = new rinad::ECMPDijkstraAlgorithm();
+		reference = new rinad::ECMPDijkstraAlgorithm();
+	} else {
+		algorithm = new rinad::DijkstraAlgorithm();
+		reference = new rinad::DijkstraAlgorithm();
+	}
+
+	buildSyntheticLinks(300, links, costs);
+	linksToFSOs(links, costs, objects);
+	rinad::Graph graph(objects);
+	algorithm->computeRoutingTable(graph, objects, "n0", rt);
+	routingTableToString(rt);
+
+	for (unsigned int step = 0; step < 200 && result == 0; step++) {
+		edges.clear();
+		for (unsigned int k = 0; k < 1 + step % 3; k++) {
+			seed = seed * 1103515245 + 12345;
+			unsigned int l = (seed >> 8) % links.size();
+			seed = seed * 1103515245 + 12345;
+			costs[l] = (seed >> 8) % 3 == 0 ? -1 : 1 + (seed >> 4) % 4;
+
+			std::stringstream n1, n2;
+			n1 << "n" << links[l].first;
+			n2 << "n" << links[l].second;
+			v1 = graph.vertex_id(n1.str());
+			v2 = graph.vertex_id(n2.str());
+			graph.set_edge_weight(v1, v2, costs[l]);
+			edges.push_back(std::make_pair(v1, v2));
+		}
+
+		if (algorithm->updateRoutingTable(graph, edges, "n0", rt) >= 0) {
+			incremental++;
+		}
+		std::string updated = routingTableToString(rt);
+
+		objects.clear();
+		linksToFSOs(links, costs, objects);
+		rinad::Graph full_graph(objects);
+		reference->computeRoutingTable(full_graph, objects, "n0", rt);
+		std::string full = routingTableToString(rt);
+
+		if (updated != full || graph.edges_.size() != full_graph.edges_.size()) {
+			LOG_IPCP_ERR("Incremental routing table differs at step %u",
+				     step);
+			result = -1;
+		}
+	}
+
+	if (result == 0 && incremental == 0) {
+		LOG_IPCP_ERR("No update was done incrementally");
+		result = -1;
+	}
+
+	delete algorithm;
+	delete reference;
+
+	if (result == 0) {
+		LOG_IPCP_INFO("incrementalRoutingTable_SameAsFull test passed "
+			      "(ecmp %d, %u of 200 updates incremental)",
+			      ecmp, incremental);
+	}
+
+	return result;
+}
+
+// Take links down, bring them up and change their costs through the FSDB,
+// one direction at a time, and check the routing table updated with the
+// changed links it reports against a full computation over all its FSOs
+int flowStateObjects_IncrementalSameAsFull()
+{
+	std::vector<std::pair<unsigned int, unsigned int> > links;
+	std::vector<int> costs;
+	std::list<rinad::FlowStateObject> objects;
+	std::list<rinad::FlowStateObject>::iterator ot;
+	std::map<std::pair<std::string, std::string>, int> changed;
+	std::list<std::pair<unsigned int, unsigned int> > edges;
+	std::list<rina::RoutingTableEntry *> rt;
+	rinad::DijkstraAlgorithm algorithm;
+	rinad::DijkstraAlgorithm reference;
+	rinad::FlowStateObjects fsos(0);
+	rinad::FlowStateObject * fso;
+	std::string name, neighbor_name;
+	unsigned int seed = 555;
+	unsigned int incremental = 0;
+	int result = 0;
+
+	buildSyntheticLinks(100, links, costs);
+	linksToFSOs(links, costs, objects);
+	for (ot = objects.begin(); ot != objects.end(); ++ot) {
+		fsos.addObject(*ot);
+	}
+
+	objects.clear();
+	fsos.getAllFSOs(objects);
+	rinad::Graph graph(objects);
+	algorithm.computeRoutingTable(graph, objects, "n0", rt);
+	routingTableToString(rt);
+	fsos.getChangedLinks(changed);
+
+	for (unsigned int step = 0; step < 100 && result == 0; step++) {
+		for (unsigned int k = 0; k < 1 + step % 3; k++) {
+			seed = seed * 1103515245 + 12345;
+			unsigned int l = (seed >> 8) % links.size();
+			std::stringstream n1, n2;
+			n1 << "n" << links[l].first;
+			n2 << "n" << links[l].second;
+			name = n1.str();
+			neighbor_name = n2.str();
+			if ((seed >> 4) % 2) {
+				std::swap(name, neighbor_name);
+			}
+
+			fso = fsos.getObject(name, neighbor_name);
+			seed = seed * 1103515245 + 12345;
+			if ((seed >> 8) % 3 == 0) {
+				fsos.deprecateObjects(neighbor_name, name, 100);
+				continue;
+			}
+
+			if (!fso->state_up) {
+				fsos.updateObject(fso->object_name, 0);
+			}
+			fsos.updateCost(neighbor_name, name, 1 + (seed >> 4) % 4);
+		}
+
+		changed.clear();
+		edges.clear();
+		fsos.getChangedLinks(changed);
+		if (!graph.set_edge_weights(changed, edges)) {
+			LOG_IPCP_ERR("Changed links not applied to the graph at step %u",
+				     step);
+			result = -1;
+			break;
+		}
+
+		if (algorithm.updateRoutingTable(graph, edges, "n0", rt) >= 0) {
+			incremental++;
+		}
+		std::string updated = routingTableToString(rt);
+
+		objects.clear();
+		fsos.getAllFSOs(objects);
+		rinad::Graph full_graph(objects);
+		reference.computeRoutingTable(full_graph, objects, "n0", rt);
+		std::string full = routingTableToString(rt);
+
+		if (updated != full || graph.edges_.size() != full_graph.edges_.size()) {
+			LOG_IPCP_ERR("Routing table updated from the FSDB differs at step %u",
+				     step);
+			result = -1;
+		}
+	}
+
+	if (result == 0 && incremental == 0) {
+		LOG_IPCP_ERR("No update was done incrementally");
+		result = -1;
+	}
+
+	if (result == 0) {
+		LOG_IPCP_INFO("flowStateObjects_IncrementalSameAsFull test passed "
+			      "(%u of 100 updates incremental)", incremental);
+	}
+
+	return result;
+}
+
+// Time of a single link flap with the incremental update and with a full
+// computation over a new graph
+int benchIncrementalRoutingTable(unsigned int n)
+{
+	std::vector<std::pair<unsigned int, unsigned int> > links;
+	std::vector<int> costs;
+	std::list<rinad::FlowStateObject> objects;
+	std::list<std::pair<unsigned int, unsigned int> > edges;
+	std::list<rina::RoutingTableEntry *> rt;
+	rinad::DijkstraAlgorithm dijkstra;
+	struct timeval start;
+	double incremental_ms, full_ms;
+	int v1, v2;
+
+	buildSyntheticLinks(n, links, costs);
+	linksToFSOs(links, costs, objects);
+	rinad::Graph graph(objects);
+	dijkstra.computeRoutingTable(graph, objects, "n0", rt);
+	routingTableToString(rt);
+
+	// A chord far from the source
+	std::stringstream n1, n2;
+	n1 << "n" << links[links.size() / 2 + 1].first;
+	n2 << "n" << links[links.size() / 2 + 1].second;
+	v1 = graph.vertex_id(n1.str());
+	v2 = graph.vertex_id(n2.str());
+	edges.push_back(std::make_pair(v1, v2));
+
+	gettimeofday(&start, 0);
+	graph.set_edge_weight(v1, v2, -1);
+	dijkstra.updateRoutingTable(graph, edges, "n0", rt);
+	routingTableToString(rt);
+	graph.set_edge_weight(v1, v2, costs[links.size() / 2 + 1]);
+	dijkstra.updateRoutingTable(graph, edges, "n0", rt);
+	incremental_ms = elapsedMs(start) / 2;
+	routingTableToString(rt);
+
+	gettimeofday(&start, 0);
+	rinad::Graph full_graph(objects);
+	dijkstra.computeRoutingTable(full_graph, objects, "n0", rt);
+	full_ms = elapsedMs(start);
+	routingTableToString(rt);
+
+	std::cout << "Link flap: " << n << " nodes, incremental "
+		  << incremental_ms << " ms, full " << full_ms
+		  << " ms" << std::endl;
+
+	return 0;
+}
+
+// The LFAs computed with several threads are the same as with one, for a
+// source with many neighbors
+int loopFreeAlternates_ThreadsSameResult()
+{
+	std::vector<std::pair<unsigned int, unsigned int> > links;
+	std::vector<int> costs;
+	std::list<rinad::FlowStateObject> objects;
+	std::list<rina::RoutingTableEntry *> rt;
+	rinad::DijkstraAlgorithm dijkstra;
+	std::string tables[2];
+	unsigned int threads[2] = {1, 4};
+	struct timeval start;
+	unsigned int neighbors = 0;
+	int result = 0;
+
+	buildSyntheticLinks(2000, links, costs);
+	for (unsigned int i = 37; i < 2000; i += 37) {
+		links.push_back(std::make_pair(0, i));
+		costs.push_back(3);
+	}
+	linksToFSOs(links, costs, objects);
+	rinad::Graph graph(objects);
+	for (unsigned int i = 1; i < graph.num_vertices(); i++) {
+		if (graph.contains_edge("n0", graph.names_[i])) {
+			neighbors++;
+		}
+	}
+
+	for (unsigned int k = 0; k < 2; k++) {
+		rinad::LoopFreeAlternateAlgorithm lfa(dijkstra, threads[k]);
+
+		dijkstra.computeRoutingTable(graph, objects, "n0", rt);
+		gettimeofday(&start, 0);
+		lfa.fortifyRoutingTable(graph, "n0", rt);
+		std::cout << "LFA: 2000 nodes, " << neighbors
+			  << " neighbors, " << threads[k] << " threads "
+			  << elapsedMs(start) << " ms" << std::endl;
+		tables[k] = routingTableToString(rt);
+	}
+
+	if (tables[0] != tables[1]) {
+		LOG_IPCP_ERR("LFAs differ with %u and %u threads",
+			     threads[0], threads[1]);
+		result = -1;
+	} else if (tables[0].find('/') == tables[0].rfind('/')) {
+		LOG_IPCP_ERR("No LFA was found");
+		result = -1;
+	}
+
+	if (result == 0) {
+		LOG_IPCP_INFO("loopFreeAlternates_ThreadsSameResult test passed");
+	}
+
+	return result;
+}
+
+// Encode a group of FSOs with and without packing, and check that both
+// decode to the same objects and the packed form is smaller
+int flowStateObjectList_PackedSameAsPlain()
+{
+	std::vector<std::pair<unsigned int, unsigned int> > links;
+	std::vector<int> costs;
+	std::list<rinad::FlowStateObject> objects;
+	std::list<rinad::FlowStateObject> decoded[2];
+	std::list<rinad::FlowStateObject>::iterator it, jt;
+	rina::ser_obj_t encoded[2];
+	int result = 0;
+
+	buildSyntheticLinks(100, links, costs);
+	linksToFSOs(links, costs, objects);
+	for (it = objects.begin(); it != objects.end(); ++it) {
+		it->add_address(links.size());
+		it->add_neighboraddress(links.size() + 1);
+		it->add_neighboraddress(links.size() + 2);
+	}
+
+	for (unsigned int k = 0; k < 2; k++) {
+		rinad::FlowStateObjectListEncoder encoder(k == 1);
+		encoder.encode(objects, encoded[k]);
+		encoder.decode(encoded[k], decoded[k]);
+	}
+
+	std::cout << "FSO group of " << objects.size() << " objects: "
+		  << encoded[0].size_ << " bytes plain, "
+		  << encoded[1].size_ << " bytes packed" << std::endl;
+
+	if (encoded[1].size_ >= encoded[0].size_) {
+		LOG_IPCP_ERR("Packed encoding is not smaller");
+		result = -1;
+	}
+
+	for (unsigned int k = 0; k < 2 && result == 0; k++) {
+		if (decoded[k].size() != objects.size()) {
+			LOG_IPCP_ERR("Wrong number of decoded objects");
+			result = -1;
+			break;
+		}
+		for (it = objects.begin(), jt = decoded[k].begin();
+				it != objects.end(); ++it, ++jt) {
+			if (it->toString() != jt->toString() ||
+					it->object_name != jt->object_name) {
+				LOG_IPCP_ERR("Decoded object %s differs",
+					     it->object_name.c_str());
+				result = -1;
+				break;
+			}
+		}
+	}
+
+	if (result == 0) {
+		LOG_IPCP_INFO("flowStateObjectList_PackedSameAsPlain test passed");
+	}
+
+	return result;
+}
+
+// A packed group whose FSO refers to a name that is not in the group must
+// be rejected, not decoded to an empty name
+int flowStateObjectList_BadNameIndexRejected()
+{
+	rina::messages::flowStateObjectGroup_t gpb;
+	rina::messages::flowStateObject_t *gpb_fso;
+	std::list<rinad::FlowStateObject> decoded;
+	rinad::FlowStateObjectListEncoder encoder(true);
+	rina::ser_obj_t encoded;
+	int result = -1;
+
+	gpb.add_names("a");
+	gpb_fso = gpb.add_flow_state_objects();
+	gpb_fso->set_name_index(0);
+	gpb_fso->set_neighbor_name_index(1);
+	gpb_fso->set_cost(1);
+	gpb_fso->set_state(true);
+	gpb_fso->set_sequence_number(1);
+	gpb_fso->set_age(0);
+
+	encoded.size_ = gpb.ByteSize();
+	encoded.message_ = new unsigned char[encoded.size_];
+	gpb.SerializeToArray(encoded.message_, encoded.size_);
+
+	try {
+		encoder.decode(encoded, decoded);
+		LOG_IPCP_ERR("Out of range name index was decoded");
+	} catch (rina::Exception &e) {
+		LOG_IPCP_INFO("flowStateObjectList_BadNameIndexRejected test passed");
+		result = 0;
+	}
+
+	return result;
+}
+
+int test_incremental_spf() {
+	int result = 0;
+
+	result = incrementalRoutingTable_SameAsFull(false);
+	if (result < 0) {
+		return result;
+	}
+
+	result = incrementalRoutingTable_SameAsFull(true);
+	if (result < 0) {
+		return result;
+	}
+
+	result = flowStateObjects_IncrementalSameAsFull();
+	if (result < 0) {
+		return result;
+	}
+
+	return benchIncrementalRoutingTable(10000);
+}
+
+int test_lfa() {
+	return loopFreeAlternates_ThreadsSameResult();
+}
+
+int test_fso_encoding() {
+	int result = 0;
+
+	result = flowStateObjectList_PackedSameAsPlain();
+	if (result < 0) {
+		return result;
+	}
+
+	return flowStateObjectList_BadNameIndexRejected();
+}
+
 int main()
 {
 	int result = 0;
@@ -1151,5 +1751,33 @@ int main()
 		return result;
 	}
 	LOG_IPCP_INFO("test_mp_dijkstra tests passed");
+
+	result = bench_routing();
+	if (result < 0) {
+		LOG_IPCP_ERR("bench_routing failed");
+		return result;
+	}
+	LOG_IPCP_INFO("bench_routing passed");
+
+	result = test_incremental_spf();
+	if (result < 0) {
+		LOG_IPCP_ERR("test_incremental_spf tests failed");
+		return result;
+	}
+	LOG_IPCP_INFO("test_incremental_spf tests passed");
+
+	result = test_lfa();
+	if (result < 0) {
+		LOG_IPCP_ERR("test_lfa tests failed");
+		return result;
+	}
+	LOG_IPCP_INFO("test_lfa tests passed");
+
+	result = test_fso_encoding();
+	if (result < 0) {
+		LOG_IPCP_ERR("test_fso_encoding tests failed");
+		return result;
+	}
+	LOG_IPCP_INFO("test_fso_encoding tests passed");
 	return 0;
 }
@@ -840,15 +840,22 @@ int ResourceAllocator::get_next_hop_name(const std::string& dest_name,
 unsigned int ResourceAllocator::get_n1_port_to_address(unsigned int dest_address)
 {
 	std::map<std::string, rina::PDUForwardingTableEntry *>::iterator it;
+	rina::PDUForwardingTableEntry * best = 0;
 
 	rina::ReadScopedLock g(pduft_lock);
 
+	// Longest prefix match, entries may be aggregated
 	for (it = pduft.begin(); it != pduft.end(); ++it) {
-		if (it->second->address == dest_address) {
-			return it->second->portIdAltlists.front().alts.front();
-		}
+		if (!it->second->covers(dest_address))
+			continue;
+
+		if (!best || it->second->wildcardBits < best->wildcardBits)
+			best = it->second;
 	}
 
+	if (best)
+		return best->portIdAltlists.front().alts.front();
+
 	return 0;
 }
 
@@ -869,8 +876,10 @@ bool ResourceAllocator::entry_is_in_pduft(unsigned int dest_address)
 {
 	std::map<std::string, rina::PDUForwardingTableEntry*>::iterator it;
 
+	// A covering prefix does not count, the host entry is more specific
 	for (it = pduft.begin(); it != pduft.end(); ++it) {
-		if (it->second->address == dest_address) {
+		if (it->second->address == dest_address &&
+				it->second->wildcardBits == 0) {
 			return true;
 		}
 	}
@@ -40,10 +40,21 @@ ManagementSDUReaderData::ManagementSDUReaderData(unsigned int max_sdu_size)
 	max_sdu_size_ = max_sdu_size;
 }
 
+/// CDAP messages queued for a port until the batch window expires
+struct CDAPBatch {
+	CDAPBatch() : size(0) {};
+
+	std::list<rina::ser_obj_t*> sdus;
+	int size;
+};
+
 class IPCPCDAPIOHandler : public rina::cdap::CDAPIOHandler
 {
  public:
-	IPCPCDAPIOHandler(IPCPRIBDaemonImpl * ribd) : rib_daemon(ribd) {};
+	IPCPCDAPIOHandler(IPCPRIBDaemonImpl * ribd) : rib_daemon(ribd),
+						      batch_window_ms(0),
+						      flush_tasks(0) {};
+	~IPCPCDAPIOHandler();
 	void send(const rina::cdap::cdap_m_t &m_sent,
 		  const rina::cdap_rib::con_handle_t& con_handle);
 
@@ -51,6 +62,17 @@ class IPCPCDAPIOHandler : public rina::cdap::CDAPIOHandler
 			     unsigned int handle,
 			     rina::cdap_rib::cdap_dest_t cdap_dest);
 
+	/// 0 sends every message on its own SDU (the default)
+	void set_batch_window(unsigned int window_ms);
+	void flush_batch(unsigned int port_id);
+
+	/// Max SDU size of the N-1 flow, 0 if unknown or deallocated
+	void set_max_sdu_size(unsigned int port_id, unsigned int max_sdu_size);
+
+	/// Flush tasks that have been created and not deleted yet
+	void add_flush_task();
+	void remove_flush_task();
+
  private:
 	void invoke_callback(rina::cdap_rib::con_handle_t& con_handle,
 			     const rina::cdap::cdap_m_t& m_rcv,
@@ -62,14 +84,206 @@ class IPCPCDAPIOHandler : public rina::cdap::CDAPIOHandler
 	void forward_adata_msg(const rina::ser_obj_t &message,
 			       unsigned int address);
 
+	/// Queue the SDU in the batch of its port (takes its buffer), or
+	/// send it right away if batching is disabled
+	void __queue_message(const rina::cdap_rib::con_handle_t& con_handle,
+			     rina::ser_obj_t& sdu);
+	void __flush_batch(unsigned int port_id);
+
+	/// Largest batched SDU the port and the peer's reader take
+	int __max_batch_size(unsigned int port_id);
+
         // Lock to control that when sending a message requiring
 	// a reply the CDAP Session manager has been updated before
 	// receiving the response message
         rina::Lockable atomic_send_lock_;
         IPCPRIBDaemonImpl * rib_daemon;
         rina::Timer timer;
+        unsigned int batch_window_ms;
+        std::map<unsigned int, CDAPBatch> batches;
+        std::map<unsigned int, unsigned int> max_sdu_sizes;
+
+        // Flush tasks run on their own threads, the handler waits for
+        // them before it goes away
+        rina::ConditionVariable flush_tasks_cond;
+        unsigned int flush_tasks;
 };
 
+IPCPCDAPIOHandler::~IPCPCDAPIOHandler()
+{
+	std::map<unsigned int, CDAPBatch>::iterator it;
+	std::list<rina::ser_obj_t*>::iterator jt;
+
+	// Flush tasks point to this handler. Cancel the pending ones and
+	// wait for the ones already dispatched to finish.
+	timer.get_task_scheduler()->cancelTasks(&timer);
+
+	flush_tasks_cond.lock();
+	while (flush_tasks > 0)
+		flush_tasks_cond.doWait();
+	flush_tasks_cond.unlock();
+
+	rina::ScopedLock g(atomic_send_lock_);
+
+	for (it = batches.begin(); it != batches.end(); ++it)
+		for (jt = it->second.sdus.begin();
+				jt != it->second.sdus.end(); ++jt)
+			delete *jt;
+	batches.clear();
+}
+
+void IPCPCDAPIOHandler::set_batch_window(unsigned int window_ms)
+{
+	rina::ScopedLock g(atomic_send_lock_);
+
+	batch_window_ms = window_ms;
+	if (batch_window_ms != 0)
+		return;
+
+	while (!batches.empty())
+		__flush_batch(batches.begin()->first);
+}
+
+void IPCPCDAPIOHandler::flush_batch(unsigned int port_id)
+{
+	rina::ScopedLock g(atomic_send_lock_);
+
+	__flush_batch(port_id);
+}
+
+void IPCPCDAPIOHandler::set_max_sdu_size(unsigned int port_id,
+					 unsigned int max_sdu_size)
+{
+	rina::ScopedLock g(atomic_send_lock_);
+
+	if (max_sdu_size == 0)
+		max_sdu_sizes.erase(port_id);
+	else
+		max_sdu_sizes[port_id] = max_sdu_size;
+}
+
+void IPCPCDAPIOHandler::add_flush_task()
+{
+	rina::ScopedLock g(flush_tasks_cond);
+
+	flush_tasks++;
+}
+
+void IPCPCDAPIOHandler::remove_flush_task()
+{
+	rina::ScopedLock g(flush_tasks_cond);
+
+	flush_tasks--;
+	if (flush_tasks == 0)
+		flush_tasks_cond.signal();
+}
+
+int IPCPCDAPIOHandler::__max_batch_size(unsigned int port_id)
+{
+	std::map<unsigned int, unsigned int>::iterator it;
+	int max_size = InternalFlowSDUReader::BUFFER_SIZE;
+
+	it = max_sdu_sizes.find(port_id);
+	if (it != max_sdu_sizes.end() && it->second < (unsigned int) max_size)
+		max_size = it->second;
+
+	return max_size;
+}
+
+void IPCPCDAPIOHandler::__queue_message(const rina::cdap_rib::con_handle_t& con_handle,
+					rina::ser_obj_t& sdu)
+{
+	std::map<unsigned int, CDAPBatch>::iterator it;
+	rina::ser_obj_t * queued;
+	int batched_size, max_size;
+
+	if (batch_window_ms == 0) {
+		__send_message(con_handle, sdu);
+		return;
+	}
+
+	batched_size = rina::cdap::CDAPBatchEncoder::batched_size(sdu.size_);
+	max_size = __max_batch_size(con_handle.port_id);
+
+	it = batches.find(con_handle.port_id);
+	if (it != batches.end() &&
+			it->second.size + batched_size > max_size) {
+		__flush_batch(con_handle.port_id);
+		it = batches.end();
+	}
+
+	if (batched_size > max_size) {
+		__send_message(con_handle, sdu);
+		return;
+	}
+
+	if (it == batches.end()) {
+		it = batches.insert(std::make_pair(con_handle.port_id,
+						   CDAPBatch())).first;
+		timer.scheduleTask(new FlushCDAPBatchTimerTask(this,
+							       con_handle.port_id),
+				   batch_window_ms);
+	}
+
+	queued = new rina::ser_obj_t();
+	queued->message_ = sdu.message_;
+	queued->size_ = sdu.size_;
+	sdu.message_ = 0;
+	sdu.size_ = 0;
+	it->second.sdus.push_back(queued);
+	it->second.size += batched_size;
+}
+
+void IPCPCDAPIOHandler::__flush_batch(unsigned int port_id)
+{
+	std::map<unsigned int, CDAPBatch>::iterator it;
+	std::list<rina::ser_obj_t*>::iterator jt;
+	rina::cdap_rib::con_handle_t con_handle;
+	rina::ser_obj_t sdu;
+
+	it = batches.find(port_id);
+	if (it == batches.end())
+		return;
+
+	con_handle.port_id = port_id;
+	try {
+		if (it->second.sdus.size() == 1) {
+			__send_message(con_handle, *it->second.sdus.front());
+		} else {
+			rina::cdap::CDAPBatchEncoder().encode(it->second.sdus,
+							      sdu);
+			__send_message(con_handle, sdu);
+		}
+
+		LOG_IPCP_DBG("Sent batch of %d CDAP messages through port-id %u",
+			     (int) it->second.sdus.size(), port_id);
+	} catch (rina::Exception &e) {
+		LOG_IPCP_ERR("Problems sending batch of CDAP messages through port-id %u: %s",
+			     port_id, e.what());
+	}
+
+	for (jt = it->second.sdus.begin(); jt != it->second.sdus.end(); ++jt)
+		delete *jt;
+	batches.erase(it);
+}
+
+FlushCDAPBatchTimerTask::FlushCDAPBatchTimerTask(IPCPCDAPIOHandler * handler,
+						 unsigned int port_id)
+		: io_handler(handler), pid(port_id)
+{
+	io_handler->add_flush_task();
+}
+
+FlushCDAPBatchTimerTask::~FlushCDAPBatchTimerTask() throw()
+{
+	io_handler->remove_flush_task();
+}
+
+void FlushCDAPBatchTimerTask::run()
+{
+	io_handler->flush_batch(pid);
+}
+
 void IPCPCDAPIOHandler::__send_message(const rina::cdap_rib::con_handle_t & con_handle,
 				       const rina::ser_obj_t& sdu)
 {
@@ -145,7 +359,7 @@ void IPCPCDAPIOHandler::send(const rina::cdap::cdap_m_t& m_sent,
 
 			manager_->encodeCDAPMessage(a_data_m, sdu);
 
-			__send_message(con_handle, sdu);
+			__queue_message(con_handle, sdu);
 
 			LOG_IPCP_DBG("Sent A-Data CDAP message to address %u via port-id %u: \n%s",
 				     con_handle.address,
@@ -160,13 +374,13 @@ void IPCPCDAPIOHandler::send(const rina::cdap::cdap_m_t& m_sent,
 							    sdu,
 							    con_handle.port_id);
 
-			__send_message(con_handle, sdu);
-
 			LOG_IPCP_DBG("Sent CDAP message of size %d through port-id %u: \n%s" ,
 				      sdu.size_,
 				      con_handle.port_id,
 				      m_sent.to_string().c_str());
 
+			__queue_message(con_handle, sdu);
+
 			manager_->messageSent(m_sent,
 					     con_handle.port_id);
 		} else if (con_handle.cdap_dest == rina::cdap_rib::CDAP_DEST_IPCM) {
@@ -226,6 +440,35 @@ void IPCPCDAPIOHandler::process_message(rina::ser_obj_t &message,
 		}
 	}
 
+	//0 A batch carries several messages, process them in order
+	if (rina::cdap::CDAPBatchEncoder().is_batch(message)) {
+		std::list<rina::ser_obj_t*> parts;
+		std::list<rina::ser_obj_t*>::iterator it;
+
+		rina::cdap::CDAPBatchEncoder().decode(message, parts);
+
+		// Batches are never nested, reject the SDU as a whole
+		for (it = parts.begin(); it != parts.end(); ++it)
+			if (rina::cdap::CDAPBatchEncoder().is_batch(**it))
+				break;
+		if (it != parts.end()) {
+			for (it = parts.begin(); it != parts.end(); ++it)
+				delete *it;
+			throw rina::Exception("Batch of CDAP messages nested in a batch");
+		}
+
+		for (it = parts.begin(); it != parts.end(); ++it) {
+			try {
+				process_message(**it, handle, cdap_dest);
+			} catch (rina::Exception &e) {
+				LOG_IPCP_ERR("Problems processing batched CDAP message from port %u: %s",
+					     handle, e.what());
+			}
+			delete *it;
+		}
+		return;
+	}
+
 	//1 Decode the message and obtain the CDAP session descriptor
 	atomic_send_lock_.lock();
 	try {
@@ -480,7 +723,7 @@ int InternalFlowSDUReader::run()
 	rina::ser_obj_t message;
 	rina::cdap_rib::con_handle_t con_handle;
 
-	message.message_ = new unsigned char[5000];
+	message.message_ = new unsigned char[BUFFER_SIZE];
 	int bytes_read = 0;
 	bool keep_going = true;
 
@@ -489,7 +732,7 @@ int InternalFlowSDUReader::run()
 		     portid, cdap_session);
 
 	while(keep_going) {
-		bytes_read = read(fd, message.message_, 5000);
+		bytes_read = read(fd, message.message_, BUFFER_SIZE);
 		LOG_IPCP_DBG("Got message %d bytes of port-id %d, "
 				"handling to CDAP Provider",
 				bytes_read,
@@ -596,8 +839,21 @@ void IPCPRIBDaemonImpl::set_application_process(rina::ApplicationProcess * ap)
         subscribeToEvents();
 }
 
+const std::string IPCPRIBDaemonImpl::CDAP_BATCH_WINDOW_IN_MS = "cdapBatchWindowInMs";
+
 void IPCPRIBDaemonImpl::set_dif_configuration(const rina::DIFConfiguration& dif_configuration) {
+	rina::PolicyConfig psconf = dif_configuration.et_configuration_.policy_set_;
+	unsigned int batch_window_ms = 0;
+
 	LOG_IPCP_DBG("Configuration set: %u", dif_configuration.address_);
+
+	try {
+		batch_window_ms = psconf.get_param_value_as_uint(CDAP_BATCH_WINDOW_IN_MS);
+	} catch (rina::Exception &e) {
+		LOG_IPCP_DBG("Could not parse CDAP batch window, not batching");
+	}
+
+	io_handler->set_batch_window(batch_window_ms);
 }
 
 void IPCPRIBDaemonImpl::subscribeToEvents()
@@ -625,12 +881,16 @@ void IPCPRIBDaemonImpl::eventHappened(rina::InternalEvent * event)
 void IPCPRIBDaemonImpl::nMinusOneFlowDeallocated(int portId)
 {
         rina::cdap::getProvider()->get_session_manager()->removeCDAPSession(portId);
+        io_handler->set_max_sdu_size(portId, 0);
 }
 
 void IPCPRIBDaemonImpl::nMinusOneFlowAllocated(rina::NMinusOneFlowAllocatedEvent * event)
 {
 	if (!event)
 		return;
+
+	io_handler->set_max_sdu_size(event->flow_information_.portId,
+			event->flow_information_.flowSpecification.maxSDUsize);
 }
 
 void IPCPRIBDaemonImpl::processQueryRIBRequestEvent(const rina::QueryRIBRequestEvent& event)
@@ -66,6 +66,9 @@ public:
 	~InternalFlowSDUReader() throw() {};
 	int run();
 
+	/// Size of the read buffer, the largest SDU read from an internal flow
+	static const int BUFFER_SIZE = 5000;
+
 	int portid;
 	int cdap_session;
 	int fd;
@@ -94,6 +97,8 @@ public:
         void processReadManagementSDUEvent(rina::ReadMgmtSDUResponseEvent& event);
         int get_fd(unsigned int cdap_session);
 
+        static const std::string CDAP_BATCH_WINDOW_IN_MS;
+
 private:
         friend class StopInternalFlowReaderTimerTask;
 
@@ -141,6 +146,22 @@ private:
 	int port_id;
 };
 
+/// Sends the CDAP messages queued for a port once the batch window expires
+class FlushCDAPBatchTimerTask: public rina::TimerTask {
+public:
+	FlushCDAPBatchTimerTask(IPCPCDAPIOHandler * handler,
+				unsigned int port_id);
+	~FlushCDAPBatchTimerTask() throw();
+	void run();
+	std::string name() const {
+		return "flush-cdap-batch";
+	}
+
+private:
+	IPCPCDAPIOHandler * io_handler;
+	unsigned int pid;
+};
+
 class ETCleanStateTimerTask: public rina::TimerTask {
 public:
 	ETCleanStateTimerTask(unsigned int port_id) : pid(port_id) {};
@@ -0,0 +1,82 @@
+#!/bin/bash
+#
+# Fast failover test over the loopback shim
+#
+# Start the IPC Manager with conf/ipcmanager.conf-failoverloopback first.
+# test1, test2 and test3 are enrolled in a triangle, so test1 reaches test2
+# directly and through test3 as a loop free alternate. Disconnecting test1
+# from test2 deallocates their N-1 flow: the RMT unbinds its port and the
+# PFF of test1 fails over to test3 without waiting for the routing daemon.
+# The failover must take less than MAX_NS nanoseconds (default 1 ms), as
+# logged by the RMT.
+#
+# IPC process ids follow the order of the configuration file, override A, B
+# and C if they differ.
+
+IRATI_BIN=${IRATI_BIN:-/usr/local/irati/bin}
+SOCK=${SOCK:-/usr/local/irati/var/run/ipcm-console.sock}
+MAX_NS=${MAX_NS:-1000000}
+A=${A:-2}
+B=${B:-3}
+C=${C:-4}
+DIF=test-failover.DIF
+SHIM=test-shim-loopback.DIF
+# test2.IRATI, qos-id 1
+ENTRY=/sys/rina/ipcps/$A/rmt/pff/17-1
+
+ctl() {
+        $IRATI_BIN/irati-ctl --unix-socket $SOCK "$@"
+}
+
+enroll() {
+        if ! ctl enroll-to-dif $1 $DIF $SHIM $2 1 | grep -q "completed"; then
+                echo "FAIL: IPC process $1 could not enroll with $2"
+                exit 1
+        fi
+}
+
+enroll $B test1.IRATI
+enroll $C test1.IRATI
+enroll $C test2.IRATI
+
+# Let the routing daemons compute the table and the alternates
+sleep 3
+
+if [ ! -f $ENTRY/nhops ]; then
+        echo "FAIL: no forwarding entry for test2.IRATI in IPC process $A"
+        exit 1
+fi
+before=$(cat $ENTRY/nhops)
+echo "test1 reaches test2 through N-1 port $before"
+
+mark=$(dmesg | wc -l)
+ctl disc-nei $A test2.IRATI 1 > /dev/null
+after=$(cat $ENTRY/nhops 2> /dev/null)
+sleep 1
+
+took=$(dmesg | tail -n +$((mark + 1)) | \
+       sed -n 's/.*PFF failover took \([0-9]*\) ns.*/\1/p')
+if [ -z "$took" ]; then
+        echo "FAIL: no N-1 port was unbound"
+        exit 1
+fi
+
+ret=0
+for ns in $took; do
+        echo "PFF failover took $ns ns"
+        if [ $ns -ge $MAX_NS ]; then
+                echo "FAIL: failover slower than $MAX_NS ns"
+                ret=1
+        fi
+done
+
+if [ "$after" = "$before" ]; then
+        echo "FAIL: test1 still forwards to test2 on N-1 port $before"
+        ret=1
+fi
+
+# Leave the triangle as it was
+enroll $B test1.IRATI
+
+[ $ret -eq 0 ] && echo "PASS"
+exit $ret